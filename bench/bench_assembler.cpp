@@ -0,0 +1,153 @@
+#include <array>
+#include <assembler.hpp>
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+#include <thread>
+#include <unordered_map>
+
+// Assembler throughput on generated programs of state.range(0) lines, mixing operand forms
+
+static auto generate(usize lines) {
+    auto source = std::string {};
+    for (usize i = 0; i < lines; i++) {
+        switch (i % 4) {
+        case 0:
+            fmt::format_to(std::back_inserter(source), "    ldi r{}, #0x{:X}\n", i % 8, i % 256);
+            break;
+        case 1:
+            fmt::format_to(std::back_inserter(source), "    add r{}, r{}, r{}\n", i % 8, (i + 1) % 8, (i + 2) % 8);
+            break;
+        case 2:
+            fmt::format_to(std::back_inserter(source), "    push r{}\n", i % 8);
+            break;
+        default:
+            fmt::format_to(std::back_inserter(source), "    jz r6, r7\n");
+            break;
+        }
+    }
+    return source;
+}
+
+static void BM_Assemble(benchmark::State& state) {
+    const auto source = generate(static_cast<usize>(state.range(0)));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(Assembler::assemble(source));
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * static_cast<i64>(source.size()));
+}
+
+static void BM_AssembleIntoBuffer(benchmark::State& state) {
+    const auto source = generate(static_cast<usize>(state.range(0)));
+    auto output = std::vector<ProcessorSpec::insr_t>(static_cast<usize>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Assembler::assemble(source, output));
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * static_cast<i64>(source.size()));
+}
+
+BENCHMARK(BM_Assemble)->Arg(1 << 10)->Arg(1 << 16);
+BENCHMARK(BM_AssembleIntoBuffer)->Arg(1 << 10)->Arg(1 << 16);
+
+// Same source handed over in 4KiB chunks
+static void BM_AssembleStream(benchmark::State& state) {
+    const auto source = generate(static_cast<usize>(state.range(0)));
+    for (auto _ : state) {
+        auto sink = VectorInstructionSink {};
+        auto stream = AssemblerStream { sink };
+        for (usize i = 0; i < source.size(); i += 4096)
+            stream.feed(std::string_view { source }.substr(i, 4096));
+        stream.finish();
+        benchmark::DoNotOptimize(sink.instructions().data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * static_cast<i64>(source.size()));
+}
+
+BENCHMARK(BM_AssembleStream)->Arg(1 << 16);
+
+// One label per line, each line loading the low byte of another label somewhere in the program, so about
+// half of all references point forward and have to be patched in at the end
+static auto generate_labels(usize lines) {
+    auto source = std::string {};
+    for (usize i = 0; i < lines; i++)
+        fmt::format_to(std::back_inserter(source), "l{}: ldi r{}, $(l{} & 0xFF)\n", i, i % 8, (i * 7919) % lines);
+    return source;
+}
+
+static void BM_AssembleLabels(benchmark::State& state) {
+    const auto source = generate_labels(static_cast<usize>(state.range(0)));
+    for (auto _ : state) {
+        const auto code = Assembler::assemble(source);
+        if (code.empty())
+            state.SkipWithError("program didn't assemble");
+        benchmark::DoNotOptimize(code.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * static_cast<i64>(source.size()));
+}
+
+BENCHMARK(BM_AssembleLabels)->Arg(1 << 10)->Arg(100'000);
+
+// Mnemonic lookups per second through the compile-time perfect hash, against the unordered_map of
+// std::string the assembler used to have. Every third lookup misses.
+static constexpr auto lookup_words = std::array<std::string_view, 12> {
+    "add", "ldi", "mov", "push", "jz", "nop", "hlt", "st", "ldm", "xor", "pusha", "or",
+};
+
+static void BM_MnemonicLookup(benchmark::State& state) {
+    usize found = 0;
+    for (auto _ : state) {
+        for (const auto word : lookup_words) {
+            benchmark::DoNotOptimize(word);
+            found += find_mnemonic(word).has_value();
+        }
+    }
+    benchmark::DoNotOptimize(found);
+    state.SetItemsProcessed(state.iterations() * static_cast<i64>(lookup_words.size()));
+}
+
+static void BM_MnemonicLookupUnorderedMap(benchmark::State& state) {
+    auto map = std::unordered_map<std::string, InstructionType> {};
+    for (u8 type = 0; type < instruction_info.size(); type++)
+        map.emplace(instruction_info[type].mnemonic, static_cast<InstructionType>(type));
+
+    usize found = 0;
+    for (auto _ : state) {
+        for (const auto word : lookup_words) {
+            benchmark::DoNotOptimize(word);
+            found += map.contains(std::string { word });
+        }
+    }
+    benchmark::DoNotOptimize(found);
+    state.SetItemsProcessed(state.iterations() * static_cast<i64>(lookup_words.size()));
+}
+
+BENCHMARK(BM_MnemonicLookup);
+BENCHMARK(BM_MnemonicLookupUnorderedMap);
+
+// Fills the whole address space, 64 '.org' sections of 512 instructions each, assembled into an image
+// on 1 to hardware_concurrency threads. 32k instructions are all 64KiB fit, so this is as big as it gets.
+static void BM_AssembleImage(benchmark::State& state) {
+    static constexpr usize sections = 64;
+    static constexpr usize lines = (ProcessorSpec::highest_addr + 1u) / sizeof(ProcessorSpec::insr_t);
+    static const auto source = [] {
+        const auto section = generate(lines / sections);
+        auto source = std::string {};
+        for (usize i = 0; i < sections; i++)
+            source += fmt::format(".org 0x{:X}\n{}", i * (ProcessorSpec::highest_addr + 1u) / sections, section);
+        return source;
+    }();
+
+    for (auto _ : state) {
+        const auto image = Assembler::assemble_image(source, static_cast<usize>(state.range(0)));
+        if (!image)
+            state.SkipWithError("image didn't assemble");
+        benchmark::DoNotOptimize(image);
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<i64>(lines));
+    state.SetBytesProcessed(state.iterations() * static_cast<i64>(source.size()));
+}
+
+BENCHMARK(BM_AssembleImage)->RangeMultiplier(2)->Range(1, std::max<i64>(std::thread::hardware_concurrency(), 1))->UseRealTime();
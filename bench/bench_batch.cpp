@@ -0,0 +1,45 @@
+#include "workloads.hpp"
+#include <batch.hpp>
+#include <benchmark/benchmark.h>
+
+// The same sweep, once with a Processor per parameter and once as lanes of a batch
+
+static void BM_SweepProcessors(benchmark::State& state) {
+    const auto code = Assembler::assemble(Workloads::sweep);
+    const auto lanes = static_cast<usize>(state.range(0));
+    auto processor = Processor {};
+    Workloads::load(processor, code);
+
+    u64 retired = 0;
+    for (auto _ : state) {
+        for (usize lane = 0; lane < lanes; lane++) {
+            const auto before = processor.retired_instructions();
+            processor.set_program_counter(ProcessorSpec::reset_pc);
+            processor.unset_flag(Processor::Flag::Halt);
+            processor.write_register(0, static_cast<data_t>(lane));
+            processor.execute();
+            retired += processor.retired_instructions() - before;
+        }
+    }
+    state.SetItemsProcessed(static_cast<i64>(retired));
+}
+BENCHMARK(BM_SweepProcessors)->Arg(256)->Arg(4096)->Unit(benchmark::kMillisecond);
+
+static void BM_SweepBatch(benchmark::State& state, ProcessorBatch::Kernel kernel) {
+    const auto code = Assembler::assemble(Workloads::sweep);
+    const auto lanes = static_cast<usize>(state.range(0));
+
+    u64 retired = 0;
+    for (auto _ : state) {
+        auto batch = ProcessorBatch { lanes, kernel };
+        for (usize i = 0; i < code.size(); i++)
+            batch.write_instruction(static_cast<addr_t>(ProcessorSpec::reset_pc + i * sizeof(insr_t)), code[i]);
+        for (usize lane = 0; lane < lanes; lane++)
+            batch.write_register(lane, 0, static_cast<data_t>(lane));
+        batch.execute();
+        retired += batch.stats().lane_instructions;
+    }
+    state.SetItemsProcessed(static_cast<i64>(retired));
+}
+BENCHMARK_CAPTURE(BM_SweepBatch, Scalar, ProcessorBatch::Kernel::Scalar)->Arg(256)->Arg(4096)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_SweepBatch, Best, ProcessorBatch::best_kernel())->Arg(256)->Arg(4096)->Unit(benchmark::kMillisecond);
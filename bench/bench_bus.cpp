@@ -0,0 +1,74 @@
+#include "workloads.hpp"
+#include <benchmark/benchmark.h>
+#include <banks.hpp>
+#include <bus.hpp>
+
+// What the memory bus costs: a load/store heavy program on RAM alone, the same with devices attached to
+// pages it doesn't touch, stores that all go to a device, and banks of extended memory
+
+class NullDevice final : public MemoryDevice {
+public:
+    auto read(u16) -> data_t override { return 0; }
+    auto write(u16, data_t data) -> void override { benchmark::DoNotOptimize(data); }
+};
+
+static auto run_workload(benchmark::State& state, Processor& processor, const std::string& source) {
+    const auto code = Assembler::assemble(source);
+    u64 retired = 0;
+    for (auto _ : state) {
+        Workloads::load(processor, code);
+        processor.execute();
+        retired += processor.retired_instructions();
+    }
+    state.SetItemsProcessed(static_cast<i64>(retired));
+}
+
+static void BM_BusRam(benchmark::State& state) {
+    auto processor = Processor {};
+    run_workload(state, processor, Workloads::page_increment);
+}
+BENCHMARK(BM_BusRam)->Unit(benchmark::kMicrosecond);
+
+static void BM_BusRamWithDevices(benchmark::State& state) {
+    auto console = NullDevice {};
+    auto timer = TimerDevice {};
+    auto processor = Processor {};
+    processor.attach_device(0xF0, 1, console);
+    processor.attach_device(0xF1, 1, timer);
+    run_workload(state, processor, Workloads::page_increment);
+}
+BENCHMARK(BM_BusRamWithDevices)->Unit(benchmark::kMicrosecond);
+
+// Same program with the page it works on taken over by a device
+static void BM_BusDevice(benchmark::State& state) {
+    auto device = NullDevice {};
+    auto processor = Processor {};
+    processor.attach_device(0x40, 1, device);
+    run_workload(state, processor, Workloads::page_increment);
+}
+BENCHMARK(BM_BusDevice)->Unit(benchmark::kMicrosecond);
+
+// The same program working on a window into extended memory
+static void BM_BusBankWindow(benchmark::State& state) {
+    auto store = ExtendedMemory::create(1 << 20);
+    auto processor = Processor {};
+    auto switcher = BankSwitcher { processor, *store, 1 };
+    switcher.add_window(0x40);
+    run_workload(state, processor, Workloads::page_increment);
+}
+BENCHMARK(BM_BusBankWindow)->Unit(benchmark::kMicrosecond);
+
+// Switching a window of 16 pages between banks spread over 256 MiB
+static void BM_BankSwitch(benchmark::State& state) {
+    auto store = ExtendedMemory::create(256 << 20);
+    auto processor = Processor {};
+    auto switcher = BankSwitcher { processor, *store, 16 };
+    switcher.add_window(0x40);
+    usize bank = 0;
+    for (auto _ : state) {
+        bank = (bank + 4099) % switcher.bank_count();
+        benchmark::DoNotOptimize(switcher.select(0, bank));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BankSwitch);
@@ -0,0 +1,81 @@
+#include <benchmark/benchmark.h>
+#include <disassembler.hpp>
+#include <algorithm>
+#include <random>
+
+// A full 64KiB dump of random valid instructions, disassembled into strings, a reused arena and a
+// reused fmt::memory_buffer
+
+static auto dump() {
+    auto code = std::vector<ProcessorSpec::insr_t> {};
+    auto random = std::mt19937 { 42 };
+    auto line = std::array<char, Disassembler::max_line_length> {};
+    while (code.size() < (ProcessorSpec::highest_addr + 1u) / sizeof(ProcessorSpec::insr_t)) {
+        const auto instruction = static_cast<ProcessorSpec::insr_t>(random());
+        if (!Disassembler::disassemble_line(instruction, line))
+            continue;
+        code.push_back(instruction);
+    }
+    return code;
+}
+
+static void BM_DisassembleStrings(benchmark::State& state) {
+    const auto code = dump();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(Disassembler::disassemble(code));
+    state.SetItemsProcessed(state.iterations() * static_cast<i64>(code.size()));
+    state.SetBytesProcessed(state.iterations() * static_cast<i64>(code.size() * sizeof(ProcessorSpec::insr_t)));
+}
+
+static void BM_DisassembleArena(benchmark::State& state) {
+    const auto code = dump();
+    auto batch = Disassembly {};
+    for (auto _ : state) {
+        Disassembler::disassemble(code, batch);
+        benchmark::DoNotOptimize(batch.text().data());
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<i64>(code.size()));
+    state.SetBytesProcessed(state.iterations() * static_cast<i64>(code.size() * sizeof(ProcessorSpec::insr_t)));
+}
+
+static void BM_DisassembleMemoryBuffer(benchmark::State& state) {
+    const auto code = dump();
+    auto buffer = fmt::memory_buffer {};
+    auto diagnostics = std::vector<DisassemblyDiagnostic> {};
+    for (auto _ : state) {
+        buffer.clear();
+        Disassembler::disassemble(code, buffer, diagnostics);
+        benchmark::DoNotOptimize(buffer.data());
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<i64>(code.size()));
+    state.SetBytesProcessed(state.iterations() * static_cast<i64>(code.size() * sizeof(ProcessorSpec::insr_t)));
+}
+
+BENCHMARK(BM_DisassembleStrings);
+BENCHMARK(BM_DisassembleArena);
+BENCHMARK(BM_DisassembleMemoryBuffer);
+
+// Just the classification every line above starts with, random instructions valid or not
+static void BM_Classify(benchmark::State& state, Disassembler::Kernel kernel) {
+    if (kernel > Disassembler::best_kernel()) {
+        state.SkipWithError("kernel isn't supported by this CPU");
+        return;
+    }
+    auto code = std::vector<ProcessorSpec::insr_t>((ProcessorSpec::highest_addr + 1u) / sizeof(ProcessorSpec::insr_t));
+    auto random = std::mt19937 { 42 };
+    std::ranges::generate(code, [&] { return static_cast<ProcessorSpec::insr_t>(random()); });
+    auto groups = std::vector<OperandKind>(code.size());
+    auto valid = std::vector<u64>(code.size() / 64);
+
+    for (auto _ : state) {
+        Disassembler::classify(code, groups, valid, kernel);
+        benchmark::DoNotOptimize(valid.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<i64>(code.size()));
+    state.SetBytesProcessed(state.iterations() * static_cast<i64>(code.size() * sizeof(ProcessorSpec::insr_t)));
+}
+
+BENCHMARK_CAPTURE(BM_Classify, Scalar, Disassembler::Kernel::Scalar);
+BENCHMARK_CAPTURE(BM_Classify, Ssse3, Disassembler::Kernel::Ssse3);
+BENCHMARK_CAPTURE(BM_Classify, Avx2, Disassembler::Kernel::Avx2);
@@ -0,0 +1,150 @@
+#include "workloads.hpp"
+#include <benchmark/benchmark.h>
+#include <binary_trace.hpp>
+#include <profiler.hpp>
+#include <undo.hpp>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+enum class Backend {
+    Default,
+    Switch,
+    Threaded,
+    Blocks,
+};
+
+// Runs the workload to completion once per iteration and reports retired instructions per second
+template <Backend backend = Backend::Default>
+static auto run_workload(benchmark::State& state, Processor& processor, const std::string& source = Workloads::nested_loops) {
+    const auto code = Assembler::assemble(source);
+
+    u64 retired = 0;
+    u64 cycles = 0;
+    for (auto _ : state) {
+        Workloads::load(processor, code);
+
+#if defined(__x86_64__)
+        const auto start = __rdtsc();
+#endif
+        if constexpr (backend == Backend::Switch)
+            processor.execute_switch();
+        else if constexpr (backend == Backend::Threaded)
+            processor.execute_threaded();
+        else if constexpr (backend == Backend::Blocks)
+            processor.execute_blocks();
+        else
+            processor.execute();
+#if defined(__x86_64__)
+        cycles += __rdtsc() - start;
+#endif
+
+        retired += processor.retired_instructions();
+    }
+
+    state.SetItemsProcessed(static_cast<i64>(retired));
+    state.counters["decode_hit_rate"] = processor.decode_cache_stats().hit_rate();
+    if (cycles != 0)
+        state.counters["cycles_per_instruction"] = static_cast<f64>(cycles) / static_cast<f64>(retired);
+}
+
+static void BM_ExecuteQuiet(benchmark::State& state) {
+    auto processor = Processor {};
+    run_workload(state, processor);
+}
+BENCHMARK(BM_ExecuteQuiet)->Unit(benchmark::kMillisecond);
+
+// The same through execute() for each kind of workload: register-only loops, ldm/st and push/pop
+static void BM_Workload(benchmark::State& state, const std::string& source) {
+    auto processor = Processor {};
+    run_workload(state, processor, source);
+}
+BENCHMARK_CAPTURE(BM_Workload, Alu, Workloads::nested_loops)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, Memory, Workloads::page_increment)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, Stack, Workloads::stack_shuffle)->Unit(benchmark::kMillisecond);
+
+static void BM_ExecuteNullSink(benchmark::State& state) {
+    auto sink = NullTraceSink {};
+    auto processor = Processor { sink };
+    run_workload(state, processor);
+}
+BENCHMARK(BM_ExecuteNullSink)->Unit(benchmark::kMillisecond);
+
+static void BM_ExecuteRingSink(benchmark::State& state) {
+    auto sink = RingTraceSink { 4096 };
+    auto processor = Processor { sink };
+    run_workload(state, processor);
+}
+BENCHMARK(BM_ExecuteRingSink)->Unit(benchmark::kMillisecond);
+
+static void BM_ExecuteProfiler(benchmark::State& state) {
+    auto profiler = Profiler {};
+    auto processor = Processor { profiler };
+    run_workload(state, processor);
+}
+BENCHMARK(BM_ExecuteProfiler)->Unit(benchmark::kMillisecond);
+
+static void BM_ExecuteBinarySink(benchmark::State& state) {
+    auto* file = std::fopen("/dev/null", "w");
+    {
+        auto sink = BinaryTraceSink { file };
+        auto processor = Processor { sink };
+        run_workload(state, processor);
+        state.counters["stalls"] = static_cast<f64>(sink.stalls());
+    }
+    std::fclose(file);
+}
+BENCHMARK(BM_ExecuteBinarySink)->Unit(benchmark::kMillisecond);
+
+static void BM_ExecuteUndoLog(benchmark::State& state) {
+    auto processor = Processor {};
+    auto log = UndoLog { processor };
+    processor.set_trace_sink(&log);
+    run_workload(state, processor);
+}
+BENCHMARK(BM_ExecuteUndoLog)->Unit(benchmark::kMillisecond);
+
+static void BM_ExecuteFileSink(benchmark::State& state) {
+    auto* file = std::fopen("/dev/null", "w");
+    {
+        auto sink = FileTraceSink { file };
+        auto processor = Processor { sink };
+        run_workload(state, processor);
+    }
+    std::fclose(file);
+}
+BENCHMARK(BM_ExecuteFileSink)->Unit(benchmark::kMillisecond);
+
+// All backends are always compiled in, the build options only pick the ones behind execute()
+static void BM_DispatchSwitch(benchmark::State& state) {
+    auto processor = Processor {};
+    run_workload<Backend::Switch>(state, processor);
+}
+BENCHMARK(BM_DispatchSwitch)->Unit(benchmark::kMillisecond);
+
+#if defined(__GNUC__)
+static void BM_DispatchThreaded(benchmark::State& state) {
+    auto processor = Processor {};
+    run_workload<Backend::Threaded>(state, processor);
+}
+BENCHMARK(BM_DispatchThreaded)->Unit(benchmark::kMillisecond);
+#endif
+
+static void BM_DispatchBlocks(benchmark::State& state) {
+    auto processor = Processor {};
+#if defined(PROCESSOR_JIT)
+    processor.disable_jit();
+#endif
+    run_workload<Backend::Blocks>(state, processor);
+}
+BENCHMARK(BM_DispatchBlocks)->Unit(benchmark::kMillisecond);
+
+#if defined(PROCESSOR_JIT)
+static void BM_DispatchJit(benchmark::State& state) {
+    auto processor = Processor {};
+    run_workload<Backend::Blocks>(state, processor);
+    state.counters["native_blocks"] = static_cast<f64>(processor.jit_stats().compiled);
+}
+BENCHMARK(BM_DispatchJit)->Unit(benchmark::kMillisecond);
+#endif
@@ -0,0 +1,68 @@
+#include <assembler.hpp>
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <image.hpp>
+#include <processor.hpp>
+#include <unistd.h>
+
+// Starting a short job with 16 KiB of program: writing every assembled instruction, copying the segments of
+// a mapped image, and mapping its pages without copying them
+
+static auto program_source() {
+    auto source = std::string { "hlt\n.org 0x1000\n" };
+    for (usize i = 0; i < 8192; i++)
+        source += fmt::format("ldi r{}, #{}\n", i % 8, i % 256);
+    return source;
+}
+
+static auto saved_image() {
+    static const auto image = [] {
+        const auto path = (std::filesystem::temp_directory_path() / fmt::format("bench-{}.pimg", ::getpid())).string();
+        const auto assembled = Assembler::assemble_image(program_source());
+        if (!assembled || !assembled->save(path))
+            std::abort();
+        auto mapped = MappedImage::open(path);
+        std::filesystem::remove(path);
+        return *mapped;
+    }();
+    return image;
+}
+
+static void BM_StartAssembled(benchmark::State& state) {
+    const auto image = *Assembler::assemble_image(program_source());
+    auto processor = Processor {};
+    for (auto _ : state) {
+        processor.reset();
+        for (const auto& section : image.sections) {
+            for (u32 offset = 0; offset < section.size; offset += sizeof(insr_t)) {
+                const auto address = static_cast<addr_t>(section.origin + offset);
+                processor.write_instruction(address, static_cast<insr_t>(image.memory[address] << 8 | image.memory[address + 1u]));
+            }
+        }
+        benchmark::DoNotOptimize(processor.execute());
+    }
+}
+
+static void BM_StartLoaded(benchmark::State& state) {
+    const auto image = saved_image();
+    auto processor = Processor {};
+    for (auto _ : state) {
+        processor.reset();
+        image.load_into(processor);
+        benchmark::DoNotOptimize(processor.execute());
+    }
+}
+
+static void BM_StartMapped(benchmark::State& state) {
+    const auto image = saved_image();
+    auto processor = Processor {};
+    for (auto _ : state) {
+        processor.reset();
+        image.map_into(processor);
+        benchmark::DoNotOptimize(processor.execute());
+    }
+}
+
+BENCHMARK(BM_StartAssembled);
+BENCHMARK(BM_StartLoaded);
+BENCHMARK(BM_StartMapped);
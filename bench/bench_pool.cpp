@@ -0,0 +1,48 @@
+#include "workloads.hpp"
+#include <array>
+#include <benchmark/benchmark.h>
+#include <cstring>
+#include <pool.hpp>
+
+// Cost of Processor::reset() against the number of memory pages written since the last one, and the
+// 64KiB memset every reset used to pay for comparison
+
+static void BM_ResetDirtyPages(benchmark::State& state) {
+    const auto pages = static_cast<usize>(state.range(0));
+    auto processor = Processor {};
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (usize page = 0; page < pages; page++)
+            processor.write_memory(static_cast<addr_t>(page * PagedMemory::page_size), 1);
+        state.ResumeTiming();
+
+        processor.reset();
+    }
+    state.counters["pages_reused"] = static_cast<f64>(processor.memory_stats().pages_reused);
+}
+
+static void BM_ResetFullMemset(benchmark::State& state) {
+    auto memory = std::array<u8, ProcessorSpec::highest_addr + 1> {};
+    for (auto _ : state) {
+        std::memset(memory.data(), 0, memory.size());
+        benchmark::ClobberMemory();
+    }
+}
+
+// Acquire, load a short program, run it and give the processor back
+static void BM_PoolRoundTrip(benchmark::State& state) {
+    const auto code = Assembler::assemble(Workloads::sweep);
+    auto pool = ProcessorPool {};
+    for (auto _ : state) {
+        auto processor = pool.acquire();
+        for (usize i = 0; i < code.size(); i++)
+            processor->write_instruction(static_cast<addr_t>(ProcessorSpec::reset_pc + i * sizeof(insr_t)), code[i]);
+        processor->execute();
+        pool.release(std::move(processor));
+    }
+    state.counters["created"] = static_cast<f64>(pool.stats().created);
+}
+
+BENCHMARK(BM_ResetDirtyPages)->Arg(0)->Arg(1)->Arg(4)->Arg(16)->Arg(64)->Arg(256);
+BENCHMARK(BM_ResetFullMemset);
+BENCHMARK(BM_PoolRoundTrip);
@@ -0,0 +1,37 @@
+#include "workloads.hpp"
+#include <benchmark/benchmark.h>
+#include <runner.hpp>
+
+// Scaling of JobRunner with the number of threads, once with few long jobs and once with lots of short ones
+
+static void run_jobs(benchmark::State& state, const std::string& source, usize job_count) {
+    const auto code = Assembler::assemble(source);
+    auto jobs = std::vector<Job>(job_count, Job { .program = code });
+    for (usize i = 0; i < jobs.size(); i++)
+        jobs[i].registers[0] = static_cast<data_t>(i);
+
+    auto runner = JobRunner { static_cast<usize>(state.range(0)) };
+    u64 retired = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(runner.run(jobs));
+        retired += runner.stats().retired_instructions;
+    }
+    state.SetItemsProcessed(static_cast<i64>(retired));
+    state.counters["steals"] = static_cast<f64>(runner.stats().steals);
+}
+
+static void BM_RunnerNestedLoops(benchmark::State& state) {
+    run_jobs(state, Workloads::nested_loops, 256);
+}
+
+static void BM_RunnerSweep(benchmark::State& state) {
+    run_jobs(state, Workloads::sweep, 4096);
+}
+
+static void thread_counts(benchmark::internal::Benchmark* benchmark) {
+    for (i64 threads = 1; threads <= std::max<i64>(std::thread::hardware_concurrency(), 1); threads *= 2)
+        benchmark->Arg(threads);
+}
+
+BENCHMARK(BM_RunnerNestedLoops)->Apply(thread_counts)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_RunnerSweep)->Apply(thread_counts)->UseRealTime()->Unit(benchmark::kMillisecond);
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <assembler.hpp>
+#include <processor.hpp>
+
+namespace Workloads {
+
+// Two nested countdown loops, 255 * 255 iterations of a 5 instruction inner loop.
+// Retires roughly 330k instructions before halting.
+static const auto nested_loops = std::string { R"(
+    ldi r0, #255
+    ldi r2, #1
+    ldi r6, #0xFF
+    ldi r4, #0x0A
+    ldi r5, #0x0C
+    ldi r1, #255
+    add r3, r3, r1
+    ldi r7, #0x16
+    sub r1, r1, r2
+    jz r6, r7
+    jp r6, r5
+    ldi r7, #0x1E
+    sub r0, r0, r2
+    jz r6, r7
+    jp r6, r4
+    hlt
+)" };
+
+// Parameter sweep kernel, 200 iterations of an 8 instruction loop mixing r0 into a running value.
+// Every lane runs the same number of iterations, only r0 differs.
+static const auto sweep = std::string { R"(
+    ldi r1, #200
+    ldi r3, #1
+    ldi r6, #0xFF
+    ldi r7, #0x0A
+    ldi r5, #0x1A
+    mul r2, r2, r0
+    add r2, r2, r3
+    xor r4, r4, r2
+    and r4, r4, r0
+    or r4, r4, r3
+    sub r1, r1, r3
+    jz r6, r5
+    jp r6, r7
+    hlt
+)" };
+
+// Adds 1 to every byte of the page at 0x4000, 64 times over. A load and a store out of every 6 instructions,
+// roughly 100k instructions in total.
+static const auto page_increment = std::string { R"(
+        ldi r4, #64
+        ldi r3, #1
+        ldi r1, #0x40
+        ldi r6, $(inner >> 8)
+        ldi r7, $(inner & 0xFF)
+        ldi r2, $(pass & 0xFF)
+inner:  ldm r5, r1, r0
+        add r5, r5, r3
+        st r1, r0, r5
+        add r0, r0, r3
+        jz r6, r2
+        jp r6, r7
+pass:   ldi r5, $(done & 0xFF)
+        sub r4, r4, r3
+        jz r6, r5
+        jp r6, r7
+done:   hlt
+)" };
+
+// Pushes and pops 4 registers, 256 times in a row and that 64 times over. 8 of every 11 instructions go
+// through the stack, roughly 180k instructions in total.
+static const auto stack_shuffle = std::string { R"(
+        ldi r4, #64
+        ldi r1, #1
+        ldi r6, $(inner >> 8)
+        ldi r7, $(inner & 0xFF)
+        ldi r5, $(pass & 0xFF)
+inner:  push r0
+        push r1
+        push r2
+        push r3
+        pop r3
+        pop r2
+        pop r1
+        pop r0
+        add r0, r0, r1
+        jz r6, r5
+        jp r6, r7
+pass:   ldi r2, $(done & 0xFF)
+        sub r4, r4, r1
+        jz r6, r2
+        jp r6, r7
+done:   hlt
+)" };
+
+inline auto load(Processor& processor, const std::vector<ProcessorSpec::insr_t>& code) {
+    processor.reset();
+    for (usize i = 0; i < code.size(); i++)
+        processor.write_instruction(static_cast<addr_t>(ProcessorSpec::reset_pc + i * sizeof(insr_t)), code[i]);
+}
+
+}
@@ -1,6 +1,11 @@
 option(NATIVE_OPTS "Enable processor-native optimizations" ON)
 option(LTO "Enable link-time optimizations" ON)
 option(USE_MOLD "Force using the mold linker" OFF)
+option(TRACING "Compile in support for instruction trace sinks" ON)
+option(BENCHMARKS "Build the processor_bench target" ON)
+option(THREADED_DISPATCH "Use the computed goto interpreter backend instead of the portable switch (GCC/Clang)" ON)
+option(BLOCK_TRANSLATION "Run straight-line code as translated basic blocks instead of one instruction at a time" ON)
+option(JIT "Translate hot basic blocks to native x86-64 code (needs BLOCK_TRANSLATION to be used by execute())" ON)
 
 if (${USE_MOLD})
     if (NOT APPLE)
@@ -12,6 +17,27 @@ if (${NATIVE_OPTS})
     list(APPEND ADDITIONAL_OPTIONS -march=native -mtune=native)
 endif ()
 
+if (NOT ${TRACING})
+    add_compile_definitions(PROCESSOR_DISABLE_TRACING)
+endif ()
+
+if (${THREADED_DISPATCH})
+    list(APPEND DISPATCH_DEFINITIONS PROCESSOR_THREADED_DISPATCH)
+endif ()
+
+if (${BLOCK_TRANSLATION})
+    list(APPEND DISPATCH_DEFINITIONS PROCESSOR_BLOCK_TRANSLATION)
+endif ()
+
+if (${JIT})
+    if (CMAKE_SYSTEM_PROCESSOR MATCHES "x86_64|AMD64|amd64" AND UNIX)
+        list(APPEND DISPATCH_DEFINITIONS PROCESSOR_JIT)
+        set(JIT_SOURCES ${PROJECT_SOURCE_DIR}/src/jit.cpp)
+    else ()
+        message(STATUS "JIT is only supported on x86-64 Unix-likes, disabling it")
+    endif ()
+endif ()
+
 if (${LTO})
     list(APPEND ADDITIONAL_OPTIONS -flto)
 endif ()
@@ -6,6 +6,8 @@ if (NOT (EXISTS ${CPM_DOWNLOAD_LOCATION}))
 endif ()
 include(${CPM_DOWNLOAD_LOCATION})
 
+find_package(Threads REQUIRED)
+
 CPMAddPackage(NAME fmt VERSION 10.0.0 GITHUB_REPOSITORY fmtlib/fmt GIT_TAG 10.0.0)
 CPMAddPackage(NAME cxxopts VERSION 3.2.0 GITHUB_REPOSITORY jarro2783/cxxopts GIT_TAG v3.2.0)
 
@@ -14,5 +16,15 @@ if (NOT APPLE)
     CPMAddPackage(NAME googletest VERSION 1.14.0 GITHUB_REPOSITORY google/googletest GIT_TAG v1.14.0)
 endif ()
 
+if (${BENCHMARKS})
+    CPMAddPackage(
+        NAME benchmark
+        VERSION 1.8.3
+        GITHUB_REPOSITORY google/benchmark
+        GIT_TAG v1.8.3
+        OPTIONS "BENCHMARK_ENABLE_TESTING OFF" "BENCHMARK_ENABLE_GTEST_TESTS OFF"
+    )
+endif ()
+
 include_directories(${CMAKE_CURRENT_BINARY_DIR}/_deps/cxxopts-src/include)
 include_directories(${CMAKE_CURRENT_BINARY_DIR}/_deps/fmt-src/include)
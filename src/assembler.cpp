@@ -1,38 +1,49 @@
 #include <assembler.hpp>
-#include <cassert>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
 #include <fmt/ranges.h>
 #include <fmt/std.h>
+#include <istream>
+#include <limits>
 #include <optional>
-#include <sstream>
+#include <thread>
+#include <unistd.h>
 #include <unordered_map>
 
 /*
- * Currently, the assembler only supports a pure list of instructions without any labels, macros, comments, directives or other amenities.
- * It would be great if code like this was possible:
- *
+ * One instruction per line, operands separated by commas and/or whitespace. ';' starts a comment.
  *
  * .org 0xFF00
  *
  *        ldi r0, #10
  *        ldi r1, #1
+ *        ldi r6, $(loop >> 8)
+ *        ldi r7, $(loop & 0xFF)
+ *        ldi r5, $(done & 0xFF)
  * loop:  sub r0, r0, r1
- *        jz done
- *        jp loop
+ *        jz r6, r5
+ *        jp r6, r7
  * done:  hlt
  *
  *
- * In this example, the assembler could replace the labels by offsets into the instruction stream based on the provided origin address
- * and number of instructions. Since the size per instruction stays at a constant 2 bytes, this should be reasonably easy.
- * The first 'ldi r0, #10' is located at address $FF00, the next one at $FF02, and so on. The 'loop' label is nothing more than a
- * more readable way of saying $FF04.
+ * Labels stand for the address of the instruction following them. Since every instruction is 2 bytes, that's
+ * known as soon as the label is seen, and the only thing that has to wait for the end of the program are
+ * expressions referring to labels further down. Those are collected and patched in afterwards, which keeps
+ * assembling linear in the size of the program.
  *
- * If jump instructions can be modified to support labels, we don't have to load addresses and offsets manually into registers any more.
- * An implementation of those jumps may need to be assembled as macros, making the code less predictable in size. The instructions may still
- * expect their addresses to be passed as two 8-bit registers, and register state needs to be preserved, requiring the use of a stack.
+ * '.org <address>' makes the following instructions start at that address. It's only allowed when assembling an
+ * image (Assembler::assemble_image), a flat program starts at the reset PC, or wherever the sink it's streamed
+ * into puts it (InstructionSink::start).
  *
- * Perhaps macros could look like the following:
+ * Expressions surrounded by a pair of parens with a dollar sign are evaluated at compile time and can be used
+ * wherever an immediate can. They know numbers (decimal, 0x hex, 0b binary), labels, parens, unary - and ~, and
+ * the binary operators * / % + - << >> & ^ | with C precedence. The result has to fit into the immediate.
  *
- * .org 0xFF00
+ * Macros are defined between '@macro' and '@end' and used like an instruction:
  *
  * @macro jump_to_address $addr
  *        push r6
@@ -40,9 +51,14 @@
  *        ldi r6, $(addr >> 8)
  *        ldi r7, $(addr & 0xFF)
  *        jp r6, r7
+ * @end
+ *
+ *        jump_to_address loop
  *
- * where '$addr' is a 16-bit immediate value. After the jump, register state is messed up but state is preserved on the stack. The caller can restore
- * the old state by popping into r6 and r7 if required. Expressions surrounded by a pair of parens with a dollar sign are evaluated at compile time.
+ * Parameters are referred to by name inside of expressions, and as '$name' anywhere else in the body (so
+ * '$reg' can stand for a register). Arguments are substituted as they are written. Macros have to be
+ * defined before they're used, may use other macros, and can't define labels, since every use would
+ * define them again.
  *
  * Another idea is to allow treating pairs of 8-bit registers as combined 16-bit ones. This is common in other older architectures, like I think the Z80 and i8008?
  * 	- r0, r1 => d0
@@ -51,7 +67,7 @@
  * 	- r6, r7 => d3
  * 	Not quite sure about the syntax.
  *
- * Then, the fancy bit manipulation wouldn't be necessary and we maybe don't have to implement constexpr's:
+ * Then, the fancy bit manipulation wouldn't be necessary:
  * @macro jump_to_address $addr
  *        push d3
  *        ldi d3, $addr
@@ -61,163 +77,616 @@
  *
  * */
 
-auto split(const std::string& str, char delimiter) -> std::vector<std::string> {
-    std::vector<std::string> tokens;
-    std::istringstream stream(str.data());
-    std::string token;
-    while (std::getline(stream, token, delimiter)) {
-        tokens.push_back(token);
+namespace {
+    constexpr usize max_tokens = 8;
+    constexpr usize max_macro_depth = 16;
+    // Nested parens and unary operators, each of them recurses
+    constexpr usize max_expression_depth = 256;
+
+    constexpr auto is_space(char c) -> bool {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
     }
-    return tokens;
-}
 
-enum class InstructionArguments {
-    None,
-    SingleReg,
-    DoubleReg,
-    TripleReg,
-    RegImm,
-};
+    constexpr auto is_identifier_start(char c) -> bool {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+    }
 
-struct InstructionDefinition {
-    InstructionType type;
-    InstructionArguments args;
-};
+    constexpr auto is_identifier_char(char c) -> bool {
+        return is_identifier_start(c) || (c >= '0' && c <= '9');
+    }
 
-static std::unordered_map<std::string, InstructionDefinition> instruction_map = {
-    { "add", { .type = InstructionType::Add, .args = InstructionArguments::TripleReg } },
-    { "and", { .type = InstructionType::And, .args = InstructionArguments::TripleReg } },
-    { "div", { .type = InstructionType::Div, .args = InstructionArguments::TripleReg } },
-    { "hlt", { .type = InstructionType::Halt, .args = InstructionArguments::None } },
-    { "jp", { .type = InstructionType::Jump, .args = InstructionArguments::DoubleReg } },
-    { "jz", { .type = InstructionType::JumpIfZero, .args = InstructionArguments::DoubleReg } },
-    { "ldi", { .type = InstructionType::LoadFromImm, .args = InstructionArguments::RegImm } },
-    { "ldm", { .type = InstructionType::LoadFromMem, .args = InstructionArguments::TripleReg } },
-    { "ldr", { .type = InstructionType::LoadFromReg, .args = InstructionArguments::DoubleReg } },
-    { "mul", { .type = InstructionType::Mul, .args = InstructionArguments::TripleReg } },
-    { "or", { .type = InstructionType::Or, .args = InstructionArguments::TripleReg } },
-    { "pop", { .type = InstructionType::Pop, .args = InstructionArguments::SingleReg } },
-    { "push", { .type = InstructionType::Push, .args = InstructionArguments::SingleReg } },
-    { "st", { .type = InstructionType::Store, .args = InstructionArguments::TripleReg } },
-    { "sub", { .type = InstructionType::Sub, .args = InstructionArguments::TripleReg } },
-    { "xor", { .type = InstructionType::Xor, .args = InstructionArguments::TripleReg } },
-};
+    constexpr auto is_identifier(std::string_view token) -> bool {
+        return !token.empty() && is_identifier_start(token[0]) && std::ranges::all_of(token, is_identifier_char);
+    }
 
-// 'r1' and 'r1,' -> 1
-auto parse_register(std::string_view token) -> std::optional<Register> {
-    if (!token.starts_with('r'))
-        return std::nullopt;
-    // 2 for a format like 'r1'. 3 when it ends with a comma.
-    if (token.length() != 2 && token.length() != 3)
-        return std::nullopt;
+    // Splits a line at whitespace and commas into at most tokens.size() tokens, ignoring everything after
+    // a ';'. '$(...)' is a single token, spaces and all. Returns the number of tokens found, which is one
+    // more than fits into tokens if there are too many.
+    constexpr auto tokenize(std::string_view line, std::span<std::string_view> tokens) -> usize {
+        line = line.substr(0, line.find(';'));
 
-    const auto register_char = token[1];
-    if (!std::isdigit(register_char))
-        return std::nullopt;
+        usize count = 0;
+        usize i = 0;
+        while (true) {
+            while (i < line.size() && (is_space(line[i]) || line[i] == ','))
+                i++;
+            if (i == line.size())
+                return count;
+            if (count == tokens.size())
+                return count + 1;
 
-    const auto register_index = register_char - '0';
-    if (register_index < 0 || register_index > 9)
-        return std::nullopt;
+            const auto start = i;
+            if (line.substr(i).starts_with("$(")) {
+                usize depth = 0;
+                do {
+                    depth += line[i] == '(';
+                    depth -= line[i] == ')';
+                    i++;
+                } while (i < line.size() && (depth > 0 || line[i - 1] != ')'));
+            } else {
+                while (i < line.size() && !is_space(line[i]) && line[i] != ',')
+                    i++;
+            }
+            tokens[count++] = line.substr(start, i - start);
+        }
+    }
 
-    return Register { static_cast<ProcessorSpec::reg_t>(register_index) };
-}
+    // 'r1' -> 1
+    auto parse_register(std::string_view token) -> std::optional<Register> {
+        if (token.length() != 2 || token[0] != 'r')
+            return std::nullopt;
 
-// '#123' '#0x7B' -> 123
-auto parse_immediate(std::string_view token) -> std::optional<Immediate> {
-    if (!token.starts_with('#')) {
-        fmt::println("immediate needs to start with a '#' character");
-        return std::nullopt;
+        const auto register_char = token[1];
+        if (register_char < '0' || register_char > '9')
+            return std::nullopt;
+
+        return Register { static_cast<ProcessorSpec::reg_t>(register_char - '0') };
     }
 
-    const auto is_hex = token.starts_with("#0x");
-    // Subtract 1 from the substr length for the leading # and another one if
-    // the token ends with a comma
-    auto subtract = 1 + (token.ends_with(',') ? 1 : 0);
+    // '123' '0x7B' '0b1111011' -> 123, the whole token has to be a number
+    template <typename T>
+    auto parse_number(std::string_view token) -> std::optional<T> {
+        auto base = 10;
+        if (token.starts_with("0x")) {
+            token.remove_prefix(2);
+            base = 16;
+        } else if (token.starts_with("0b")) {
+            token.remove_prefix(2);
+            base = 2;
+        }
 
-    auto immediate = 0;
-    if (is_hex) {
-        // get rid of the 0x prefix
-        subtract += 2;
+        auto value = T { 0 };
+        const auto [end, error] = std::from_chars(token.data(), token.data() + token.size(), value, base);
+        if (error != std::errc {} || end != token.data() + token.size() || token.empty())
+            return std::nullopt;
+        return value;
+    }
 
-        const auto substr = token.substr(3, token.length() - subtract);
-        immediate = std::stoi(substr.data(), nullptr, 16);
-    } else {
-        const auto substr = token.substr(1, token.length() - subtract);
-        immediate = std::stoi(substr.data(), nullptr, 10);
+    auto check_immediate(i64 immediate) -> std::optional<Immediate> {
+        static constexpr auto min = std::numeric_limits<ProcessorSpec::imm_t>::min();
+        static constexpr auto max = std::numeric_limits<ProcessorSpec::imm_t>::max();
+        if (immediate < min) {
+            fmt::println("immediate {} is too small (min {})", immediate, min);
+            return std::nullopt;
+        }
+        if (immediate > max) {
+            fmt::println("immediate {} is too big (max {})", immediate, max);
+            return std::nullopt;
+        }
+        return Immediate { static_cast<ProcessorSpec::imm_t>(immediate) };
     }
 
-    static constexpr auto min = std::numeric_limits<ProcessorSpec::imm_t>::min();
-    static constexpr auto max = std::numeric_limits<ProcessorSpec::imm_t>::max();
-    if (immediate < min) {
-        fmt::println("immediate is too small (min {})", min);
-        return std::nullopt;
+    // '#123' '#0x7B' -> 123
+    auto parse_immediate(std::string_view token) -> std::optional<Immediate> {
+        if (!token.starts_with('#')) {
+            fmt::println("immediate needs to start with a '#' character");
+            return std::nullopt;
+        }
+
+        const auto immediate = parse_number<i32>(token.substr(1));
+        if (!immediate) {
+            fmt::println("immediate '{}' is not a number", token);
+            return std::nullopt;
+        }
+        return check_immediate(*immediate);
     }
-    if (immediate > max) {
-        fmt::println("immediate is too big (max {})", max);
-        return std::nullopt;
+
+    struct Evaluation {
+        enum Kind : u8 {
+            Value,
+            // Refers to a label that isn't known (yet)
+            Unresolved,
+            // Already printed why
+            Error,
+        };
+
+        Kind kind;
+        i64 value { 0 };
+    };
+
+    // Recursive descent over the inside of '$(...)'. lookup turns a label into its address, or
+    // std::nullopt if it isn't known, which doesn't stop the rest of the expression from being checked.
+    template <typename Lookup>
+    class ExpressionParser {
+    public:
+        ExpressionParser(std::string_view text, const Lookup& lookup)
+            : m_text { text }
+            , m_lookup { lookup } {
+        }
+
+        auto evaluate() -> Evaluation {
+            const auto value = parse_binary(0);
+            skip_spaces();
+            if (!m_error && m_position != m_text.size())
+                fail("unexpected '{}'", m_text.substr(m_position));
+            if (m_error)
+                return Evaluation { .kind = Evaluation::Error };
+            if (m_unresolved)
+                return Evaluation { .kind = Evaluation::Unresolved };
+            return Evaluation { .kind = Evaluation::Value, .value = value };
+        }
+
+    private:
+        struct Operator {
+            std::string_view symbol;
+            u8 precedence;
+        };
+
+        // Lowest precedence first, two character operators before their one character prefixes
+        static constexpr auto operators = std::array {
+            Operator { "|", 0 },
+            Operator { "^", 1 },
+            Operator { "&", 2 },
+            Operator { "<<", 3 },
+            Operator { ">>", 3 },
+            Operator { "+", 4 },
+            Operator { "-", 4 },
+            Operator { "*", 5 },
+            Operator { "/", 5 },
+            Operator { "%", 5 },
+        };
+        static constexpr u8 max_precedence = 5;
+
+        template <typename... Args>
+        auto fail(fmt::format_string<Args...> format, Args&&... args) -> i64 {
+            if (!m_error)
+                fmt::println("in expression '{}': {}", m_text, fmt::format(format, std::forward<Args>(args)...));
+            m_error = true;
+            return 0;
+        }
+
+        auto skip_spaces() -> void {
+            while (m_position < m_text.size() && is_space(m_text[m_position]))
+                m_position++;
+        }
+
+        auto next_operator(u8 precedence) -> const Operator* {
+            skip_spaces();
+            const auto rest = m_text.substr(m_position);
+            for (const auto& op : operators) {
+                if (op.precedence == precedence && rest.starts_with(op.symbol))
+                    return &op;
+            }
+            return nullptr;
+        }
+
+        auto parse_binary(u8 precedence) -> i64 {
+            if (precedence > max_precedence)
+                return parse_unary();
+
+            auto lhs = parse_binary(precedence + 1);
+            while (!m_error) {
+                const auto* op = next_operator(precedence);
+                if (op == nullptr)
+                    break;
+                m_position += op->symbol.size();
+                const auto rhs = parse_binary(precedence + 1);
+                lhs = apply(op->symbol, lhs, rhs);
+            }
+            return lhs;
+        }
+
+        auto apply(std::string_view op, i64 lhs, i64 rhs) -> i64 {
+            if ((op == "/" || op == "%") && rhs == 0 && !m_unresolved)
+                return fail("division by zero");
+            if ((op == "<<" || op == ">>") && (rhs < 0 || rhs > 63))
+                return m_unresolved ? 0 : fail("shift by {}", rhs);
+            if (m_unresolved)
+                return 0;
+
+            i64 result = 0;
+            switch (op[0]) {
+            case '|':
+                return lhs | rhs;
+            case '^':
+                return lhs ^ rhs;
+            case '&':
+                return lhs & rhs;
+            case '<':
+                return lhs << rhs;
+            case '>':
+                return lhs >> rhs;
+            case '+':
+                return __builtin_add_overflow(lhs, rhs, &result) ? fail("{} + {} overflows", lhs, rhs) : result;
+            case '-':
+                return __builtin_sub_overflow(lhs, rhs, &result) ? fail("{} - {} overflows", lhs, rhs) : result;
+            case '*':
+                return __builtin_mul_overflow(lhs, rhs, &result) ? fail("{} * {} overflows", lhs, rhs) : result;
+            }
+            if (lhs == std::numeric_limits<i64>::min() && rhs == -1)
+                return fail("{} {} {} overflows", lhs, op, rhs);
+            return op == "/" ? lhs / rhs : lhs % rhs;
+        }
+
+        auto parse_unary() -> i64 {
+            skip_spaces();
+            if (m_position == m_text.size())
+                return fail("expected a value");
+
+            const auto c = m_text[m_position];
+            if ((c == '-' || c == '~' || c == '+' || c == '(') && m_depth == max_expression_depth)
+                return fail("nested more than {} levels deep", max_expression_depth);
+            if (c == '-' || c == '~' || c == '+') {
+                m_position++;
+                m_depth++;
+                const auto value = parse_unary();
+                m_depth--;
+                if (c == '-' && value == std::numeric_limits<i64>::min())
+                    return m_unresolved ? 0 : fail("-({}) overflows", value);
+                return c == '-' ? -value : c == '~' ? ~value : value;
+            }
+            if (c == '(') {
+                m_position++;
+                m_depth++;
+                const auto value = parse_binary(0);
+                m_depth--;
+                skip_spaces();
+                if (m_position == m_text.size() || m_text[m_position] != ')')
+                    return fail("missing ')'");
+                m_position++;
+                return value;
+            }
+
+            const auto start = m_position;
+            while (m_position < m_text.size() && is_identifier_char(m_text[m_position]))
+                m_position++;
+            const auto token = m_text.substr(start, m_position - start);
+            if (token.empty())
+                return fail("unexpected '{}'", m_text.substr(start));
+
+            if (is_identifier_start(token[0])) {
+                const auto value = m_lookup(token);
+                if (!value)
+                    m_unresolved = true;
+                return value.value_or(0);
+            }
+            const auto value = parse_number<i64>(token);
+            if (!value)
+                return fail("'{}' is not a number", token);
+            return *value;
+        }
+
+        std::string_view m_text;
+        const Lookup& m_lookup;
+        usize m_position { 0 };
+        // Parens and unary operators currently open
+        usize m_depth { 0 };
+        bool m_unresolved { false };
+        bool m_error { false };
+    };
+
+    // '$(expr)' -> expr
+    auto expression_text(std::string_view token) -> std::optional<std::string_view> {
+        if (!token.starts_with("$(") || !token.ends_with(')'))
+            return std::nullopt;
+        return token.substr(2, token.size() - 3);
     }
 
-    return Immediate { static_cast<ProcessorSpec::imm_t>(immediate) };
-}
+    template <typename Lookup>
+    auto evaluate(std::string_view expression, const Lookup& lookup) -> Evaluation {
+        return ExpressionParser<Lookup> { expression, lookup }.evaluate();
+    }
+
+    struct StringHash {
+        using is_transparent = void;
+
+        auto operator()(std::string_view string) const noexcept -> usize {
+            return std::hash<std::string_view> {}(string);
+        }
+    };
+
+    template <typename T>
+    using StringMap = std::unordered_map<std::string, T, StringHash, std::equal_to<>>;
+
+    struct Macro {
+        std::vector<std::string> params;
+        std::vector<std::string> body;
+        usize line;
+    };
+
+    using MacroTable = StringMap<Macro>;
+
+    // '@macro name $a, $b' -> name, { a, b }
+    auto parse_macro_header(std::span<const std::string_view> tokens, usize line_number) -> std::optional<std::pair<std::string, Macro>> {
+        if (tokens.size() < 2 || !is_identifier(tokens[1])) {
+            fmt::println("line {}: '@macro' expects a name", line_number);
+            return std::nullopt;
+        }
+        if (find_mnemonic(tokens[1])) {
+            fmt::println("line {}: macro '{}' would hide the instruction", line_number, tokens[1]);
+            return std::nullopt;
+        }
+
+        auto macro = Macro { .params = {}, .body = {}, .line = line_number };
+        for (const auto param : tokens.subspan(2)) {
+            if (!param.starts_with('$') || !is_identifier(param.substr(1))) {
+                fmt::println("line {}: macro parameter '{}' has to look like '$name'", line_number, param);
+                return std::nullopt;
+            }
+            macro.params.emplace_back(param.substr(1));
+        }
+        return std::pair { std::string { tokens[1] }, std::move(macro) };
+    }
+
+    // Replaces '$param' with its argument, and inside of '$(...)' every param on its own with '(argument)'
+    auto substitute(std::string_view line, const Macro& macro, std::span<const std::string_view> args) -> std::string {
+        const auto argument = [&](std::string_view name) -> std::optional<std::string_view> {
+            for (usize i = 0; i < macro.params.size(); i++) {
+                if (macro.params[i] == name)
+                    return args[i];
+            }
+            return std::nullopt;
+        };
+
+        auto result = std::string {};
+        usize depth = 0;
+        for (usize i = 0; i < line.size();) {
+            const auto c = line[i];
+            if (c == '$' && i + 1 < line.size() && line[i + 1] == '(') {
+                result += "$(";
+                depth++;
+                i += 2;
+            } else if (c == '$' && i + 1 < line.size() && is_identifier_start(line[i + 1])) {
+                auto end = i + 1;
+                while (end < line.size() && is_identifier_char(line[end]))
+                    end++;
+                const auto value = argument(line.substr(i + 1, end - i - 1));
+                result += value.value_or(line.substr(i, end - i));
+                i = end;
+            } else if (depth > 0 && is_identifier_start(c)) {
+                auto end = i;
+                while (end < line.size() && is_identifier_char(line[end]))
+                    end++;
+                const auto name = line.substr(i, end - i);
+                if (const auto value = argument(name))
+                    result += fmt::format("({})", *value);
+                else
+                    result += name;
+                i = end;
+            } else {
+                if (depth > 0 && c == '(')
+                    depth++;
+                if (depth > 0 && c == ')')
+                    depth--;
+                result += c;
+                i++;
+            }
+        }
+        return result;
+    }
+
+    // Writes into a span, remembering if it ran out of space
+    class SpanInstructionSink final : public InstructionSink {
+    public:
+        explicit SpanInstructionSink(std::span<ProcessorSpec::insr_t> output)
+            : m_output { output } {
+        }
+
+        auto emit(ProcessorSpec::insr_t instruction) -> void override {
+            if (m_count < m_output.size())
+                m_output[m_count] = instruction;
+            m_count++;
+        }
+
+        [[nodiscard]] auto overflowed() const noexcept { return m_count > m_output.size(); }
+
+    private:
+        std::span<ProcessorSpec::insr_t> m_output;
+        usize m_count { 0 };
+    };
+
+    class VectorRefInstructionSink final : public InstructionSink {
+    public:
+        explicit VectorRefInstructionSink(std::vector<ProcessorSpec::insr_t>& output)
+            : m_output { &output } {
+        }
+
+        auto emit(ProcessorSpec::insr_t instruction) -> void override {
+            m_output->push_back(instruction);
+        }
 
-auto strip(const std::string& str) -> std::string {
-    const auto first = str.find_first_not_of(" \t");
-    const auto last = str.find_last_not_of(" \t");
-    if (first == std::string::npos || last == std::string::npos)
-        return "";
-    return str.substr(first, last - first + 1);
+    private:
+        std::vector<ProcessorSpec::insr_t>* m_output;
+    };
 }
 
-auto Assembler::assemble(const std::string& source) -> std::vector<ProcessorSpec::insr_t> {
-    if (source.empty())
-        return {};
+class Assembler::Unit {
+public:
+    enum class Mode : u8 {
+        // Starts at the sink's start, expressions may refer to labels further down
+        Flat,
+        // Starts at the sink's start, expressions that refer to labels further down are patched into the sink by finish
+        Stream,
+        // Part of an image, see assemble_image. Every label is resolved during linking.
+        Chunk,
+    };
 
-    auto lines = split(source, '\n');
+    // Instructions after the index-th one are at address, until the next origin
+    struct Origin {
+        usize index;
+        ProcessorSpec::addr_t address;
+    };
 
-    auto instructions = std::vector<ProcessorSpec::insr_t> {};
-    for (auto& line : lines) {
-        line = strip(line);
+    // Positions are the segment (0 for the one before the first origin, i for after origins[i - 1]) and
+    // the number of instructions before it
+    struct Label {
+        std::string name;
+        usize segment;
+        usize index;
+        usize line;
+    };
 
-        auto tokens = split(line, ' ');
-        if (tokens.empty())
-            continue;
+    // Immediate to patch into an already emitted instruction
+    struct Fixup {
+        usize segment;
+        usize index;
+        std::string expression;
+        usize line;
+        // As emitted, with an immediate of 0. Only kept by streams, the others still have their code around.
+        ProcessorSpec::insr_t instruction { 0 };
+    };
 
-        auto mnemonic_it = instruction_map.find(tokens[0]);
-        if (mnemonic_it == instruction_map.end()) {
-            fmt::println("illegal instruction (unknown mnemonic)");
-            return {};
+    Unit(Mode mode, InstructionSink& sink, usize first_line = 1, const MacroTable* predefined_macros = nullptr)
+        : m_mode { mode }
+        , m_sink { &sink }
+        , m_line_number { first_line }
+        , m_predefined_macros { predefined_macros } {
+    }
+
+    // Returns false if the line didn't assemble, after printing why
+    auto feed(std::string_view line) -> bool {
+        const auto line_number = m_line_number++;
+        if (m_in_macro)
+            return define_macro_line(line, line_number);
+        return process(line, line_number, 0);
+    }
+
+    // Checks that nothing is left open. Streams patch every expression that had to wait for a label into the sink.
+    auto finish() -> bool {
+        if (m_in_macro) {
+            fmt::println("line {}: '@macro' without '@end'", m_macro_line);
+            return false;
+        }
+        if (m_mode != Mode::Stream)
+            return true;
+
+        for (const auto& fixup : m_fixups) {
+            const auto immediate = resolve_fixup(fixup);
+            if (!immediate)
+                return false;
+            if (!m_sink->patch(fixup.index, static_cast<ProcessorSpec::insr_t>(fixup.instruction | *immediate))) {
+                fmt::println("line {}: expression '{}' refers to a label further down, which this sink can't go back for", fixup.line, fixup.expression);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // For Flat units, evaluates every expression that had to wait for a label and patches it into code
+    auto resolve(std::span<ProcessorSpec::insr_t> code) -> bool {
+        for (const auto& fixup : m_fixups) {
+            const auto immediate = resolve_fixup(fixup);
+            if (!immediate)
+                return false;
+            code[fixup.index] |= *immediate;
+        }
+        return true;
+    }
+
+    [[nodiscard]] auto instructions() const noexcept { return m_instructions; }
+    [[nodiscard]] auto origins() const noexcept -> std::span<const Origin> { return m_origins; }
+    [[nodiscard]] auto labels() const noexcept -> std::span<const Label> { return m_labels; }
+    [[nodiscard]] auto fixups() const noexcept -> std::span<const Fixup> { return m_fixups; }
+
+private:
+    [[nodiscard]] auto resolve_fixup(const Fixup& fixup) const -> std::optional<Immediate> {
+        const auto result = evaluate(fixup.expression, [this](std::string_view name) { return find_symbol(name); });
+        if (result.kind == Evaluation::Unresolved)
+            fmt::println("line {}: expression '{}' refers to an unknown label", fixup.line, fixup.expression);
+        if (result.kind != Evaluation::Value)
+            return std::nullopt;
+        const auto immediate = check_immediate(result.value);
+        if (!immediate)
+            fmt::println("line {}: in expression '{}'", fixup.line, fixup.expression);
+        return immediate;
+    }
+
+    auto process(std::string_view line, usize line_number, usize depth) -> bool {
+        auto storage = std::array<std::string_view, max_tokens> {};
+        const auto token_count = tokenize(line, storage);
+        if (token_count == 0)
+            return true;
+        if (token_count > storage.size()) {
+            fmt::println("line {}: illegal instruction (too many arguments)", line_number);
+            return false;
+        }
+        auto tokens = std::span { storage }.first(token_count);
+
+        if (tokens[0].ends_with(':')) {
+            if (!define_label(tokens[0].substr(0, tokens[0].size() - 1), line_number, depth))
+                return false;
+            tokens = tokens.subspan(1);
+            if (tokens.empty())
+                return true;
+        }
+
+        if (const auto type = find_mnemonic(tokens[0]))
+            return assemble_instruction(*type, tokens, line_number);
+        if (tokens[0] == ".org")
+            return set_origin(tokens, line_number);
+        if (tokens[0] == "@macro")
+            return begin_macro(tokens, line_number, depth);
+        if (tokens[0] == "@end") {
+            fmt::println("line {}: '@end' without '@macro'", line_number);
+            return false;
         }
+        if (const auto* macro = find_macro(tokens[0]))
+            return expand_macro(*macro, tokens, line_number, depth);
+
+        fmt::println("line {}: illegal instruction (unknown mnemonic '{}')", line_number, tokens[0]);
+        return false;
+    }
 
+    auto assemble_instruction(InstructionType type, std::span<const std::string_view> tokens, usize line_number) -> bool {
         // extremely unhelpful, please improve error handling sometime
-#define MUST_PARSE(fn) ({                                    \
-    auto __result = fn;                                      \
-    if (!__result.has_value()) {                             \
-        fmt::println("error parsing register or immediate"); \
-        return {};                                           \
-    }                                                        \
-    __result.value();                                        \
+#define MUST_PARSE(fn) ({                                                         \
+    auto __result = fn;                                                           \
+    if (!__result.has_value()) {                                                  \
+        fmt::println("line {}: error parsing register or immediate", line_number); \
+        return false;                                                             \
+    }                                                                             \
+    __result.value();                                                             \
 })
 
-        const auto type = mnemonic_it->second.type;
+        auto instruction = ProcessorSpec::insr_t { 0 };
         switch (tokens.size()) {
         case 1: {
-            instructions.emplace_back(encode_instruction(type));
+            instruction = encode_instruction(type);
             break;
         }
         case 2: {
             const auto reg = MUST_PARSE(parse_register(tokens[1]));
-            instructions.emplace_back(encode_instruction(type, reg));
+            instruction = encode_instruction(type, reg);
             break;
         }
         case 3: {
-            if (mnemonic_it->second.args == InstructionArguments::RegImm) {
+            if (info(type).operands == OperandKind::RegImm) {
                 const auto reg = MUST_PARSE(parse_register(tokens[1]));
-                const auto imm = MUST_PARSE(parse_immediate(tokens[2]));
-                instructions.emplace_back(encode_instruction(type, reg, imm));
+                if (const auto expression = expression_text(tokens[2])) {
+                    // Goes in with a zero immediate, finish(), resolve() or the linker patch it later if need be
+                    const auto fixups = m_fixups.size();
+                    const auto imm = MUST_PARSE(evaluate_immediate(*expression, line_number));
+                    instruction = encode_instruction(type, reg, imm);
+                    if (m_fixups.size() != fixups)
+                        m_fixups.back().instruction = instruction;
+                } else {
+                    const auto imm = MUST_PARSE(parse_immediate(tokens[2]));
+                    instruction = encode_instruction(type, reg, imm);
+                }
             } else {
                 const auto r1 = MUST_PARSE(parse_register(tokens[1]));
                 const auto r2 = MUST_PARSE(parse_register(tokens[2]));
-                instructions.emplace_back(encode_instruction(type, r1, r2));
+                instruction = encode_instruction(type, r1, r2);
             }
             break;
         }
@@ -225,15 +694,522 @@ auto Assembler::assemble(const std::string& source) -> std::vector<ProcessorSpec
             const auto r1 = MUST_PARSE(parse_register(tokens[1]));
             const auto r2 = MUST_PARSE(parse_register(tokens[2]));
             const auto r3 = MUST_PARSE(parse_register(tokens[3]));
-            instructions.emplace_back(encode_instruction(type, r1, r2, r3));
+            instruction = encode_instruction(type, r1, r2, r3);
             break;
         }
         default:
-            fmt::println("illegal instruction (too many arguments)");
-            return {};
+            fmt::println("line {}: illegal instruction (too many arguments)", line_number);
+            return false;
         }
-    }
 #undef MUST_PARSE
 
+        m_sink->emit(instruction);
+        m_instructions++;
+        return true;
+    }
+
+    // The immediate if the expression can be evaluated right away, 0 if it has to wait for a label
+    auto evaluate_immediate(std::string_view expression, usize line_number) -> std::optional<Immediate> {
+        const auto result = evaluate(expression, [this](std::string_view name) { return find_symbol(name); });
+        switch (result.kind) {
+        case Evaluation::Value:
+            return check_immediate(result.value);
+        case Evaluation::Unresolved:
+            m_fixups.push_back(Fixup { .segment = m_origins.size(), .index = m_instructions, .expression = std::string { expression }, .line = line_number });
+            return Immediate { 0 };
+        default:
+            return std::nullopt;
+        }
+    }
+
+    auto define_label(std::string_view name, usize line_number, usize depth) -> bool {
+        if (depth > 0) {
+            fmt::println("line {}: macros can't define labels", line_number);
+            return false;
+        }
+        if (!is_identifier(name)) {
+            fmt::println("line {}: '{}' isn't a valid label name", line_number, name);
+            return false;
+        }
+
+        m_labels.push_back(Label { .name = std::string { name }, .segment = m_origins.size(), .index = m_instructions, .line = line_number });
+        // Chunks don't know where they are, the linker takes care of them
+        if (m_mode != Mode::Chunk) {
+            const auto address = m_sink->start() + m_instructions * sizeof(ProcessorSpec::insr_t);
+            const auto [existing, inserted] = m_symbols.emplace(name, std::pair { static_cast<i64>(address), line_number });
+            if (!inserted) {
+                fmt::println("line {}: label '{}' is already defined on line {}", line_number, name, existing->second.second);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    [[nodiscard]] auto find_symbol(std::string_view name) const -> std::optional<i64> {
+        const auto symbol = m_symbols.find(name);
+        if (symbol == m_symbols.end())
+            return std::nullopt;
+        return symbol->second.first;
+    }
+
+    auto set_origin(std::span<const std::string_view> tokens, usize line_number) -> bool {
+        if (m_mode != Mode::Chunk) {
+            fmt::println("line {}: '.org' needs Assembler::assemble_image", line_number);
+            return false;
+        }
+        const auto origin = tokens.size() == 2 ? parse_number<ProcessorSpec::addr_t>(tokens[1]) : std::nullopt;
+        if (!origin) {
+            fmt::println("line {}: '.org' expects a single address", line_number);
+            return false;
+        }
+        m_origins.push_back(Origin { .index = m_instructions, .address = *origin });
+        return true;
+    }
+
+    auto begin_macro(std::span<const std::string_view> tokens, usize line_number, usize depth) -> bool {
+        if (depth > 0) {
+            fmt::println("line {}: macros can't define other macros", line_number);
+            return false;
+        }
+        m_in_macro = true;
+        m_macro_line = line_number;
+        // Chunks got all macros up front, they only have to skip the definitions
+        if (m_predefined_macros != nullptr)
+            return true;
+
+        auto header = parse_macro_header(tokens, line_number);
+        if (!header)
+            return false;
+        const auto [existing, inserted] = m_macros.try_emplace(std::move(header->first), std::move(header->second));
+        if (!inserted) {
+            fmt::println("line {}: macro '{}' is already defined on line {}", line_number, existing->first, existing->second.line);
+            return false;
+        }
+        m_macro = &existing->second;
+        return true;
+    }
+
+    auto define_macro_line(std::string_view line, usize line_number) -> bool {
+        auto storage = std::array<std::string_view, 1> {};
+        if (tokenize(line, storage) > 0 && storage[0] == "@end") {
+            m_in_macro = false;
+            m_macro = nullptr;
+            return true;
+        }
+        if (storage[0] == "@macro") {
+            fmt::println("line {}: macros can't define other macros", line_number);
+            return false;
+        }
+        if (m_macro != nullptr)
+            m_macro->body.emplace_back(line);
+        return true;
+    }
+
+    [[nodiscard]] auto find_macro(std::string_view name) const -> const Macro* {
+        const auto& macros = m_predefined_macros != nullptr ? *m_predefined_macros : m_macros;
+        const auto macro = macros.find(name);
+        return macro != macros.end() ? &macro->second : nullptr;
+    }
+
+    auto expand_macro(const Macro& macro, std::span<const std::string_view> tokens, usize line_number, usize depth) -> bool {
+        if (macro.line > line_number) {
+            fmt::println("line {}: macro '{}' is used before its definition on line {}", line_number, tokens[0], macro.line);
+            return false;
+        }
+        if (depth == max_macro_depth) {
+            fmt::println("line {}: macros nested more than {} deep", line_number, max_macro_depth);
+            return false;
+        }
+        const auto args = tokens.subspan(1);
+        if (args.size() != macro.params.size()) {
+            fmt::println("line {}: macro '{}' expects {} arguments, got {}", line_number, tokens[0], macro.params.size(), args.size());
+            return false;
+        }
+
+        for (const auto& body_line : macro.body) {
+            if (!process(substitute(body_line, macro, args), line_number, depth + 1)) {
+                fmt::println("line {}: in macro '{}'", line_number, tokens[0]);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Mode m_mode;
+    InstructionSink* m_sink;
+    usize m_line_number;
+    usize m_instructions { 0 };
+
+    std::vector<Origin> m_origins;
+    std::vector<Label> m_labels;
+    std::vector<Fixup> m_fixups;
+    // Address and line of every label, not used by chunks
+    StringMap<std::pair<i64, usize>> m_symbols;
+
+    const MacroTable* m_predefined_macros;
+    MacroTable m_macros;
+    // Between '@macro' and '@end'
+    bool m_in_macro { false };
+    usize m_macro_line { 0 };
+    // The one being defined
+    Macro* m_macro { nullptr };
+};
+
+auto Assembler::assemble(std::string_view source, std::span<ProcessorSpec::insr_t> output) -> std::optional<usize> {
+    auto sink = SpanInstructionSink { output };
+    auto unit = Unit { Unit::Mode::Flat, sink };
+    while (!source.empty()) {
+        const auto end = source.find('\n');
+        const auto line = source.substr(0, end);
+        source.remove_prefix(end == std::string_view::npos ? source.size() : end + 1);
+
+        if (!unit.feed(line))
+            return std::nullopt;
+        if (sink.overflowed()) {
+            fmt::println("program doesn't fit into {} instructions", output.size());
+            return std::nullopt;
+        }
+    }
+
+    if (!unit.finish() || !unit.resolve(output.first(unit.instructions())))
+        return std::nullopt;
+    return unit.instructions();
+}
+
+auto Assembler::assemble(std::string_view source) -> std::vector<ProcessorSpec::insr_t> {
+    auto instructions = std::vector<ProcessorSpec::insr_t> {};
+    // Most lines hold an instruction, only macros can make a program longer than that
+    instructions.reserve(static_cast<usize>(std::ranges::count(source, '\n')) + 1);
+
+    auto sink = VectorRefInstructionSink { instructions };
+    auto unit = Unit { Unit::Mode::Flat, sink };
+    while (!source.empty()) {
+        const auto end = source.find('\n');
+        const auto line = source.substr(0, end);
+        source.remove_prefix(end == std::string_view::npos ? source.size() : end + 1);
+
+        if (!unit.feed(line))
+            return {};
+    }
+
+    if (!unit.finish() || !unit.resolve(instructions))
+        return {};
     return instructions;
 }
+
+namespace {
+    struct Chunk {
+        std::string_view source;
+        usize first_line;
+        VectorInstructionSink code;
+        std::unique_ptr<Assembler::Unit> unit;
+        bool failed { false };
+    };
+
+    // Macros are collected before assembling any chunk, so a chunk can use the ones defined in the
+    // chunks before it. Their definitions are kept out of the chunks' way.
+    struct MacroDefinitions {
+        MacroTable macros;
+        // Byte ranges of each definition, '@macro' to the end of the '@end' line, in source order
+        std::vector<std::pair<usize, usize>> ranges;
+    };
+
+    auto collect_macros(std::string_view source) -> std::optional<MacroDefinitions> {
+        auto definitions = MacroDefinitions {};
+        usize line_number = 1;
+        usize counted = 0;
+        usize position = 0;
+        while (true) {
+            const auto at = source.find('@', position);
+            if (at == std::string_view::npos)
+                break;
+            const auto line_start = source.rfind('\n', at) + 1;
+            auto line_end = source.find('\n', at);
+            line_end = line_end == std::string_view::npos ? source.size() : line_end + 1;
+            position = line_end;
+
+            auto storage = std::array<std::string_view, max_tokens> {};
+            const auto token_count = tokenize(source.substr(line_start, line_end - line_start), storage);
+            if (token_count == 0 || token_count > max_tokens || storage[0] != "@macro")
+                continue;
+
+            line_number += static_cast<usize>(std::count(source.begin() + static_cast<isize>(counted), source.begin() + static_cast<isize>(line_start), '\n'));
+            counted = line_start;
+            auto header = parse_macro_header(std::span { storage }.first(token_count), line_number);
+            if (!header)
+                return std::nullopt;
+
+            auto& macro = header->second;
+            auto body_start = line_end;
+            auto found_end = false;
+            while (body_start < source.size()) {
+                auto body_end = source.find('\n', body_start);
+                body_end = body_end == std::string_view::npos ? source.size() : body_end + 1;
+                const auto line = source.substr(body_start, body_end - body_start);
+                body_start = body_end;
+
+                auto first = std::array<std::string_view, 1> {};
+                if (tokenize(line, first) > 0 && first[0] == "@end") {
+                    found_end = true;
+                    break;
+                }
+                // Nested definitions are reported by the chunk that gets to the line
+                macro.body.emplace_back(line.substr(0, line.find('\n')));
+            }
+            if (!found_end) {
+                fmt::println("line {}: '@macro' without '@end'", line_number);
+                return std::nullopt;
+            }
+
+            definitions.ranges.emplace_back(line_start, body_start);
+            position = body_start;
+            const auto [existing, inserted] = definitions.macros.try_emplace(std::move(header->first), std::move(macro));
+            if (!inserted) {
+                fmt::println("line {}: macro '{}' is already defined on line {}", line_number, existing->first, existing->second.line);
+                return std::nullopt;
+            }
+        }
+        return definitions;
+    }
+
+    // Cuts the source into chunks of about chunk_size bytes, each ending with a full line and none of
+    // them starting inside a macro definition
+    auto split_chunks(std::string_view source, usize chunk_size, std::span<const std::pair<usize, usize>> macro_ranges) -> std::vector<Chunk> {
+        auto chunks = std::vector<Chunk> {};
+        usize line = 1;
+        usize start = 0;
+        auto range = macro_ranges.begin();
+        while (start < source.size()) {
+            auto end = source.size();
+            if (start + chunk_size < source.size()) {
+                const auto newline = source.find('\n', start + chunk_size - 1);
+                end = newline == std::string_view::npos ? source.size() : newline + 1;
+            }
+            while (range != macro_ranges.end() && range->second <= end)
+                range++;
+            if (range != macro_ranges.end() && range->first < end)
+                end = range->second;
+
+            const auto text = source.substr(start, end - start);
+            chunks.push_back(Chunk { .source = text, .first_line = line, .code = {}, .unit = nullptr });
+            line += static_cast<usize>(std::ranges::count(text, '\n'));
+            start = end;
+        }
+        return chunks;
+    }
+
+    auto assemble_chunk(Chunk& chunk, const MacroTable& macros) -> void {
+        chunk.unit = std::make_unique<Assembler::Unit>(Assembler::Unit::Mode::Chunk, chunk.code, chunk.first_line, &macros);
+        auto source = chunk.source;
+        while (!source.empty()) {
+            const auto end = source.find('\n');
+            const auto line = source.substr(0, end);
+            source.remove_prefix(end == std::string_view::npos ? source.size() : end + 1);
+
+            if (!chunk.unit->feed(line)) {
+                chunk.failed = true;
+                return;
+            }
+        }
+    }
+
+    // Places every segment in order, after the one before it unless it starts with an origin, and then
+    // patches every expression that refers to a label
+    auto link(std::span<const Chunk> chunks) -> std::optional<ProgramImage> {
+        auto image = ProgramImage {};
+        auto used = std::vector<bool>(image.memory.size());
+        usize address = ProcessorSpec::reset_pc;
+        // Index of the section the next instruction continues, no_section after an origin
+        static constexpr auto no_section = std::numeric_limits<usize>::max();
+        usize section = no_section;
+
+        // Address every segment of every chunk starts at
+        auto segment_addresses = std::vector<std::vector<usize>>(chunks.size());
+        for (usize c = 0; c < chunks.size(); c++) {
+            const auto& instructions = chunks[c].code.instructions();
+            const auto origins = chunks[c].unit->origins();
+            for (usize segment = 0; segment <= origins.size(); segment++) {
+                if (segment > 0) {
+                    address = origins[segment - 1].address;
+                    section = no_section;
+                }
+                segment_addresses[c].push_back(address);
+
+                const auto begin = segment > 0 ? origins[segment - 1].index : 0;
+                const auto end = segment < origins.size() ? origins[segment].index : instructions.size();
+                if (begin == end)
+                    continue;
+                if (section == no_section) {
+                    section = image.sections.size();
+                    image.sections.push_back(ProgramImage::Section { .origin = static_cast<ProcessorSpec::addr_t>(address), .size = 0 });
+                }
+
+                auto& current = image.sections[section];
+                if (address + (end - begin) * sizeof(ProcessorSpec::insr_t) > image.memory.size()) {
+                    fmt::println("section at 0x{:04X} runs past the end of memory", current.origin);
+                    return std::nullopt;
+                }
+                for (auto index = begin; index < end; index++) {
+                    if (used[address] || used[address + 1]) {
+                        fmt::println("section at 0x{:04X} overlaps another one at 0x{:04X}", current.origin, address);
+                        return std::nullopt;
+                    }
+                    used[address] = used[address + 1] = true;
+                    image.memory[address] = static_cast<u8>(instructions[index] >> 8);
+                    image.memory[address + 1] = static_cast<u8>(instructions[index] & 0xFF);
+                    address += sizeof(ProcessorSpec::insr_t);
+                }
+                current.size = static_cast<u32>(address - current.origin);
+            }
+        }
+
+        const auto address_of = [&](usize chunk, usize segment, usize index) {
+            const auto start = segment > 0 ? chunks[chunk].unit->origins()[segment - 1].index : 0;
+            return segment_addresses[chunk][segment] + (index - start) * sizeof(ProcessorSpec::insr_t);
+        };
+
+        auto symbols = StringMap<std::pair<i64, usize>> {};
+        for (usize c = 0; c < chunks.size(); c++) {
+            for (const auto& label : chunks[c].unit->labels()) {
+                const auto value = static_cast<i64>(address_of(c, label.segment, label.index));
+                const auto [existing, inserted] = symbols.emplace(label.name, std::pair { value, label.line });
+                if (!inserted) {
+                    fmt::println("line {}: label '{}' is already defined on line {}", label.line, label.name, existing->second.second);
+                    return std::nullopt;
+                }
+                image.symbols.push_back(ProgramImage::Symbol { .name = label.name, .address = static_cast<ProcessorSpec::addr_t>(value) });
+            }
+        }
+
+        const auto lookup = [&](std::string_view name) -> std::optional<i64> {
+            const auto symbol = symbols.find(name);
+            return symbol != symbols.end() ? std::optional { symbol->second.first } : std::nullopt;
+        };
+        for (usize c = 0; c < chunks.size(); c++) {
+            for (const auto& fixup : chunks[c].unit->fixups()) {
+                const auto result = evaluate(fixup.expression, lookup);
+                if (result.kind == Evaluation::Unresolved)
+                    fmt::println("line {}: expression '{}' refers to an unknown label", fixup.line, fixup.expression);
+                if (result.kind != Evaluation::Value)
+                    return std::nullopt;
+                const auto immediate = check_immediate(result.value);
+                if (!immediate) {
+                    fmt::println("line {}: in expression '{}'", fixup.line, fixup.expression);
+                    return std::nullopt;
+                }
+                // The immediate is the low byte of the instruction
+                image.memory[address_of(c, fixup.segment, fixup.index) + 1] = *immediate;
+            }
+        }
+        return image;
+    }
+}
+
+auto Assembler::assemble_image(std::string_view source, usize threads, usize chunk_size) -> std::optional<ProgramImage> {
+    threads = std::max<usize>(threads, 1);
+    if (chunk_size == 0)
+        chunk_size = threads == 1 ? source.size() : std::max<usize>(source.size() / (threads * 8), 64 * 1024);
+
+    const auto definitions = collect_macros(source);
+    if (!definitions)
+        return std::nullopt;
+
+    auto chunks = split_chunks(source, std::max<usize>(chunk_size, 1), definitions->ranges);
+    auto next = std::atomic<usize> { 0 };
+    const auto work = [&] {
+        for (auto i = next.fetch_add(1, std::memory_order_relaxed); i < chunks.size(); i = next.fetch_add(1, std::memory_order_relaxed))
+            assemble_chunk(chunks[i], definitions->macros);
+    };
+    {
+        // The calling thread helps out
+        auto workers = std::vector<std::jthread> {};
+        for (usize i = 1; i < std::min(threads, chunks.size()); i++)
+            workers.emplace_back(work);
+        work();
+    }
+
+    if (std::ranges::any_of(chunks, &Chunk::failed))
+        return std::nullopt;
+    return link(chunks);
+}
+
+auto Assembler::assemble(std::istream& source, InstructionSink& sink) -> std::optional<usize> {
+    auto stream = AssemblerStream { sink };
+    auto buffer = std::array<char, stream_chunk_size> {};
+    while (source) {
+        source.read(buffer.data(), buffer.size());
+        if (!stream.feed(std::string_view { buffer.data(), static_cast<usize>(source.gcount()) }))
+            return std::nullopt;
+    }
+    if (source.bad() || !stream.finish())
+        return std::nullopt;
+    return stream.instructions();
+}
+
+auto Assembler::assemble_fd(int fd, InstructionSink& sink) -> std::optional<usize> {
+    auto stream = AssemblerStream { sink };
+    auto buffer = std::array<char, stream_chunk_size> {};
+    while (true) {
+        const auto bytes = ::read(fd, buffer.data(), buffer.size());
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0) {
+            fmt::println("can't read assembler source: {}", std::strerror(errno));
+            return std::nullopt;
+        }
+        if (bytes == 0)
+            break;
+        if (!stream.feed(std::string_view { buffer.data(), static_cast<usize>(bytes) }))
+            return std::nullopt;
+    }
+    if (!stream.finish())
+        return std::nullopt;
+    return stream.instructions();
+}
+
+AssemblerStream::AssemblerStream(InstructionSink& sink)
+    : m_unit { std::make_unique<Assembler::Unit>(Assembler::Unit::Mode::Stream, sink) } {
+}
+
+AssemblerStream::~AssemblerStream() = default;
+
+auto AssemblerStream::instructions() const noexcept -> usize {
+    return m_unit->instructions();
+}
+
+auto AssemblerStream::feed(std::string_view chunk) -> bool {
+    while (!m_failed) {
+        const auto end = chunk.find('\n');
+        if (end == std::string_view::npos) {
+            m_partial.append(chunk);
+            break;
+        }
+
+        // Lines entirely inside the chunk are assembled right from it
+        if (m_partial.empty()) {
+            assemble_line(chunk.substr(0, end));
+        } else {
+            m_partial.append(chunk.substr(0, end));
+            assemble_line(m_partial);
+            m_partial.clear();
+        }
+        chunk.remove_prefix(end + 1);
+    }
+    return !m_failed;
+}
+
+auto AssemblerStream::finish() -> bool {
+    if (!m_failed && !m_partial.empty()) {
+        assemble_line(m_partial);
+        m_partial.clear();
+    }
+    if (!m_failed && !m_unit->finish())
+        m_failed = true;
+    return !m_failed;
+}
+
+auto AssemblerStream::assemble_line(std::string_view line) -> bool {
+    if (!m_unit->feed(line))
+        m_failed = true;
+    return !m_failed;
+}
@@ -1,11 +1,137 @@
 #pragma once
 
+#include <iosfwd>
+#include <memory>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include <image.hpp>
 #include <instructions.hpp>
 
+// Receives instructions from the streaming assembler as soon as the line they're on is complete
+class InstructionSink {
+public:
+    virtual ~InstructionSink() = default;
+
+    virtual auto emit(ProcessorSpec::insr_t instruction) -> void = 0;
+    // Replaces the index-th instruction emitted so far. The stream calls this once it's finished, for every
+    // instruction whose immediate refers to a label further down. Sinks that can't go back return false,
+    // which fails the stream if the program has any such reference.
+    virtual auto patch(usize, ProcessorSpec::insr_t) -> bool { return false; }
+    // Where the first instruction ends up, which is what labels point into
+    [[nodiscard]] virtual auto start() const noexcept -> ProcessorSpec::addr_t { return ProcessorSpec::reset_pc; }
+};
+
+class VectorInstructionSink final : public InstructionSink {
+public:
+    auto emit(ProcessorSpec::insr_t instruction) -> void override {
+        m_instructions.push_back(instruction);
+    }
+
+    auto patch(usize index, ProcessorSpec::insr_t instruction) -> bool override {
+        m_instructions[index] = instruction;
+        return true;
+    }
+
+    [[nodiscard]] auto instructions() const noexcept -> const std::vector<ProcessorSpec::insr_t>& { return m_instructions; }
+
+private:
+    std::vector<ProcessorSpec::insr_t> m_instructions;
+};
+
+// Writes instructions to consecutive addresses of anything with write_instruction(address, instruction),
+// like a Processor or ProcessorBatch, so the program never exists anywhere else
+template <typename Target>
+class LoadingInstructionSink final : public InstructionSink {
+public:
+    explicit LoadingInstructionSink(Target& target, ProcessorSpec::addr_t start = ProcessorSpec::reset_pc)
+        : m_target { &target }
+        , m_start { start }
+        , m_address { start } {
+    }
+
+    auto emit(ProcessorSpec::insr_t instruction) -> void override {
+        m_target->write_instruction(m_address, instruction);
+        m_address += sizeof(ProcessorSpec::insr_t);
+    }
+
+    auto patch(usize index, ProcessorSpec::insr_t instruction) -> bool override {
+        m_target->write_instruction(static_cast<ProcessorSpec::addr_t>(m_start + index * sizeof(ProcessorSpec::insr_t)), instruction);
+        return true;
+    }
+
+    [[nodiscard]] auto start() const noexcept -> ProcessorSpec::addr_t override { return m_start; }
+    // Where the next instruction goes
+    [[nodiscard]] auto address() const noexcept { return m_address; }
+
+private:
+    Target* m_target;
+    ProcessorSpec::addr_t m_start;
+    ProcessorSpec::addr_t m_address;
+};
+
+// See the top of assembler.cpp for the syntax
 class Assembler final {
 public:
-    [[nodiscard]] static auto assemble(const std::string& source) -> std::vector<ProcessorSpec::insr_t>;
-};
\ No newline at end of file
+    // Writes into output and returns the number of instructions written, without allocating unless the
+    // program uses labels, macros or expressions. The program is meant to be loaded at the reset PC, which
+    // is where labels point into, '.org' isn't allowed. Fails if the program doesn't assemble or doesn't fit
+    // into output.
+    [[nodiscard]] static auto assemble(std::string_view source, std::span<ProcessorSpec::insr_t> output) -> std::optional<usize>;
+
+    // Empty if the program doesn't assemble
+    [[nodiscard]] static auto assemble(std::string_view source) -> std::vector<ProcessorSpec::insr_t>;
+
+    // Streams the source through an AssemblerStream in fixed size chunks, returns the number of
+    // instructions emitted. Instructions before a failing line have been emitted already.
+    static auto assemble(std::istream& source, InstructionSink& sink) -> std::optional<usize>;
+    // Same for a file descriptor, which is read until EOF but not closed
+    static auto assemble_fd(int fd, InstructionSink& sink) -> std::optional<usize>;
+
+    // Assembles a program made of '.org <address>' delimited sections into an image. Code before the
+    // first '.org' goes to the reset PC. The source is cut into chunks at line boundaries, which are
+    // assembled on up to threads threads, and placed into the image in source order afterwards, so the
+    // image is the same no matter the number of threads. Labels are resolved while placing the chunks,
+    // so they work across chunks and sections. chunk_size of 0 picks one from the source size.
+    // With more than one thread, each chunk that fails to assemble reports its first error.
+    [[nodiscard]] static auto assemble_image(std::string_view source, usize threads = 1, usize chunk_size = 0) -> std::optional<ProgramImage>;
+
+    static constexpr usize stream_chunk_size = 64 * 1024;
+
+    // Assembles one line after the other, keeping track of labels, macros and expressions that can only
+    // be evaluated later. Only defined in assembler.cpp.
+    class Unit;
+};
+
+// Assembles source handed over in chunks of any size, lines may be split across chunks. Only an
+// unfinished line, macro definitions, labels and expressions waiting for a label are kept around, so memory
+// use doesn't grow with the rest of the program. Instructions are emitted as soon as their line is complete.
+// The ones with an expression that refers to a label further down go out with an immediate of 0 and are
+// patched into the sink by finish(), see InstructionSink::patch. Labels point to where the sink puts the code.
+class AssemblerStream {
+public:
+    explicit AssemblerStream(InstructionSink& sink);
+    ~AssemblerStream();
+
+    AssemblerStream(const AssemblerStream&) = delete;
+    auto operator=(const AssemblerStream&) -> AssemblerStream& = delete;
+
+    // Returns false once a line failed to assemble, everything after it is ignored
+    auto feed(std::string_view chunk) -> bool;
+    // Assembles what's left of a last line without a newline at the end and patches forward references
+    auto finish() -> bool;
+
+    [[nodiscard]] auto failed() const noexcept { return m_failed; }
+    // Emitted so far
+    [[nodiscard]] auto instructions() const noexcept -> usize;
+
+private:
+    auto assemble_line(std::string_view line) -> bool;
+
+    std::unique_ptr<Assembler::Unit> m_unit;
+    std::string m_partial;
+    bool m_failed { false };
+};
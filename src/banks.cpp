@@ -0,0 +1,110 @@
+#include <banks.hpp>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <sys/mman.h>
+
+auto ExtendedMemory::create(usize size) -> std::optional<ExtendedMemory> {
+    size = (size + PagedMemory::page_size - 1) / PagedMemory::page_size * PagedMemory::page_size;
+    if (size == 0)
+        return ExtendedMemory { nullptr, 0 };
+
+    // Anonymous pages are zero and only get backed by memory once written
+    auto* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (data == MAP_FAILED) {
+        fmt::println(stderr, "can't reserve {} bytes of extended memory: {}", size, std::strerror(errno));
+        return std::nullopt;
+    }
+    return ExtendedMemory { static_cast<u8*>(data), size };
+}
+
+ExtendedMemory::ExtendedMemory(u8* data, usize size)
+    : m_data { data }
+    , m_size { size } {
+}
+
+ExtendedMemory::~ExtendedMemory() {
+    if (m_data != nullptr)
+        ::munmap(m_data, m_size);
+}
+
+ExtendedMemory::ExtendedMemory(ExtendedMemory&& other) noexcept
+    : m_data { std::exchange(other.m_data, nullptr) }
+    , m_size { std::exchange(other.m_size, 0) } {
+}
+
+auto ExtendedMemory::operator=(ExtendedMemory&& other) noexcept -> ExtendedMemory& {
+    std::swap(m_data, other.m_data);
+    std::swap(m_size, other.m_size);
+    return *this;
+}
+
+BankSwitcher::BankSwitcher(Processor& processor, ExtendedMemory& store, usize bank_pages)
+    : m_processor { processor }
+    , m_store { store }
+    , m_bank_pages { std::max<usize>(bank_pages, 1) }
+    // Bank numbers are 16 bits wide
+    , m_bank_count { std::min<usize>(store.size() / bank_size(), usize { std::numeric_limits<u16>::max() } + 1) } {
+}
+
+auto BankSwitcher::add_window(usize first_page) -> std::optional<usize> {
+    if (m_bank_count == 0 || first_page + m_bank_pages > PagedMemory::page_count)
+        return std::nullopt;
+    for (const auto& window : m_windows) {
+        if (first_page < window.first_page + m_bank_pages && window.first_page < first_page + m_bank_pages)
+            return std::nullopt;
+    }
+
+    // The lowest bank no other window shows
+    usize bank = 0;
+    while (bank < m_bank_count && shown_elsewhere(m_windows.size(), bank))
+        bank++;
+    if (bank == m_bank_count)
+        return std::nullopt;
+
+    m_windows.push_back(Window { .first_page = first_page, .bank = static_cast<u16>(bank), .pending_high = 0 });
+    auto* data = m_store.data() + bank * bank_size();
+    for (usize page = 0; page < m_bank_pages; page++)
+        m_processor.map_memory_window(first_page + page, data + page * PagedMemory::page_size);
+    return m_windows.size() - 1;
+}
+
+auto BankSwitcher::select(usize window, usize bank) -> bool {
+    if (window >= m_windows.size() || bank >= m_bank_count || shown_elsewhere(window, bank))
+        return false;
+
+    auto& selected = m_windows[window];
+    selected.bank = static_cast<u16>(bank);
+    auto* data = m_store.data() + bank * bank_size();
+    for (usize page = 0; page < m_bank_pages; page++)
+        m_processor.map_memory_window(selected.first_page + page, data + page * PagedMemory::page_size);
+    return true;
+}
+
+auto BankSwitcher::shown_elsewhere(usize window, usize bank) const -> bool {
+    for (usize other = 0; other < m_windows.size(); other++) {
+        if (other != window && m_windows[other].bank == bank)
+            return true;
+    }
+    return false;
+}
+
+auto BankSwitcher::read(u16 offset) -> data_t {
+    const auto window = offset / 2u;
+    if (window >= m_windows.size())
+        return 0;
+    const auto bank = m_windows[window].bank;
+    return static_cast<data_t>(offset % 2 == 0 ? bank >> 8 : bank & 0xFF);
+}
+
+auto BankSwitcher::write(u16 offset, data_t data) -> void {
+    const auto window = offset / 2u;
+    if (window >= m_windows.size())
+        return;
+    if (offset % 2 == 0)
+        m_windows[window].pending_high = data;
+    else
+        select(window, usize { m_windows[window].pending_high } << 8 | data);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include <bus.hpp>
+#include <processor.hpp>
+
+// Memory beyond the 64KiB address space, for programs to switch into windows of it (see BankSwitcher).
+// It's reserved up front but the system only backs it with memory once it's touched, so a few hundred
+// MiB cost nothing until a program uses them. Starts out zeroed.
+class ExtendedMemory {
+public:
+    // Prints why and returns nothing if size bytes can't be reserved. size is rounded up to whole pages.
+    [[nodiscard]] static auto create(usize size) -> std::optional<ExtendedMemory>;
+
+    ~ExtendedMemory();
+    ExtendedMemory(ExtendedMemory&& other) noexcept;
+    auto operator=(ExtendedMemory&& other) noexcept -> ExtendedMemory&;
+
+    [[nodiscard]] auto size() const noexcept { return m_size; }
+    [[nodiscard]] auto data() noexcept { return m_data; }
+    [[nodiscard]] auto data() const noexcept -> const u8* { return m_data; }
+
+private:
+    ExtendedMemory(u8* data, usize size);
+
+    u8* m_data;
+    usize m_size;
+};
+
+// Shows banks of an ExtendedMemory in windows of a processor's address space. The store is split into banks
+// of bank_pages pages, and each window shows one bank at a time, the lowest one no other window shows to begin
+// with. Switching is a pointer swap per page of the window (see Processor::map_memory_window), nothing is
+// copied, and whatever the processor cached about the window's pages is dropped.
+//
+// No two windows show the same bank. The processor only drops what it cached about the address it stored to,
+// so code run from one window wouldn't notice stores to the same bytes through another.
+//
+// Attached to a page as a device, programs switch banks themselves: window w is switched by storing the bank
+// number to offsets 2w (most significant byte) and 2w + 1, the second store does the switch. Reading those
+// returns the bank the window shows. Switching to a bank that doesn't exist or another window shows does
+// nothing.
+//
+// Works on the processor it was made for only, forks of it share its windows and banks but can't switch them.
+class BankSwitcher final : public MemoryDevice {
+public:
+    BankSwitcher(Processor& processor, ExtendedMemory& store, usize bank_pages);
+
+    // Window of bank_pages pages starting at first_page, returns its number. Nothing if it doesn't fit into
+    // the address space, overlaps another window or every bank is shown already.
+    auto add_window(usize first_page) -> std::optional<usize>;
+    // Returns false if window or bank doesn't exist, or another window shows the bank
+    auto select(usize window, usize bank) -> bool;
+
+    [[nodiscard]] auto bank(usize window) const { return m_windows[window].bank; }
+    [[nodiscard]] auto bank_count() const noexcept { return m_bank_count; }
+    [[nodiscard]] auto bank_size() const noexcept { return m_bank_pages * PagedMemory::page_size; }
+
+    auto read(u16 offset) -> data_t override;
+    auto write(u16 offset, data_t data) -> void override;
+
+private:
+    [[nodiscard]] auto shown_elsewhere(usize window, usize bank) const -> bool;
+
+    struct Window {
+        usize first_page;
+        u16 bank;
+        // Written to the first register, waiting for the second
+        u8 pending_high;
+    };
+
+    Processor& m_processor;
+    ExtendedMemory& m_store;
+    usize m_bank_pages;
+    usize m_bank_count;
+    std::vector<Window> m_windows;
+};
@@ -0,0 +1,655 @@
+#include <batch.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <type_traits>
+#include <unordered_map>
+
+namespace {
+    using Flag = Processor::Flag;
+
+    constexpr usize vector_width = 32;
+    constexpr usize stack_page_size = 256;
+
+    constexpr u8 carry_flag = std::to_underlying(Flag::Carry);
+    constexpr u8 zero_flag = std::to_underlying(Flag::Zero);
+    constexpr u8 overflow_flag = std::to_underlying(Flag::Overflow);
+    constexpr u8 negative_flag = std::to_underlying(Flag::Negative);
+    constexpr u8 halt_flag = std::to_underlying(Flag::Halt);
+
+#if defined(__GNUC__)
+    // The vector helpers below are always inlined, so the "ABI changed" note about passing them around doesn't apply
+#pragma GCC diagnostic ignored "-Wpsabi"
+    using u8x32 = u8 __attribute__((vector_size(32)));
+    using i8x32 = signed char __attribute__((vector_size(32)));
+    using u16x32 = u16 __attribute__((vector_size(64)));
+#define BATCH_INLINE [[gnu::always_inline]] inline
+#else
+#define BATCH_INLINE inline
+#endif
+
+    // Kernels are written once against V, which is either a single u8 or a vector of them. Lanes
+    // outside the group (mask 0) keep their registers and flags.
+
+    template <typename V>
+    BATCH_INLINE auto load(const u8* source) -> V {
+        V value;
+        std::memcpy(&value, source, sizeof(V));
+        return value;
+    }
+
+    template <typename V>
+    BATCH_INLINE auto store(u8* destination, V value) -> void {
+        std::memcpy(destination, &value, sizeof(V));
+    }
+
+    template <typename V>
+    BATCH_INLINE auto splat(u8 value) -> V {
+        if constexpr (std::is_same_v<V, u8>)
+            return value;
+        else
+            return V {} + value;
+    }
+
+    // Comparison results as all-ones/all-zeroes bytes
+    template <typename V, typename Condition>
+    BATCH_INLINE auto to_mask(Condition condition) -> V {
+        if constexpr (std::is_same_v<V, u8>)
+            return condition ? u8 { 0xFF } : u8 { 0 };
+        else
+            return std::bit_cast<V>(condition);
+    }
+
+    template <typename V>
+    BATCH_INLINE auto select(V mask, V yes, V no) -> V {
+        return static_cast<V>((yes & mask) | (no & static_cast<V>(~mask)));
+    }
+
+    template <typename V>
+    BATCH_INLINE auto mul_overflows(V lhs, V rhs) -> V {
+        if constexpr (std::is_same_v<V, u8>) {
+            return to_mask<V>(static_cast<u16>(lhs * rhs) > 0xFF);
+        } else {
+            const auto product = __builtin_convertvector(lhs, u16x32) * __builtin_convertvector(rhs, u16x32);
+            return to_mask<V>(__builtin_convertvector(product > 0xFF, i8x32));
+        }
+    }
+
+    template <InstructionType type, typename V>
+    BATCH_INLINE auto apply(u8* dst, u8* lhs, u8* rhs, u8 data, u8* flags, const u8* mask, usize lanes) -> void {
+        constexpr auto zn_bits = static_cast<u8>(zero_flag | negative_flag);
+
+        for (usize i = 0; i < lanes; i += sizeof(V)) {
+            const auto active = load<V>(mask + i);
+            const auto old_flags = load<V>(flags + i);
+
+            if constexpr (type == InstructionType::Halt) {
+                store(flags + i, select(active, static_cast<V>(old_flags | halt_flag), old_flags));
+                continue;
+            }
+
+            const auto a = load<V>(lhs + i);
+            const auto b = load<V>(rhs + i);
+            V result;
+            if constexpr (type == InstructionType::LoadFromReg)
+                result = a;
+            else if constexpr (type == InstructionType::LoadFromImm)
+                result = splat<V>(data);
+            else if constexpr (type == InstructionType::Add)
+                result = static_cast<V>(a + b);
+            else if constexpr (type == InstructionType::Sub)
+                result = static_cast<V>(a - b);
+            else if constexpr (type == InstructionType::Mul)
+                result = static_cast<V>(a * b);
+            else if constexpr (type == InstructionType::And)
+                result = static_cast<V>(a & b);
+            else if constexpr (type == InstructionType::Or)
+                result = static_cast<V>(a | b);
+            else if constexpr (type == InstructionType::Xor)
+                result = static_cast<V>(a ^ b);
+            store(dst + i, select(active, result, load<V>(dst + i)));
+
+            auto new_flags = static_cast<V>(old_flags & static_cast<u8>(~zn_bits));
+            new_flags |= static_cast<V>(to_mask<V>(result == 0) & zero_flag);
+            new_flags |= static_cast<V>(static_cast<V>(result >> 7) << 3);
+
+            // Carry and overflow look at the operands after dst was written, like Processor does
+            if constexpr (type == InstructionType::Add || type == InstructionType::Sub || type == InstructionType::Mul) {
+                const auto lhs_after = load<V>(lhs + i);
+                const auto rhs_after = load<V>(rhs + i);
+                if constexpr (type == InstructionType::Add) {
+                    new_flags &= static_cast<u8>(~overflow_flag);
+                    new_flags |= static_cast<V>(to_mask<V>(lhs_after > static_cast<V>(~rhs_after)) & overflow_flag);
+                } else if constexpr (type == InstructionType::Sub) {
+                    new_flags &= static_cast<u8>(~carry_flag);
+                    new_flags |= static_cast<V>(to_mask<V>(rhs_after > lhs_after) & carry_flag);
+                } else {
+                    new_flags &= static_cast<u8>(~overflow_flag);
+                    new_flags |= static_cast<V>(mul_overflows(lhs_after, rhs_after) & overflow_flag);
+                }
+            }
+
+            store(flags + i, select(active, new_flags, old_flags));
+        }
+    }
+
+    template <typename V>
+    BATCH_INLINE auto apply(InstructionType type, u8* dst, u8* lhs, u8* rhs, u8 data, u8* flags, const u8* mask, usize lanes) -> void {
+        switch (type) {
+        case InstructionType::LoadFromReg:
+            return apply<InstructionType::LoadFromReg, V>(dst, lhs, rhs, data, flags, mask, lanes);
+        case InstructionType::LoadFromImm:
+            return apply<InstructionType::LoadFromImm, V>(dst, lhs, rhs, data, flags, mask, lanes);
+        case InstructionType::Add:
+            return apply<InstructionType::Add, V>(dst, lhs, rhs, data, flags, mask, lanes);
+        case InstructionType::Sub:
+            return apply<InstructionType::Sub, V>(dst, lhs, rhs, data, flags, mask, lanes);
+        case InstructionType::Mul:
+            return apply<InstructionType::Mul, V>(dst, lhs, rhs, data, flags, mask, lanes);
+        case InstructionType::And:
+            return apply<InstructionType::And, V>(dst, lhs, rhs, data, flags, mask, lanes);
+        case InstructionType::Or:
+            return apply<InstructionType::Or, V>(dst, lhs, rhs, data, flags, mask, lanes);
+        case InstructionType::Xor:
+            return apply<InstructionType::Xor, V>(dst, lhs, rhs, data, flags, mask, lanes);
+        case InstructionType::Halt:
+            return apply<InstructionType::Halt, V>(dst, lhs, rhs, data, flags, mask, lanes);
+        default:
+            return;
+        }
+    }
+
+    // Whether (value & bits) == expected for every lane in the mask
+    template <typename V>
+    BATCH_INLINE auto all_equal(const u8* values, u8 bits, u8 expected, const u8* mask, usize lanes) -> bool {
+        for (usize i = 0; i < lanes; i += sizeof(V)) {
+            const auto differs = static_cast<V>(to_mask<V>(static_cast<V>(load<V>(values + i) & bits) != splat<V>(expected)) & load<V>(mask + i));
+            if constexpr (std::is_same_v<V, u8>) {
+                if (differs != 0)
+                    return false;
+            } else {
+                const auto words = std::bit_cast<std::array<u64, sizeof(V) / sizeof(u64)>>(differs);
+                if (std::ranges::any_of(words, [](u64 word) { return word != 0; }))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    auto apply_scalar(InstructionType type, u8* dst, u8* lhs, u8* rhs, u8 data, u8* flags, const u8* mask, usize lanes) -> void {
+        apply<u8>(type, dst, lhs, rhs, data, flags, mask, lanes);
+    }
+
+    auto all_equal_scalar(const u8* values, u8 bits, u8 expected, const u8* mask, usize lanes) -> bool {
+        return all_equal<u8>(values, bits, expected, mask, lanes);
+    }
+
+#if defined(__GNUC__) && defined(__x86_64__)
+    // SSE2 is part of x86-64, the 32 byte vectors end up as pairs of SSE registers here
+    auto apply_sse(InstructionType type, u8* dst, u8* lhs, u8* rhs, u8 data, u8* flags, const u8* mask, usize lanes) -> void {
+        apply<u8x32>(type, dst, lhs, rhs, data, flags, mask, lanes);
+    }
+
+    auto all_equal_sse(const u8* values, u8 bits, u8 expected, const u8* mask, usize lanes) -> bool {
+        return all_equal<u8x32>(values, bits, expected, mask, lanes);
+    }
+
+    [[gnu::target("avx2")]]
+    auto apply_avx2(InstructionType type, u8* dst, u8* lhs, u8* rhs, u8 data, u8* flags, const u8* mask, usize lanes) -> void {
+        apply<u8x32>(type, dst, lhs, rhs, data, flags, mask, lanes);
+    }
+
+    [[gnu::target("avx2")]]
+    auto all_equal_avx2(const u8* values, u8 bits, u8 expected, const u8* mask, usize lanes) -> bool {
+        return all_equal<u8x32>(values, bits, expected, mask, lanes);
+    }
+#endif
+
+    struct Kernels {
+        auto (*apply)(InstructionType, u8*, u8*, u8*, u8, u8*, const u8*, usize) -> void;
+        auto (*all_equal)(const u8*, u8, u8, const u8*, usize) -> bool;
+    };
+
+    auto kernels_for(ProcessorBatch::Kernel kernel) -> Kernels {
+#if defined(__GNUC__) && defined(__x86_64__)
+        switch (kernel) {
+        case ProcessorBatch::Kernel::Avx2:
+            return { &apply_avx2, &all_equal_avx2 };
+        case ProcessorBatch::Kernel::Sse:
+            return { &apply_sse, &all_equal_sse };
+        default:
+            break;
+        }
+#endif
+        static_cast<void>(kernel);
+        return { &apply_scalar, &all_equal_scalar };
+    }
+
+    constexpr auto vectorized(InstructionType type) -> bool {
+        switch (type) {
+        case InstructionType::LoadFromReg:
+        case InstructionType::LoadFromImm:
+        case InstructionType::Add:
+        case InstructionType::Sub:
+        case InstructionType::Mul:
+        case InstructionType::And:
+        case InstructionType::Or:
+        case InstructionType::Xor:
+        case InstructionType::Halt:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    auto zn_flags(u8 flags, data_t value) -> u8 {
+        flags = static_cast<u8>(flags & ~(zero_flag | negative_flag));
+        if (value == 0)
+            flags |= zero_flag;
+        if (value & 0b1000'0000)
+            flags |= negative_flag;
+        return flags;
+    }
+}
+
+ProcessorBatch::ProcessorBatch(usize lanes, Kernel kernel)
+    : m_lanes(lanes)
+    , m_padded((lanes + vector_width - 1) / vector_width * vector_width)
+    , m_kernel(kernel)
+    , m_memory(ProcessorSpec::highest_addr + 1)
+    , m_stack_pages(lanes * stack_page_size)
+    , m_flags(m_padded)
+    , m_program_counters(lanes, ProcessorSpec::reset_pc)
+    , m_stack_pointers(lanes, ProcessorSpec::stack_top_addr)
+    , m_retired(lanes)
+    , m_budgets(lanes)
+    , m_status(lanes, LaneStatus::Running)
+    , m_escaped(lanes) {
+    for (auto& reg : m_registers)
+        reg.assign(m_padded, 0);
+}
+
+ProcessorBatch::~ProcessorBatch() = default;
+
+auto ProcessorBatch::best_kernel() -> Kernel {
+#if defined(__GNUC__) && defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2"))
+        return Kernel::Avx2;
+    return Kernel::Sse;
+#else
+    return Kernel::Scalar;
+#endif
+}
+
+auto ProcessorBatch::write_memory(addr_t address, data_t data) -> void {
+    m_memory[address] = data;
+    m_escape_image.reset();
+    if (address < stack_page_size) {
+        for (usize lane = 0; lane < m_lanes; lane++)
+            m_stack_pages[lane * stack_page_size + address] = data;
+    }
+    for (auto& processor : m_escaped) {
+        if (processor)
+            processor->write_memory(address, data);
+    }
+}
+
+auto ProcessorBatch::write_instruction(addr_t start_address, insr_t encoded_instruction) -> void {
+    write_memory(start_address, static_cast<data_t>((encoded_instruction >> 8) & 0xFF));
+    write_memory(static_cast<addr_t>(start_address + 1), static_cast<data_t>(encoded_instruction & 0xFF));
+}
+
+auto ProcessorBatch::write_register(usize lane, u8 reg, data_t data) -> void {
+    if (lane >= m_lanes || reg >= ProcessorSpec::register_count)
+        return;
+    if (m_escaped[lane])
+        m_escaped[lane]->write_register(reg, data);
+    else
+        m_registers[reg][lane] = data;
+}
+
+auto ProcessorBatch::lane(usize index) const -> LaneState {
+    auto state = LaneState {};
+    if (const auto& processor = m_escaped[index]) {
+        std::ranges::copy(processor->registers(), state.registers.begin());
+        state.program_counter = processor->program_counter();
+        state.stack_pointer = processor->stack_pointer();
+        state.flags = processor->flags();
+        state.retired_instructions = m_retired[index] + processor->retired_instructions();
+    } else {
+        for (u8 reg = 0; reg < ProcessorSpec::register_count; reg++)
+            state.registers[reg] = m_registers[reg][index];
+        state.program_counter = m_program_counters[index];
+        state.stack_pointer = m_stack_pointers[index];
+        state.flags = m_flags[index];
+        state.retired_instructions = m_retired[index];
+    }
+    state.status = m_status[index];
+    return state;
+}
+
+auto ProcessorBatch::execute(usize instruction_count) -> void {
+    if (instruction_count == 0)
+        return;
+
+    for (usize lane = 0; lane < m_lanes; lane++) {
+        if (m_status[lane] == LaneStatus::OutOfBudget)
+            m_status[lane] = LaneStatus::Running;
+        m_budgets[lane] = instruction_count;
+    }
+
+    form_groups();
+    while (!m_groups.empty()) {
+        // Lowest address first, lanes that fell behind in a loop get to catch up and merge again
+        auto next = std::ranges::min_element(m_groups, {}, &Group::pc);
+        step(*next);
+        std::erase_if(m_groups, [](const Group& group) { return group.lanes == 0; });
+    }
+}
+
+auto ProcessorBatch::form_groups() -> void {
+    auto groups = std::unordered_map<addr_t, usize> {};
+    for (usize lane = 0; lane < m_lanes; lane++) {
+        if (m_status[lane] != LaneStatus::Running)
+            continue;
+
+        if (m_escaped[lane]) {
+            // Lanes that left the batch earlier just keep going on their own
+            run_escaped(lane);
+            continue;
+        }
+
+        // Same checks Processor does before every instruction
+        if (m_flags[lane] & halt_flag) {
+            m_status[lane] = LaneStatus::Halted;
+            continue;
+        }
+        const auto pc = m_program_counters[lane];
+        if (pc == ProcessorSpec::highest_addr) {
+            m_status[lane] = LaneStatus::EndOfMemory;
+            continue;
+        }
+
+        auto [it, created] = groups.try_emplace(pc, m_groups.size());
+        if (created)
+            m_groups.push_back({ .pc = pc, .mask = std::vector<u8>(m_padded), .lanes = 0, .pending = 0, .budget = 0 });
+        auto& group = m_groups[it->second];
+        group.mask[lane] = 0xFF;
+        group.lanes++;
+    }
+
+    for (auto& group : m_groups)
+        refresh_budget(group);
+}
+
+template <typename Function>
+auto ProcessorBatch::for_each_lane(const Group& group, Function function) const -> void {
+    // Skip over whole words of lanes outside the group, groups are often sparse after diverging
+    for (usize base = 0; base < m_lanes; base += sizeof(u64)) {
+        u64 word;
+        std::memcpy(&word, group.mask.data() + base, sizeof(word));
+        while (word != 0) {
+            const auto byte = static_cast<usize>(std::countr_zero(word)) / 8;
+            word &= ~(u64 { 0xFF } << (byte * 8));
+            if (base + byte < m_lanes)
+                function(base + byte);
+        }
+    }
+}
+
+auto ProcessorBatch::settle(Group& group) -> void {
+    if (group.pending == 0)
+        return;
+    for_each_lane(group, [&](usize lane) {
+        m_retired[lane] += group.pending;
+        m_budgets[lane] -= group.pending;
+    });
+    group.pending = 0;
+}
+
+auto ProcessorBatch::refresh_budget(Group& group) -> void {
+    group.budget = std::numeric_limits<u64>::max();
+    for_each_lane(group, [&](usize lane) { group.budget = std::min(group.budget, m_budgets[lane]); });
+}
+
+auto ProcessorBatch::finish(Group& group, usize lane, LaneStatus status) -> void {
+    m_status[lane] = status;
+    m_program_counters[lane] = group.pc;
+    group.mask[lane] = 0;
+    group.lanes--;
+}
+
+auto ProcessorBatch::escape(Group& group, usize lane) -> void {
+    if (!m_escape_image) {
+        m_escape_image = std::make_unique<Processor>();
+        for (u32 address = stack_page_size; address <= ProcessorSpec::highest_addr; address++) {
+            if (m_memory[address] != 0)
+                m_escape_image->write_memory(static_cast<addr_t>(address), m_memory[address]);
+        }
+    }
+
+    auto processor = std::make_unique<Processor>(m_escape_image->fork());
+    for (usize address = 0; address < stack_page_size; address++)
+        processor->write_memory(static_cast<addr_t>(address), m_stack_pages[lane * stack_page_size + address]);
+    for (u8 reg = 0; reg < ProcessorSpec::register_count; reg++)
+        processor->write_register(reg, m_registers[reg][lane]);
+    for (const auto flag : { Flag::Carry, Flag::Zero, Flag::Overflow, Flag::Negative, Flag::Halt }) {
+        if (m_flags[lane] & std::to_underlying(flag))
+            processor->set_flag(flag);
+    }
+    processor->set_program_counter(group.pc);
+    processor->set_stack_pointer(m_stack_pointers[lane]);
+
+    m_escaped[lane] = std::move(processor);
+    m_stats.escaped++;
+    finish(group, lane, LaneStatus::Running);
+    run_escaped(lane);
+}
+
+auto ProcessorBatch::run_escaped(usize lane) -> void {
+    auto& processor = *m_escaped[lane];
+    if (processor.execute(m_budgets[lane]))
+        m_status[lane] = LaneStatus::OutOfBudget;
+    else if (processor.is_flag_set(Flag::Halt))
+        m_status[lane] = LaneStatus::Halted;
+    else if (processor.program_counter() == ProcessorSpec::highest_addr)
+        m_status[lane] = LaneStatus::EndOfMemory;
+    else
+        m_status[lane] = LaneStatus::Failed;
+}
+
+auto ProcessorBatch::step(Group& group) -> void {
+    const auto pc = group.pc;
+
+    // The stack page differs between lanes, so code in it can't run for all of them at once
+    if (pc < stack_page_size) {
+        settle(group);
+        for_each_lane(group, [&](usize lane) { escape(group, lane); });
+        return;
+    }
+
+    const auto instruction = static_cast<insr_t>(m_memory[pc] << 8 | m_memory[pc + 1]);
+    const auto decoded = Processor::decode_fields(instruction);
+    if (!Processor::registers_in_range(decoded)) {
+        settle(group);
+        for_each_lane(group, [&](usize lane) { finish(group, lane, LaneStatus::Failed); });
+        return;
+    }
+
+    // Fields an instruction doesn't use may hold anything, point them at a register that exists
+    const auto operands = register_operand_count(decoded.type);
+    const auto r1 = operands >= 1 ? decoded.r1.reg : u8 { 0 };
+    const auto r2 = operands >= 2 ? decoded.r2.reg : r1;
+    const auto r3 = operands >= 3 ? decoded.r3.reg : r1;
+    // An all-zero instruction halts, but still runs as "ldr r0, r0" first
+    const auto halts = instruction == 0 || decoded.type == InstructionType::Halt;
+    const auto kernels = kernels_for(m_kernel);
+
+    if (vectorized(decoded.type)) {
+        kernels.apply(
+            decoded.type,
+            m_registers[r1].data(),
+            m_registers[r2].data(),
+            m_registers[r3].data(),
+            decoded.data,
+            m_flags.data(),
+            group.mask.data(),
+            m_padded
+        );
+        if (instruction == 0)
+            kernels.apply(InstructionType::Halt, nullptr, nullptr, nullptr, 0, m_flags.data(), group.mask.data(), m_padded);
+    } else {
+        // These go lane by lane and may drop some of them, which needs their counts up to date
+        settle(group);
+        switch (decoded.type) {
+        case InstructionType::LoadFromMem:
+            for_each_lane(group, [&](usize lane) {
+                const auto address = static_cast<addr_t>(m_registers[r2][lane] << 8 | m_registers[r3][lane]);
+                const auto value = address < stack_page_size ? m_stack_pages[lane * stack_page_size + address] : m_memory[address];
+                m_registers[r1][lane] = value;
+                m_flags[lane] = zn_flags(m_flags[lane], value);
+            });
+            break;
+        case InstructionType::Store:
+            for_each_lane(group, [&](usize lane) {
+                const auto address = static_cast<addr_t>(m_registers[r1][lane] << 8 | m_registers[r2][lane]);
+                if (address >= stack_page_size) {
+                    escape(group, lane);
+                    return;
+                }
+                const auto value = m_registers[r3][lane];
+                m_stack_pages[lane * stack_page_size + address] = value;
+                m_flags[lane] = zn_flags(m_flags[lane], value);
+            });
+            break;
+        case InstructionType::Div:
+            for_each_lane(group, [&](usize lane) {
+                if (m_registers[r3][lane] == 0) {
+                    finish(group, lane, LaneStatus::Failed);
+                    return;
+                }
+                const auto value = static_cast<data_t>(m_registers[r2][lane] / m_registers[r3][lane]);
+                m_registers[r1][lane] = value;
+                m_flags[lane] = zn_flags(m_flags[lane], value);
+            });
+            break;
+        case InstructionType::Push:
+            for_each_lane(group, [&](usize lane) {
+                auto& sp = m_stack_pointers[lane];
+                if (sp <= ProcessorSpec::stack_top_addr - ProcessorSpec::stack_size) {
+                    finish(group, lane, LaneStatus::Failed);
+                    return;
+                }
+                sp--;
+                m_stack_pages[lane * stack_page_size + sp] = m_registers[r1][lane];
+            });
+            break;
+        case InstructionType::Pop:
+            for_each_lane(group, [&](usize lane) {
+                auto& sp = m_stack_pointers[lane];
+                if (sp >= ProcessorSpec::stack_top_addr) {
+                    finish(group, lane, LaneStatus::Failed);
+                    return;
+                }
+                m_registers[r1][lane] = m_stack_pages[lane * stack_page_size + sp];
+                sp++;
+            });
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (group.lanes == 0)
+        return;
+
+    m_stats.steps++;
+    m_stats.lane_instructions += group.lanes;
+    group.pending++;
+    group.budget--;
+
+    auto next_pc = static_cast<addr_t>(pc + sizeof(insr_t));
+    if (decoded.type == InstructionType::Jump || decoded.type == InstructionType::JumpIfZero) {
+        // Usually every lane goes the same way, which the kernels can tell without visiting lanes one by one
+        const auto first = static_cast<usize>(std::ranges::find(group.mask, u8 { 0xFF }) - group.mask.begin());
+        const auto first_zero = static_cast<u8>(m_flags[first] & zero_flag);
+        const auto taken = decoded.type == InstructionType::Jump || first_zero != 0;
+        const auto same_condition = decoded.type == InstructionType::Jump
+            || kernels.all_equal(m_flags.data(), zero_flag, first_zero, group.mask.data(), m_padded);
+        const auto same_target = !taken
+            || (kernels.all_equal(m_registers[r1].data(), 0xFF, m_registers[r1][first], group.mask.data(), m_padded)
+                && kernels.all_equal(m_registers[r2].data(), 0xFF, m_registers[r2][first], group.mask.data(), m_padded));
+
+        if (!same_condition || !same_target) {
+            // Every target becomes a group of its own, the old one goes away
+            m_stats.divergences++;
+            settle(group);
+            auto split = std::vector<Group> {};
+            auto index = std::unordered_map<addr_t, usize> {};
+            for_each_lane(group, [&](usize lane) {
+                const auto lane_taken = decoded.type == InstructionType::Jump || (m_flags[lane] & zero_flag);
+                const auto target = lane_taken ? static_cast<addr_t>(m_registers[r1][lane] << 8 | m_registers[r2][lane]) : next_pc;
+                auto [it, created] = index.try_emplace(target, split.size());
+                if (created)
+                    split.push_back({ .pc = target, .mask = std::vector<u8>(m_padded), .lanes = 0, .pending = 0, .budget = 0 });
+                split[it->second].mask[lane] = 0xFF;
+                split[it->second].lanes++;
+            });
+            group.lanes = 0;
+
+            for (auto& part : split) {
+                refresh_budget(part);
+                if (part.budget == 0) {
+                    for_each_lane(part, [&](usize lane) {
+                        if (m_budgets[lane] == 0)
+                            finish(part, lane, LaneStatus::OutOfBudget);
+                    });
+                    refresh_budget(part);
+                }
+                if (part.pc == ProcessorSpec::highest_addr)
+                    for_each_lane(part, [&](usize lane) { finish(part, lane, LaneStatus::EndOfMemory); });
+                if (part.lanes != 0)
+                    m_groups.push_back(std::move(part));
+            }
+            return;
+        }
+
+        if (taken)
+            next_pc = static_cast<addr_t>(m_registers[r1][first] << 8 | m_registers[r2][first]);
+    }
+
+    group.pc = next_pc;
+    if (group.budget == 0) {
+        settle(group);
+        for_each_lane(group, [&](usize lane) {
+            if (m_budgets[lane] == 0)
+                finish(group, lane, LaneStatus::OutOfBudget);
+        });
+        refresh_budget(group);
+    }
+    if (halts) {
+        settle(group);
+        for_each_lane(group, [&](usize lane) { finish(group, lane, LaneStatus::Halted); });
+    }
+    if (group.pc == ProcessorSpec::highest_addr) {
+        settle(group);
+        for_each_lane(group, [&](usize lane) { finish(group, lane, LaneStatus::EndOfMemory); });
+    }
+    if (group.lanes == 0)
+        return;
+
+    // Caught up with another group, from here on they run together
+    for (auto& other : m_groups) {
+        if (&other == &group || other.pc != group.pc || other.lanes == 0)
+            continue;
+        settle(group);
+        settle(other);
+        for (usize i = 0; i < m_padded; i++)
+            other.mask[i] |= group.mask[i];
+        other.lanes += group.lanes;
+        other.budget = std::min(other.budget, group.budget);
+        group.lanes = 0;
+        return;
+    }
+}
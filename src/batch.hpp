@@ -0,0 +1,123 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include <processor.hpp>
+
+// Runs many copies of one program side by side, each lane with its own registers, flags and stack page,
+// e.g. for parameter sweeps. Lanes sitting at the same address form a group that executes one instruction
+// for all of its lanes at a time, with SIMD kernels for the register-only instructions. Groups split up
+// where lanes take different jumps and merge again once they meet at the same address.
+//
+// Memory outside the stack page (0x0000-0x00FF) is shared and read-only while running. A lane that stores
+// there, or runs code from its stack page, gets moved into a regular Processor and finishes on its own.
+class ProcessorBatch {
+public:
+    enum class Kernel : u8 {
+        Scalar,
+        Sse,
+        Avx2,
+    };
+
+    enum class LaneStatus : u8 {
+        Running,
+        // Stopped by the halt flag, or an all-zero instruction
+        Halted,
+        EndOfMemory,
+        // An instruction failed, the program counter still points to it
+        Failed,
+        // Ran out of instructions for this execute() call, can be resumed by calling it again
+        OutOfBudget,
+    };
+
+    struct LaneState {
+        std::array<reg_t, ProcessorSpec::register_count> registers;
+        addr_t program_counter;
+        addr_t stack_pointer;
+        u8 flags;
+        u64 retired_instructions;
+        LaneStatus status;
+    };
+
+    struct Stats {
+        // Instructions executed for a whole group at once
+        u64 steps { 0 };
+        // Sum of lane instructions retired by those steps
+        u64 lane_instructions { 0 };
+        // Times a group's lanes went to different addresses
+        u64 divergences { 0 };
+        // Lanes handed over to a regular Processor
+        u64 escaped { 0 };
+    };
+
+    explicit ProcessorBatch(usize lanes, Kernel kernel = best_kernel());
+    ~ProcessorBatch();
+
+    ProcessorBatch(const ProcessorBatch&) = delete;
+    auto operator=(const ProcessorBatch&) -> ProcessorBatch& = delete;
+
+    // Best kernel the CPU running this supports
+    [[nodiscard]] static auto best_kernel() -> Kernel;
+
+    // Writes to the stack page go to every lane
+    auto write_memory(addr_t address, data_t data) -> void;
+    auto write_instruction(addr_t start_address, insr_t encoded_instruction) -> void;
+    auto write_register(usize lane, u8 reg, data_t data) -> void;
+
+    // Runs every lane that hasn't stopped yet for up to instruction_count instructions each.
+    // Unlike Processor, nothing is printed when a lane stops, see LaneState::status instead.
+    auto execute(usize instruction_count = std::numeric_limits<usize>::max()) -> void;
+
+    [[nodiscard]] auto lane(usize index) const -> LaneState;
+    [[nodiscard]] auto size() const noexcept { return m_lanes; }
+    [[nodiscard]] auto kernel() const noexcept { return m_kernel; }
+    [[nodiscard]] auto stats() const noexcept { return m_stats; }
+
+private:
+    // Lanes at the same address. mask has 0xFF for every member lane.
+    struct Group {
+        addr_t pc;
+        std::vector<u8> mask;
+        usize lanes;
+        // Steps executed since the members' retired counts were last updated
+        u64 pending;
+        // Steps left until the first member runs out of budget
+        u64 budget;
+    };
+
+    auto form_groups() -> void;
+    auto step(Group& group) -> void;
+    auto settle(Group& group) -> void;
+    auto refresh_budget(Group& group) -> void;
+    auto finish(Group& group, usize lane, LaneStatus status) -> void;
+    auto escape(Group& group, usize lane) -> void;
+    auto run_escaped(usize lane) -> void;
+
+    template <typename Function>
+    auto for_each_lane(const Group& group, Function function) const -> void;
+
+    usize m_lanes;
+    // Lane count rounded up to a full vector, padding lanes never belong to any group
+    usize m_padded;
+    Kernel m_kernel;
+
+    std::vector<u8> m_memory;
+    // 256 bytes per lane
+    std::vector<u8> m_stack_pages;
+    std::array<std::vector<u8>, ProcessorSpec::register_count> m_registers;
+    std::vector<u8> m_flags;
+    std::vector<addr_t> m_program_counters;
+    std::vector<addr_t> m_stack_pointers;
+    std::vector<u64> m_retired;
+    // Instructions left in the current execute() call
+    std::vector<u64> m_budgets;
+    std::vector<LaneStatus> m_status;
+    std::vector<std::unique_ptr<Processor>> m_escaped;
+    // Shared memory without any stack page, escaped lanes start out as forks of it and share its pages
+    std::unique_ptr<Processor> m_escape_image;
+
+    std::vector<Group> m_groups;
+    Stats m_stats {};
+};
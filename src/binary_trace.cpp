@@ -0,0 +1,315 @@
+#include <binary_trace.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <disassembler.hpp>
+#include <fmt/core.h>
+
+namespace {
+    using namespace std::chrono_literals;
+
+    // How long the drain thread sleeps once the ring is empty
+    constexpr auto idle_wait = 50us;
+
+    // What both ends of a trace start out from, see BinaryTraceFormat
+    auto initial_state() -> TraceEntry {
+        return TraceEntry {
+            .pc = static_cast<ProcessorSpec::addr_t>(ProcessorSpec::reset_pc - sizeof(ProcessorSpec::insr_t)),
+            .instruction = 0,
+            .registers = {},
+            .stack_pointer = ProcessorSpec::stack_top_addr,
+            .flags = 0,
+        };
+    }
+
+    auto next_pc(ProcessorSpec::addr_t pc) -> ProcessorSpec::addr_t {
+        return static_cast<ProcessorSpec::addr_t>(pc + sizeof(ProcessorSpec::insr_t));
+    }
+
+    // Longest record: both masks, pc, instruction, stack pointer, flags and every register
+    constexpr usize max_record_size = 2 + 3 * sizeof(u16) + 1 + ProcessorSpec::register_count;
+
+    auto put_u16(u8*& out, u16 value) -> void {
+        *out++ = static_cast<u8>(value);
+        *out++ = static_cast<u8>(value >> 8);
+    }
+
+    // Writes the record for entry to out, which needs room for max_record_size bytes, moves out past it and
+    // state and instructions on to entry
+    auto encode(const TraceEntry& entry, TraceEntry& state, std::vector<ProcessorSpec::insr_t>& instructions, u8*& out) -> void {
+        u8 changed = 0;
+        if (entry.pc != next_pc(state.pc))
+            changed |= BinaryTraceFormat::Jumped;
+        if (entry.instruction != instructions[entry.pc])
+            changed |= BinaryTraceFormat::Instruction;
+        if (entry.stack_pointer != state.stack_pointer)
+            changed |= BinaryTraceFormat::StackPointer;
+        if (entry.flags != state.flags)
+            changed |= BinaryTraceFormat::Flags;
+
+        u8 registers = 0;
+        for (usize i = 0; i < entry.registers.size(); i++) {
+            if (entry.registers[i] != state.registers[i])
+                registers |= static_cast<u8>(1u << i);
+        }
+
+        *out++ = changed;
+        *out++ = registers;
+        if (changed & BinaryTraceFormat::Jumped)
+            put_u16(out, entry.pc);
+        if (changed & BinaryTraceFormat::Instruction)
+            put_u16(out, entry.instruction);
+        if (changed & BinaryTraceFormat::StackPointer)
+            put_u16(out, entry.stack_pointer);
+        if (changed & BinaryTraceFormat::Flags)
+            *out++ = entry.flags;
+        for (usize i = 0; i < entry.registers.size(); i++) {
+            if (registers & (1u << i))
+                *out++ = entry.registers[i];
+        }
+
+        instructions[entry.pc] = entry.instruction;
+        state = entry;
+    }
+
+    auto format_flags(u8 flags) -> std::string {
+        static constexpr auto names = std::string_view { "CZVNH" };
+        auto text = std::string {};
+        for (usize i = 0; i < names.size(); i++) {
+            if (flags & (1u << i))
+                text.push_back(names[i]);
+        }
+        return text.empty() ? "-" : text;
+    }
+}
+
+TraceRing::TraceRing(usize capacity)
+    : m_entries(std::bit_ceil(std::max<usize>(capacity, 2)))
+    , m_mask { m_entries.size() - 1 } {
+}
+
+auto TraceRing::try_push(const TraceEntry& entry) noexcept -> bool {
+    const auto tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_cached_head == m_entries.size()) {
+        m_cached_head = m_head.load(std::memory_order_acquire);
+        if (tail - m_cached_head == m_entries.size())
+            return false;
+    }
+
+    // One field at a time: the processor only just built entry with narrow stores, which a single 16 byte
+    // load of the whole thing can't be forwarded from, and waiting for them costs more than the push itself
+    auto& slot = m_entries[tail & m_mask];
+    slot.pc = entry.pc;
+    slot.instruction = entry.instruction;
+    slot.registers = entry.registers;
+    slot.stack_pointer = entry.stack_pointer;
+    slot.flags = entry.flags;
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+auto TraceRing::pop(std::span<TraceEntry> out) noexcept -> usize {
+    const auto head = m_head.load(std::memory_order_relaxed);
+    if (m_cached_tail == head)
+        m_cached_tail = m_tail.load(std::memory_order_acquire);
+
+    const auto count = std::min(out.size(), m_cached_tail - head);
+    for (usize i = 0; i < count; i++)
+        out[i] = m_entries[(head + i) & m_mask];
+    m_head.store(head + count, std::memory_order_release);
+    return count;
+}
+
+BinaryTraceSink::BinaryTraceSink(std::FILE* file, usize capacity)
+    : m_ring { capacity }
+    , m_file { file } {
+    const auto header = BinaryTraceFormat::Header {
+        .magic = { 'P', 'T', 'R', 'C' },
+        .version = BinaryTraceFormat::version,
+        .reserved = 0,
+    };
+    std::fwrite(&header, sizeof(header), 1, m_file);
+    m_thread = std::jthread { [this](std::stop_token stop_token) { drain(std::move(stop_token)); } };
+}
+
+BinaryTraceSink::~BinaryTraceSink() {
+    flush();
+    m_thread.request_stop();
+    m_thread.join();
+}
+
+auto BinaryTraceSink::record(const TraceEntry& entry) -> void {
+    if (!m_ring.try_push(entry)) [[unlikely]] {
+        m_stalls++;
+        while (!m_ring.try_push(entry))
+            std::this_thread::yield();
+    }
+    m_recorded++;
+}
+
+auto BinaryTraceSink::flush() -> void {
+    while (m_written.load(std::memory_order_acquire) != m_recorded)
+        std::this_thread::yield();
+    std::fflush(m_file);
+}
+
+auto BinaryTraceSink::drain(std::stop_token stop_token) -> void {
+    auto state = initial_state();
+    auto instructions = std::vector<ProcessorSpec::insr_t>(ProcessorSpec::highest_addr + 1u);
+    auto batch = std::vector<TraceEntry>(4096);
+    auto bytes = std::vector<u8>(batch.size() * max_record_size);
+
+    // Everything is flushed before the stop is requested, so there's nothing left to drain after it
+    while (!stop_token.stop_requested()) {
+        const auto count = m_ring.pop(batch);
+        if (count == 0) {
+            std::this_thread::sleep_for(idle_wait);
+            continue;
+        }
+
+        auto* out = bytes.data();
+        for (usize i = 0; i < count; i++)
+            encode(batch[i], state, instructions, out);
+        const auto size = static_cast<usize>(out - bytes.data());
+        if (std::fwrite(bytes.data(), 1, size, m_file) != size && !m_failed.exchange(true, std::memory_order_relaxed))
+            fmt::println(stderr, "can't write trace: {}", std::strerror(errno));
+        m_written.fetch_add(count, std::memory_order_release);
+    }
+}
+
+auto BinaryTraceReader::open(const std::string& path) -> std::optional<BinaryTraceReader> {
+    auto* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        fmt::println(stderr, "can't open {}: {}", path, std::strerror(errno));
+        return std::nullopt;
+    }
+
+    auto bytes = std::vector<u8> {};
+    auto chunk = std::array<u8, 64 * 1024> {};
+    while (const auto length = std::fread(chunk.data(), 1, chunk.size(), file))
+        bytes.insert(bytes.end(), chunk.begin(), chunk.begin() + static_cast<isize>(length));
+    const auto failed = std::ferror(file) != 0;
+    std::fclose(file);
+    if (failed) {
+        fmt::println(stderr, "can't read {}", path);
+        return std::nullopt;
+    }
+    return from_bytes(std::move(bytes));
+}
+
+auto BinaryTraceReader::from_bytes(std::vector<u8> bytes) -> std::optional<BinaryTraceReader> {
+    auto header = BinaryTraceFormat::Header {};
+    if (bytes.size() < sizeof(header)) {
+        fmt::println(stderr, "not a binary trace: too short");
+        return std::nullopt;
+    }
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (std::string_view { header.magic, sizeof(header.magic) } != BinaryTraceFormat::magic) {
+        fmt::println(stderr, "not a binary trace: bad magic");
+        return std::nullopt;
+    }
+    if (header.version != BinaryTraceFormat::version) {
+        fmt::println(stderr, "unsupported binary trace version {}", header.version);
+        return std::nullopt;
+    }
+    return BinaryTraceReader { std::move(bytes) };
+}
+
+BinaryTraceReader::BinaryTraceReader(std::vector<u8> bytes)
+    : m_bytes { std::move(bytes) }
+    , m_state { initial_state() }
+    , m_instructions(ProcessorSpec::highest_addr + 1u) {
+}
+
+auto BinaryTraceReader::next() -> std::optional<TraceEntry> {
+    if (m_truncated || m_offset == m_bytes.size())
+        return std::nullopt;
+
+    // Checked up front, so the reads below can't run past the end
+    const auto remaining = m_bytes.size() - m_offset;
+    if (remaining < 2) {
+        m_truncated = true;
+        return std::nullopt;
+    }
+    const auto changed = m_bytes[m_offset];
+    const auto registers = m_bytes[m_offset + 1];
+    const auto size = 2
+        + ((changed & BinaryTraceFormat::Jumped) ? 2u : 0u)
+        + ((changed & BinaryTraceFormat::Instruction) ? 2u : 0u)
+        + ((changed & BinaryTraceFormat::StackPointer) ? 2u : 0u)
+        + ((changed & BinaryTraceFormat::Flags) ? 1u : 0u)
+        + static_cast<usize>(std::popcount(registers));
+    if (remaining < size) {
+        m_truncated = true;
+        return std::nullopt;
+    }
+
+    auto offset = m_offset + 2;
+    const auto read_u16 = [&] {
+        const auto value = static_cast<u16>(m_bytes[offset] | (m_bytes[offset + 1] << 8));
+        offset += 2;
+        return value;
+    };
+
+    auto entry = m_state;
+    entry.pc = (changed & BinaryTraceFormat::Jumped) ? read_u16() : next_pc(m_state.pc);
+    entry.instruction = (changed & BinaryTraceFormat::Instruction) ? read_u16() : m_instructions[entry.pc];
+    if (changed & BinaryTraceFormat::StackPointer)
+        entry.stack_pointer = read_u16();
+    if (changed & BinaryTraceFormat::Flags)
+        entry.flags = m_bytes[offset++];
+    for (usize i = 0; i < entry.registers.size(); i++) {
+        if (registers & (1u << i))
+            entry.registers[i] = m_bytes[offset++];
+    }
+
+    m_offset = offset;
+    m_instructions[entry.pc] = entry.instruction;
+    m_state = entry;
+    return entry;
+}
+
+auto BinaryTraceReader::print(std::FILE* file) -> u64 {
+    auto out = fmt::memory_buffer {};
+    auto changes = fmt::memory_buffer {};
+    auto line = std::array<char, Disassembler::max_line_length> {};
+    u64 count = 0;
+
+    // What an instruction changed only shows up in the entry after it, the last one is printed on its own
+    auto current = next();
+    while (current) {
+        const auto following = next();
+        const auto length = Disassembler::disassemble_line(current->instruction, line);
+        const auto text = length ? std::string_view { line.data(), *length } : std::string_view { "<illegal>" };
+        changes.clear();
+        if (following) {
+            for (usize i = 0; i < current->registers.size(); i++) {
+                if (following->registers[i] != current->registers[i])
+                    fmt::format_to(std::back_inserter(changes), " r{}=0x{:02X}", i, following->registers[i]);
+            }
+            if (following->stack_pointer != current->stack_pointer)
+                fmt::format_to(std::back_inserter(changes), " sp=0x{:04X}", following->stack_pointer);
+            if (following->flags != current->flags)
+                fmt::format_to(std::back_inserter(changes), " flags={}", format_flags(following->flags));
+        }
+
+        if (changes.size() == 0)
+            fmt::format_to(std::back_inserter(out), "0x{:04X} {}\n", current->pc, text);
+        else
+            fmt::format_to(std::back_inserter(out), "0x{:04X} {:<20}{}\n", current->pc, text, std::string_view { changes.data(), changes.size() });
+        count++;
+
+        if (out.size() >= 64 * 1024) {
+            std::fwrite(out.data(), 1, out.size(), file);
+            out.clear();
+        }
+        current = following;
+    }
+
+    std::fwrite(out.data(), 1, out.size(), file);
+    return count;
+}
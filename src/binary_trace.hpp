@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <trace.hpp>
+
+// Single producer, single consumer queue of trace entries that never locks. Only the producer writes the
+// tail and only the consumer the head, and each side keeps a copy of the other's index it only refreshes
+// once the ring looks full (or empty), so most pushes and pops don't touch the other side's cache line.
+class TraceRing {
+public:
+    // Rounded up to a power of two
+    explicit TraceRing(usize capacity);
+
+    // Producer side, false if there's no room
+    auto try_push(const TraceEntry& entry) noexcept -> bool;
+    // Consumer side, moves up to out.size() of the oldest entries into out and returns how many that were
+    auto pop(std::span<TraceEntry> out) noexcept -> usize;
+
+    [[nodiscard]] auto capacity() const noexcept { return m_entries.size(); }
+
+private:
+    std::vector<TraceEntry> m_entries;
+    usize m_mask;
+
+    alignas(64) std::atomic<usize> m_tail { 0 };
+    usize m_cached_head { 0 };
+
+    alignas(64) std::atomic<usize> m_head { 0 };
+    usize m_cached_tail { 0 };
+};
+
+// Binary traces, little endian throughout:
+//
+//   Header       magic "PTRC", version
+//   Record[]     one per instruction, holding only what changed since the one before:
+//
+//     u8         bit 0: pc isn't the previous one + 2, bit 1: instruction isn't the one last seen at pc,
+//                bit 2: stack pointer changed, bit 3: flags changed
+//     u8         bit n set if register n changed
+//     then pc, instruction (both u16), stack pointer (u16) and flags (u8) if their bit is set, and the new
+//     value of every changed register, lowest first
+//
+// Both ends start out from the state after Processor::reset (pc 2 bytes before the reset PC) and an
+// instruction of 0 at every address, so a run of straight-line code that only changes one register takes up
+// 3 bytes per instruction instead of the 16 of a TraceEntry.
+namespace BinaryTraceFormat {
+    static constexpr auto magic = std::string_view { "PTRC" };
+    static constexpr u16 version = 1;
+
+    struct Header {
+        char magic[4];
+        u16 version;
+        u16 reserved;
+    };
+
+    static_assert(sizeof(Header) == 8);
+
+    enum Changed : u8 {
+        Jumped = 0b0001,
+        Instruction = 0b0010,
+        StackPointer = 0b0100,
+        Flags = 0b1000,
+    };
+}
+
+// Hands every entry to a TraceRing, which a background thread drains into a file in the format above. The
+// processor's thread only copies the entry per instruction, all encoding and I/O happens on the other one.
+// Nothing gets dropped: once the ring is full, record waits for the drain thread to make room.
+class BinaryTraceSink final : public TraceSink {
+public:
+    static constexpr usize default_capacity = 1 << 16;
+
+    // Writes the header right away. The file stays open and has to outlive the sink.
+    explicit BinaryTraceSink(std::FILE* file, usize capacity = default_capacity);
+    ~BinaryTraceSink() override;
+
+    BinaryTraceSink(const BinaryTraceSink&) = delete;
+    auto operator=(const BinaryTraceSink&) -> BinaryTraceSink& = delete;
+
+    auto record(const TraceEntry& entry) -> void override;
+    // Waits until everything recorded so far is in the file
+    auto flush() -> void override;
+
+    [[nodiscard]] auto recorded() const noexcept { return m_recorded; }
+    // Times record found the ring full and had to wait
+    [[nodiscard]] auto stalls() const noexcept { return m_stalls; }
+    // Writing to the file failed at some point, the trace is missing everything from there on. Only final
+    // after flush.
+    [[nodiscard]] auto failed() const noexcept { return m_failed.load(std::memory_order_relaxed); }
+
+private:
+    auto drain(std::stop_token stop_token) -> void;
+
+    TraceRing m_ring;
+    std::FILE* m_file;
+    u64 m_recorded { 0 };
+    u64 m_stalls { 0 };
+    // Entries the drain thread wrote to the file
+    std::atomic<u64> m_written { 0 };
+    std::atomic<bool> m_failed { false };
+    std::jthread m_thread;
+};
+
+// Reads a binary trace back one entry at a time
+class BinaryTraceReader {
+public:
+    // Prints why and returns nothing if the file can't be read or isn't a binary trace
+    [[nodiscard]] static auto open(const std::string& path) -> std::optional<BinaryTraceReader>;
+    [[nodiscard]] static auto from_bytes(std::vector<u8> bytes) -> std::optional<BinaryTraceReader>;
+
+    // Nothing once every entry has been read, or if the rest of the file is cut off, see truncated
+    auto next() -> std::optional<TraceEntry>;
+    [[nodiscard]] auto truncated() const noexcept { return m_truncated; }
+
+    // Writes every remaining entry as one disassembled line, followed by the registers, stack pointer and flags
+    // the instruction changed ("0xFF00 ldi r0, #5    r0=0x05"). Returns the number of entries.
+    auto print(std::FILE* file) -> u64;
+
+private:
+    explicit BinaryTraceReader(std::vector<u8> bytes);
+
+    std::vector<u8> m_bytes;
+    usize m_offset { sizeof(BinaryTraceFormat::Header) };
+    bool m_truncated { false };
+    TraceEntry m_state;
+    std::vector<ProcessorSpec::insr_t> m_instructions;
+};
@@ -0,0 +1,42 @@
+#include <bus.hpp>
+
+#include <chrono>
+
+ConsoleDevice::ConsoleDevice(std::FILE* file)
+    : m_file { file } {
+}
+
+auto ConsoleDevice::read(u16) -> ProcessorSpec::data_t {
+    return 0;
+}
+
+auto ConsoleDevice::write(u16, ProcessorSpec::data_t data) -> void {
+    std::fputc(data, m_file);
+    m_written++;
+}
+
+auto ConsoleDevice::flush() -> void {
+    std::fflush(m_file);
+}
+
+TimerDevice::TimerDevice(Clock clock)
+    : m_clock { std::move(clock) }
+    , m_start { m_clock() } {
+}
+
+auto TimerDevice::read(u16 offset) -> ProcessorSpec::data_t {
+    const auto byte = offset % sizeof(m_latched);
+    if (byte == 0)
+        m_latched = static_cast<u32>(m_clock() - m_start);
+    return static_cast<ProcessorSpec::data_t>(m_latched >> (8 * (sizeof(m_latched) - 1 - byte)));
+}
+
+auto TimerDevice::write(u16, ProcessorSpec::data_t) -> void {
+    m_start = m_clock();
+    m_latched = 0;
+}
+
+auto TimerDevice::steady_microseconds() -> u64 {
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<u64>(std::chrono::duration_cast<std::chrono::microseconds>(now).count());
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <cstdio>
+#include <functional>
+
+#include <memory.hpp>
+#include <spec.hpp>
+
+// Something that answers reads and writes to a range of pages in place of RAM (memory mapped I/O)
+class MemoryDevice {
+public:
+    virtual ~MemoryDevice() = default;
+
+    // offset is counted from the first address of the first page the device is attached at
+    virtual auto read(u16 offset) -> ProcessorSpec::data_t = 0;
+    virtual auto write(u16 offset, ProcessorSpec::data_t data) -> void = 0;
+};
+
+// Which pages of the address space belong to a device. Every other page is RAM, and finding that out
+// is one load from a table of 256 pointers, so memory accesses only take an indirect call on device pages.
+// Devices aren't owned and have to outlive their use by the bus.
+class MemoryBus {
+public:
+    static constexpr usize page_size = PagedMemory::page_size;
+    static constexpr usize page_count = PagedMemory::page_count;
+
+    // nullptr if address is RAM
+    [[nodiscard]] auto device(ProcessorSpec::addr_t address) const noexcept -> MemoryDevice* {
+        return m_devices[address / page_size];
+    }
+
+    // Only for addresses a device is attached at
+    [[nodiscard]] auto read(ProcessorSpec::addr_t address) const -> ProcessorSpec::data_t {
+        return device(address)->read(offset(address));
+    }
+
+    auto write(ProcessorSpec::addr_t address, ProcessorSpec::data_t data) const -> void {
+        device(address)->write(offset(address), data);
+    }
+
+    // Returns false without attaching anything if any of the pages is taken or past the end of memory
+    auto attach(usize first_page, usize pages, MemoryDevice& device) -> bool {
+        if (pages == 0 || first_page + pages > page_count)
+            return false;
+        for (auto page = first_page; page < first_page + pages; page++) {
+            if (m_devices[page] != nullptr)
+                return false;
+        }
+        for (auto page = first_page; page < first_page + pages; page++) {
+            m_devices[page] = &device;
+            m_first_pages[page] = static_cast<u8>(first_page);
+        }
+        m_attached_pages += pages;
+        return true;
+    }
+
+    // Every page the device is attached at is RAM again
+    auto detach(const MemoryDevice& device) -> void {
+        for (usize page = 0; page < page_count; page++) {
+            if (m_devices[page] == &device) {
+                m_devices[page] = nullptr;
+                m_attached_pages--;
+            }
+        }
+    }
+
+    [[nodiscard]] auto empty() const noexcept {
+        return m_attached_pages == 0;
+    }
+
+private:
+    [[nodiscard]] auto offset(ProcessorSpec::addr_t address) const noexcept -> u16 {
+        return static_cast<u16>(address - m_first_pages[address / page_size] * page_size);
+    }
+
+    std::array<MemoryDevice*, page_count> m_devices {};
+    std::array<u8, page_count> m_first_pages {};
+    usize m_attached_pages { 0 };
+};
+
+// Writes every byte stored to it to a file, reads are always 0. Output is buffered by the C stream.
+class ConsoleDevice final : public MemoryDevice {
+public:
+    explicit ConsoleDevice(std::FILE* file);
+
+    auto read(u16 offset) -> ProcessorSpec::data_t override;
+    auto write(u16 offset, ProcessorSpec::data_t data) -> void override;
+
+    auto flush() -> void;
+    [[nodiscard]] auto written() const noexcept { return m_written; }
+
+private:
+    std::FILE* m_file;
+    u64 m_written { 0 };
+};
+
+// Counts ticks of a clock (microseconds by default) since it was created or last written to. The count is
+// 32 bits wide and read a byte at a time, most significant first like instructions: reading offset 0 latches
+// the whole count, offsets 1 to 3 return the rest of the latched value. The layout repeats every 4 bytes.
+// Writing anything restarts the count at 0.
+class TimerDevice final : public MemoryDevice {
+public:
+    using Clock = std::function<u64()>;
+
+    explicit TimerDevice(Clock clock = steady_microseconds);
+
+    auto read(u16 offset) -> ProcessorSpec::data_t override;
+    auto write(u16 offset, ProcessorSpec::data_t data) -> void override;
+
+    static auto steady_microseconds() -> u64;
+
+private:
+    Clock m_clock;
+    u64 m_start;
+    u32 m_latched { 0 };
+};
@@ -1,73 +1,15 @@
 #include <disassembler.hpp>
 
-#include <array>
+#include <algorithm>
+#include <cstring>
 
-// Clang doesn't seem to like constexpr std::array
-#ifdef __clang__
-#define ARRAY_CONSTEXPR
-#else
-#define ARRAY_CONSTEXPR constexpr
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
 #endif
 
 static constexpr usize register_mask = 0xF;
 static constexpr usize imm_mask = 0xFF;
 
-static ARRAY_CONSTEXPR std::array instruction_to_string = {
-    "ldr",
-    "st",
-    "add",
-    "sub",
-    "mul",
-    "div",
-    "jp",
-    "jz",
-    "and",
-    "or",
-    "xor",
-    "push",
-    "pop",
-    "ldi",
-    "ldm",
-    "hlt",
-};
-
-enum class InstructionGroup {
-    NoReg,
-    SingleReg,
-    DoubleReg,
-    TripleReg,
-    RegImm,
-    Unknown
-};
-
-constexpr auto get_instruction_group(InstructionType type) -> InstructionGroup {
-    switch (type) {
-    case InstructionType::Halt:
-        return InstructionGroup::NoReg;
-    case InstructionType::Push:
-    case InstructionType::Pop:
-        return InstructionGroup::SingleReg;
-    case InstructionType::Jump:
-    case InstructionType::JumpIfZero:
-    case InstructionType::LoadFromReg:
-        return InstructionGroup::DoubleReg;
-    case InstructionType::Add:
-    case InstructionType::And:
-    case InstructionType::Div:
-    case InstructionType::LoadFromMem:
-    case InstructionType::Mul:
-    case InstructionType::Or:
-    case InstructionType::Store:
-    case InstructionType::Sub:
-    case InstructionType::Xor:
-        return InstructionGroup::TripleReg;
-    case InstructionType::LoadFromImm:
-        return InstructionGroup::RegImm;
-    default:
-        return InstructionGroup::Unknown;
-    }
-}
-
 bool validate_empty_registers(ProcessorSpec::insr_t instruction, i32 expected_registers) {
     static constexpr usize max_registers = 3;
 
@@ -86,73 +28,319 @@ bool validate_empty_registers(ProcessorSpec::insr_t instruction, i32 expected_re
     }
 }
 
-auto Disassembler::disassemble(std::span<const ProcessorSpec::insr_t> code) -> std::vector<std::string> {
-    std::vector<std::string> result;
+namespace {
+    // Appends to a buffer known to be big enough, no formatting library involved
+    class LineWriter {
+    public:
+        explicit LineWriter(char* output)
+            : m_output { output } {
+        }
+
+        auto text(std::string_view text) -> void {
+            std::memcpy(m_output + m_length, text.data(), text.size());
+            m_length += text.size();
+        }
+
+        auto reg(usize reg) -> void {
+            m_output[m_length++] = 'r';
+            m_output[m_length++] = static_cast<char>('0' + reg);
+        }
 
-    for (const auto instruction : code) {
-        const auto mnemonic_index = static_cast<u8>((instruction >> 12) & register_mask);
-        const auto& mnemonic = instruction_to_string[mnemonic_index];
+        auto number(usize value) -> void {
+            if (value >= 100)
+                m_output[m_length++] = static_cast<char>('0' + value / 100);
+            if (value >= 10)
+                m_output[m_length++] = static_cast<char>('0' + value / 10 % 10);
+            m_output[m_length++] = static_cast<char>('0' + value % 10);
+        }
+
+        [[nodiscard]] auto length() const noexcept { return m_length; }
+
+    private:
+        char* m_output;
+        usize m_length { 0 };
+    };
 
-        const auto instruction_type = static_cast<InstructionType>(mnemonic_index);
-        const auto group = get_instruction_group(instruction_type);
+    // Why an instruction doesn't disassemble, checking one field after the other
+    auto diagnose(ProcessorSpec::insr_t instruction) -> std::optional<DisassemblyDiagnostic::Kind> {
+        const auto operands = info(static_cast<InstructionType>((instruction >> 12) & register_mask)).operands;
+        const auto r1 = (instruction >> 8) & register_mask;
+        const auto r2 = (instruction >> 4) & register_mask;
+        const auto r3 = instruction & register_mask;
 
-        switch (group) {
-        case InstructionGroup::NoReg:
+        switch (operands) {
+        case OperandKind::None:
             if (!validate_empty_registers(instruction, 3))
-                fmt::println(stderr, "Instruction '{}' expected no registers, potentially corrupt!", mnemonic);
-            else
-                result.emplace_back(mnemonic);
+                return DisassemblyDiagnostic::UnusedFieldSet;
             break;
-
-        case InstructionGroup::SingleReg: {
-            const auto r1 = (instruction >> 8) & register_mask;
+        case OperandKind::SingleReg:
             if (r1 >= ProcessorSpec::register_count)
-                fmt::println(stderr, "Instruction '{}' addresses an invalid register", mnemonic);
-            else if (!validate_empty_registers(instruction, 2))
-                fmt::println(stderr, "Instruction '{}' expected 1 register, potentially corrupt!", mnemonic);
-            else
-                result.emplace_back(fmt::format("{} r{}", mnemonic, r1));
+                return DisassemblyDiagnostic::InvalidRegister;
+            if (!validate_empty_registers(instruction, 2))
+                return DisassemblyDiagnostic::UnusedFieldSet;
             break;
-        }
-
-        case InstructionGroup::DoubleReg: {
-            const auto r1 = (instruction >> 8) & register_mask;
-            const auto r2 = (instruction >> 4) & register_mask;
+        case OperandKind::DoubleReg:
             if (r1 >= ProcessorSpec::register_count || r2 >= ProcessorSpec::register_count)
-                fmt::println(stderr, "Instruction '{}' addresses an invalid register", mnemonic);
-            else if (!validate_empty_registers(instruction, 1))
-                fmt::println(stderr, "Instruction '{}' expected 2 registers, potentially corrupt!", mnemonic);
-            else
-                result.emplace_back(fmt::format("{} r{}, r{}", mnemonic, r1, r2));
+                return DisassemblyDiagnostic::InvalidRegister;
+            if (!validate_empty_registers(instruction, 1))
+                return DisassemblyDiagnostic::UnusedFieldSet;
             break;
-        }
-
-        case InstructionGroup::TripleReg: {
-            const auto r1 = (instruction >> 8) & register_mask;
-            const auto r2 = (instruction >> 4) & register_mask;
-            const auto r3 = instruction & register_mask;
+        case OperandKind::TripleReg:
             if (r1 >= ProcessorSpec::register_count || r2 >= ProcessorSpec::register_count || r3 >= ProcessorSpec::register_count)
-                fmt::println(stderr, "Instruction '{}' addresses an invalid register", mnemonic);
-            else
-                result.emplace_back(fmt::format("{} r{}, r{}, r{}", mnemonic, r1, r2, r3));
+                return DisassemblyDiagnostic::InvalidRegister;
+            break;
+        case OperandKind::RegImm:
+            if (r1 >= ProcessorSpec::register_count)
+                return DisassemblyDiagnostic::InvalidRegister;
             break;
         }
+        return std::nullopt;
+    }
 
-        case InstructionGroup::RegImm: {
-            const auto r1 = (instruction >> 8) & register_mask;
-            const auto imm = instruction & imm_mask;
-            if (r1 >= ProcessorSpec::register_count)
-                fmt::println(stderr, "Instruction '{}' addresses an invalid register", mnemonic);
-            else
-                result.emplace_back(fmt::format("{} r{}, #{}", mnemonic, r1, imm));
+    // Writes an instruction known to be valid, at most Disassembler::max_line_length characters
+    auto write_line(ProcessorSpec::insr_t instruction, OperandKind operands, char* output) -> usize {
+        const auto mnemonic = info(static_cast<InstructionType>((instruction >> 12) & register_mask)).mnemonic;
+        auto writer = LineWriter { output };
+        writer.text(mnemonic);
+        switch (operands) {
+        case OperandKind::None:
+            break;
+        case OperandKind::SingleReg:
+            writer.text(" ");
+            writer.reg((instruction >> 8) & register_mask);
+            break;
+        case OperandKind::DoubleReg:
+            writer.text(" ");
+            writer.reg((instruction >> 8) & register_mask);
+            writer.text(", ");
+            writer.reg((instruction >> 4) & register_mask);
+            break;
+        case OperandKind::TripleReg:
+            writer.text(" ");
+            writer.reg((instruction >> 8) & register_mask);
+            writer.text(", ");
+            writer.reg((instruction >> 4) & register_mask);
+            writer.text(", ");
+            writer.reg(instruction & register_mask);
+            break;
+        case OperandKind::RegImm:
+            writer.text(" ");
+            writer.reg((instruction >> 8) & register_mask);
+            writer.text(", #");
+            writer.number(instruction & imm_mask);
             break;
         }
+        return writer.length();
+    }
 
+    // Every register field has its top bit cleared when valid, every unused field is all zeroes. That
+    // makes validity a single AND per instruction with a mask depending on its operand kind.
+    constexpr auto zero_mask(OperandKind operands) -> u16 {
+        switch (operands) {
+        case OperandKind::None:
+            return 0x0FFF;
+        case OperandKind::SingleReg:
+            return 0x08FF;
+        case OperandKind::DoubleReg:
+            return 0x088F;
+        case OperandKind::TripleReg:
+            return 0x0888;
         default:
-            fmt::println(stderr, "Encountered unknown instruction '{:b}'", instruction);
-            break;
+            return 0x0800;
+        }
+    }
+
+    static_assert(ProcessorSpec::register_count == 8, "zero_mask expects register fields to be valid below 8");
+
+    // Indexed by opcode, what pshufb looks up
+    template <typename T, typename Function>
+    constexpr auto opcode_table(Function function) {
+        auto table = std::array<T, instruction_info.size()> {};
+        for (usize type = 0; type < table.size(); type++)
+            table[type] = function(instruction_info[type].operands);
+        return table;
+    }
+
+    constexpr auto group_table = opcode_table<u8>([](OperandKind operands) { return std::to_underlying(operands); });
+    constexpr auto zero_mask_low = opcode_table<u8>([](OperandKind operands) { return static_cast<u8>(zero_mask(operands) & 0xFF); });
+    constexpr auto zero_mask_high = opcode_table<u8>([](OperandKind operands) { return static_cast<u8>(zero_mask(operands) >> 8); });
+
+    auto set_bit(std::span<u64> bits, usize index, bool value) -> void {
+        bits[index / 64] |= static_cast<u64>(value) << (index % 64);
+    }
+
+    // Also the tail of the SIMD kernels, from index first on
+    auto classify_scalar(std::span<const ProcessorSpec::insr_t> code, OperandKind* groups, std::span<u64> valid, usize first) -> void {
+        for (auto i = first; i < code.size(); i++) {
+            groups[i] = info(static_cast<InstructionType>(code[i] >> 12)).operands;
+            set_bit(valid, i, !diagnose(code[i]));
+        }
+    }
+
+#if defined(__GNUC__) && defined(__x86_64__)
+    // 16 instructions at a time. Opcodes are packed into bytes for looking up the group and both halves
+    // of the zero mask, the halves are interleaved back into one u16 per instruction.
+    [[gnu::target("ssse3")]]
+    auto classify_ssse3(std::span<const ProcessorSpec::insr_t> code, OperandKind* groups, std::span<u64> valid) -> void {
+        const auto groups_lookup = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group_table.data()));
+        const auto low_lookup = _mm_loadu_si128(reinterpret_cast<const __m128i*>(zero_mask_low.data()));
+        const auto high_lookup = _mm_loadu_si128(reinterpret_cast<const __m128i*>(zero_mask_high.data()));
+        const auto zero = _mm_setzero_si128();
+
+        usize i = 0;
+        for (; i + 16 <= code.size(); i += 16) {
+            const auto first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(code.data() + i));
+            const auto second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(code.data() + i + 8));
+            const auto opcodes = _mm_packus_epi16(_mm_srli_epi16(first, 12), _mm_srli_epi16(second, 12));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(groups + i), _mm_shuffle_epi8(groups_lookup, opcodes));
+
+            const auto low = _mm_shuffle_epi8(low_lookup, opcodes);
+            const auto high = _mm_shuffle_epi8(high_lookup, opcodes);
+            const auto first_ok = _mm_cmpeq_epi16(_mm_and_si128(first, _mm_unpacklo_epi8(low, high)), zero);
+            const auto second_ok = _mm_cmpeq_epi16(_mm_and_si128(second, _mm_unpackhi_epi8(low, high)), zero);
+            const auto bits = static_cast<u16>(_mm_movemask_epi8(_mm_packs_epi16(first_ok, second_ok)));
+            std::memcpy(reinterpret_cast<u8*>(valid.data()) + i / 8, &bits, sizeof(bits));
+        }
+        classify_scalar(code, groups, valid, i);
+    }
+
+    // Same for 32 instructions. Packing works within 128-bit lanes, so the packed opcodes come out as
+    // 0-7, 16-23, 8-15, 24-31 and get put back in order before looking anything up.
+    [[gnu::target("avx2")]]
+    auto classify_avx2(std::span<const ProcessorSpec::insr_t> code, OperandKind* groups, std::span<u64> valid) -> void {
+        const auto groups_lookup = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group_table.data())));
+        const auto low_lookup = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(zero_mask_low.data())));
+        const auto high_lookup = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(zero_mask_high.data())));
+        const auto zero = _mm256_setzero_si256();
+
+        usize i = 0;
+        for (; i + 32 <= code.size(); i += 32) {
+            const auto first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(code.data() + i));
+            const auto second = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(code.data() + i + 16));
+            const auto packed = _mm256_packus_epi16(_mm256_srli_epi16(first, 12), _mm256_srli_epi16(second, 12));
+            const auto opcodes = _mm256_permute4x64_epi64(packed, 0b11'01'10'00);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(groups + i), _mm256_shuffle_epi8(groups_lookup, opcodes));
+
+            // Unpacking is in-lane too, which undoes the shuffle of packed: first and second line up again
+            const auto low = _mm256_shuffle_epi8(low_lookup, packed);
+            const auto high = _mm256_shuffle_epi8(high_lookup, packed);
+            const auto first_ok = _mm256_cmpeq_epi16(_mm256_and_si256(first, _mm256_unpacklo_epi8(low, high)), zero);
+            const auto second_ok = _mm256_cmpeq_epi16(_mm256_and_si256(second, _mm256_unpackhi_epi8(low, high)), zero);
+            const auto ok = _mm256_permute4x64_epi64(_mm256_packs_epi16(first_ok, second_ok), 0b11'01'10'00);
+            const auto bits = static_cast<u32>(_mm256_movemask_epi8(ok));
+            std::memcpy(reinterpret_cast<u8*>(valid.data()) + i / 8, &bits, sizeof(bits));
+        }
+        classify_scalar(code, groups, valid, i);
+    }
+#endif
+
+    // Instructions classified at once by format_lines, small enough for the stack
+    constexpr usize classify_block = 4096;
+
+    // Writes a '\n' terminated line per instruction to output, which has room for all of them. Returns
+    // the number of characters written, and the offset every line starts at if offsets isn't empty.
+    auto format_lines(std::span<const ProcessorSpec::insr_t> code, char* output, std::span<usize> offsets, std::vector<DisassemblyDiagnostic>& diagnostics) -> usize {
+        const auto kernel = Disassembler::best_kernel();
+        auto groups = std::array<OperandKind, classify_block> {};
+        auto valid = std::array<u64, classify_block / 64> {};
+
+        usize used = 0;
+        for (usize block = 0; block < code.size(); block += classify_block) {
+            const auto instructions = code.subspan(block, std::min(classify_block, code.size() - block));
+            Disassembler::classify(instructions, groups, valid, kernel);
+
+            for (usize i = 0; i < instructions.size(); i++) {
+                if (!offsets.empty())
+                    offsets[block + i] = used;
+                if (valid[i / 64] & (u64 { 1 } << (i % 64)))
+                    used += write_line(instructions[i], groups[i], output + used);
+                else
+                    diagnostics.push_back(DisassemblyDiagnostic { .index = block + i, .instruction = instructions[i], .kind = *diagnose(instructions[i]) });
+                output[used++] = '\n';
+            }
         }
+        return used;
     }
+}
 
+auto Disassembler::best_kernel() -> Kernel {
+#if defined(__GNUC__) && defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2"))
+        return Kernel::Avx2;
+    if (__builtin_cpu_supports("ssse3"))
+        return Kernel::Ssse3;
+#endif
+    return Kernel::Scalar;
+}
+
+auto Disassembler::classify(std::span<const ProcessorSpec::insr_t> code, std::span<OperandKind> groups, std::span<u64> valid, Kernel kernel) -> void {
+    std::ranges::fill(valid.first((code.size() + 63) / 64), 0);
+    switch (kernel) {
+#if defined(__GNUC__) && defined(__x86_64__)
+    case Kernel::Avx2:
+        classify_avx2(code, groups.data(), valid);
+        return;
+    case Kernel::Ssse3:
+        classify_ssse3(code, groups.data(), valid);
+        return;
+#endif
+    default:
+        classify_scalar(code, groups.data(), valid, 0);
+        return;
+    }
+}
+
+auto Disassembler::disassemble(std::span<const ProcessorSpec::insr_t> code) -> std::vector<std::string> {
+    auto batch = Disassembly {};
+    disassemble(code, batch);
+
+    auto result = std::vector<std::string> {};
+    result.reserve(code.size() - batch.diagnostics().size());
+    auto diagnostic = batch.diagnostics().begin();
+    for (usize i = 0; i < batch.size(); i++) {
+        if (diagnostic != batch.diagnostics().end() && diagnostic->index == i) {
+            fmt::println(stderr, "{}", describe(*diagnostic++));
+            continue;
+        }
+        result.emplace_back(batch.line(i));
+    }
     return result;
 }
+
+auto Disassembler::disassemble(std::span<const ProcessorSpec::insr_t> code, Disassembly& output) -> void {
+    output.clear();
+    output.m_offsets.resize(code.size() + 1);
+    output.m_text.resize_and_overwrite(code.size() * (max_line_length + 1), [&](char* text, usize) {
+        const auto used = format_lines(code, text, std::span { output.m_offsets }.first(code.size()), output.m_diagnostics);
+        output.m_offsets.back() = used;
+        return used;
+    });
+}
+
+auto Disassembler::disassemble(std::span<const ProcessorSpec::insr_t> code, fmt::memory_buffer& output, std::vector<DisassemblyDiagnostic>& diagnostics) -> void {
+    const auto start = output.size();
+    output.resize(start + code.size() * (max_line_length + 1));
+    const auto used = format_lines(code, output.data() + start, {}, diagnostics);
+    output.resize(start + used);
+}
+
+auto Disassembler::disassemble_line(ProcessorSpec::insr_t instruction, std::span<char, max_line_length> output) -> std::optional<usize> {
+    if (diagnose(instruction))
+        return std::nullopt;
+    return write_line(instruction, info(static_cast<InstructionType>(instruction >> 12)).operands, output.data());
+}
+
+auto Disassembler::describe(const DisassemblyDiagnostic& diagnostic) -> std::string {
+    const auto& [mnemonic, operands] = info(static_cast<InstructionType>((diagnostic.instruction >> 12) & register_mask));
+    if (diagnostic.kind == DisassemblyDiagnostic::InvalidRegister)
+        return fmt::format("Instruction '{}' addresses an invalid register", mnemonic);
+
+    switch (operands) {
+    case OperandKind::None:
+        return fmt::format("Instruction '{}' expected no registers, potentially corrupt!", mnemonic);
+    case OperandKind::SingleReg:
+        return fmt::format("Instruction '{}' expected 1 register, potentially corrupt!", mnemonic);
+    default:
+        return fmt::format("Instruction '{}' expected 2 registers, potentially corrupt!", mnemonic);
+    }
+}
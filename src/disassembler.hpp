@@ -1,12 +1,88 @@
 #pragma once
 
+#include <fmt/format.h>
+#include <optional>
 #include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <instructions.hpp>
 
+// Why an instruction didn't disassemble
+struct DisassemblyDiagnostic {
+    enum Kind : u8 {
+        // One of the register fields names a register that doesn't exist
+        InvalidRegister,
+        // A field the instruction doesn't use isn't zero
+        UnusedFieldSet,
+    };
+
+    // Position of the instruction in the disassembled span
+    usize index;
+    ProcessorSpec::insr_t instruction;
+    Kind kind;
+};
+
+// Every line of a batch in one char arena, with an offsets table into it. Reusing one for the next
+// batch keeps its storage, so disassembling doesn't allocate once it's big enough.
+class Disassembly {
+public:
+    // One line per disassembled instruction, empty for the ones with a diagnostic
+    [[nodiscard]] auto size() const noexcept { return m_offsets.empty() ? 0 : m_offsets.size() - 1; }
+    [[nodiscard]] auto line(usize index) const noexcept -> std::string_view {
+        return std::string_view { m_text }.substr(m_offsets[index], m_offsets[index + 1] - m_offsets[index] - 1);
+    }
+    // All lines, each ending with a '\n'
+    [[nodiscard]] auto text() const noexcept -> std::string_view { return m_text; }
+    [[nodiscard]] auto diagnostics() const noexcept -> std::span<const DisassemblyDiagnostic> { return m_diagnostics; }
+
+    auto clear() noexcept -> void {
+        m_text.clear();
+        m_offsets.clear();
+        m_diagnostics.clear();
+    }
+
+private:
+    friend class Disassembler;
+
+    std::string m_text;
+    std::vector<usize> m_offsets;
+    std::vector<DisassemblyDiagnostic> m_diagnostics;
+};
+
 class Disassembler final {
 public:
+    enum class Kernel : u8 {
+        Scalar,
+        Ssse3,
+        Avx2,
+    };
+
+    // "ldm r0, r6, r7" and "ldi r0, #255" are as long as it gets
+    static constexpr usize max_line_length = 16;
+
+    // Best kernel the CPU running this supports
+    [[nodiscard]] static auto best_kernel() -> Kernel;
+
+    // Looks at every instruction at once: groups gets its operand kind, and its bit in valid (least
+    // significant first) is set if it disassembles. groups needs room for code.size() entries, valid for
+    // code.size() bits. The SIMD kernels look up which fields have to be zero with byte shuffles, the
+    // scalar one checks each field like disassemble() always did and is what they're tested against.
+    static auto classify(std::span<const ProcessorSpec::insr_t> code, std::span<OperandKind> groups, std::span<u64> valid, Kernel kernel = best_kernel()) -> void;
+
+    // One string per valid instruction. Invalid ones are left out, and why is printed to stderr.
     [[nodiscard]] static auto disassemble(std::span<const ProcessorSpec::insr_t> code) -> std::vector<std::string>;
-};
\ No newline at end of file
+
+    // Replaces what output held with code, one line per instruction
+    static auto disassemble(std::span<const ProcessorSpec::insr_t> code, Disassembly& output) -> void;
+
+    // Appends one '\n' terminated line per instruction to output, empty ones for those that got a diagnostic
+    static auto disassemble(std::span<const ProcessorSpec::insr_t> code, fmt::memory_buffer& output, std::vector<DisassemblyDiagnostic>& diagnostics) -> void;
+
+    // Writes a single instruction without a newline and returns its length, nothing if it's invalid
+    [[nodiscard]] static auto disassemble_line(ProcessorSpec::insr_t instruction, std::span<char, max_line_length> output) -> std::optional<usize>;
+
+    // "Instruction 'hlt' expected no registers, potentially corrupt!"
+    [[nodiscard]] static auto describe(const DisassemblyDiagnostic& diagnostic) -> std::string;
+};
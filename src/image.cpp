@@ -0,0 +1,198 @@
+#include <image.hpp>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fmt/core.h>
+#include <limits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    template <typename T>
+    auto append(std::vector<u8>& bytes, const T& value) -> void {
+        const auto* data = reinterpret_cast<const u8*>(&value);
+        bytes.insert(bytes.end(), data, data + sizeof(T));
+    }
+
+    template <typename T>
+    auto read(std::span<const u8> bytes, usize offset) -> T {
+        auto value = T {};
+        std::memcpy(&value, bytes.data() + offset, sizeof(T));
+        return value;
+    }
+}
+
+auto ProgramImage::save(const std::string& path) const -> bool {
+    // The format stores name lengths in 16 bits
+    for (const auto& symbol : symbols) {
+        if (symbol.name.size() > std::numeric_limits<u16>::max()) {
+            fmt::println(stderr, "can't save {}: symbol name of {} bytes is too long", path, symbol.name.size());
+            return false;
+        }
+    }
+
+    auto bytes = std::vector<u8> {};
+    append(bytes, ImageFormat::Header {
+                      .magic = { 'P', 'I', 'M', 'G' },
+                      .version = ImageFormat::version,
+                      .entry = entry,
+                      .segment_count = static_cast<u32>(sections.size()),
+                      .symbol_count = static_cast<u32>(symbols.size()),
+                  });
+
+    // Tables first, their offsets are patched in once the data behind them is placed
+    const auto segments_at = bytes.size();
+    bytes.resize(bytes.size() + sections.size() * sizeof(ImageFormat::Segment));
+    const auto symbols_at = bytes.size();
+    bytes.resize(bytes.size() + symbols.size() * sizeof(ImageFormat::Symbol));
+
+    for (usize i = 0; i < symbols.size(); i++) {
+        const auto record = ImageFormat::Symbol {
+            .address = symbols[i].address,
+            .name_size = static_cast<u16>(symbols[i].name.size()),
+            .name_offset = static_cast<u32>(bytes.size()),
+        };
+        std::memcpy(bytes.data() + symbols_at + i * sizeof(record), &record, sizeof(record));
+        bytes.insert(bytes.end(), symbols[i].name.begin(), symbols[i].name.end());
+    }
+
+    for (usize i = 0; i < sections.size(); i++) {
+        const auto& section = sections[i];
+        // Same distance into a page as in memory
+        const auto misalignment = (usize { section.origin } + PagedMemory::page_size - bytes.size() % PagedMemory::page_size) % PagedMemory::page_size;
+        bytes.resize(bytes.size() + misalignment);
+
+        const auto record = ImageFormat::Segment { .origin = section.origin, .flags = 0, .size = section.size, .offset = bytes.size() };
+        std::memcpy(bytes.data() + segments_at + i * sizeof(record), &record, sizeof(record));
+        bytes.insert(bytes.end(), memory.begin() + section.origin, memory.begin() + section.origin + section.size);
+    }
+
+    auto* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        fmt::println(stderr, "can't open {} for writing: {}", path, std::strerror(errno));
+        return false;
+    }
+    const auto written = std::fwrite(bytes.data(), 1, bytes.size(), file);
+    const auto closed = std::fclose(file) == 0;
+    if (written != bytes.size() || !closed) {
+        fmt::println(stderr, "can't write {}: {}", path, std::strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Unmaps the file once the last image or memory page using it is gone
+class MappedImage::Mapping {
+public:
+    Mapping(void* data, usize size)
+        : m_data { data }
+        , m_size { size } {
+    }
+
+    ~Mapping() {
+        ::munmap(m_data, m_size);
+    }
+
+    Mapping(const Mapping&) = delete;
+    auto operator=(const Mapping&) -> Mapping& = delete;
+
+    [[nodiscard]] auto bytes() const noexcept {
+        return std::span { static_cast<const u8*>(m_data), m_size };
+    }
+
+private:
+    void* m_data;
+    usize m_size;
+};
+
+MappedImage::MappedImage(std::shared_ptr<const void> mapping, std::span<const u8> bytes)
+    : m_mapping { std::move(mapping) }
+    , m_bytes { bytes } {
+}
+
+auto MappedImage::open(const std::string& path) -> std::optional<MappedImage> {
+    const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fmt::println(stderr, "can't open {}: {}", path, std::strerror(errno));
+        return std::nullopt;
+    }
+
+    struct stat status {};
+    if (::fstat(fd, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(ImageFormat::Header))) {
+        fmt::println(stderr, "{} is too small to be an image", path);
+        ::close(fd);
+        return std::nullopt;
+    }
+    const auto size = static_cast<usize>(status.st_size);
+    auto* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive on its own
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        fmt::println(stderr, "can't map {}: {}", path, std::strerror(errno));
+        return std::nullopt;
+    }
+
+    const auto mapping = std::make_shared<const Mapping>(data, size);
+    auto image = MappedImage { mapping, mapping->bytes() };
+    if (!image.parse()) {
+        fmt::println(stderr, "{} isn't a valid image", path);
+        return std::nullopt;
+    }
+    return image;
+}
+
+auto MappedImage::from_bytes(std::span<const u8> bytes, std::shared_ptr<const void> owner) -> std::optional<MappedImage> {
+    auto image = MappedImage { std::move(owner), bytes };
+    if (!image.parse())
+        return std::nullopt;
+    return image;
+}
+
+auto MappedImage::parse() -> bool {
+    if (m_bytes.size() < sizeof(ImageFormat::Header))
+        return false;
+    const auto header = read<ImageFormat::Header>(m_bytes, 0);
+    if (std::string_view { header.magic, sizeof(header.magic) } != ImageFormat::magic || header.version != ImageFormat::version)
+        return false;
+
+    const auto symbols_at = sizeof(header) + usize { header.segment_count } * sizeof(ImageFormat::Segment);
+    if (symbols_at + usize { header.symbol_count } * sizeof(ImageFormat::Symbol) > m_bytes.size())
+        return false;
+    m_entry = header.entry;
+
+    m_segments.reserve(header.segment_count);
+    for (usize i = 0; i < header.segment_count; i++) {
+        const auto record = read<ImageFormat::Segment>(m_bytes, sizeof(header) + i * sizeof(ImageFormat::Segment));
+        if (record.origin + usize { record.size } > ProcessorSpec::highest_addr + 1u || record.offset > m_bytes.size() || record.size > m_bytes.size() - record.offset)
+            return false;
+        // map_into relies on this
+        if ((record.offset - record.origin) % PagedMemory::page_size != 0)
+            return false;
+        m_segments.push_back(Segment { .origin = record.origin, .data = m_bytes.subspan(record.offset, record.size) });
+    }
+
+    m_symbols.reserve(header.symbol_count);
+    for (usize i = 0; i < header.symbol_count; i++) {
+        const auto record = read<ImageFormat::Symbol>(m_bytes, symbols_at + i * sizeof(ImageFormat::Symbol));
+        if (record.name_offset + usize { record.name_size } > m_bytes.size())
+            return false;
+        const auto name = std::string_view { reinterpret_cast<const char*>(m_bytes.data()) + record.name_offset, record.name_size };
+        m_symbols.push_back(Symbol { .name = name, .address = record.address });
+    }
+    return true;
+}
+
+auto MappedImage::to_program_image() const -> ProgramImage {
+    auto image = ProgramImage {};
+    image.entry = m_entry;
+    for (const auto& segment : m_segments) {
+        std::ranges::copy(segment.data, image.memory.begin() + segment.origin);
+        image.sections.push_back(ProgramImage::Section { .origin = segment.origin, .size = static_cast<u32>(segment.data.size()) });
+    }
+    for (const auto& symbol : m_symbols)
+        image.symbols.push_back(ProgramImage::Symbol { .name = std::string { symbol.name }, .address = symbol.address });
+    return image;
+}
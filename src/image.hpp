@@ -0,0 +1,163 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <memory.hpp>
+#include <spec.hpp>
+
+// An assembled program laid out in the address space, see Assembler::assemble_image
+struct ProgramImage {
+    struct Section {
+        ProcessorSpec::addr_t origin;
+        // In bytes
+        u32 size;
+    };
+
+    struct Symbol {
+        std::string name;
+        ProcessorSpec::addr_t address;
+    };
+
+    // The whole address space, bytes outside of every section are zero
+    std::vector<u8> memory = std::vector<u8>(ProcessorSpec::highest_addr + 1u);
+    // In source order, they never overlap
+    std::vector<Section> sections;
+    // Where execution starts
+    ProcessorSpec::addr_t entry { ProcessorSpec::reset_pc };
+    // Every label, in source order
+    std::vector<Symbol> symbols;
+
+    // Writes every section into anything with write_memory(address, data), like a Processor
+    template <typename Target>
+    auto load_into(Target& target) const -> void {
+        for (const auto& section : sections) {
+            for (u32 offset = 0; offset < section.size; offset++) {
+                const auto address = static_cast<ProcessorSpec::addr_t>(section.origin + offset);
+                target.write_memory(address, memory[address]);
+            }
+        }
+    }
+
+    // Writes the image in the binary format below, returns false after printing why if that didn't work,
+    // which includes symbol names longer than 65535 bytes
+    auto save(const std::string& path) const -> bool;
+};
+
+// Binary program images, little endian throughout:
+//
+//   Header       magic "PIMG", version, entry PC, number of segments and symbols
+//   Segment[]    origin, size and file offset of the bytes of each section
+//   Symbol[]     address, and length and file offset of the name of each symbol
+//   names        not terminated
+//   data         the bytes of every segment, starting at an offset that's as far into a 256 byte page as
+//                its origin, so whole memory pages can be used straight out of a mapping of the file
+namespace ImageFormat {
+    static constexpr auto magic = std::string_view { "PIMG" };
+    static constexpr u16 version = 1;
+
+    struct Header {
+        char magic[4];
+        u16 version;
+        ProcessorSpec::addr_t entry;
+        u32 segment_count;
+        u32 symbol_count;
+    };
+
+    struct Segment {
+        ProcessorSpec::addr_t origin;
+        // Always 0 for now
+        u16 flags;
+        u32 size;
+        u64 offset;
+    };
+
+    struct Symbol {
+        ProcessorSpec::addr_t address;
+        u16 name_size;
+        u32 name_offset;
+    };
+
+    static_assert(sizeof(Header) == 16 && sizeof(Segment) == 16 && sizeof(Symbol) == 8);
+}
+
+// A binary image mapped into memory read-only. Nothing is parsed beyond the tables, and the segments are
+// used right where they are in the mapping, which stays alive for as long as any copy of this or any
+// memory page mapped from it.
+class MappedImage {
+public:
+    struct Segment {
+        ProcessorSpec::addr_t origin;
+        std::span<const u8> data;
+    };
+
+    struct Symbol {
+        std::string_view name;
+        ProcessorSpec::addr_t address;
+    };
+
+    // Prints why and returns nothing if the file can't be mapped or isn't a valid image
+    [[nodiscard]] static auto open(const std::string& path) -> std::optional<MappedImage>;
+    // Same for an image already in memory. owner is kept alive by the MappedImage and every page map_into
+    // hands out, like the mapping of a file. Without one, the bytes have to outlive the MappedImage and every
+    // processor it was mapped into, including their forks and snapshots.
+    [[nodiscard]] static auto from_bytes(std::span<const u8> bytes, std::shared_ptr<const void> owner = nullptr) -> std::optional<MappedImage>;
+
+    [[nodiscard]] auto entry() const noexcept { return m_entry; }
+    [[nodiscard]] auto segments() const noexcept -> std::span<const Segment> { return m_segments; }
+    [[nodiscard]] auto symbols() const noexcept -> std::span<const Symbol> { return m_symbols; }
+
+    // Copies every segment into target (a page at a time, through write_memory(address, span)) and
+    // points its program counter at the entry
+    template <typename Target>
+    auto load_into(Target& target) const -> void {
+        for (const auto& segment : m_segments)
+            target.write_memory(segment.origin, segment.data);
+        target.set_program_counter(m_entry);
+    }
+
+    // Like load_into, except whole pages of a segment aren't copied: target reads them straight from the
+    // mapping until it writes to one, see Processor::map_memory_page. Only the pages a segment doesn't
+    // fill completely are copied.
+    template <typename Target>
+    auto map_into(Target& target) const -> void {
+        static constexpr auto page_size = PagedMemory::page_size;
+        for (const auto& segment : m_segments) {
+            const auto start = static_cast<usize>(segment.origin);
+            const auto end = start + segment.data.size();
+            const auto first_page = (start + page_size - 1) / page_size;
+            const auto last_page = end / page_size;
+            if (first_page >= last_page) {
+                target.write_memory(segment.origin, segment.data);
+                continue;
+            }
+
+            target.write_memory(segment.origin, segment.data.first(first_page * page_size - start));
+            for (auto page = first_page; page < last_page; page++) {
+                const auto* data = reinterpret_cast<const PagedMemory::Page*>(segment.data.data() + page * page_size - start);
+                target.map_memory_page(page, std::shared_ptr<const PagedMemory::Page> { m_mapping, data });
+            }
+            if (end > last_page * page_size)
+                target.write_memory(static_cast<ProcessorSpec::addr_t>(last_page * page_size), segment.data.subspan(last_page * page_size - start));
+        }
+        target.set_program_counter(m_entry);
+    }
+
+    [[nodiscard]] auto to_program_image() const -> ProgramImage;
+
+private:
+    class Mapping;
+
+    MappedImage(std::shared_ptr<const void> mapping, std::span<const u8> bytes);
+    auto parse() -> bool;
+
+    std::shared_ptr<const void> m_mapping;
+    std::span<const u8> m_bytes;
+    ProcessorSpec::addr_t m_entry { ProcessorSpec::reset_pc };
+    std::vector<Segment> m_segments;
+    std::vector<Symbol> m_symbols;
+};
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <string_view>
 #include <utility>
 
 #include <spec.hpp>
@@ -51,3 +55,122 @@ static constexpr auto encode_instruction(InstructionType type, Register r1, Regi
 static constexpr auto encode_instruction(InstructionType type, Register r1, Immediate imm) -> ProcessorSpec::insr_t {
     return static_cast<ProcessorSpec::insr_t>(std::to_underlying(type) << 12 | r1 << 8 | imm);
 }
+
+enum class OperandKind : u8 {
+    None,
+    SingleReg,
+    DoubleReg,
+    TripleReg,
+    RegImm,
+};
+
+struct InstructionInfo {
+    std::string_view mnemonic;
+    OperandKind operands;
+};
+
+// The one description of the instruction set both the assembler and the disassembler work from,
+// indexed by InstructionType
+// clang-format off
+static constexpr auto instruction_info = std::array<InstructionInfo, 16> {{
+    { "ldr",  OperandKind::DoubleReg },
+    { "st",   OperandKind::TripleReg },
+    { "add",  OperandKind::TripleReg },
+    { "sub",  OperandKind::TripleReg },
+    { "mul",  OperandKind::TripleReg },
+    { "div",  OperandKind::TripleReg },
+    { "jp",   OperandKind::DoubleReg },
+    { "jz",   OperandKind::DoubleReg },
+    { "and",  OperandKind::TripleReg },
+    { "or",   OperandKind::TripleReg },
+    { "xor",  OperandKind::TripleReg },
+    { "push", OperandKind::SingleReg },
+    { "pop",  OperandKind::SingleReg },
+    { "ldi",  OperandKind::RegImm },
+    { "ldm",  OperandKind::TripleReg },
+    { "hlt",  OperandKind::None },
+}};
+// clang-format on
+
+static constexpr auto info(InstructionType type) -> const InstructionInfo& {
+    return instruction_info[std::to_underlying(type)];
+}
+
+// Number of register fields an instruction reads, starting with r1. Fields past that count are unused.
+static constexpr auto register_operand_count(InstructionType type) -> u8 {
+    switch (info(type).operands) {
+    case OperandKind::None:
+        return 0;
+    case OperandKind::SingleReg:
+    case OperandKind::RegImm:
+        return 1;
+    case OperandKind::DoubleReg:
+        return 2;
+    default:
+        return 3;
+    }
+}
+
+// Mnemonics are looked up through a perfect hash of their characters packed into a u32, with the
+// multiplier searched for at compile time. A lookup is one multiplication and one comparison.
+namespace MnemonicHash {
+    static constexpr usize max_length = sizeof(u32);
+    static constexpr u32 table_bits = 5;
+
+    static constexpr auto pack(std::string_view mnemonic) -> u32 {
+        u32 packed = 0;
+        for (usize i = 0; i < mnemonic.size(); i++)
+            packed |= static_cast<u32>(static_cast<u8>(mnemonic[i])) << (i * 8);
+        return packed;
+    }
+
+    static constexpr auto slot(u32 packed, u32 multiplier) -> u32 {
+        return (packed * multiplier) >> (32 - table_bits);
+    }
+
+    static constexpr auto find_multiplier() -> u32 {
+        for (u32 multiplier = 0x9E3779B1;; multiplier += 2) {
+            auto used = std::array<bool, 1 << table_bits> {};
+            auto collision = false;
+            for (const auto& instruction : instruction_info) {
+                auto& taken = used[slot(pack(instruction.mnemonic), multiplier)];
+                collision |= taken;
+                taken = true;
+            }
+            if (!collision)
+                return multiplier;
+        }
+    }
+
+    static constexpr auto multiplier = find_multiplier();
+
+    struct Entry {
+        // 0 for empty slots, no mnemonic packs to that
+        u32 packed { 0 };
+        InstructionType type { InstructionType::Halt };
+    };
+
+    static constexpr auto table = [] {
+        auto entries = std::array<Entry, 1 << table_bits> {};
+        for (u8 type = 0; type < instruction_info.size(); type++) {
+            const auto packed = pack(instruction_info[type].mnemonic);
+            entries[slot(packed, multiplier)] = Entry { .packed = packed, .type = static_cast<InstructionType>(type) };
+        }
+        return entries;
+    }();
+}
+
+static constexpr auto find_mnemonic(std::string_view mnemonic) -> std::optional<InstructionType> {
+    if (mnemonic.empty() || mnemonic.size() > MnemonicHash::max_length)
+        return std::nullopt;
+    const auto packed = MnemonicHash::pack(mnemonic);
+    const auto& entry = MnemonicHash::table[MnemonicHash::slot(packed, MnemonicHash::multiplier)];
+    if (entry.packed != packed)
+        return std::nullopt;
+    return entry.type;
+}
+
+static_assert(std::ranges::all_of(instruction_info, [](const auto& instruction) {
+    return instruction.mnemonic.size() <= MnemonicHash::max_length && find_mnemonic(instruction.mnemonic) && info(*find_mnemonic(instruction.mnemonic)).mnemonic == instruction.mnemonic;
+}));
+static_assert(!find_mnemonic("mov") && !find_mnemonic("ad") && !find_mnemonic("addd") && !find_mnemonic("pushr"));
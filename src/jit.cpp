@@ -0,0 +1,412 @@
+#include <jit.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+
+namespace {
+    // Generations are handed out globally, so code from one Jit is never mistaken for another's
+    std::atomic<u64> next_generation { 1 };
+
+    // x86-64 register numbers. Guest register n lives in host register r8 + n.
+    constexpr u8 rax = 0;
+    constexpr u8 rcx = 1;
+    constexpr u8 rdx = 2;
+    constexpr u8 rsi = 6;
+    constexpr u8 rdi = 7;
+    constexpr u8 r8 = 8;
+
+    constexpr u8 zero_flag = 0b00010;
+    constexpr u8 carry_flag = 0b00001;
+    constexpr u8 overflow_flag = 0b00100;
+    constexpr u8 negative_flag = 0b01000;
+    constexpr u8 halt_flag = 0b10000;
+
+    // Condition codes for setcc/jcc
+    constexpr u8 cc_above = 0x7;
+    constexpr u8 cc_zero = 0x4;
+    constexpr u8 cc_not_zero = 0x5;
+    constexpr u8 cc_sign = 0x8;
+
+    static_assert(offsetof(JitContext, registers) == 0);
+    static_assert(offsetof(JitContext, flags) == 8);
+    static_assert(offsetof(JitContext, pc) == 10);
+    static_assert(offsetof(JitContext, pages) == 16);
+
+    constexpr auto guest(u8 reg) -> u8 {
+        return static_cast<u8>(r8 + reg);
+    }
+
+    // Just enough of an assembler for what the translator needs. Byte operations always carry a REX
+    // prefix, which is what makes r8b-r15b reachable and keeps sil/dil from turning into dh/bh.
+    class Emitter {
+    public:
+        [[nodiscard]] auto bytes() const -> const std::vector<u8>& { return m_bytes; }
+        [[nodiscard]] auto size() const { return m_bytes.size(); }
+
+        auto emit(std::initializer_list<u8> bytes) -> void {
+            m_bytes.insert(m_bytes.end(), bytes);
+        }
+
+        auto emit16(u16 value) -> void {
+            emit({ static_cast<u8>(value), static_cast<u8>(value >> 8) });
+        }
+
+        auto emit32(u32 value) -> void {
+            emit16(static_cast<u16>(value));
+            emit16(static_cast<u16>(value >> 16));
+        }
+
+        // <op> r/m8, r8 with both operands in registers (mov, add, sub, and, or, xor, test)
+        auto op_r8(u8 opcode, u8 rm, u8 reg) -> void {
+            emit({ rex(false, reg, rm), opcode, modrm(0b11, reg, rm) });
+        }
+
+        auto mov_r8_imm(u8 dst, u8 value) -> void {
+            emit({ rex(false, 0, dst), static_cast<u8>(0xB0 + (dst & 7)), value });
+        }
+
+        auto movzx_r32_r8(u8 dst, u8 src) -> void {
+            emit({ rex(false, dst, src), 0x0F, 0xB6, modrm(0b11, dst, src) });
+        }
+
+        // movzx r32, byte [rdi + offset]
+        auto load_context_u8(u8 dst, u8 offset) -> void {
+            emit({ rex(false, dst, rdi), 0x0F, 0xB6, modrm(0b01, dst, rdi), offset });
+        }
+
+        // mov byte [rdi + offset], r8
+        auto store_context_u8(u8 offset, u8 src) -> void {
+            emit({ rex(false, src, rdi), 0x88, modrm(0b01, src, rdi), offset });
+        }
+
+        // mov r64, [rdi + offset]
+        auto load_context_u64(u8 dst, u8 offset) -> void {
+            emit({ rex(true, dst, rdi), 0x8B, modrm(0b01, dst, rdi), offset });
+        }
+
+        // mov word [rdi + offset], imm16
+        auto store_context_u16_imm(u8 offset, u16 value) -> void {
+            emit({ 0x66, 0xC7, modrm(0b01, 0, rdi), offset });
+            emit16(value);
+        }
+
+        // mov word [rdi + offset], ax
+        auto store_context_ax(u8 offset) -> void {
+            emit({ 0x66, 0x89, modrm(0b01, rax, rdi), offset });
+        }
+
+        // eax = high << 8 | low, the way addresses are built from two registers
+        auto address_from(u8 high, u8 low) -> void {
+            movzx_r32_r8(rax, high);
+            emit({ 0xC1, 0xE0, 0x08 }); // shl eax, 8
+            movzx_r32_r8(rcx, low);
+            emit({ 0x09, 0xC8 }); // or eax, ecx
+        }
+
+        // mov r8, byte [high << 8 | low], through the page table rsi points to
+        auto load_memory(u8 dst, u8 high, u8 low) -> void {
+            movzx_r32_r8(rax, high);
+            emit({ 0x48, 0x8B, 0x04, 0xC6 }); // mov rax, [rsi + rax * 8]
+            movzx_r32_r8(rcx, low);
+            emit({ rex(false, dst, 0), 0x8A, modrm(0b00, dst, 0b100), 0x08 }); // mov r8, byte [rax + rcx]
+        }
+
+        auto setcc(u8 condition, u8 dst) -> void {
+            emit({ rex(false, 0, dst), 0x0F, static_cast<u8>(0x90 | condition), modrm(0b11, 0, dst) });
+        }
+
+        // shl r8, count
+        auto shl_r8(u8 reg, u8 count) -> void {
+            if (count == 1)
+                emit({ rex(false, 0, reg), 0xD0, modrm(0b11, 4, reg) });
+            else if (count > 1)
+                emit({ rex(false, 0, reg), 0xC0, modrm(0b11, 4, reg), count });
+        }
+
+        auto and_dl_imm(u8 mask) -> void { emit({ 0x80, 0xE2, mask }); }
+        auto or_dl_imm(u8 mask) -> void { emit({ 0x80, 0xCA, mask }); }
+        auto test_dl_imm(u8 mask) -> void { emit({ 0xF6, 0xC2, mask }); }
+
+        auto push(u8 reg) -> void { emit({ rex(false, 0, reg), static_cast<u8>(0x50 + (reg & 7)) }); }
+        auto pop(u8 reg) -> void { emit({ rex(false, 0, reg), static_cast<u8>(0x58 + (reg & 7)) }); }
+        auto ret() -> void { emit({ 0xC3 }); }
+
+        // Short forward jump, returns the position of the displacement for patch()
+        auto jump(std::optional<u8> condition) -> usize {
+            if (condition)
+                emit({ static_cast<u8>(0x70 | *condition), 0x00 });
+            else
+                emit({ 0xEB, 0x00 });
+            return m_bytes.size() - 1;
+        }
+
+        auto patch(usize displacement) -> void {
+            m_bytes[displacement] = static_cast<u8>(m_bytes.size() - displacement - 1);
+        }
+
+    private:
+        static constexpr auto rex(bool wide, u8 reg, u8 rm) -> u8 {
+            return static_cast<u8>(0x40 | (wide ? 0b1000 : 0) | ((reg >> 3) << 2) | (rm >> 3));
+        }
+
+        static constexpr auto modrm(u8 mod, u8 reg, u8 rm) -> u8 {
+            return static_cast<u8>((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+        }
+
+        std::vector<u8> m_bytes;
+    };
+
+    constexpr u8 op_add = 0x00;
+    constexpr u8 op_or = 0x08;
+    constexpr u8 op_and = 0x20;
+    constexpr u8 op_sub = 0x28;
+    constexpr u8 op_xor = 0x30;
+    constexpr u8 op_mov = 0x88;
+    constexpr u8 op_test = 0x84;
+
+    // Recomputes zero and negative from a guest register, in dl
+    auto emit_zn_flags(Emitter& emitter, u8 reg) -> void {
+        emitter.and_dl_imm(static_cast<u8>(~(zero_flag | negative_flag)));
+        emitter.op_r8(op_test, reg, reg);
+        emitter.setcc(cc_zero, rax);
+        emitter.setcc(cc_sign, rcx);
+        emitter.shl_r8(rax, 1);
+        emitter.shl_r8(rcx, 3);
+        emitter.op_r8(op_or, rdx, rax);
+        emitter.op_r8(op_or, rdx, rcx);
+    }
+
+    // Sets flag to the "above" condition of the last comparison
+    auto emit_above_flag(Emitter& emitter, u8 flag, u8 shift) -> void {
+        emitter.setcc(cc_above, rax);
+        emitter.and_dl_imm(static_cast<u8>(~flag));
+        emitter.shl_r8(rax, shift);
+        emitter.op_r8(op_or, rdx, rax);
+    }
+
+    // dst = lhs <op> rhs for the byte-sized ALU instructions
+    auto emit_alu(Emitter& emitter, u8 opcode, const JitOp& op) -> void {
+        emitter.op_r8(op_mov, rax, guest(op.r2));
+        emitter.op_r8(opcode, rax, guest(op.r3));
+        emitter.op_r8(op_mov, guest(op.r1), rax);
+    }
+
+    // Carry and overflow look at the operands after dst was written, like the interpreter does,
+    // which matters when dst is also one of the operands
+    auto emit_reload_operands(Emitter& emitter, const JitOp& op) -> void {
+        emitter.movzx_r32_r8(rax, guest(op.r2));
+        emitter.movzx_r32_r8(rcx, guest(op.r3));
+    }
+
+    auto emit_op(Emitter& emitter, const JitOp& op, u16 next_pc) -> void {
+        switch (op.type) {
+        case InstructionType::LoadFromReg:
+            emitter.op_r8(op_mov, guest(op.r1), guest(op.r2));
+            break;
+        case InstructionType::LoadFromImm:
+            emitter.mov_r8_imm(guest(op.r1), op.data);
+            break;
+        case InstructionType::LoadFromMem:
+            emitter.load_memory(guest(op.r1), guest(op.r2), guest(op.r3));
+            break;
+        case InstructionType::Add:
+            emit_alu(emitter, op_add, op);
+            if (op.cv_flags) {
+                emit_reload_operands(emitter, op);
+                emitter.emit({ 0x01, 0xC8 }); // add eax, ecx
+                emitter.emit({ 0x3D });       // cmp eax, 0xFF
+                emitter.emit32(0xFF);
+                emit_above_flag(emitter, overflow_flag, 2);
+            }
+            break;
+        case InstructionType::Sub:
+            emit_alu(emitter, op_sub, op);
+            if (op.cv_flags) {
+                emit_reload_operands(emitter, op);
+                emitter.emit({ 0x39, 0xC1 }); // cmp ecx, eax
+                emit_above_flag(emitter, carry_flag, 0);
+            }
+            break;
+        case InstructionType::Mul:
+            emit_reload_operands(emitter, op);
+            emitter.emit({ 0x0F, 0xAF, 0xC1 }); // imul eax, ecx
+            emitter.op_r8(op_mov, guest(op.r1), rax);
+            if (op.cv_flags) {
+                emit_reload_operands(emitter, op);
+                emitter.emit({ 0x0F, 0xAF, 0xC1 });
+                emitter.emit({ 0x3D });
+                emitter.emit32(0xFF);
+                emit_above_flag(emitter, overflow_flag, 2);
+            }
+            break;
+        case InstructionType::And:
+            emit_alu(emitter, op_and, op);
+            break;
+        case InstructionType::Or:
+            emit_alu(emitter, op_or, op);
+            break;
+        case InstructionType::Xor:
+            emit_alu(emitter, op_xor, op);
+            break;
+        case InstructionType::Jump:
+            emitter.address_from(guest(op.r1), guest(op.r2));
+            emitter.store_context_ax(offsetof(JitContext, pc));
+            return;
+        case InstructionType::JumpIfZero: {
+            emitter.address_from(guest(op.r1), guest(op.r2));
+            emitter.test_dl_imm(zero_flag);
+            const auto taken = emitter.jump(cc_not_zero);
+            emitter.store_context_u16_imm(offsetof(JitContext, pc), next_pc);
+            const auto done = emitter.jump(std::nullopt);
+            emitter.patch(taken);
+            emitter.store_context_ax(offsetof(JitContext, pc));
+            emitter.patch(done);
+            return;
+        }
+        case InstructionType::Halt:
+            emitter.or_dl_imm(halt_flag);
+            break;
+        default:
+            break;
+        }
+
+        if (op.zn_flags)
+            emit_zn_flags(emitter, guest(op.r1));
+    }
+
+    auto ends_with_jump(std::span<const JitOp> ops) -> bool {
+        const auto type = ops.back().type;
+        return type == InstructionType::Jump || type == InstructionType::JumpIfZero;
+    }
+}
+
+Jit::Jit(u32 hot_threshold)
+    : m_generation(next_generation++)
+    , m_hot_threshold(hot_threshold) {
+}
+
+Jit::~Jit() {
+    release();
+}
+
+Jit::Jit(const Jit& other)
+    : Jit(other.m_hot_threshold) {
+}
+
+auto Jit::operator=(const Jit& other) -> Jit& {
+    if (this != &other) {
+        release();
+        m_generation = next_generation++;
+        m_hot_threshold = other.m_hot_threshold;
+        m_stats = {};
+    }
+    return *this;
+}
+
+Jit::Jit(Jit&& other) noexcept
+    : m_code(std::exchange(other.m_code, nullptr))
+    , m_used(std::exchange(other.m_used, 0))
+    , m_generation(std::exchange(other.m_generation, next_generation++))
+    , m_hot_threshold(other.m_hot_threshold)
+    , m_stats(std::exchange(other.m_stats, {})) {
+}
+
+auto Jit::operator=(Jit&& other) noexcept -> Jit& {
+    if (this != &other) {
+        release();
+        m_code = std::exchange(other.m_code, nullptr);
+        m_used = std::exchange(other.m_used, 0);
+        m_generation = std::exchange(other.m_generation, next_generation++);
+        m_hot_threshold = other.m_hot_threshold;
+        m_stats = std::exchange(other.m_stats, {});
+    }
+    return *this;
+}
+
+auto Jit::supports(InstructionType type) -> bool {
+    switch (type) {
+    // Memory writes need invalidation and these three can fail, all of that stays with the interpreter
+    case InstructionType::Store:
+    case InstructionType::Push:
+    case InstructionType::Pop:
+    case InstructionType::Div:
+        return false;
+    default:
+        return true;
+    }
+}
+
+auto Jit::compile(ProcessorSpec::addr_t start, std::span<const JitOp> ops) -> NativeBlock {
+    if (ops.empty())
+        return nullptr;
+
+    auto emitter = Emitter {};
+    for (u8 reg = 12; reg <= 15; reg++)
+        emitter.push(reg);
+    for (u8 reg = 0; reg < ProcessorSpec::register_count; reg++)
+        emitter.load_context_u8(guest(reg), reg);
+    emitter.load_context_u8(rdx, offsetof(JitContext, flags));
+    emitter.load_context_u64(rsi, offsetof(JitContext, pages));
+
+    auto pc = start;
+    for (const auto& op : ops) {
+        pc = static_cast<ProcessorSpec::addr_t>(pc + sizeof(ProcessorSpec::insr_t));
+        emit_op(emitter, op, pc);
+    }
+    if (!ends_with_jump(ops))
+        emitter.store_context_u16_imm(offsetof(JitContext, pc), pc);
+
+    for (u8 reg = 0; reg < ProcessorSpec::register_count; reg++)
+        emitter.store_context_u8(reg, guest(reg));
+    emitter.store_context_u8(offsetof(JitContext, flags), rdx);
+    for (u8 reg = 15; reg >= 12; reg--)
+        emitter.pop(reg);
+    emitter.ret();
+
+    const auto size = emitter.size();
+    if (size > code_buffer_size)
+        return nullptr;
+
+    if (m_code == nullptr) {
+        auto* mapping = mmap(nullptr, code_buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED)
+            return nullptr;
+        m_code = static_cast<u8*>(mapping);
+    } else if (mprotect(m_code, code_buffer_size, PROT_READ | PROT_WRITE) != 0) {
+        return nullptr;
+    }
+
+    if (m_used + size > code_buffer_size)
+        flush();
+
+    auto* code = m_code + m_used;
+    std::memcpy(code, emitter.bytes().data(), size);
+    m_used += size;
+
+    if (mprotect(m_code, code_buffer_size, PROT_READ | PROT_EXEC) != 0)
+        return nullptr;
+
+    m_stats.compiled++;
+    m_stats.code_bytes = m_used;
+    return reinterpret_cast<NativeBlock>(code);
+}
+
+auto Jit::release() -> void {
+    if (m_code != nullptr)
+        munmap(m_code, code_buffer_size);
+    m_code = nullptr;
+    m_used = 0;
+}
+
+auto Jit::flush() -> void {
+    m_used = 0;
+    m_generation = next_generation++;
+    m_stats.flushes++;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <span>
+
+#include <instructions.hpp>
+
+// Processor state handed to native code. Laid out for the generated code, see jit.cpp.
+struct JitContext {
+    std::array<u8, ProcessorSpec::register_count> registers;
+    u8 flags;
+    // Program counter after the last translated instruction, written by the native code
+    ProcessorSpec::addr_t pc;
+    // One pointer per 256 byte page of guest memory
+    const u8* const* pages;
+};
+
+struct JitOp {
+    InstructionType type;
+    u8 r1;
+    u8 r2;
+    u8 r3;
+    u8 data;
+    // Whether the instruction has to compute the zero/negative and the carry/overflow flags
+    bool zn_flags;
+    bool cv_flags;
+};
+
+using NativeBlock = void (*)(JitContext*);
+
+// Translates basic blocks into x86-64 machine code, written into mmap'd pages.
+// Guest registers live in r8b-r15b and the flags in dl while a block runs.
+// Copying a Jit gives an empty one, native code is never shared between processors.
+class Jit final {
+public:
+    struct Stats {
+        // Blocks translated so far
+        u64 compiled { 0 };
+        // Times the code buffer filled up and everything was thrown away
+        u64 flushes { 0 };
+        // Bytes of machine code currently in use
+        usize code_bytes { 0 };
+    };
+
+    static constexpr usize code_buffer_size = 1024 * 1024;
+    static constexpr u32 default_hot_threshold = 16;
+
+    explicit Jit(u32 hot_threshold = default_hot_threshold);
+    ~Jit();
+
+    Jit(const Jit& other);
+    auto operator=(const Jit& other) -> Jit&;
+    Jit(Jit&& other) noexcept;
+    auto operator=(Jit&& other) noexcept -> Jit&;
+
+    [[nodiscard]] static auto supports(InstructionType type) -> bool;
+
+    // Translates ops, all of which must be supported, into a function running them. start is the address
+    // of the first instruction. Returns nullptr if no executable memory is available.
+    // May throw away all previously translated code, see generation().
+    auto compile(ProcessorSpec::addr_t start, std::span<const JitOp> ops) -> NativeBlock;
+
+    // Changes whenever previously returned code becomes invalid. Unique across all Jit instances.
+    [[nodiscard]] auto generation() const noexcept { return m_generation; }
+    [[nodiscard]] auto hot_threshold() const noexcept { return m_hot_threshold; }
+    [[nodiscard]] auto stats() const noexcept { return m_stats; }
+
+private:
+    auto release() -> void;
+    auto flush() -> void;
+
+    u8* m_code { nullptr };
+    usize m_used { 0 };
+    u64 m_generation { 0 };
+    u32 m_hot_threshold { default_hot_threshold };
+    Stats m_stats {};
+};
@@ -1,24 +1,250 @@
 #include <assembler.hpp>
+#include <binary_trace.hpp>
+#include <chrono>
+#include <cxxopts.hpp>
 #include <disassembler.hpp>
+#include <fstream>
+#include <image.hpp>
+#include <iterator>
+#include <map>
 #include <processor.hpp>
+#include <profiler.hpp>
 #include <ranges>
+#include <replay.hpp>
+#include <runner.hpp>
+#include <sstream>
+#include <undo.hpp>
+
+static auto status_name(JobStatus status) -> std::string_view {
+    switch (status) {
+    case JobStatus::Halted:
+        return "halted";
+    case JobStatus::EndOfMemory:
+        return "end of memory";
+    case JobStatus::Failed:
+        return "failed";
+    case JobStatus::OutOfBudget:
+        return "out of budget";
+    case JobStatus::Cancelled:
+        return "cancelled";
+    }
+    return "?";
+}
+
+// One job per line: "<program.asm> [r0=<value> ... r7=<value>] [budget=<instructions>]", '#' starts a comment.
+// Programs are assembled once no matter how many jobs use them. Programs ending in .pimg are images (see
+// --assemble), mapped once and shared by every job using them.
+static auto run_jobs(const std::string& path, usize threads, usize time_slice) -> int {
+    auto file = std::ifstream { path };
+    if (!file) {
+        fmt::println(stderr, "can't open job file {}", path);
+        return 1;
+    }
+
+    auto programs = std::map<std::string, std::vector<insr_t>> {};
+    auto images = std::map<std::string, MappedImage> {};
+    auto jobs = std::vector<Job> {};
+    auto line = std::string {};
+    for (usize line_number = 1; std::getline(file, line); line_number++) {
+        auto words = std::istringstream { line.substr(0, line.find('#')) };
+        auto program_path = std::string {};
+        if (!(words >> program_path))
+            continue;
+
+        auto job = Job {};
+        if (program_path.ends_with(".pimg")) {
+            auto image = images.find(program_path);
+            if (image == images.end()) {
+                auto mapped = MappedImage::open(program_path);
+                if (!mapped) {
+                    fmt::println(stderr, "{}:{}: can't load image {}", path, line_number, program_path);
+                    return 1;
+                }
+                image = images.emplace(program_path, std::move(*mapped)).first;
+            }
+            job.image = &image->second;
+        } else if (auto program = programs.find(program_path); program != programs.end()) {
+            job.program = program->second;
+        } else {
+            auto source = std::ifstream { program_path };
+            if (!source) {
+                fmt::println(stderr, "{}:{}: can't open program {}", path, line_number, program_path);
+                return 1;
+            }
+            auto code = VectorInstructionSink {};
+            if (!Assembler::assemble(source, code) || code.instructions().empty()) {
+                fmt::println(stderr, "{}:{}: program {} didn't assemble", path, line_number, program_path);
+                return 1;
+            }
+            if (ProcessorSpec::reset_pc + code.instructions().size() * sizeof(insr_t) > ProcessorSpec::highest_addr + 1u) {
+                fmt::println(stderr, "{}:{}: program {} with {} instructions doesn't fit into memory", path, line_number, program_path, code.instructions().size());
+                return 1;
+            }
+            job.program = programs.emplace(program_path, code.instructions()).first->second;
+        }
+
+        for (auto word = std::string {}; words >> word;) {
+            const auto equals = word.find('=');
+            try {
+                const auto value = std::stoull(word.substr(equals + 1), nullptr, 0);
+                if (word.starts_with("budget="))
+                    job.instruction_budget = value;
+                else if (word[0] == 'r' && word[1] >= '0' && word[1] < '0' + ProcessorSpec::register_count && equals == 2 && value <= 0xFF)
+                    job.registers[static_cast<usize>(word[1] - '0')] = static_cast<data_t>(value);
+                else
+                    throw std::invalid_argument { word };
+            } catch (const std::logic_error&) {
+                fmt::println(stderr, "{}:{}: can't parse '{}'", path, line_number, word);
+                return 1;
+            }
+        }
+        jobs.push_back(job);
+    }
+
+    auto runner = JobRunner { threads, time_slice };
+    const auto start = std::chrono::steady_clock::now();
+    const auto results = runner.run(jobs);
+    const auto elapsed = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+
+    for (usize i = 0; i < results.size(); i++) {
+        const auto& result = results[i];
+        fmt::println("job {}: {} after {} instructions, pc=0x{:04X}, registers {}", i, status_name(result.status), result.retired_instructions, result.program_counter, result.registers);
+    }
+    const auto stats = runner.stats();
+    fmt::println("{} jobs, {} instructions in {:.3f}s on {} threads ({} slices, {} steals)", jobs.size(), stats.retired_instructions, elapsed, runner.threads(), stats.slices, stats.steals);
+    return 0;
+}
+
+// Assembles source (with .org sections, labels and all) into an image that --jobs can run
+static auto assemble_file(const std::string& source_path, const std::string& output_path) -> int {
+    auto source = std::ifstream { source_path };
+    if (!source) {
+        fmt::println(stderr, "can't open {}", source_path);
+        return 1;
+    }
+    const auto text = std::string { std::istreambuf_iterator<char> { source }, {} };
+    const auto image = Assembler::assemble_image(text, std::thread::hardware_concurrency());
+    if (!image) {
+        fmt::println(stderr, "{} didn't assemble", source_path);
+        return 1;
+    }
+    return image->save(output_path) ? 0 : 1;
+}
+
+// Prints a trace written by --binary-trace
+static auto decode_trace(const std::string& path) -> int {
+    auto reader = BinaryTraceReader::open(path);
+    if (!reader)
+        return 1;
+    reader->print(stdout);
+    if (reader->truncated()) {
+        fmt::println(stderr, "{} is cut off", path);
+        return 1;
+    }
+    return 0;
+}
+
+// Prints the state a run written by --record was in after instruction_count instructions
+static auto seek_replay(const std::string& path, u64 instruction_count) -> int {
+    const auto replay = Replay::open(path);
+    if (!replay)
+        return 1;
+    auto processor = Processor {};
+    if (!replay->seek(processor, instruction_count)) {
+        fmt::println(stderr, "the recorded run never got to instruction {}", instruction_count);
+        return 1;
+    }
+    processor.dump_state(true);
+    return 0;
+}
+
+auto main(int argc, char** argv) -> int {
+    auto options = cxxopts::Options { "processor", "A made up CPU architecture and emulator" };
+    // clang-format off
+    options.add_options()
+        ("t,trace", "Print every executed instruction and the registers after it")
+        ("p,profile", "Count executed instructions and print where the program spent its time")
+        ("b,binary-trace", "Record every executed instruction into a binary trace file", cxxopts::value<std::string>())
+        ("decode-trace", "Print a binary trace file, one disassembled instruction per line with what it changed", cxxopts::value<std::string>())
+        ("record", "Write a replay file with a checkpoint every --interval instructions while running", cxxopts::value<std::string>())
+        ("interval", "Instructions between two checkpoints of --record", cxxopts::value<u64>()->default_value(std::to_string(ReplayRecorder::default_interval)))
+        ("replay", "Load a replay file and print the state of the recorded run after --seek instructions", cxxopts::value<std::string>())
+        ("seek", "Instruction --replay goes to", cxxopts::value<u64>()->default_value("0"))
+        ("step-back", "Keep an undo log while running and go back this many instructions from where execution stopped", cxxopts::value<usize>())
+        ("j,jobs", "Run every job listed in a file on a thread pool instead of the built-in program", cxxopts::value<std::string>())
+        ("threads", "Threads used for --jobs", cxxopts::value<usize>()->default_value(std::to_string(std::thread::hardware_concurrency())))
+        ("slice", "Instructions a job runs before it goes back into the queue", cxxopts::value<usize>()->default_value(std::to_string(JobRunner::default_time_slice)))
+        ("a,assemble", "Assemble a file into a program image instead of running anything", cxxopts::value<std::string>())
+        ("o,output", "Where --assemble writes the image", cxxopts::value<std::string>()->default_value("a.pimg"))
+        ("h,help", "Print usage");
+    // clang-format on
+
+    auto trace = false;
+    auto profile = false;
+    auto binary_trace = std::string {};
+    auto record = std::string {};
+    u64 interval = 0;
+    usize step_back = 0;
+    try {
+        const auto result = options.parse(argc, argv);
+        if (result.count("help")) {
+            fmt::println("{}", options.help());
+            return 0;
+        }
+        trace = result.count("trace") > 0;
+        if (trace && !Processor::tracing_enabled) {
+            fmt::println(stderr, "--trace needs a build with TRACING on");
+            return 1;
+        }
+        profile = result.count("profile") > 0;
+        if (profile && !Processor::tracing_enabled) {
+            fmt::println(stderr, "--profile needs a build with TRACING on");
+            return 1;
+        }
+        if (result.count("binary-trace")) {
+            if (!Processor::tracing_enabled) {
+                fmt::println(stderr, "--binary-trace needs a build with TRACING on");
+                return 1;
+            }
+            binary_trace = result["binary-trace"].as<std::string>();
+        }
+        if (result.count("decode-trace"))
+            return decode_trace(result["decode-trace"].as<std::string>());
+        if (result.count("replay"))
+            return seek_replay(result["replay"].as<std::string>(), result["seek"].as<u64>());
+        if (result.count("record"))
+            record = result["record"].as<std::string>();
+        interval = result["interval"].as<u64>();
+        if (result.count("step-back")) {
+            if (!Processor::tracing_enabled) {
+                fmt::println(stderr, "--step-back needs a build with TRACING on");
+                return 1;
+            }
+            step_back = result["step-back"].as<usize>();
+        }
+        if (result.count("assemble"))
+            return assemble_file(result["assemble"].as<std::string>(), result["output"].as<std::string>());
+        if (result.count("jobs"))
+            return run_jobs(result["jobs"].as<std::string>(), result["threads"].as<usize>(), result["slice"].as<usize>());
+    } catch (const cxxopts::exceptions::exception& e) {
+        fmt::println(stderr, "{}", e.what());
+        return 1;
+    }
 
-auto main(int, char**) -> int {
     auto processor = Processor {};
 
-    // this sucks and likely isn't correct
     const auto factorial = std::string { R"(
         ldi r0, #5
         ldi r1, #1
         ldi r2, #1
-        ldi r7, #0xFF
-        ldi r3, #0x0C
-        ldi r5, #0x13
-        mul r1, r1, r0
+        ldi r7, $(loop >> 8)
+        ldi r3, $(loop & 0xFF)
+        ldi r5, $(done & 0xFF)
+loop:   mul r1, r1, r0
         sub r0, r0, r2
         jz r7, r5
         jp r7, r3
-        hlt
+done:   hlt
     )" };
 
     const auto code = Assembler::assemble(factorial);
@@ -33,11 +259,65 @@ auto main(int, char**) -> int {
         processor.write_instruction(location, instruction);
     }
 
-    while (true) {
-        if (!processor.execute(1))
-            break;
+    if (trace) {
+        auto trace_sink = FileTraceSink { stdout };
+        processor.set_trace_sink(&trace_sink);
+
+        while (true) {
+            const auto executed = processor.execute(1);
+            trace_sink.flush();
+            if (!executed)
+                break;
+
+            fmt::println("{}", processor.registers());
+        }
 
-        fmt::println("{}", processor.registers());
+        processor.set_trace_sink(nullptr);
+    } else if (profile) {
+        auto profiler = Profiler {};
+        processor.set_trace_sink(&profiler);
+        processor.execute();
+        processor.set_trace_sink(nullptr);
+        profiler.report(stdout);
+    } else if (!binary_trace.empty()) {
+        auto* file = std::fopen(binary_trace.c_str(), "wb");
+        if (file == nullptr) {
+            fmt::println(stderr, "can't open {} for writing", binary_trace);
+            return 1;
+        }
+        auto failed = false;
+        {
+            auto trace_sink = BinaryTraceSink { file };
+            processor.set_trace_sink(&trace_sink);
+            processor.execute();
+            processor.set_trace_sink(nullptr);
+            trace_sink.flush();
+            failed = trace_sink.failed();
+        }
+        std::fclose(file);
+        if (failed)
+            return 1;
+    } else if (!record.empty()) {
+        auto* file = std::fopen(record.c_str(), "wb");
+        if (file == nullptr) {
+            fmt::println(stderr, "can't open {} for writing", record);
+            return 1;
+        }
+        {
+            auto recorder = ReplayRecorder { processor, file, interval };
+            recorder.execute();
+            fmt::println("{} checkpoints", recorder.checkpoints());
+        }
+        std::fclose(file);
+    } else if (step_back > 0) {
+        auto undo_log = UndoLog { processor };
+        processor.set_trace_sink(&undo_log);
+        processor.execute();
+        processor.set_trace_sink(nullptr);
+        const auto stopped_at = processor.program_counter();
+        fmt::println("stepped back {} instructions from 0x{:04X}", undo_log.step_back(step_back), stopped_at);
+    } else {
+        processor.execute();
     }
 
     processor.dump_state(true);
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include <spec.hpp>
+
+// The 64KiB address space, split into 256 byte pages that are shared between copies until one of them
+// writes to a page (copy-on-write). Pages nobody wrote to yet don't exist and read as zero, so a fresh
+// or cleared memory costs nothing and copying one only copies the page table. Pages are also listed in
+// the order they were first written, so clear() only has to look at those.
+//
+// Pages can also be windows onto memory owned by someone else (see map_window), which are read and written in
+// place and never copied.
+class PagedMemory {
+public:
+    static constexpr usize page_size = 256;
+    static constexpr usize page_count = (ProcessorSpec::highest_addr + 1) / page_size;
+    static constexpr usize size = page_count * page_size;
+    static_assert(page_count <= 256, "page numbers are kept as u8");
+
+    using Page = std::array<u8, page_size>;
+
+    struct Stats {
+        // Pages allocated or copied because they were written to
+        u64 pages_copied { 0 };
+        // Of those, pages that a clear() before had zeroed and kept around instead of freeing them
+        u64 pages_reused { 0 };
+    };
+
+    PagedMemory() {
+        m_page_data.fill(zero_page.data());
+    }
+
+    // Copies share every page and start counting their own stats from zero
+    PagedMemory(const PagedMemory& other)
+        : m_pages { other.m_pages }
+        , m_page_data { other.m_page_data }
+        , m_dirty { other.m_dirty }
+        , m_mapped { other.m_mapped }
+        , m_windows { other.m_windows } { }
+
+    auto operator=(const PagedMemory& other) -> PagedMemory& {
+        m_pages = other.m_pages;
+        m_page_data = other.m_page_data;
+        m_dirty = other.m_dirty;
+        m_mapped = other.m_mapped;
+        m_windows = other.m_windows;
+        return *this;
+    }
+
+    PagedMemory(PagedMemory&&) noexcept = default;
+    auto operator=(PagedMemory&&) noexcept -> PagedMemory& = default;
+
+    [[nodiscard]] auto read(ProcessorSpec::addr_t address) const -> u8 {
+        return m_page_data[address / page_size][address % page_size];
+    }
+
+    auto write(ProcessorSpec::addr_t address, u8 data) -> void {
+        writable_page(address / page_size)[address % page_size] = data;
+    }
+
+    // Copies data to consecutive addresses a page at a time, data has to fit below the end of memory
+    auto write(ProcessorSpec::addr_t address, std::span<const u8> data) -> void {
+        usize offset = 0;
+        while (offset < data.size()) {
+            const auto at = address + offset;
+            const auto page = at / page_size;
+            const auto length = std::min(page_size - at % page_size, data.size() - offset);
+            std::memcpy(writable_page(page) + at % page_size, data.data() + offset, length);
+            offset += length;
+        }
+    }
+
+    // Makes page read its bytes straight from data, e.g. a page of a mapped file. data is never written
+    // to: this memory keeps a second reference to it, so it's always shared, and the first write to the
+    // page copies it like for any other shared page.
+    auto map_page(usize page, std::shared_ptr<const Page> data) -> void {
+        if (m_pages[page] == nullptr && m_windows[page] == nullptr)
+            m_dirty.push_back(static_cast<u8>(page));
+        m_windows[page] = nullptr;
+        m_pages[page] = std::const_pointer_cast<Page>(data);
+        m_page_data[page] = data->data();
+        m_mapped.push_back(std::move(data));
+    }
+
+    // Makes page read and write page_size bytes at data in place, like a window onto a bank of memory that
+    // lives somewhere else, until nullptr turns it back into an empty page. Windows are never copied: copies
+    // of this memory see the same bytes, and clear() leaves them alone.
+    auto map_window(usize page, u8* data) -> void {
+        if (data == nullptr) {
+            if (m_windows[page] != nullptr) {
+                m_windows[page] = nullptr;
+                m_page_data[page] = zero_page.data();
+                std::erase(m_dirty, static_cast<u8>(page));
+            }
+            return;
+        }
+        if (m_pages[page] == nullptr && m_windows[page] == nullptr)
+            m_dirty.push_back(static_cast<u8>(page));
+        m_pages[page].reset();
+        m_windows[page] = data;
+        m_page_data[page] = data;
+    }
+
+    [[nodiscard]] auto is_window(usize page) const -> bool {
+        return m_windows[page] != nullptr;
+    }
+
+    // All of memory but the windows reads as zero again. Only touches the pages written since the last
+    // clear(): the ones nobody else shares are zeroed and kept for the next writes, shared ones are just let go.
+    auto clear() -> void {
+        for (const auto page : m_dirty) {
+            if (m_windows[page] != nullptr)
+                continue;
+            auto& owned = m_pages[page];
+            if (owned.use_count() == 1) {
+                owned->fill(0);
+                m_spare.push_back(std::move(owned));
+            }
+            owned.reset();
+            m_page_data[page] = zero_page.data();
+        }
+        std::erase_if(m_dirty, [this](u8 page) { return m_windows[page] == nullptr; });
+        m_mapped.clear();
+    }
+
+    // Whether page holds the same bytes in both memories, without looking at them
+    [[nodiscard]] auto shares_page(const PagedMemory& other, usize page) const -> bool {
+        return m_page_data[page] == other.m_page_data[page];
+    }
+
+    // Pages written to since the last clear(), in that order, and windows. Copies inherit the list of the original.
+    [[nodiscard]] auto dirty_pages() const -> std::span<const u8> {
+        return m_dirty;
+    }
+
+    // One pointer per page, for native code
+    [[nodiscard]] auto page_table() const -> const u8* const* {
+        return m_page_data.data();
+    }
+
+    [[nodiscard]] auto stats() const noexcept {
+        return m_stats;
+    }
+
+private:
+    [[nodiscard]] auto is_exclusive(usize page) const -> bool {
+        // Another owner can only get a reference through this one, so a count of 1 can't go up behind our back
+        return m_pages[page] != nullptr && m_pages[page].use_count() == 1;
+    }
+
+    // Where a write to page goes, copying the page first if it's shared
+    [[nodiscard]] auto writable_page(usize page) -> u8* {
+        if (!is_exclusive(page)) [[unlikely]] {
+            if (m_windows[page] != nullptr)
+                return m_windows[page];
+            make_exclusive(page);
+        }
+        return m_pages[page]->data();
+    }
+
+    auto make_exclusive(usize page) -> void {
+        auto copy = std::shared_ptr<Page> {};
+        if (m_pages[page] == nullptr) {
+            m_dirty.push_back(static_cast<u8>(page));
+            if (!m_spare.empty()) {
+                // Already zero, just like the page it replaces
+                copy = std::move(m_spare.back());
+                m_spare.pop_back();
+                m_stats.pages_reused++;
+            }
+        }
+        if (copy == nullptr) {
+            copy = std::make_shared<Page>();
+            std::copy_n(m_page_data[page], page_size, copy->begin());
+        }
+        m_pages[page] = std::move(copy);
+        m_page_data[page] = m_pages[page]->data();
+        m_stats.pages_copied++;
+    }
+
+    static constexpr Page zero_page {};
+
+    std::array<std::shared_ptr<Page>, page_count> m_pages {};
+    // Points into m_pages, or at zero_page for pages that don't exist
+    std::array<const u8*, page_count> m_page_data;
+    // Every page that isn't nullptr in m_pages, and every window
+    std::vector<u8> m_dirty;
+    // Second reference to every page given to map_page() since the last clear()
+    std::vector<std::shared_ptr<const Page>> m_mapped;
+    // Set for pages that are windows, m_pages is nullptr for those
+    std::array<u8*, page_count> m_windows {};
+    // Zeroed pages from earlier clear() calls, not shared with anyone
+    std::vector<std::shared_ptr<Page>> m_spare;
+    Stats m_stats {};
+};
+
+// Lazily allocated per-page table of T, for caches indexed by address
+template <typename T, usize page_size = PagedMemory::page_size>
+class PageCache {
+public:
+    static constexpr usize page_count = (ProcessorSpec::highest_addr + 1) / page_size;
+
+    // Allocates the entry's page on first use
+    auto operator[](ProcessorSpec::addr_t address) -> T& {
+        auto& page = m_pages[address / page_size];
+        if (page == nullptr) [[unlikely]] {
+            page = std::make_unique<Page>();
+            m_used.push_back(static_cast<u16>(address / page_size));
+        }
+        return (*page)[address % page_size];
+    }
+
+    // nullptr if the page was never used
+    [[nodiscard]] auto find(ProcessorSpec::addr_t address) const -> T* {
+        const auto& page = m_pages[address / page_size];
+        return page != nullptr ? &(*page)[address % page_size] : nullptr;
+    }
+
+    auto clear_page(usize page) -> void {
+        if (m_pages[page] == nullptr)
+            return;
+        m_pages[page].reset();
+        std::erase(m_used, static_cast<u16>(page));
+    }
+
+    // Only looks at pages that were used
+    auto clear() -> void {
+        for (const auto page : m_used)
+            m_pages[page].reset();
+        m_used.clear();
+    }
+
+private:
+    using Page = std::array<T, page_size>;
+
+    std::array<std::unique_ptr<Page>, page_count> m_pages {};
+    std::vector<u16> m_used;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <processor.hpp>
+
+// Keeps processors around for reuse instead of constructing a new one per program. Every processor handed
+// out by acquire() is in the same state as a new one, but since reset() only clears what the last program
+// touched, that is a lot cheaper than constructing one when programs are small.
+//
+// Not thread-safe, use one pool per thread.
+class ProcessorPool {
+public:
+    struct Stats {
+        // Processors constructed because the pool was empty
+        u64 created { 0 };
+        // Processors reset and handed out again
+        u64 reused { 0 };
+    };
+
+    [[nodiscard]] auto acquire() -> std::unique_ptr<Processor> {
+        if (m_idle.empty()) {
+            m_stats.created++;
+            return std::make_unique<Processor>();
+        }
+
+        auto processor = std::move(m_idle.back());
+        m_idle.pop_back();
+        processor->reset();
+        m_stats.reused++;
+        return processor;
+    }
+
+    // Keeps the processor around as it is, it's only reset when it's handed out again
+    auto release(std::unique_ptr<Processor> processor) -> void {
+        if (processor)
+            m_idle.push_back(std::move(processor));
+    }
+
+    [[nodiscard]] auto idle() const noexcept { return m_idle.size(); }
+    [[nodiscard]] auto stats() const noexcept { return m_stats; }
+
+private:
+    std::vector<std::unique_ptr<Processor>> m_idle;
+    Stats m_stats {};
+};
@@ -1,12 +1,20 @@
+#pragma once
+
 #include <array>
 #include <fmt/format.h>
 #include <fmt/ranges.h>
 #include <fmt/std.h>
+#include <optional>
 #include <span>
 #include <stack>
 #include <utility>
+#include <vector>
 
+#include <bus.hpp>
 #include <instructions.hpp>
+#include <jit.hpp>
+#include <memory.hpp>
+#include <trace.hpp>
 
 /*
  * ldr    <dst>,<src>       load value at reg src into reg dst
@@ -44,24 +52,201 @@ public:
         Halt = 0b10000,
     };
 
+    // Only clears memory pages and caches that were used since the last reset, so reusing a processor for a
+    // small program is cheap, see ProcessorPool
     constexpr auto reset() {
-        m_memory.fill(0);
+        m_memory.clear();
         m_registers = { 0 };
         m_program_counter = ProcessorSpec::reset_pc;
         m_stack_pointer = ProcessorSpec::stack_top_addr;
         m_flags = 0;
+        m_retired_instructions = 0;
+        m_decode_cache.clear();
+        m_decode_cache_stats = {};
+        clear_blocks();
     }
 
     constexpr Processor() {
         reset();
+#if defined(PROCESSOR_JIT)
+        m_jit.emplace();
+#endif
+    }
+
+    explicit Processor(TraceSink& trace_sink)
+        : Processor() {
+        m_trace_sink = &trace_sink;
+    }
+
+    // Copies share memory pages until either side writes to one, and the devices attached to them. Caches,
+    // blocks and native code aren't copied, the copy builds its own as it runs.
+    Processor(const Processor& other)
+        : m_memory { other.m_memory }
+        , m_bus { other.m_bus }
+        , m_registers { other.m_registers }
+        , m_program_counter { other.m_program_counter }
+        , m_stack_pointer { other.m_stack_pointer }
+        , m_flags { other.m_flags }
+        , m_retired_instructions { other.m_retired_instructions }
+        , m_trace_sink { other.m_trace_sink } {
+#if defined(PROCESSOR_JIT)
+        if (other.m_jit)
+            m_jit.emplace(other.m_jit->hot_threshold());
+#endif
+    }
+
+    auto operator=(const Processor& other) -> Processor& {
+        if (this != &other) {
+            auto copy = Processor { other };
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    Processor(Processor&&) noexcept = default;
+    auto operator=(Processor&&) noexcept -> Processor& = default;
+
+#ifdef PROCESSOR_DISABLE_TRACING
+    static constexpr auto tracing_enabled = false;
+#else
+    static constexpr auto tracing_enabled = true;
+#endif
+
+    // Pass nullptr to detach. The sink must outlive its use by this processor.
+    constexpr auto set_trace_sink(TraceSink* trace_sink) noexcept {
+        m_trace_sink = trace_sink;
     }
 
+    [[nodiscard]] constexpr auto trace_sink() const noexcept {
+        return m_trace_sink;
+    }
+
+    // Number of instructions executed since the last reset
+    [[nodiscard]] constexpr auto retired_instructions() const noexcept {
+        return m_retired_instructions;
+    }
+
+    // Only meant for going back in time, see UndoLog
+    constexpr auto set_retired_instructions(u64 count) noexcept {
+        m_retired_instructions = count;
+    }
+
+    // Goes to the device attached at address, if there is one
     [[nodiscard]] constexpr auto read_memory(addr_t address) const {
-        return m_memory[address];
+        if (m_bus.device(address) != nullptr) [[unlikely]]
+            return m_bus.read(address);
+        return m_memory.read(address);
+    }
+
+    [[nodiscard]] constexpr auto has_device(addr_t address) const noexcept {
+        return m_bus.device(address) != nullptr;
+    }
+
+    // What RAM holds at address, without asking any device
+    [[nodiscard]] constexpr auto peek_memory(addr_t address) const {
+        return m_memory.read(address);
     }
 
     constexpr auto write_memory(addr_t address, data_t data) {
-        m_memory[address] = data;
+        if (m_bus.device(address) != nullptr) [[unlikely]] {
+            m_bus.write(address, data);
+            return;
+        }
+        m_memory.write(address, data);
+        invalidate_decoded(address);
+        if (!m_block_pages[address >> 8].empty()) [[unlikely]]
+            invalidate_blocks(address);
+    }
+
+    // Copies data to consecutive addresses of RAM, a page at a time. Cheaper than writing byte by byte.
+    // Devices don't see any of it, like with map_memory_page.
+    auto write_memory(addr_t address, std::span<const data_t> data) -> void {
+        if (data.empty())
+            return;
+        m_memory.write(address, data);
+        for (auto page = address / PagedMemory::page_size; page <= (address + data.size() - 1) / PagedMemory::page_size; page++)
+            invalidate_page(page);
+    }
+
+    // Reads the page straight out of data until something writes to it, see PagedMemory::map_page
+    auto map_memory_page(usize page, std::shared_ptr<const PagedMemory::Page> data) -> void {
+        m_memory.map_page(page, std::move(data));
+        invalidate_page(page);
+    }
+
+    // Reads and writes page_size bytes at data in place of the page, see PagedMemory::map_window. nullptr
+    // turns the page back into RAM. data has to outlive its use by the processor.
+    auto map_memory_window(usize page, u8* data) -> void {
+        m_memory.map_window(page, data);
+        invalidate_page(page);
+    }
+
+    // Makes device answer every access to pages [first_page, first_page + pages) instead of RAM, which keeps
+    // what it holds until the device is detached. Instructions are always fetched from RAM. Returns false if
+    // a device is attached at one of the pages already. The device has to outlive its use by the processor.
+    auto attach_device(usize first_page, usize pages, MemoryDevice& device) -> bool {
+        if (!m_bus.attach(first_page, pages, device))
+            return false;
+        // Native code reads memory straight from the page table
+        clear_blocks();
+        return true;
+    }
+
+    auto detach_device(const MemoryDevice& device) -> void {
+        m_bus.detach(device);
+    }
+
+    [[nodiscard]] constexpr auto memory_stats() const noexcept {
+        return m_memory.stats();
+    }
+
+    // Memory pages written since the last reset, which is what the next reset() has to clear
+    [[nodiscard]] auto dirty_pages() const {
+        return m_memory.dirty_pages();
+    }
+
+    // Registers, flags and memory at one point in time. Holding on to one only keeps the memory pages
+    // alive that were written since, every other page is shared with the processor.
+    struct Snapshot {
+        PagedMemory memory;
+        std::array<reg_t, ProcessorSpec::register_count> registers;
+        addr_t program_counter;
+        addr_t stack_pointer;
+        u8 flags;
+        u64 retired_instructions;
+    };
+
+    // Copies the page table, not the pages
+    [[nodiscard]] auto snapshot() const -> Snapshot {
+        return Snapshot {
+            .memory = m_memory,
+            .registers = m_registers,
+            .program_counter = m_program_counter,
+            .stack_pointer = m_stack_pointer,
+            .flags = m_flags,
+            .retired_instructions = m_retired_instructions,
+        };
+    }
+
+    // Goes back to a snapshot taken from this processor or any copy of it. Cached decodes and blocks
+    // survive on every page that's still the same, the others are thrown away.
+    auto restore(const Snapshot& snapshot) -> void {
+        for (usize page = 0; page < PagedMemory::page_count; page++) {
+            if (!m_memory.shares_page(snapshot.memory, page))
+                invalidate_page(page);
+        }
+
+        m_memory = snapshot.memory;
+        m_registers = snapshot.registers;
+        m_program_counter = snapshot.program_counter;
+        m_stack_pointer = snapshot.stack_pointer;
+        m_flags = snapshot.flags;
+        m_retired_instructions = snapshot.retired_instructions;
+    }
+
+    // Independent copy, see the copy constructor
+    [[nodiscard]] auto fork() const -> Processor {
+        return *this;
     }
 
     constexpr auto write_instruction(addr_t start_address, insr_t encoded_instruction) {
@@ -81,10 +266,22 @@ public:
         return m_stack_pointer;
     }
 
+    constexpr auto set_program_counter(addr_t address) noexcept {
+        m_program_counter = address;
+    }
+
+    constexpr auto set_stack_pointer(addr_t address) noexcept {
+        m_stack_pointer = address;
+    }
+
     [[nodiscard]] constexpr auto flags() const noexcept {
         return m_flags;
     }
 
+    constexpr auto set_flags(u8 flags) noexcept {
+        m_flags = flags;
+    }
+
     [[nodiscard]] constexpr auto is_flag_set(Flag flag) const noexcept -> bool {
         return m_flags & std::to_underlying(flag);
     }
@@ -130,10 +327,10 @@ public:
     }
 
     constexpr auto dump_memory(usize width = 8) const noexcept {
-        for (usize x = 0; x < m_memory.size(); x += width) {
+        for (usize x = 0; x < PagedMemory::size; x += width) {
             fmt::print("{:4X}: ", x);
-            for (usize xx = 0; xx < width; xx++) {
-                auto byte = m_memory[x + xx];
+            for (usize xx = 0; xx < width && x + xx < PagedMemory::size; xx++) {
+                auto byte = peek_memory(static_cast<addr_t>(x + xx));
                 fmt::print("{:2X} ", byte);
             }
             fmt::print("\n");
@@ -144,7 +341,7 @@ public:
         if (with_memory) {
             dump_memory(48);
         } else {
-            fmt::println("memory=<size 0x{:X} bytes>", m_memory.size());
+            fmt::println("memory=<size 0x{:X} bytes>", PagedMemory::size);
         }
 
         fmt::println(
@@ -169,36 +366,294 @@ public:
         data_t data;
     };
 
+    struct PredecodedInstruction {
+        DecodedInstruction decoded { InstructionType::LoadFromReg, Register { 0 }, Register { 0 }, Register { 0 }, 0 };
+        insr_t instruction { 0 };
+        bool valid { false };
+        // All register fields the instruction uses are in range, so its handler can skip checking them
+        bool verified { false };
+    };
+
+    struct DecodeCacheStats {
+        // Instructions that were executed straight from the cache
+        u64 hits { 0 };
+        // Instructions that had to be fetched and decoded first
+        u64 misses { 0 };
+
+        [[nodiscard]] constexpr auto hit_rate() const noexcept -> f64 {
+            const auto total = hits + misses;
+            return total == 0 ? 0.0 : static_cast<f64>(hits) / static_cast<f64>(total);
+        }
+    };
+
+    [[nodiscard]] constexpr auto decode_cache_stats() const noexcept {
+        return m_decode_cache_stats;
+    }
+
+    // Runs up to instruction_count instructions with the backends selected at build time
+    // (BLOCK_TRANSLATION, THREADED_DISPATCH). Returns false once execution stops for any other reason.
     constexpr auto execute(usize instruction_count = std::numeric_limits<usize>::max()) -> bool {
+#if defined(PROCESSOR_BLOCK_TRANSLATION)
+        if !consteval {
+            return execute_blocks(instruction_count);
+        }
+#endif
+        return execute_interpreted(instruction_count);
+    }
+
+    // Interpreter without block translation
+    constexpr auto execute_interpreted(usize instruction_count = std::numeric_limits<usize>::max()) -> bool {
+#if defined(PROCESSOR_THREADED_DISPATCH) && defined(__GNUC__)
+        if !consteval {
+            return execute_threaded(instruction_count);
+        }
+#endif
+        return execute_switch(instruction_count);
+    }
+
+    // Portable backend, one switch dispatch per loop iteration
+    constexpr auto execute_switch(usize instruction_count = std::numeric_limits<usize>::max()) -> bool {
         for (usize i = 0; i < instruction_count; i++) {
-            if (is_flag_set(Flag::Halt)) {
-                fmt::println("halt flag set");
+            if (!can_continue())
                 return false;
-            }
 
-            if (m_program_counter == std::numeric_limits<decltype(m_program_counter)>::max()) {
-                fmt::println("reached end of memory");
+            const auto& predecoded = fetch_predecoded(m_program_counter);
+            trace(predecoded.instruction);
+
+            const auto executed = predecoded.verified
+                ? execute_instruction<false>(predecoded.decoded)
+                : execute_instruction<true>(predecoded.decoded);
+            if (!executed) {
+                report_failure(predecoded.decoded);
                 return false;
             }
 
-            const auto instruction = fetch_instruction(m_program_counter);
-            const auto decoded = decode_instruction(instruction);
-            const auto executed = execute_instruction(decoded);
+            m_program_counter += sizeof(ProcessorSpec::insr_t);
+            m_retired_instructions++;
+        }
 
-            if (!executed) {
-                fmt::println("instruction @ pc=0x{:X} failed to execute", m_program_counter);
-                fmt::println(
-                    "type={} r1={} r2={} r3={} data={}",
-                    std::to_underlying(decoded.type),
-                    decoded.r1,
-                    decoded.r2,
-                    decoded.r3,
-                    decoded.data
-                );
+        return true;
+    }
+
+#if defined(__GNUC__)
+    // Threaded code backend using labels as values (GCC/Clang extension). Every handler
+    // retires its instruction and jumps straight to the handler of the next one, instead of
+    // going back through a shared loop and a bounds-checked switch.
+    auto execute_threaded(usize instruction_count = std::numeric_limits<usize>::max()) -> bool {
+        // Indexed by the 4-bit opcode, so every possible type has an entry. The second half
+        // holds the handlers for verified instructions, which skip the register checks.
+        static const void* const dispatch_table[] = {
+            &&load_from_reg,
+            &&store,
+            &&add,
+            &&sub,
+            &&mul,
+            &&div,
+            &&jump,
+            &&jump_if_zero,
+            &&and_,
+            &&or_,
+            &&xor_,
+            &&push,
+            &&pop,
+            &&load_from_imm,
+            &&load_from_mem,
+            &&halt,
+            &&load_from_reg_verified,
+            &&store_verified,
+            &&add_verified,
+            &&sub_verified,
+            &&mul_verified,
+            &&div_verified,
+            &&jump_verified,
+            &&jump_if_zero_verified,
+            &&and_verified,
+            &&or_verified,
+            &&xor_verified,
+            &&push_verified,
+            &&pop_verified,
+            &&load_from_imm_verified,
+            &&load_from_mem_verified,
+            &&halt_verified,
+        };
+        static_assert(std::size(dispatch_table) == 32);
+
+        const PredecodedInstruction* current = nullptr;
+        usize executed = 0;
+
+#define DISPATCH()                                                                  \
+    do {                                                                            \
+        if (executed == instruction_count)                                          \
+            return true;                                                            \
+        if (!can_continue())                                                        \
+            return false;                                                           \
+        current = &fetch_predecoded(m_program_counter);                             \
+        trace(current->instruction);                                                \
+        goto* dispatch_table[(current->verified << 4) | (std::to_underlying(current->decoded.type) & 0xF)]; \
+    } while (0)
+
+#define RETIRE(handler)                                 \
+    do {                                                \
+        if (!handler(current->decoded)) [[unlikely]] {  \
+            report_failure(current->decoded);           \
+            return false;                               \
+        }                                               \
+        m_program_counter += sizeof(insr_t);            \
+        m_retired_instructions++;                       \
+        executed++;                                     \
+        DISPATCH();                                     \
+    } while (0)
+
+        DISPATCH();
+
+    load_from_reg:
+        RETIRE(execute_load_from_reg<true>);
+    store:
+        RETIRE(execute_store<true>);
+    add:
+        RETIRE(execute_add<true>);
+    sub:
+        RETIRE(execute_sub<true>);
+    mul:
+        RETIRE(execute_mul<true>);
+    div:
+        RETIRE(execute_div<true>);
+    jump:
+        RETIRE(execute_jump<true>);
+    jump_if_zero:
+        RETIRE(execute_jump_if_zero<true>);
+    and_:
+        RETIRE(execute_and<true>);
+    or_:
+        RETIRE(execute_or<true>);
+    xor_:
+        RETIRE(execute_xor<true>);
+    push:
+        RETIRE(execute_push<true>);
+    pop:
+        RETIRE(execute_pop<true>);
+    load_from_imm:
+        RETIRE(execute_load_from_imm<true>);
+    load_from_mem:
+        RETIRE(execute_load_from_mem<true>);
+    halt:
+        RETIRE(execute_halt<true>);
+
+    load_from_reg_verified:
+        RETIRE(execute_load_from_reg<false>);
+    store_verified:
+        RETIRE(execute_store<false>);
+    add_verified:
+        RETIRE(execute_add<false>);
+    sub_verified:
+        RETIRE(execute_sub<false>);
+    mul_verified:
+        RETIRE(execute_mul<false>);
+    div_verified:
+        RETIRE(execute_div<false>);
+    jump_verified:
+        RETIRE(execute_jump<false>);
+    jump_if_zero_verified:
+        RETIRE(execute_jump_if_zero<false>);
+    and_verified:
+        RETIRE(execute_and<false>);
+    or_verified:
+        RETIRE(execute_or<false>);
+    xor_verified:
+        RETIRE(execute_xor<false>);
+    push_verified:
+        RETIRE(execute_push<false>);
+    pop_verified:
+        RETIRE(execute_pop<false>);
+    load_from_imm_verified:
+        RETIRE(execute_load_from_imm<false>);
+    load_from_mem_verified:
+        RETIRE(execute_load_from_mem<false>);
+    halt_verified:
+        RETIRE(execute_halt<false>);
+
+#undef RETIRE
+#undef DISPATCH
+    }
+#endif
+
+    struct BlockStats {
+        // Basic blocks translated so far
+        u64 compiled { 0 };
+        // Times a whole block was run in one go
+        u64 dispatches { 0 };
+        // Blocks thrown away because one of their instructions was written to
+        u64 invalidated { 0 };
+    };
+
+    [[nodiscard]] constexpr auto block_stats() const noexcept {
+        return m_block_stats;
+    }
+
+#if defined(PROCESSOR_JIT)
+    // On by default. Blocks that ran hot_threshold times get translated to native code, see jit.hpp.
+    auto enable_jit(u32 hot_threshold = Jit::default_hot_threshold) -> void {
+        m_jit.emplace(hot_threshold);
+    }
+
+    auto disable_jit() -> void {
+        m_jit.reset();
+    }
+
+    [[nodiscard]] auto jit_stats() const -> Jit::Stats {
+        return m_jit ? m_jit->stats() : Jit::Stats {};
+    }
+#endif
+
+    // Translates straight-line code into basic blocks, starting at the reset PC and at every address a jump
+    // lands on, and runs each block in one go. Flags are only computed by the last instruction in a block
+    // writing them. Whatever doesn't fit into a block (unverified instructions, a budget too small for the
+    // next block) goes through the interpreter one instruction at a time. While a trace sink is attached, blocks
+    // run without native code and with handlers that compute every flag, since trace entries hold the flags as
+    // of every single instruction.
+    auto execute_blocks(usize instruction_count = std::numeric_limits<usize>::max()) -> bool {
+        usize executed = 0;
+        while (executed < instruction_count) {
+            if (!can_continue())
                 return false;
+
+            const auto slot = m_block_index[m_program_counter];
+            auto* block = slot != 0 ? &m_blocks[slot - 1] : compile_block(m_program_counter);
+            if (block == nullptr || block->ops.size() > instruction_count - executed) {
+                if (!execute_interpreted(1))
+                    return false;
+                executed++;
+                continue;
             }
 
-            m_program_counter += sizeof(ProcessorSpec::insr_t);
+            m_block_stats.dispatches++;
+            m_decode_cache_stats.hits += block->ops.size() - block->fresh_decodes;
+            block->fresh_decodes = 0;
+
+            if (tracing_enabled && m_trace_sink != nullptr) [[unlikely]] {
+                if (!execute_block_traced(*block))
+                    return false;
+                executed += block->ops.size();
+                continue;
+            }
+
+            usize first_op = 0;
+#if defined(PROCESSOR_JIT)
+            if (m_jit)
+                first_op = execute_native(*block);
+#endif
+            for (auto i = first_op; i < block->ops.size(); i++) {
+                const auto& op = block->ops[i];
+                if (!op.handler(*this, op.decoded)) [[unlikely]] {
+                    m_retired_instructions += i;
+                    report_failure(op.decoded);
+                    return false;
+                }
+
+                m_program_counter += sizeof(insr_t);
+            }
+            m_retired_instructions += block->ops.size();
+            executed += block->ops.size();
         }
 
         return true;
@@ -212,8 +667,8 @@ public:
     [[nodiscard]] constexpr auto fetch_instruction(addr_t addr) const -> insr_t {
         static_assert(sizeof(insr_t) == 2);
 
-        const auto first_byte = read_memory(addr);
-        const auto second_byte = read_memory(addr + 1);
+        const auto first_byte = peek_memory(addr);
+        const auto second_byte = peek_memory(static_cast<addr_t>(addr + 1));
         const auto instruction = static_cast<insr_t const>((first_byte << 8) | second_byte);
         return instruction;
     }
@@ -222,6 +677,82 @@ public:
         if (instruction == 0)
             set_flag(Flag::Halt);
 
+        return decode_fields(instruction);
+    }
+
+    // Cached equivalent of fetch_instruction + decode_instruction. Entries are filled
+    // on first use and dropped again whenever one of their two bytes is written.
+    constexpr auto fetch_predecoded(addr_t address) -> const PredecodedInstruction& {
+        if (m_decode_cache[address].valid) [[likely]]
+            m_decode_cache_stats.hits++;
+
+        const auto& entry = predecode(address);
+        if (entry.instruction == 0)
+            set_flag(Flag::Halt);
+
+        return entry;
+    }
+
+    // Fills the cache entry for address if it isn't already, without executing anything or touching flags
+    constexpr auto predecode(addr_t address) -> const PredecodedInstruction& {
+        auto& entry = m_decode_cache[address];
+        if (!entry.valid) {
+            m_decode_cache_stats.misses++;
+            entry.instruction = fetch_instruction(address);
+            entry.decoded = decode_fields(entry.instruction);
+            entry.valid = true;
+            entry.verified = registers_in_range(entry.decoded);
+        }
+
+        return entry;
+    }
+
+    struct VerificationIssue {
+        addr_t address;
+        insr_t instruction;
+    };
+
+    // Decodes instruction_count instructions starting at start_address ahead of time and reports the ones
+    // using out-of-range registers. Everything else is marked verified and runs without per-instruction
+    // register checks until one of its bytes is written again. Instructions first reached through a jump
+    // are verified the same way once they are decoded, this just does it for a whole image up front.
+    auto verify(addr_t start_address, usize instruction_count) -> std::vector<VerificationIssue> {
+        auto issues = std::vector<VerificationIssue> {};
+        for (usize i = 0; i < instruction_count; i++) {
+            const auto address = static_cast<addr_t>(start_address + i * sizeof(insr_t));
+            if (address == std::numeric_limits<addr_t>::max())
+                break;
+
+            const auto& entry = predecode(address);
+            if (!entry.verified)
+                issues.push_back({ .address = address, .instruction = entry.instruction });
+        }
+        return issues;
+    }
+
+    [[nodiscard]] constexpr auto is_verified(addr_t address) const -> bool {
+        const auto* entry = m_decode_cache.find(address);
+        return entry != nullptr && entry->valid && entry->verified;
+    }
+
+    [[nodiscard]] static constexpr auto registers_in_range(const DecodedInstruction& decoded) -> bool {
+        const auto used = register_operand_count(decoded.type);
+        return (used < 1 || decoded.r1 < ProcessorSpec::register_count)
+            && (used < 2 || decoded.r2 < ProcessorSpec::register_count)
+            && (used < 3 || decoded.r3 < ProcessorSpec::register_count);
+    }
+
+    constexpr auto invalidate_decoded(addr_t address) -> void {
+        // Instructions are two bytes wide, so the one starting a byte earlier overlaps as well
+        if (auto* entry = m_decode_cache.find(address))
+            entry->valid = false;
+        if (address > 0) {
+            if (auto* entry = m_decode_cache.find(static_cast<addr_t>(address - 1)))
+                entry->valid = false;
+        }
+    }
+
+    static constexpr auto decode_fields(insr_t instruction) -> DecodedInstruction {
         // Always parse out all fields, no matter what the instruction actually requires.
         return DecodedInstruction {
             .type = static_cast<InstructionType>(instruction >> 12),
@@ -243,291 +774,740 @@ public:
             unset_flag(Flag::Negative);
     }
 
+    // With checked = false the caller guarantees registers_in_range(instruction)
+    template <bool checked = true>
     constexpr auto execute_instruction(const DecodedInstruction& instruction) -> bool {
-        const auto r1 = instruction.r1.reg;
-        const auto r2 = instruction.r2.reg;
-        const auto r3 = instruction.r3.reg;
-
-        fmt::print("0x{:X} ", m_program_counter);
         switch (instruction.type) {
-        case InstructionType::LoadFromReg: {
-            fmt::println("ldr r{}, r{}", r1, r2);
+        case InstructionType::LoadFromReg:
+            return execute_load_from_reg<checked>(instruction);
+        case InstructionType::LoadFromImm:
+            return execute_load_from_imm<checked>(instruction);
+        case InstructionType::LoadFromMem:
+            return execute_load_from_mem<checked>(instruction);
+        case InstructionType::Store:
+            return execute_store<checked>(instruction);
+        case InstructionType::Add:
+            return execute_add<checked>(instruction);
+        case InstructionType::Sub:
+            return execute_sub<checked>(instruction);
+        case InstructionType::Mul:
+            return execute_mul<checked>(instruction);
+        case InstructionType::Div:
+            return execute_div<checked>(instruction);
+        case InstructionType::Jump:
+            return execute_jump<checked>(instruction);
+        case InstructionType::JumpIfZero:
+            return execute_jump_if_zero<checked>(instruction);
+        case InstructionType::And:
+            return execute_and<checked>(instruction);
+        case InstructionType::Or:
+            return execute_or<checked>(instruction);
+        case InstructionType::Xor:
+            return execute_xor<checked>(instruction);
+        case InstructionType::Push:
+            return execute_push<checked>(instruction);
+        case InstructionType::Pop:
+            return execute_pop<checked>(instruction);
+        case InstructionType::Halt:
+            return execute_halt<checked>(instruction);
+        default:
+            return false;
+        }
+    }
 
-            if (r1 >= ProcessorSpec::register_count)
-                return false;
-            if (r2 >= ProcessorSpec::register_count)
+private:
+    constexpr auto can_continue() const -> bool {
+        if (is_flag_set(Flag::Halt)) {
+            fmt::println("halt flag set");
+            return false;
+        }
+
+        if (m_program_counter == std::numeric_limits<decltype(m_program_counter)>::max()) {
+            fmt::println("reached end of memory");
+            return false;
+        }
+
+        return true;
+    }
+
+    constexpr auto trace(insr_t instruction) -> void {
+        if constexpr (tracing_enabled) {
+            if (m_trace_sink) [[unlikely]]
+                m_trace_sink->record({
+                    .pc = m_program_counter,
+                    .instruction = instruction,
+                    .registers = m_registers,
+                    .stack_pointer = m_stack_pointer,
+                    .flags = m_flags,
+                });
+        }
+    }
+
+    using BlockHandler = auto (*)(Processor&, const DecodedInstruction&) -> bool;
+
+    // Plain function wrapping a handler, cheaper to call than a pointer to member
+    template <auto handler>
+    static auto block_thunk(Processor& processor, const DecodedInstruction& instruction) -> bool {
+        return (processor.*handler)(instruction);
+    }
+
+    struct BlockOp {
+        BlockHandler handler;
+        // Computes every flag, for running with a trace sink
+        BlockHandler traced_handler;
+        DecodedInstruction decoded;
+        insr_t instruction;
+        // Which flags this instruction has to compute, see compile_block
+        bool zn_flags;
+        bool cv_flags;
+    };
+
+    struct Block {
+        addr_t start { 0 };
+        // One past the last byte the block's instructions occupy
+        u32 end { 0 };
+        std::vector<BlockOp> ops;
+        // Instructions decoded while compiling, counted as cache misses rather than hits on the first run
+        usize fresh_decodes { 0 };
+        // Times the block ran, until it gets handed to the JIT
+        u32 runs { 0 };
+        // Native code for the first native_ops instructions, valid while native_generation matches the JIT's
+        NativeBlock native { nullptr };
+        usize native_ops { 0 };
+        u64 native_generation { 0 };
+    };
+
+    static constexpr usize max_block_length = 64;
+    static constexpr usize block_page_size = 256;
+
+    static constexpr auto ends_block(InstructionType type) -> bool {
+        switch (type) {
+        case InstructionType::Jump:
+        case InstructionType::JumpIfZero:
+        case InstructionType::Halt:
+        // Writes to memory may hit code, including the rest of this block
+        case InstructionType::Store:
+        case InstructionType::Push:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static constexpr auto writes_zn_flags(InstructionType type) -> bool {
+        switch (type) {
+        case InstructionType::Push:
+        case InstructionType::Pop:
+        case InstructionType::Jump:
+        case InstructionType::JumpIfZero:
+        case InstructionType::Halt:
+            return false;
+        default:
+            return true;
+        }
+    }
+
+    // Handlers that can bail out mid-block, in which case all flags up to that point have to be correct
+    static constexpr auto may_fail(InstructionType type) -> bool {
+        return type == InstructionType::Div || type == InstructionType::Push || type == InstructionType::Pop;
+    }
+
+    template <bool zn_flags, bool cv_flags>
+    static constexpr auto block_handler(InstructionType type) -> BlockHandler {
+        switch (type) {
+        case InstructionType::LoadFromReg:
+            return &block_thunk<&Processor::execute_load_from_reg<false, zn_flags, cv_flags>>;
+        case InstructionType::LoadFromImm:
+            return &block_thunk<&Processor::execute_load_from_imm<false, zn_flags, cv_flags>>;
+        case InstructionType::LoadFromMem:
+            return &block_thunk<&Processor::execute_load_from_mem<false, zn_flags, cv_flags>>;
+        case InstructionType::Store:
+            return &block_thunk<&Processor::execute_store<false, zn_flags, cv_flags>>;
+        case InstructionType::Add:
+            return &block_thunk<&Processor::execute_add<false, zn_flags, cv_flags>>;
+        case InstructionType::Sub:
+            return &block_thunk<&Processor::execute_sub<false, zn_flags, cv_flags>>;
+        case InstructionType::Mul:
+            return &block_thunk<&Processor::execute_mul<false, zn_flags, cv_flags>>;
+        case InstructionType::Div:
+            return &block_thunk<&Processor::execute_div<false, zn_flags, cv_flags>>;
+        case InstructionType::Jump:
+            return &block_thunk<&Processor::execute_jump<false, zn_flags, cv_flags>>;
+        case InstructionType::JumpIfZero:
+            return &block_thunk<&Processor::execute_jump_if_zero<false, zn_flags, cv_flags>>;
+        case InstructionType::And:
+            return &block_thunk<&Processor::execute_and<false, zn_flags, cv_flags>>;
+        case InstructionType::Or:
+            return &block_thunk<&Processor::execute_or<false, zn_flags, cv_flags>>;
+        case InstructionType::Xor:
+            return &block_thunk<&Processor::execute_xor<false, zn_flags, cv_flags>>;
+        case InstructionType::Push:
+            return &block_thunk<&Processor::execute_push<false, zn_flags, cv_flags>>;
+        case InstructionType::Pop:
+            return &block_thunk<&Processor::execute_pop<false, zn_flags, cv_flags>>;
+        case InstructionType::Halt:
+        default:
+            return &block_thunk<&Processor::execute_halt<false, zn_flags, cv_flags>>;
+        }
+    }
+
+    // One instruction at a time, tracing each one and retiring it before the next is traced
+    auto execute_block_traced(const Block& block) -> bool {
+        for (const auto& op : block.ops) {
+            trace(op.instruction);
+            if (!op.traced_handler(*this, op.decoded)) [[unlikely]] {
+                report_failure(op.decoded);
                 return false;
-            auto& dst = m_registers[r1];
-            auto& src = m_registers[r2];
+            }
+
+            m_program_counter += sizeof(insr_t);
+            m_retired_instructions++;
+        }
+        return true;
+    }
+
+    auto compile_block(addr_t start) -> Block* {
+        auto ops = std::vector<BlockOp> {};
+        usize fresh_decodes = 0;
+        u32 address = start;
+        // Leave the top of memory to the interpreter, which knows how to stop there
+        while (ops.size() < max_block_length && address + sizeof(insr_t) < ProcessorSpec::highest_addr) {
+            const auto cached = m_decode_cache[static_cast<addr_t>(address)].valid;
+            const auto& entry = predecode(static_cast<addr_t>(address));
+            // An all-zero instruction halts at decode time, let the interpreter take care of that
+            if (!entry.verified || entry.instruction == 0)
+                break;
+
+            if (!cached)
+                fresh_decodes++;
+            ops.push_back({
+                .handler = nullptr,
+                .traced_handler = block_handler<true, true>(entry.decoded.type),
+                .decoded = entry.decoded,
+                .instruction = entry.instruction,
+                .zn_flags = false,
+                .cv_flags = false,
+            });
+            address += sizeof(insr_t);
+
+            if (ends_block(entry.decoded.type))
+                break;
+        }
+
+        if (ops.empty())
+            return nullptr;
+
+        // Walk backwards to find the last writer of every flag. Flags have to be exact when leaving
+        // the block and right before any instruction that might fail.
+        auto zn_live = true;
+        auto carry_live = true;
+        auto overflow_live = true;
+        for (auto it = ops.rbegin(); it != ops.rend(); it++) {
+            const auto type = it->decoded.type;
+            const auto writes_carry = type == InstructionType::Sub;
+            const auto writes_overflow = type == InstructionType::Add || type == InstructionType::Mul;
+
+            const auto zn = writes_zn_flags(type) && zn_live;
+            const auto cv = (writes_carry && carry_live) || (writes_overflow && overflow_live);
+            if (zn)
+                it->handler = cv ? block_handler<true, true>(type) : block_handler<true, false>(type);
+            else
+                it->handler = cv ? block_handler<false, true>(type) : block_handler<false, false>(type);
+            it->zn_flags = zn;
+            it->cv_flags = cv;
+
+            zn_live = zn_live && !writes_zn_flags(type);
+            carry_live = carry_live && !writes_carry;
+            overflow_live = overflow_live && !writes_overflow;
+            if (may_fail(type))
+                zn_live = carry_live = overflow_live = true;
+        }
+
+        u32 slot = 0;
+        if (m_free_blocks.empty()) {
+            slot = static_cast<u32>(m_blocks.size());
+            m_blocks.emplace_back();
+        } else {
+            slot = m_free_blocks.back();
+            m_free_blocks.pop_back();
+        }
+
+        auto& block = m_blocks[slot];
+        block.start = start;
+        block.end = address;
+        block.ops = std::move(ops);
+        block.fresh_decodes = fresh_decodes;
+        block.runs = 0;
+        block.native = nullptr;
+        block.native_ops = 0;
+        block.native_generation = 0;
+
+        m_block_index[start] = slot + 1;
+        for (auto page = block.start / block_page_size; page <= (block.end - 1) / block_page_size; page++)
+            m_block_pages[page].push_back(slot);
+
+        m_block_stats.compiled++;
+        return &block;
+    }
+
+#if defined(PROCESSOR_JIT)
+    // Runs the block's native prefix, if it has one by now, and returns how many instructions that covered
+    auto execute_native(Block& block) -> usize {
+        if (block.native_generation != m_jit->generation()) {
+            if (++block.runs < m_jit->hot_threshold())
+                return 0;
+            compile_native(block);
+        }
+        if (block.native == nullptr)
+            return 0;
+
+        auto context = JitContext { .registers = m_registers, .flags = m_flags, .pc = m_program_counter, .pages = m_memory.page_table() };
+        block.native(&context);
+        m_registers = context.registers;
+        m_flags = context.flags;
+        m_program_counter = context.pc;
+        return block.native_ops;
+    }
+
+    auto compile_native(Block& block) -> void {
+        auto ops = std::vector<JitOp> {};
+        for (const auto& op : block.ops) {
+            if (!Jit::supports(op.decoded.type))
+                break;
+            // Loads from device pages need the bus
+            if (op.decoded.type == InstructionType::LoadFromMem && !m_bus.empty())
+                break;
+            ops.push_back({
+                .type = op.decoded.type,
+                .r1 = op.decoded.r1,
+                .r2 = op.decoded.r2,
+                .r3 = op.decoded.r3,
+                .data = op.decoded.data,
+                .zn_flags = op.zn_flags,
+                .cv_flags = op.cv_flags,
+            });
+        }
+
+        // Compiling may flush the code buffer, so the generation is read afterwards.
+        // Blocks that can't be translated get the current generation too, to not try again.
+        block.native = ops.empty() ? nullptr : m_jit->compile(block.start, ops);
+        block.native_ops = block.native != nullptr ? ops.size() : 0;
+        block.native_generation = m_jit->generation();
+    }
+#endif
+
+    auto invalidate_blocks(addr_t address) -> void {
+        auto& page = m_block_pages[address / block_page_size];
+        for (usize i = 0; i < page.size();) {
+            const auto& block = m_blocks[page[i]];
+            if (address >= block.start && address < block.end) {
+                // Removes the block from this page too, the next one moves into slot i
+                drop_block(page[i]);
+            } else {
+                i++;
+            }
+        }
+    }
+
+    // Everything cached about the page's contents, for when all of it might have changed
+    auto invalidate_page(usize page) -> void {
+        m_decode_cache.clear_page(page);
+        if (page > 0)
+            invalidate_decoded(static_cast<addr_t>(page * PagedMemory::page_size - 1));
+        while (!m_block_pages[page].empty())
+            drop_block(m_block_pages[page].back());
+    }
+
+    auto drop_block(u32 slot) -> void {
+        const auto& block = m_blocks[slot];
+        m_block_index[block.start] = 0;
+        for (auto page = block.start / block_page_size; page <= (block.end - 1) / block_page_size; page++)
+            std::erase(m_block_pages[page], slot);
+
+        // The ops stay around until the slot is reused, the block might still be running
+        m_free_blocks.push_back(slot);
+        m_block_stats.invalidated++;
+    }
+
+    constexpr auto clear_blocks() -> void {
+        m_block_index.clear();
+        // Dropped blocks already took themselves off their pages, clearing them again doesn't hurt
+        for (const auto& block : m_blocks) {
+            for (auto page = block.start / block_page_size; page <= (block.end - 1) / block_page_size; page++)
+                m_block_pages[page].clear();
+        }
+        m_blocks.clear();
+        m_free_blocks.clear();
+        m_block_stats = {};
+    }
+
+    template <bool checked, typename... Registers>
+    static constexpr auto registers_valid(Registers... registers) -> bool {
+        if constexpr (checked)
+            return ((registers < ProcessorSpec::register_count) && ...);
+        else
+            return true;
+    }
+
+    constexpr auto report_failure(const DecodedInstruction& decoded) const -> void {
+        fmt::println("instruction @ pc=0x{:X} failed to execute", m_program_counter);
+        fmt::println(
+            "type={} r1={} r2={} r3={} data={}",
+            std::to_underlying(decoded.type),
+            decoded.r1,
+            decoded.r2,
+            decoded.r3,
+            decoded.data
+        );
+    }
+
+    template <bool checked, bool zn_flags = true, bool cv_flags = true>
+    constexpr auto execute_load_from_reg(const DecodedInstruction& instruction) -> bool {
+        const auto r1 = instruction.r1.reg;
+        const auto r2 = instruction.r2.reg;
+
+        if (!registers_valid<checked>(r1, r2))
+            return false;
+        auto& dst = m_registers[r1];
+        auto& src = m_registers[r2];
 
-            dst = src;
+        dst = src;
 
+        if constexpr (zn_flags)
             set_zn_flags(dst);
-        } break;
-        case InstructionType::LoadFromImm: {
-            fmt::println("ldi r{}, #{}", r1, instruction.data);
 
-            if (r1 >= ProcessorSpec::register_count)
-                return false;
-            auto& dst = m_registers[r1];
+        return true;
+    }
+
+    template <bool checked, bool zn_flags = true, bool cv_flags = true>
+    constexpr auto execute_load_from_imm(const DecodedInstruction& instruction) -> bool {
+        const auto r1 = instruction.r1.reg;
 
-            dst = instruction.data;
+        if (!registers_valid<checked>(r1))
+            return false;
+        auto& dst = m_registers[r1];
+
+        dst = instruction.data;
 
+        if constexpr (zn_flags)
             set_zn_flags(dst);
-        } break;
-        case InstructionType::LoadFromMem: {
-            fmt::println("ldm r{}, r{}, r{}", r1, r2, r3);
 
-            if (r1 >= ProcessorSpec::register_count)
-                return false;
-            if (r2 >= ProcessorSpec::register_count)
-                return false;
-            if (r3 >= ProcessorSpec::register_count)
-                return false;
+        return true;
+    }
+
+    template <bool checked, bool zn_flags = true, bool cv_flags = true>
+    constexpr auto execute_load_from_mem(const DecodedInstruction& instruction) -> bool {
+        const auto r1 = instruction.r1.reg;
+        const auto r2 = instruction.r2.reg;
+        const auto r3 = instruction.r3.reg;
+
+        if (!registers_valid<checked>(r1, r2, r3))
+            return false;
 
-            auto& dst = m_registers[r1];
-            auto& high_reg = m_registers[r2];
-            auto& low_reg = m_registers[r3];
-            auto address = static_cast<addr_t>((high_reg << 8) | low_reg);
+        auto& dst = m_registers[r1];
+        auto& high_reg = m_registers[r2];
+        auto& low_reg = m_registers[r3];
+        auto address = static_cast<addr_t>((high_reg << 8) | low_reg);
 
-            dst = read_memory(address);
+        dst = read_memory(address);
 
+        if constexpr (zn_flags)
             set_zn_flags(dst);
-        } break;
-        case InstructionType::Store: {
-            fmt::println("st r{}, r{}, r{}", r1, r2, r3);
 
-            if (r1 >= ProcessorSpec::register_count)
-                return false;
-            if (r2 >= ProcessorSpec::register_count)
-                return false;
-            if (r3 >= ProcessorSpec::register_count)
-                return false;
+        return true;
+    }
 
-            auto& high_reg = m_registers[r1];
-            auto& low_reg = m_registers[r2];
-            auto& src = m_registers[r3];
-            auto address = static_cast<addr_t>((high_reg << 8) | low_reg);
+    template <bool checked, bool zn_flags = true, bool cv_flags = true>
+    constexpr auto execute_store(const DecodedInstruction& instruction) -> bool {
+        const auto r1 = instruction.r1.reg;
+        const auto r2 = instruction.r2.reg;
+        const auto r3 = instruction.r3.reg;
+
+        if (!registers_valid<checked>(r1, r2, r3))
+            return false;
+
+        auto& high_reg = m_registers[r1];
+        auto& low_reg = m_registers[r2];
+        auto& src = m_registers[r3];
+        auto address = static_cast<addr_t>((high_reg << 8) | low_reg);
 
-            write_memory(address, src);
+        write_memory(address, src);
 
+        if constexpr (zn_flags)
             set_zn_flags(src);
-        } break;
-        case InstructionType::Add: {
-            fmt::println("add r{}, r{}, r{}", r1, r2, r3);
 
-            if (r1 >= ProcessorSpec::register_count)
-                return false;
-            if (r2 >= ProcessorSpec::register_count)
-                return false;
-            if (r3 >= ProcessorSpec::register_count)
-                return false;
-            auto& dst = m_registers[r1];
-            auto& lhs = m_registers[r2];
-            auto& rhs = m_registers[r3];
+        return true;
+    }
+
+    template <bool checked, bool zn_flags = true, bool cv_flags = true>
+    constexpr auto execute_add(const DecodedInstruction& instruction) -> bool {
+        const auto r1 = instruction.r1.reg;
+        const auto r2 = instruction.r2.reg;
+        const auto r3 = instruction.r3.reg;
 
-            dst = lhs + rhs;
+        if (!registers_valid<checked>(r1, r2, r3))
+            return false;
+        auto& dst = m_registers[r1];
+        auto& lhs = m_registers[r2];
+        auto& rhs = m_registers[r3];
+
+        dst = lhs + rhs;
 
+        if constexpr (cv_flags) {
             if ((static_cast<usize>(lhs) + rhs) > std::numeric_limits<data_t>::max())
                 set_flag(Flag::Overflow);
             else
                 unset_flag(Flag::Overflow);
+        }
 
+        if constexpr (zn_flags)
             set_zn_flags(dst);
-        } break;
-        case InstructionType::Sub: {
-            fmt::println("sub r{}, r{}, r{}", r1, r2, r3);
 
-            if (r1 >= ProcessorSpec::register_count)
-                return false;
-            if (r2 >= ProcessorSpec::register_count)
-                return false;
-            if (r3 >= ProcessorSpec::register_count)
-                return false;
-            auto& dst = m_registers[r1];
-            auto& lhs = m_registers[r2];
-            auto& rhs = m_registers[r3];
+        return true;
+    }
 
-            dst = lhs - rhs;
+    template <bool checked, bool zn_flags = true, bool cv_flags = true>
+    constexpr auto execute_sub(const DecodedInstruction& instruction) -> bool {
+        const auto r1 = instruction.r1.reg;
+        const auto r2 = instruction.r2.reg;
+        const auto r3 = instruction.r3.reg;
+
+        if (!registers_valid<checked>(r1, r2, r3))
+            return false;
+        auto& dst = m_registers[r1];
+        auto& lhs = m_registers[r2];
+        auto& rhs = m_registers[r3];
+
+        dst = lhs - rhs;
 
+        if constexpr (cv_flags) {
             if (rhs > lhs)
                 set_flag(Flag::Carry);
             else
                 unset_flag(Flag::Carry);
+        }
 
+        if constexpr (zn_flags)
             set_zn_flags(dst);
-        } break;
-        case InstructionType::Mul: {
-            fmt::println("mul r{}, r{}, r{}", r1, r2, r3);
 
-            if (r1 >= ProcessorSpec::register_count)
-                return false;
-            if (r2 >= ProcessorSpec::register_count)
-                return false;
-            if (r3 >= ProcessorSpec::register_count)
-                return false;
-            auto& dst = m_registers[r1];
-            auto& lhs = m_registers[r2];
-            auto& rhs = m_registers[r3];
+        return true;
+    }
 
-            dst = lhs * rhs;
+    template <bool checked, bool zn_flags = true, bool cv_flags = true>
+    constexpr auto execute_mul(const DecodedInstruction& instruction) -> bool {
+        const auto r1 = instruction.r1.reg;
+        const auto r2 = instruction.r2.reg;
+        const auto r3 = instruction.r3.reg;
+
+        if (!registers_valid<checked>(r1, r2, r3))
+            return false;
+        auto& dst = m_registers[r1];
+        auto& lhs = m_registers[r2];
+        auto& rhs = m_registers[r3];
+
+        dst = lhs * rhs;
 
+        if constexpr (cv_flags) {
             if ((static_cast<usize>(lhs) * rhs) > std::numeric_limits<data_t>::max())
                 set_flag(Flag::Overflow);
             else
                 unset_flag(Flag::Overflow);
+        }
 
+        if constexpr (zn_flags)
             set_zn_flags(dst);
-        } break;
-        case InstructionType::Div: {
-            fmt::println("div r{}, r{}, r{}", r1, r2, r3);
 
-            if (r1 >= ProcessorSpec::register_count)
-                return false;
-            if (r2 >= ProcessorSpec::register_count)
-                return false;
-            if (r3 >= ProcessorSpec::register_count)
-                return false;
-            auto& dst = m_registers[r1];
-            auto& lhs = m_registers[r2];
-            auto& rhs = m_registers[r3];
+        return true;
+    }
 
-            if (rhs == 0) {
-                fmt::println("division by zero at instruction $0x{:X}", m_program_counter);
-                return false;
-            } else {
-                dst = lhs / rhs;
-            }
+    template <bool checked, bool zn_flags = true, bool cv_flags = true>
+    constexpr auto execute_div(const DecodedInstruction& instruction) -> bool {
+        const auto r1 = instruction.r1.reg;
+        const auto r2 = instruction.r2.reg;
+        const auto r3 = instruction.r3.reg;
+
+        if (!registers_valid<checked>(r1, r2, r3))
+            return false;
+        auto& dst = m_registers[r1];
+        auto& lhs = m_registers[r2];
+        auto& rhs = m_registers[r3];
+
+        if (rhs == 0) {
+            fmt::println("division by zero at instruction $0x{:X}", m_program_counter);
+            return false;
+        } else {
+            dst = lhs / rhs;
+        }
 
+        if constexpr (zn_flags)
             set_zn_flags(dst);
-        } break;
-        case InstructionType::Jump: {
-            fmt::println("jp r{}, r{}", r1, r2);
 
-            if (r1 >= ProcessorSpec::register_count)
-                return false;
-            if (r2 >= ProcessorSpec::register_count)
-                return false;
+        return true;
+    }
+
+    template <bool checked, bool zn_flags = true, bool cv_flags = true>
+    constexpr auto execute_jump(const DecodedInstruction& instruction) -> bool {
+        const auto r1 = instruction.r1.reg;
+        const auto r2 = instruction.r2.reg;
 
-            auto& high_reg = m_registers[r1];
-            auto& low_reg = m_registers[r2];
-            auto address = static_cast<addr_t>((high_reg << 8) | low_reg);
+        if (!registers_valid<checked>(r1, r2))
+            return false;
 
-	    // Point to the previous instruction, so execution begins at the
-	    // correct address
-            m_program_counter = address - sizeof(insr_t);
-        } break;
-        case InstructionType::JumpIfZero: {
-            fmt::println("jz r{}, r{}", r1, r2);
+        auto& high_reg = m_registers[r1];
+        auto& low_reg = m_registers[r2];
+        auto address = static_cast<addr_t>((high_reg << 8) | low_reg);
 
-            if (r1 >= ProcessorSpec::register_count)
-                return false;
-            if (r2 >= ProcessorSpec::register_count)
-                return false;
+        // Point to the previous instruction, so execution begins at the
+        // correct address
+        m_program_counter = address - sizeof(insr_t);
+
+        return true;
+    }
 
-            auto& high_reg = m_registers[r1];
-            auto& low_reg = m_registers[r2];
-            auto address = static_cast<addr_t>((high_reg << 8) | low_reg);
+    template <bool checked, bool zn_flags = true, bool cv_flags = true>
+    constexpr auto execute_jump_if_zero(const DecodedInstruction& instruction) -> bool {
+        const auto r1 = instruction.r1.reg;
+        const auto r2 = instruction.r2.reg;
 
-            if (is_flag_set(Flag::Zero))
-                m_program_counter = address - sizeof(insr_t);
-        } break;
-        case InstructionType::And: {
-            fmt::println("and r{}, r{}, r{}", r1, r2, r3);
+        if (!registers_valid<checked>(r1, r2))
+            return false;
 
-            if (r1 >= ProcessorSpec::register_count)
-                return false;
-            if (r2 >= ProcessorSpec::register_count)
-                return false;
-            if (r3 >= ProcessorSpec::register_count)
-                return false;
-            auto& dst = m_registers[r1];
-            auto& lhs = m_registers[r2];
-            auto& rhs = m_registers[r3];
+        auto& high_reg = m_registers[r1];
+        auto& low_reg = m_registers[r2];
+        auto address = static_cast<addr_t>((high_reg << 8) | low_reg);
+
+        if (is_flag_set(Flag::Zero))
+            m_program_counter = address - sizeof(insr_t);
+
+        return true;
+    }
+
+    template <bool checked, bool zn_flags = true, bool cv_flags = true>
+    constexpr auto execute_and(const DecodedInstruction& instruction) -> bool {
+        const auto r1 = instruction.r1.reg;
+        const auto r2 = instruction.r2.reg;
+        const auto r3 = instruction.r3.reg;
 
-            dst = lhs & rhs;
+        if (!registers_valid<checked>(r1, r2, r3))
+            return false;
+        auto& dst = m_registers[r1];
+        auto& lhs = m_registers[r2];
+        auto& rhs = m_registers[r3];
+
+        dst = lhs & rhs;
 
+        if constexpr (zn_flags)
             set_zn_flags(dst);
-        } break;
-        case InstructionType::Or: {
-            fmt::println("or r{}, r{}, r{}", r1, r2, r3);
 
-            if (r1 >= ProcessorSpec::register_count)
-                return false;
-            if (r2 >= ProcessorSpec::register_count)
-                return false;
-            if (r3 >= ProcessorSpec::register_count)
-                return false;
-            auto& dst = m_registers[r1];
-            auto& lhs = m_registers[r2];
-            auto& rhs = m_registers[r3];
+        return true;
+    }
+
+    template <bool checked, bool zn_flags = true, bool cv_flags = true>
+    constexpr auto execute_or(const DecodedInstruction& instruction) -> bool {
+        const auto r1 = instruction.r1.reg;
+        const auto r2 = instruction.r2.reg;
+        const auto r3 = instruction.r3.reg;
+
+        if (!registers_valid<checked>(r1, r2, r3))
+            return false;
+        auto& dst = m_registers[r1];
+        auto& lhs = m_registers[r2];
+        auto& rhs = m_registers[r3];
 
-            dst = lhs | rhs;
+        dst = lhs | rhs;
 
+        if constexpr (zn_flags)
             set_zn_flags(dst);
-        } break;
-        case InstructionType::Xor: {
-            fmt::println("xor r{}, r{}, r{}", r1, r2, r3);
 
-            if (r1 >= ProcessorSpec::register_count)
-                return false;
-            if (r2 >= ProcessorSpec::register_count)
-                return false;
-            if (r3 >= ProcessorSpec::register_count)
-                return false;
-            auto& dst = m_registers[r1];
-            auto& lhs = m_registers[r2];
-            auto& rhs = m_registers[r3];
+        return true;
+    }
 
-            dst = lhs ^ rhs;
+    template <bool checked, bool zn_flags = true, bool cv_flags = true>
+    constexpr auto execute_xor(const DecodedInstruction& instruction) -> bool {
+        const auto r1 = instruction.r1.reg;
+        const auto r2 = instruction.r2.reg;
+        const auto r3 = instruction.r3.reg;
+
+        if (!registers_valid<checked>(r1, r2, r3))
+            return false;
+        auto& dst = m_registers[r1];
+        auto& lhs = m_registers[r2];
+        auto& rhs = m_registers[r3];
+
+        dst = lhs ^ rhs;
 
+        if constexpr (zn_flags)
             set_zn_flags(dst);
-        } break;
-        case InstructionType::Push: {
-            fmt::println("push r{}", r1);
 
-            if (m_stack_pointer <= ProcessorSpec::stack_top_addr - ProcessorSpec::stack_size) {
-                fmt::println("stack overflow");
-                return false;
-            }
+        return true;
+    }
 
-            if (r1 >= ProcessorSpec::register_count)
-                return false;
-            auto& src = m_registers[r1];
+    template <bool checked, bool zn_flags = true, bool cv_flags = true>
+    constexpr auto execute_push(const DecodedInstruction& instruction) -> bool {
+        const auto r1 = instruction.r1.reg;
 
-            m_stack_pointer -= static_cast<addr_t>(sizeof(data_t));
-            m_memory[m_stack_pointer] = src;
-        } break;
-        case InstructionType::Pop: {
-            fmt::println("pop r{}", r1);
+        if (m_stack_pointer <= ProcessorSpec::stack_top_addr - ProcessorSpec::stack_size) {
+            fmt::println("stack overflow");
+            return false;
+        }
 
-            if (m_stack_pointer >= ProcessorSpec::stack_top_addr) {
-                fmt::println("stack underflow (tried popping empty stack)");
-                return false;
-            }
+        if (!registers_valid<checked>(r1))
+            return false;
+        auto& src = m_registers[r1];
 
-            if (r1 >= ProcessorSpec::register_count)
-                return false;
-            auto& dst = m_registers[r1];
+        m_stack_pointer -= static_cast<addr_t>(sizeof(data_t));
+        write_memory(m_stack_pointer, src);
 
-            dst = m_memory[m_stack_pointer];
-            m_stack_pointer += sizeof(data_t);
-        } break;
-        case InstructionType::Halt: {
-            set_flag(Flag::Halt);
-            return true;
-        } break;
-        default:
+        return true;
+    }
+
+    template <bool checked, bool zn_flags = true, bool cv_flags = true>
+    constexpr auto execute_pop(const DecodedInstruction& instruction) -> bool {
+        const auto r1 = instruction.r1.reg;
+
+        if (m_stack_pointer >= ProcessorSpec::stack_top_addr) {
+            fmt::println("stack underflow (tried popping empty stack)");
             return false;
         }
+
+        if (!registers_valid<checked>(r1))
+            return false;
+        auto& dst = m_registers[r1];
+
+        dst = read_memory(m_stack_pointer);
+        m_stack_pointer += sizeof(data_t);
+
         return true;
     }
 
-private:
-    std::array<u8, ProcessorSpec::highest_addr> m_memory { 0 };
+    template <bool checked, bool zn_flags = true, bool cv_flags = true>
+    constexpr auto execute_halt(const DecodedInstruction&) -> bool {
+        set_flag(Flag::Halt);
+        return true;
+    }
+
+    PagedMemory m_memory;
+    MemoryBus m_bus;
+    // One slot per address, instructions may start at odd addresses too
+    PageCache<PredecodedInstruction> m_decode_cache;
+    DecodeCacheStats m_decode_cache_stats {};
+
+    std::vector<Block> m_blocks;
+    std::vector<u32> m_free_blocks;
+    // Slot in m_blocks + 1 for every address a block starts at, 0 if none does
+    PageCache<u32> m_block_index;
+    // Blocks overlapping each page, so a write only has to look at a few of them
+    std::array<std::vector<u32>, (ProcessorSpec::highest_addr + 1) / block_page_size> m_block_pages {};
+    BlockStats m_block_stats {};
     std::array<reg_t, ProcessorSpec::register_count> m_registers { 0 };
 
     addr_t m_program_counter { 0 };
     addr_t m_stack_pointer { ProcessorSpec::stack_top_addr };
     u8 m_flags { 0 };
+
+    u64 m_retired_instructions { 0 };
+    TraceSink* m_trace_sink { nullptr };
+#if defined(PROCESSOR_JIT)
+    std::optional<Jit> m_jit;
+#endif
 };
@@ -0,0 +1,161 @@
+#include <profiler.hpp>
+
+#include <algorithm>
+#include <disassembler.hpp>
+#include <ranges>
+
+namespace {
+    constexpr usize address_count = ProcessorSpec::highest_addr + 1u;
+
+    auto is_jump(ProcessorSpec::insr_t instruction) -> bool {
+        const auto type = static_cast<InstructionType>(instruction >> 12);
+        return type == InstructionType::Jump || type == InstructionType::JumpIfZero;
+    }
+
+    auto ends_block(ProcessorSpec::insr_t instruction) -> bool {
+        return is_jump(instruction) || static_cast<InstructionType>(instruction >> 12) == InstructionType::Halt;
+    }
+
+    auto share(u64 part, u64 total) -> f64 {
+        return total == 0 ? 0.0 : 100.0 * static_cast<f64>(part) / static_cast<f64>(total);
+    }
+}
+
+Profiler::Profiler()
+    : m_counts(address_count)
+    , m_taken(address_count)
+    , m_targets(address_count)
+    , m_instructions(address_count) {
+}
+
+auto Profiler::record(const TraceEntry& entry) -> void {
+    if (m_pending_jump != no_jump && entry.pc != m_pending_jump + sizeof(ProcessorSpec::insr_t)) {
+        m_taken[m_pending_jump]++;
+        m_targets[m_pending_jump] = entry.pc;
+    }
+    m_pending_jump = is_jump(entry.instruction) ? entry.pc : no_jump;
+
+    m_counts[entry.pc]++;
+    m_instructions[entry.pc] = entry.instruction;
+    m_opcodes[entry.instruction >> 12]++;
+    m_total++;
+}
+
+auto Profiler::clear() -> void {
+    std::ranges::fill(m_counts, 0);
+    std::ranges::fill(m_taken, 0);
+    m_opcodes = {};
+    m_total = 0;
+    m_pending_jump = no_jump;
+}
+
+auto Profiler::blocks() const -> std::vector<Block> {
+    // Blocks start at jump targets and right after jumps
+    auto leaders = std::vector<bool>(address_count + 1);
+    for (usize pc = 0; pc < address_count; pc++) {
+        if (m_counts[pc] == 0 || !is_jump(m_instructions[pc]))
+            continue;
+        leaders[pc + sizeof(ProcessorSpec::insr_t)] = true;
+        if (m_taken[pc] != 0)
+            leaders[m_targets[pc]] = true;
+    }
+
+    auto blocks = std::vector<Block> {};
+    for (usize pc = 0; pc < address_count;) {
+        if (m_counts[pc] == 0) {
+            pc++;
+            continue;
+        }
+
+        const auto runs = m_counts[pc];
+        auto end = pc;
+        while (!ends_block(m_instructions[end])) {
+            const auto next = end + sizeof(ProcessorSpec::insr_t);
+            if (next >= address_count || leaders[next] || m_counts[next] != runs)
+                break;
+            end = next;
+        }
+
+        const auto length = (end - pc) / sizeof(ProcessorSpec::insr_t) + 1;
+        blocks.push_back(Block {
+            .start = static_cast<ProcessorSpec::addr_t>(pc),
+            .end = static_cast<ProcessorSpec::addr_t>(end),
+            .runs = runs,
+            .instructions = runs * length,
+        });
+        pc = end + sizeof(ProcessorSpec::insr_t);
+    }
+
+    std::ranges::stable_sort(blocks, std::greater {}, &Block::instructions);
+    return blocks;
+}
+
+auto Profiler::loops() const -> std::vector<Loop> {
+    auto loops = std::vector<Loop> {};
+    for (usize pc = 0; pc < address_count; pc++) {
+        if (m_taken[pc] == 0 || m_targets[pc] > pc)
+            continue;
+
+        u64 instructions = 0;
+        for (usize address = m_targets[pc]; address <= pc; address++)
+            instructions += m_counts[address];
+        loops.push_back(Loop {
+            .start = m_targets[pc],
+            .end = static_cast<ProcessorSpec::addr_t>(pc),
+            .iterations = m_taken[pc],
+            .instructions = instructions,
+        });
+    }
+
+    std::ranges::stable_sort(loops, std::greater {}, &Loop::instructions);
+    return loops;
+}
+
+auto Profiler::report(std::FILE* file, usize top) const -> void {
+    auto out = fmt::memory_buffer {};
+    auto disassembly = Disassembly {};
+    auto code = std::vector<ProcessorSpec::insr_t> {};
+
+    // One line per instruction from start to end: count, disassembly, and for jumps where they went
+    const auto annotate = [&](usize start, usize end) {
+        code.clear();
+        for (auto pc = start; pc <= end; pc += sizeof(ProcessorSpec::insr_t))
+            code.push_back(m_instructions[pc]);
+        Disassembler::disassemble(code, disassembly);
+
+        for (usize i = 0; i < code.size(); i++) {
+            const auto pc = static_cast<ProcessorSpec::addr_t>(start + i * sizeof(ProcessorSpec::insr_t));
+            const auto line = disassembly.line(i);
+            fmt::format_to(std::back_inserter(out), "    0x{:04X} {:>12}  {:<16}", pc, m_counts[pc], line.empty() ? "<illegal>" : line);
+            if (is_jump(code[i]))
+                fmt::format_to(std::back_inserter(out), " taken {}, not taken {}", taken(pc), not_taken(pc));
+            out.push_back('\n');
+        }
+    };
+
+    fmt::format_to(std::back_inserter(out), "{} instructions\n\nInstruction mix:\n", m_total);
+    auto types = std::vector<usize>(m_opcodes.size());
+    for (usize i = 0; i < types.size(); i++)
+        types[i] = i;
+    std::ranges::stable_sort(types, std::greater {}, [this](usize type) { return m_opcodes[type]; });
+    for (const auto type : types) {
+        if (m_opcodes[type] != 0)
+            fmt::format_to(std::back_inserter(out), "    {:<4} {:>12} {:6.2f}%\n", instruction_info[type].mnemonic, m_opcodes[type], share(m_opcodes[type], m_total));
+    }
+
+    const auto hot_blocks = blocks();
+    fmt::format_to(std::back_inserter(out), "\nHottest blocks:\n");
+    for (const auto& block : hot_blocks | std::views::take(top)) {
+        fmt::format_to(std::back_inserter(out), "  0x{:04X}-0x{:04X}: {} runs, {} instructions ({:.2f}%)\n", block.start, block.end, block.runs, block.instructions, share(block.instructions, m_total));
+        annotate(block.start, block.end);
+    }
+
+    const auto hot_loops = loops();
+    fmt::format_to(std::back_inserter(out), "\nHottest loops:\n");
+    for (const auto& loop : hot_loops | std::views::take(top)) {
+        fmt::format_to(std::back_inserter(out), "  0x{:04X}-0x{:04X}: {} iterations, {} instructions ({:.2f}%)\n", loop.start, loop.end, loop.iterations, loop.instructions, share(loop.instructions, m_total));
+        annotate(loop.start, loop.end);
+    }
+
+    std::fwrite(out.data(), 1, out.size(), file);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <cstdio>
+#include <vector>
+
+#include <instructions.hpp>
+#include <trace.hpp>
+
+// Counts executed instructions per PC, per opcode and how often each jump was taken, in flat tables covering
+// the whole address space. It's a trace sink, so it costs nothing while it isn't attached and can be attached
+// and detached between any two calls to Processor::execute. While it is, nothing runs as native code. Built
+// with TRACING off (see Processor::tracing_enabled) it never sees an instruction.
+//
+// Whether a jump was taken is only known once the next instruction shows up, so the very last one recorded
+// counts as not taken.
+class Profiler final : public TraceSink {
+public:
+    // Straight-line run of instructions that always executed together
+    struct Block {
+        ProcessorSpec::addr_t start;
+        // Address of the last instruction
+        ProcessorSpec::addr_t end;
+        // Times the block ran
+        u64 runs;
+        // Instructions retired in it, runs * its length
+        u64 instructions;
+    };
+
+    // Taken backward jump, from end back to start
+    struct Loop {
+        ProcessorSpec::addr_t start;
+        // Address of the jump
+        ProcessorSpec::addr_t end;
+        // Times the jump was taken
+        u64 iterations;
+        // Instructions retired between start and end, including ones that ran outside the loop
+        u64 instructions;
+    };
+
+    Profiler();
+
+    auto record(const TraceEntry& entry) -> void override;
+
+    // Counts everything as if nothing ran yet
+    auto clear() -> void;
+
+    [[nodiscard]] auto total() const noexcept { return m_total; }
+    [[nodiscard]] auto count(ProcessorSpec::addr_t pc) const { return m_counts[pc]; }
+    [[nodiscard]] auto count(InstructionType type) const { return m_opcodes[std::to_underlying(type)]; }
+    [[nodiscard]] auto taken(ProcessorSpec::addr_t pc) const { return m_taken[pc]; }
+    [[nodiscard]] auto not_taken(ProcessorSpec::addr_t pc) const { return m_counts[pc] - m_taken[pc]; }
+
+    // Every block that ran, hottest (by instructions) first
+    [[nodiscard]] auto blocks() const -> std::vector<Block>;
+    // Every loop, hottest (by instructions) first. Nested loops are listed separately.
+    [[nodiscard]] auto loops() const -> std::vector<Loop>;
+
+    // Instruction mix and the top hottest blocks and loops with their disassembly
+    auto report(std::FILE* file, usize top = 10) const -> void;
+
+private:
+    // A jump the next entry tells the outcome of
+    static constexpr u32 no_jump = ProcessorSpec::highest_addr + 1u;
+
+    std::vector<u64> m_counts;
+    std::vector<u64> m_taken;
+    // Where each jump went the last time it was taken
+    std::vector<ProcessorSpec::addr_t> m_targets;
+    // Last instruction seen at each address
+    std::vector<ProcessorSpec::insr_t> m_instructions;
+    std::array<u64, 16> m_opcodes {};
+    u64 m_total { 0 };
+    u32 m_pending_jump { no_jump };
+};
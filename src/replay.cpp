@@ -0,0 +1,156 @@
+#include <replay.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fmt/core.h>
+#include <fstream>
+#include <iterator>
+
+namespace {
+    template <typename T>
+    auto append(std::vector<u8>& bytes, const T& value) -> void {
+        const auto* data = reinterpret_cast<const u8*>(&value);
+        bytes.insert(bytes.end(), data, data + sizeof(T));
+    }
+
+    template <typename T>
+    auto read(std::span<const u8> bytes, usize offset) -> T {
+        auto value = T {};
+        std::memcpy(&value, bytes.data() + offset, sizeof(T));
+        return value;
+    }
+}
+
+ReplayRecorder::ReplayRecorder(Processor& processor, std::FILE* file, u64 interval)
+    : m_processor { processor }
+    , m_file { file }
+    , m_interval { std::max<u64>(interval, 1) }
+    , m_last {} {
+    const auto header = ReplayFormat::Header {
+        .magic = { 'P', 'R', 'P', 'L' },
+        .version = ReplayFormat::version,
+        .reserved = 0,
+        .interval = m_interval,
+    };
+    if (std::fwrite(&header, sizeof(header), 1, m_file) != 1)
+        fmt::println(stderr, "can't write replay header: {}", std::strerror(errno));
+    checkpoint();
+}
+
+auto ReplayRecorder::execute(usize instruction_count) -> bool {
+    usize executed = 0;
+    while (executed < instruction_count) {
+        const auto retired = m_processor.retired_instructions();
+        const auto budget = std::min<u64>(m_interval - retired % m_interval, instruction_count - executed);
+        const auto running = m_processor.execute(budget);
+
+        const auto ran = m_processor.retired_instructions() - retired;
+        executed += ran;
+        if (ran != 0 && m_processor.retired_instructions() % m_interval == 0)
+            checkpoint();
+        if (!running)
+            return false;
+    }
+    return true;
+}
+
+auto ReplayRecorder::checkpoint() -> void {
+    auto snapshot = m_processor.snapshot();
+
+    // Written pages are the ones the processor copied since the last snapshot
+    auto pages = std::vector<u8> {};
+    for (usize page = 0; page < PagedMemory::page_count; page++) {
+        if (!snapshot.memory.shares_page(m_last.memory, page) && !snapshot.memory.is_window(page))
+            pages.push_back(static_cast<u8>(page));
+    }
+
+    auto bytes = std::vector<u8> {};
+    bytes.reserve(sizeof(ReplayFormat::Checkpoint) + pages.size() * sizeof(ReplayFormat::Page));
+    append(bytes, ReplayFormat::Checkpoint {
+                      .retired_instructions = snapshot.retired_instructions,
+                      .registers = snapshot.registers,
+                      .program_counter = snapshot.program_counter,
+                      .stack_pointer = snapshot.stack_pointer,
+                      .flags = snapshot.flags,
+                      .reserved = 0,
+                      .page_count = static_cast<u16>(pages.size()),
+                  });
+    for (const auto page : pages) {
+        bytes.push_back(page);
+        const auto* data = snapshot.memory.page_table()[page];
+        bytes.insert(bytes.end(), data, data + PagedMemory::page_size);
+    }
+
+    if (std::fwrite(bytes.data(), 1, bytes.size(), m_file) != bytes.size())
+        fmt::println(stderr, "can't write checkpoint: {}", std::strerror(errno));
+    m_last = std::move(snapshot);
+    m_checkpoints++;
+}
+
+auto Replay::open(const std::string& path) -> std::optional<Replay> {
+    auto file = std::ifstream { path, std::ios::binary };
+    if (!file) {
+        fmt::println(stderr, "can't open {}: {}", path, std::strerror(errno));
+        return std::nullopt;
+    }
+    const auto bytes = std::vector<u8> { std::istreambuf_iterator<char> { file }, {} };
+    auto replay = from_bytes(bytes);
+    if (!replay)
+        fmt::println(stderr, "{} isn't a valid replay", path);
+    return replay;
+}
+
+auto Replay::from_bytes(std::span<const u8> bytes) -> std::optional<Replay> {
+    if (bytes.size() < sizeof(ReplayFormat::Header))
+        return std::nullopt;
+    const auto header = read<ReplayFormat::Header>(bytes, 0);
+    if (std::string_view { header.magic, sizeof(header.magic) } != ReplayFormat::magic || header.version != ReplayFormat::version || header.interval == 0)
+        return std::nullopt;
+
+    auto replay = Replay {};
+    replay.m_interval = header.interval;
+
+    // Every checkpoint starts out from the memory of the one before
+    auto memory = PagedMemory {};
+    auto offset = sizeof(header);
+    while (offset < bytes.size()) {
+        if (bytes.size() - offset < sizeof(ReplayFormat::Checkpoint))
+            return std::nullopt;
+        const auto checkpoint = read<ReplayFormat::Checkpoint>(bytes, offset);
+        offset += sizeof(checkpoint);
+        if ((bytes.size() - offset) / sizeof(ReplayFormat::Page) < checkpoint.page_count)
+            return std::nullopt;
+        if (!replay.m_checkpoints.empty() && checkpoint.retired_instructions <= replay.m_checkpoints.back().retired_instructions)
+            return std::nullopt;
+
+        for (usize i = 0; i < checkpoint.page_count; i++) {
+            const auto page = bytes[offset];
+            memory.write(static_cast<ProcessorSpec::addr_t>(page * PagedMemory::page_size), bytes.subspan(offset + 1, PagedMemory::page_size));
+            offset += sizeof(ReplayFormat::Page);
+        }
+
+        replay.m_checkpoints.push_back(Processor::Snapshot {
+            .memory = memory,
+            .registers = checkpoint.registers,
+            .program_counter = checkpoint.program_counter,
+            .stack_pointer = checkpoint.stack_pointer,
+            .flags = checkpoint.flags,
+            .retired_instructions = checkpoint.retired_instructions,
+        });
+    }
+    return replay;
+}
+
+auto Replay::seek(Processor& processor, u64 instruction_count) const -> bool {
+    // First checkpoint past instruction_count, the one before it is where to start
+    const auto next = std::ranges::upper_bound(m_checkpoints, instruction_count, std::less {}, &Processor::Snapshot::retired_instructions);
+    if (next == m_checkpoints.begin())
+        return false;
+
+    const auto& checkpoint = *std::prev(next);
+    processor.restore(checkpoint);
+    if (instruction_count != checkpoint.retired_instructions)
+        processor.execute(instruction_count - checkpoint.retired_instructions);
+    return processor.retired_instructions() == instruction_count;
+}
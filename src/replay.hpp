@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdio>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <processor.hpp>
+
+// Replay files, little endian throughout:
+//
+//   Header         magic "PRPL", version, checkpoint interval
+//   Checkpoint[]   one every interval instructions, each followed by its pages
+//   Page[]         page number and all 256 bytes of every page written since the checkpoint before (the first
+//                  checkpoint has every page that isn't all zero)
+//
+// Only RAM is recorded. Windows onto banks of memory and whatever devices return aren't, so a run that
+// depends on them doesn't replay the same way.
+namespace ReplayFormat {
+    static constexpr auto magic = std::string_view { "PRPL" };
+    static constexpr u16 version = 1;
+
+    struct Header {
+        char magic[4];
+        u16 version;
+        u16 reserved;
+        u64 interval;
+    };
+
+    struct Checkpoint {
+        u64 retired_instructions;
+        std::array<ProcessorSpec::data_t, ProcessorSpec::register_count> registers;
+        ProcessorSpec::addr_t program_counter;
+        ProcessorSpec::addr_t stack_pointer;
+        u8 flags;
+        u8 reserved;
+        u16 page_count;
+    };
+
+    struct Page {
+        u8 number;
+        PagedMemory::Page data;
+    };
+
+    static_assert(sizeof(Header) == 16 && sizeof(Checkpoint) == 24 && sizeof(Page) == 257);
+}
+
+// Runs a processor and writes a checkpoint of it every interval retired instructions. Checkpoints only
+// hold the pages written since the one before: the recorder keeps a snapshot of the last one, so the
+// processor copies every page the first time it writes to it after a checkpoint and the rest are shared.
+class ReplayRecorder {
+public:
+    static constexpr u64 default_interval = 1 << 20;
+
+    // Writes the header and a first checkpoint of where processor is right now. The file stays open and
+    // has to outlive the recorder.
+    ReplayRecorder(Processor& processor, std::FILE* file, u64 interval = default_interval);
+
+    // Processor::execute, stopping at every multiple of interval for a checkpoint
+    auto execute(usize instruction_count = std::numeric_limits<usize>::max()) -> bool;
+
+    [[nodiscard]] auto checkpoints() const noexcept { return m_checkpoints; }
+
+private:
+    auto checkpoint() -> void;
+
+    Processor& m_processor;
+    std::FILE* m_file;
+    u64 m_interval;
+    Processor::Snapshot m_last;
+    u64 m_checkpoints { 0 };
+};
+
+// Every checkpoint of a recorded run, rebuilt into snapshots that share the pages that didn't change
+// between them, so holding all of them costs about as much memory as the file.
+class Replay {
+public:
+    // Prints why and returns nothing if the file can't be read or isn't a valid replay
+    [[nodiscard]] static auto open(const std::string& path) -> std::optional<Replay>;
+    [[nodiscard]] static auto from_bytes(std::span<const u8> bytes) -> std::optional<Replay>;
+
+    [[nodiscard]] auto interval() const noexcept { return m_interval; }
+    [[nodiscard]] auto checkpoints() const noexcept -> std::span<const Processor::Snapshot> { return m_checkpoints; }
+
+    // Puts processor into the state the recorded run was in after instruction_count instructions, by
+    // restoring the last checkpoint before that and executing the rest, which is less than interval
+    // instructions. Devices attached to processor stay, windows are dropped along with the rest of its memory.
+    // Returns false if the run stopped before it got there or instruction_count is before the first checkpoint.
+    auto seek(Processor& processor, u64 instruction_count) const -> bool;
+
+private:
+    u64 m_interval { ReplayRecorder::default_interval };
+    std::vector<Processor::Snapshot> m_checkpoints;
+};
@@ -0,0 +1,227 @@
+#include <runner.hpp>
+
+#include <pool.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+namespace {
+    struct JobSlot {
+        // Only set while the job is running or waiting for its next slice
+        std::unique_ptr<Processor> processor;
+        usize budget;
+    };
+
+    struct alignas(64) Worker {
+        std::mutex mutex;
+        std::deque<u32> queue;
+        // Processors of finished jobs, reset and reused for the next ones
+        ProcessorPool pool;
+        JobRunner::Stats stats;
+    };
+
+    // State of one JobRunner::run call, shared by all of its threads
+    class Run {
+    public:
+        Run(std::span<const Job> jobs, usize threads, usize time_slice, std::stop_token stop_token)
+            : m_jobs { jobs }
+            , m_time_slice { time_slice }
+            , m_stop_token { std::move(stop_token) }
+            , m_slots(jobs.size())
+            , m_results(jobs.size())
+            , m_remaining { jobs.size() } {
+            for (usize i = 0; i < threads; i++)
+                m_workers.push_back(std::make_unique<Worker>());
+
+            // Contiguous chunks, pushed in reverse so every thread starts with the front of its chunk
+            for (usize i = 0; i < threads; i++) {
+                const auto begin = jobs.size() * i / threads;
+                const auto end = jobs.size() * (i + 1) / threads;
+                for (auto job = end; job > begin; job--)
+                    m_workers[i]->queue.push_back(static_cast<u32>(job - 1));
+            }
+            for (usize job = 0; job < jobs.size(); job++)
+                m_slots[job].budget = jobs[job].instruction_budget;
+        }
+
+        auto work(usize self) -> void {
+            auto& worker = *m_workers[self];
+            while (m_remaining.load(std::memory_order_acquire) != 0) {
+                // Read before looking for work, so nothing queued after that gets slept through
+                const auto generation = m_generation.load(std::memory_order_acquire);
+                auto job = pop(worker);
+                if (!job)
+                    job = steal(self);
+                if (!job) {
+                    m_generation.wait(generation, std::memory_order_acquire);
+                    continue;
+                }
+
+                if (run_slice(worker, *job)) {
+                    // At the front, so the other jobs in the queue get their slice before this one's next
+                    auto stealable = false;
+                    {
+                        const auto lock = std::scoped_lock { worker.mutex };
+                        worker.queue.push_front(*job);
+                        stealable = worker.queue.size() > 1;
+                    }
+                    // A job that's alone in its queue is the one this thread runs next anyway
+                    if (stealable)
+                        wake();
+                }
+            }
+        }
+
+        [[nodiscard]] auto stats() const {
+            auto total = JobRunner::Stats {};
+            for (const auto& worker : m_workers) {
+                total.slices += worker->stats.slices;
+                total.steals += worker->stats.steals;
+                total.retired_instructions += worker->stats.retired_instructions;
+            }
+            return total;
+        }
+
+        [[nodiscard]] auto take_results() {
+            return std::move(m_results);
+        }
+
+    private:
+        static auto pop(Worker& worker) -> std::optional<u32> {
+            const auto lock = std::scoped_lock { worker.mutex };
+            if (worker.queue.empty())
+                return std::nullopt;
+            const auto job = worker.queue.back();
+            worker.queue.pop_back();
+            return job;
+        }
+
+        // Wakes every thread waiting for work
+        auto wake() -> void {
+            m_generation.fetch_add(1, std::memory_order_release);
+            m_generation.notify_all();
+        }
+
+        auto steal(usize self) -> std::optional<u32> {
+            for (usize i = 1; i < m_workers.size(); i++) {
+                auto& victim = *m_workers[(self + i) % m_workers.size()];
+                const auto lock = std::scoped_lock { victim.mutex };
+                if (victim.queue.empty())
+                    continue;
+                const auto job = victim.queue.front();
+                victim.queue.pop_front();
+                m_workers[self]->stats.steals++;
+                return job;
+            }
+            return std::nullopt;
+        }
+
+        // Returns true if the job wants another slice
+        auto run_slice(Worker& worker, u32 index) -> bool {
+            auto& slot = m_slots[index];
+            if (m_stop_token.stop_requested()) {
+                finish(worker, index, JobStatus::Cancelled);
+                return false;
+            }
+            if (!slot.processor && !start(worker, index))
+                return false;
+
+            auto& processor = *slot.processor;
+            const auto slice = std::min(m_time_slice, slot.budget);
+            const auto retired_before = processor.retired_instructions();
+            const auto running = processor.execute(slice);
+            worker.stats.slices++;
+            worker.stats.retired_instructions += processor.retired_instructions() - retired_before;
+
+            if (!running) {
+                if (processor.is_flag_set(Processor::Flag::Halt))
+                    finish(worker, index, JobStatus::Halted);
+                else if (processor.program_counter() == ProcessorSpec::highest_addr)
+                    finish(worker, index, JobStatus::EndOfMemory);
+                else
+                    finish(worker, index, JobStatus::Failed);
+                return false;
+            }
+
+            slot.budget -= slice;
+            if (slot.budget == 0) {
+                finish(worker, index, JobStatus::OutOfBudget);
+                return false;
+            }
+            return true;
+        }
+
+        auto start(Worker& worker, u32 index) -> bool {
+            const auto& job = m_jobs[index];
+            auto& slot = m_slots[index];
+
+            slot.processor = worker.pool.acquire();
+
+            auto& processor = *slot.processor;
+            if (job.image != nullptr) {
+                job.image->map_into(processor);
+            } else {
+                if (ProcessorSpec::reset_pc + job.program.size() * sizeof(insr_t) > ProcessorSpec::highest_addr + 1u) {
+                    finish(worker, index, JobStatus::Failed);
+                    return false;
+                }
+                for (usize i = 0; i < job.program.size(); i++)
+                    processor.write_instruction(static_cast<addr_t>(ProcessorSpec::reset_pc + i * sizeof(insr_t)), job.program[i]);
+            }
+            for (u8 reg = 0; reg < ProcessorSpec::register_count; reg++)
+                processor.write_register(reg, job.registers[reg]);
+            return true;
+        }
+
+        auto finish(Worker& worker, u32 index, JobStatus status) -> void {
+            auto& slot = m_slots[index];
+            auto& result = m_results[index];
+            if (slot.processor) {
+                const auto& processor = *slot.processor;
+                std::ranges::copy(processor.registers(), result.registers.begin());
+                result.program_counter = processor.program_counter();
+                result.stack_pointer = processor.stack_pointer();
+                result.flags = processor.flags();
+                result.retired_instructions = processor.retired_instructions();
+                worker.pool.release(std::move(slot.processor));
+            } else {
+                result.registers = m_jobs[index].registers;
+            }
+            result.status = status;
+            if (m_remaining.fetch_sub(1, std::memory_order_release) == 1)
+                wake();
+        }
+
+        std::span<const Job> m_jobs;
+        usize m_time_slice;
+        std::stop_token m_stop_token;
+        std::vector<std::unique_ptr<Worker>> m_workers;
+        std::vector<JobSlot> m_slots;
+        std::vector<JobResult> m_results;
+        std::atomic<usize> m_remaining;
+        // Bumped whenever there's something for idle threads to do, they wait for it to change
+        std::atomic<u32> m_generation { 0 };
+    };
+}
+
+JobRunner::JobRunner(usize threads, usize time_slice)
+    : m_threads { std::max<usize>(threads, 1) }
+    , m_time_slice { std::max<usize>(time_slice, 1) } {
+}
+
+auto JobRunner::run(std::span<const Job> jobs, std::stop_token stop_token) -> std::vector<JobResult> {
+    auto state = Run { jobs, m_threads, m_time_slice, std::move(stop_token) };
+    {
+        // The calling thread is worker 0
+        auto threads = std::vector<std::jthread> {};
+        for (usize i = 1; i < m_threads; i++)
+            threads.emplace_back([&state, i] { state.work(i); });
+        state.work(0);
+    }
+
+    m_stats = state.stats();
+    return state.take_results();
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <limits>
+#include <span>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+#include <image.hpp>
+#include <processor.hpp>
+
+// One program run, loaded at the reset PC. The program isn't copied, it has to stay alive until
+// JobRunner::run returns, which also means many jobs can share one image.
+struct Job {
+    std::span<const insr_t> program;
+    // Used instead of program if set, mapped into memory and started at its entry
+    const MappedImage* image { nullptr };
+    std::array<data_t, ProcessorSpec::register_count> registers {};
+    usize instruction_budget { std::numeric_limits<usize>::max() };
+};
+
+enum class JobStatus : u8 {
+    Halted,
+    EndOfMemory,
+    // An instruction failed, the program counter points to it. Also used for programs that don't fit into
+    // memory, which run() leaves to the caller to report.
+    Failed,
+    // Used up instruction_budget
+    OutOfBudget,
+    // Stopped through the stop token passed to run(), possibly before it even started
+    Cancelled,
+};
+
+struct JobResult {
+    std::array<reg_t, ProcessorSpec::register_count> registers {};
+    addr_t program_counter { ProcessorSpec::reset_pc };
+    addr_t stack_pointer { ProcessorSpec::stack_top_addr };
+    u8 flags { 0 };
+    u64 retired_instructions { 0 };
+    JobStatus status { JobStatus::Cancelled };
+};
+
+// Runs lots of jobs on a pool of threads. Every thread owns a queue of jobs, takes work from the back
+// of its own queue and steals from the front of the others' once it runs dry. Jobs run for at most
+// time_slice instructions at a time (using the budget parameter of Processor::execute), after which
+// the stop token is checked and the job goes back to the front of the queue, behind every job that hasn't
+// had a slice since. Threads that find nothing to run or steal sleep until a queue gets a second job or the
+// last job finishes, instead of polling the other queues.
+//
+// Each result is written only by the thread that finished its job, so collecting them doesn't need any
+// shared lock, and the queues are only locked by their owner and whoever steals from them.
+class JobRunner {
+public:
+    static constexpr usize default_time_slice = 1 << 16;
+
+    struct Stats {
+        // Calls to Processor::execute
+        u64 slices { 0 };
+        // Jobs taken from another thread's queue
+        u64 steals { 0 };
+        u64 retired_instructions { 0 };
+    };
+
+    explicit JobRunner(usize threads = std::thread::hardware_concurrency(), usize time_slice = default_time_slice);
+
+    // Blocks until every job stopped, results are in the same order as jobs
+    auto run(std::span<const Job> jobs, std::stop_token stop_token = {}) -> std::vector<JobResult>;
+
+    [[nodiscard]] auto threads() const noexcept { return m_threads; }
+    [[nodiscard]] auto time_slice() const noexcept { return m_time_slice; }
+    // Of the last run() call
+    [[nodiscard]] auto stats() const noexcept { return m_stats; }
+
+private:
+    usize m_threads;
+    usize m_time_slice;
+    Stats m_stats {};
+};
@@ -0,0 +1,51 @@
+#include <trace.hpp>
+
+#include <array>
+#include <disassembler.hpp>
+
+RingTraceSink::RingTraceSink(usize capacity)
+    : m_entries(capacity == 0 ? 1 : capacity) {
+}
+
+auto RingTraceSink::record(const TraceEntry& entry) -> void {
+    m_entries[m_recorded % m_entries.size()] = entry;
+    m_recorded++;
+}
+
+auto RingTraceSink::entries() const -> std::vector<TraceEntry> {
+    if (m_recorded <= m_entries.size())
+        return { m_entries.begin(), m_entries.begin() + static_cast<isize>(m_recorded) };
+
+    // Buffer wrapped around, the oldest entry sits right after the newest one
+    const auto oldest = static_cast<isize>(m_recorded % m_entries.size());
+    auto result = std::vector<TraceEntry> { m_entries.begin() + oldest, m_entries.end() };
+    result.insert(result.end(), m_entries.begin(), m_entries.begin() + oldest);
+    return result;
+}
+
+FileTraceSink::FileTraceSink(std::FILE* file)
+    : m_file(file) {
+}
+
+FileTraceSink::~FileTraceSink() {
+    flush();
+}
+
+auto FileTraceSink::record(const TraceEntry& entry) -> void {
+    auto line = std::array<char, Disassembler::max_line_length> {};
+    if (const auto length = Disassembler::disassemble_line(entry.instruction, line))
+        fmt::format_to(std::back_inserter(m_buffer), "0x{:X} {}\n", entry.pc, std::string_view { line.data(), *length });
+    else
+        fmt::format_to(std::back_inserter(m_buffer), "0x{:X} <illegal 0x{:04X}>\n", entry.pc, entry.instruction);
+
+    if (m_buffer.size() >= flush_threshold)
+        flush();
+}
+
+auto FileTraceSink::flush() -> void {
+    if (m_buffer.size() == 0)
+        return;
+    std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+    std::fflush(m_file);
+    m_buffer.clear();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <cstdio>
+#include <fmt/format.h>
+#include <vector>
+
+#include <spec.hpp>
+
+struct TraceEntry {
+    // Address the instruction was fetched from
+    ProcessorSpec::addr_t pc;
+    // Raw encoded instruction, formatting is left to the sink
+    ProcessorSpec::insr_t instruction;
+    // Everything below is the state right before the instruction ran, what it changed shows up in the next entry
+    std::array<ProcessorSpec::data_t, ProcessorSpec::register_count> registers;
+    ProcessorSpec::addr_t stack_pointer;
+    u8 flags;
+};
+
+// Receives every instruction the processor executes while a sink is attached.
+// Without a sink, the processor does no formatting or I/O per instruction at all.
+class TraceSink {
+public:
+    virtual ~TraceSink() = default;
+
+    virtual auto record(const TraceEntry& entry) -> void = 0;
+    virtual auto flush() -> void { }
+};
+
+// Accepts and discards everything. Useful for measuring the cost of the hook itself.
+class NullTraceSink final : public TraceSink {
+public:
+    auto record(const TraceEntry&) -> void override { }
+};
+
+// Keeps the most recent entries in memory, overwriting the oldest ones once full.
+class RingTraceSink final : public TraceSink {
+public:
+    explicit RingTraceSink(usize capacity);
+
+    auto record(const TraceEntry& entry) -> void override;
+
+    // Retained entries, oldest first
+    [[nodiscard]] auto entries() const -> std::vector<TraceEntry>;
+    // Total number of entries ever recorded, including overwritten ones
+    [[nodiscard]] auto recorded() const noexcept { return m_recorded; }
+    [[nodiscard]] auto capacity() const noexcept { return m_entries.size(); }
+
+private:
+    std::vector<TraceEntry> m_entries;
+    usize m_recorded { 0 };
+};
+
+// Writes one disassembled line per instruction ("0xFF00 ldi r0, #5") to a file.
+// Lines are collected in a buffer and only handed to the C stream once it fills up.
+class FileTraceSink final : public TraceSink {
+public:
+    explicit FileTraceSink(std::FILE* file);
+    ~FileTraceSink() override;
+
+    FileTraceSink(const FileTraceSink&) = delete;
+    auto operator=(const FileTraceSink&) -> FileTraceSink& = delete;
+
+    auto record(const TraceEntry& entry) -> void override;
+    auto flush() -> void override;
+
+private:
+    static constexpr usize flush_threshold = 64 * 1024;
+
+    std::FILE* m_file;
+    fmt::memory_buffer m_buffer;
+};
@@ -0,0 +1,106 @@
+#include <undo.hpp>
+
+#include <algorithm>
+#include <bit>
+
+UndoLog::UndoLog(Processor& processor, usize capacity)
+    : m_processor { processor }
+    , m_entries(std::bit_ceil(std::max<usize>(capacity, 1)))
+    , m_mask { m_entries.size() - 1 } {
+}
+
+auto UndoLog::record(const TraceEntry& entry) -> void {
+    const auto retired = m_processor.retired_instructions();
+    if (m_size > 0 && retired + 1 == m_retired) {
+        // The newest entry failed instead of retiring, this is the retry or whatever runs next in its place
+        m_next = (m_next - 1) & m_mask;
+        m_size--;
+    } else if (m_size > 0 && retired != m_retired) {
+        clear();
+    }
+
+    auto undo = Entry { .pc = entry.pc, .address = 0, .old_register = 0, .old_memory = 0, .flags = entry.flags, .kind = 0 };
+    const auto decoded = Processor::decode_fields(entry.instruction);
+    const auto write_register = [&] {
+        if (decoded.r1 >= ProcessorSpec::register_count)
+            return;
+        undo.kind |= static_cast<u8>(Register | decoded.r1);
+        undo.old_register = entry.registers[decoded.r1];
+    };
+    const auto write_memory = [&](ProcessorSpec::addr_t address) {
+        if (m_processor.has_device(address))
+            return;
+        undo.kind |= Memory;
+        undo.address = address;
+        undo.old_memory = m_processor.peek_memory(address);
+    };
+
+    switch (decoded.type) {
+    case InstructionType::Store:
+        if (decoded.r1 < ProcessorSpec::register_count && decoded.r2 < ProcessorSpec::register_count)
+            write_memory(static_cast<ProcessorSpec::addr_t>((entry.registers[decoded.r1] << 8) | entry.registers[decoded.r2]));
+        break;
+    case InstructionType::Push:
+        undo.kind |= Push;
+        write_memory(static_cast<ProcessorSpec::addr_t>(entry.stack_pointer - 1));
+        break;
+    case InstructionType::Pop:
+        undo.kind |= Pop;
+        write_register();
+        break;
+    case InstructionType::Jump:
+    case InstructionType::JumpIfZero:
+    case InstructionType::Halt:
+        break;
+    default:
+        write_register();
+        break;
+    }
+
+    m_entries[m_next] = undo;
+    m_next = (m_next + 1) & m_mask;
+    m_size = std::min(m_size + 1, m_entries.size());
+    m_retired = retired + 1;
+}
+
+auto UndoLog::step_back(usize instruction_count) -> usize {
+    if (m_size == 0)
+        return 0;
+
+    const auto retired = m_processor.retired_instructions();
+    if (retired + 1 == m_retired) {
+        // Stopped at the newest entry without retiring it, there's nothing of it to undo
+        m_next = (m_next - 1) & m_mask;
+        m_size--;
+    } else if (retired != m_retired) {
+        clear();
+        return 0;
+    }
+
+    usize undone = 0;
+    for (; undone < instruction_count && m_size > 0; undone++) {
+        m_next = (m_next - 1) & m_mask;
+        m_size--;
+        undo(m_entries[m_next]);
+    }
+    m_retired = m_processor.retired_instructions();
+    return undone;
+}
+
+auto UndoLog::clear() -> void {
+    m_size = 0;
+}
+
+auto UndoLog::undo(const Entry& entry) -> void {
+    if (entry.kind & Memory)
+        m_processor.write_memory(entry.address, entry.old_memory);
+    if (entry.kind & Register)
+        m_processor.write_register(entry.kind & 0b111, entry.old_register);
+    if (entry.kind & Push)
+        m_processor.set_stack_pointer(static_cast<ProcessorSpec::addr_t>(m_processor.stack_pointer() + 1));
+    if (entry.kind & Pop)
+        m_processor.set_stack_pointer(static_cast<ProcessorSpec::addr_t>(m_processor.stack_pointer() - 1));
+    m_processor.set_flags(entry.flags);
+    m_processor.set_program_counter(entry.pc);
+    m_processor.set_retired_instructions(m_processor.retired_instructions() - 1);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+
+#include <processor.hpp>
+
+// Remembers what every instruction overwrote, so execution can be stepped backwards from wherever it stopped,
+// like the instruction that divided by zero or overflowed the stack. It's a trace sink: attach it to the
+// processor it was made for, and nothing runs as native code while it is. Built with TRACING off (see
+// Processor::tracing_enabled) it records nothing and there's nothing to step back.
+//
+// Each instruction takes up one 8 byte entry in a ring allocated up front, holding its address, the flags
+// before it ran, and the old value of the register or memory byte it wrote to. The stack pointer only ever
+// moves by one, so push and pop don't have to store it. Once the ring is full the oldest entries are
+// overwritten, stepping back goes at most capacity instructions back.
+//
+// Writes to devices can't be taken back and aren't recorded, the rest of the instruction still is. The log
+// empties itself when the processor ends up anywhere it didn't see it go, like after a restore or a run
+// without the log attached.
+class UndoLog final : public TraceSink {
+public:
+    static constexpr usize default_capacity = 1 << 16;
+
+    // Rounded up to a power of two
+    explicit UndoLog(Processor& processor, usize capacity = default_capacity);
+
+    auto record(const TraceEntry& entry) -> void override;
+
+    // Undoes up to instruction_count of the instructions retired last, newest first, and returns how many
+    // that were. The processor ends up where it was before the oldest of them ran, Halt flag included.
+    auto step_back(usize instruction_count = 1) -> usize;
+
+    auto clear() -> void;
+
+    // Instructions that can be stepped back
+    [[nodiscard]] auto size() const noexcept { return m_size; }
+    [[nodiscard]] auto capacity() const noexcept { return m_entries.size(); }
+
+private:
+    struct Entry {
+        ProcessorSpec::addr_t pc;
+        // Only valid with Memory set
+        ProcessorSpec::addr_t address;
+        ProcessorSpec::data_t old_register;
+        ProcessorSpec::data_t old_memory;
+        u8 flags;
+        // Register written in the lowest 3 bits, then the Kind bits
+        u8 kind;
+    };
+
+    static_assert(sizeof(Entry) == 8);
+
+    enum Kind : u8 {
+        Register = 0b0000'1000,
+        Memory = 0b0001'0000,
+        Push = 0b0010'0000,
+        Pop = 0b0100'0000,
+    };
+
+    auto undo(const Entry& entry) -> void;
+
+    Processor& m_processor;
+    std::vector<Entry> m_entries;
+    usize m_mask;
+    // Slot the next entry goes into
+    usize m_next { 0 };
+    usize m_size { 0 };
+    // Retired instructions the processor is at once the newest entry retired
+    u64 m_retired { 0 };
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdio>
+#include <gtest/gtest.h>
+
+#include <assembler.hpp>
+#include <processor.hpp>
+
+// Writes code to consecutive addresses starting at the reset PC
+inline auto load(Processor& processor, const std::vector<ProcessorSpec::insr_t>& code) {
+    for (usize i = 0; i < code.size(); i++)
+        processor.write_instruction(static_cast<addr_t>(ProcessorSpec::reset_pc + i * sizeof(insr_t)), code[i]);
+}
+
+inline auto load(Processor& processor, const std::string& source) {
+    load(processor, Assembler::assemble(source));
+}
+
+// Registers, program counter, stack pointer, flags, retired instructions and all of memory. Reports the first
+// address that differs.
+inline auto expect_same_state(const Processor& actual, const Processor& expected) {
+    EXPECT_TRUE(std::ranges::equal(actual.registers(), expected.registers()));
+    EXPECT_EQ(actual.program_counter(), expected.program_counter());
+    EXPECT_EQ(actual.stack_pointer(), expected.stack_pointer());
+    EXPECT_EQ(actual.flags(), expected.flags());
+    EXPECT_EQ(actual.retired_instructions(), expected.retired_instructions());
+    for (u32 address = 0; address <= ProcessorSpec::highest_addr; address++) {
+        if (actual.read_memory(static_cast<addr_t>(address)) != expected.read_memory(static_cast<addr_t>(address))) {
+            ADD_FAILURE() << "memory differs at 0x" << std::hex << address;
+            break;
+        }
+    }
+}
+
+// Everything written to file so far, up to 1 MiB
+inline auto read_all(std::FILE* file) {
+    std::rewind(file);
+    auto bytes = std::vector<u8>(1 << 20);
+    bytes.resize(std::fread(bytes.data(), 1, bytes.size(), file));
+    return bytes;
+}
@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 #include <assembler.hpp>
+#include <cstdio>
+#include <processor.hpp>
+#include <sstream>
 
 TEST(Assembler, AssembleValidProgram) {
     auto source = std::string { R"(
@@ -85,3 +88,312 @@ TEST(Assembler, TooManyArguments) {
 
     EXPECT_EQ(code.size(), 0);
 }
+
+TEST(Assembler, AssembleIntoBuffer) {
+    const auto source = std::string_view { "ldi r0, #0x2A\n\n  push r0  \r\nhlt" };
+
+    auto buffer = std::array<ProcessorSpec::insr_t, 3> {};
+    EXPECT_EQ(Assembler::assemble(source, buffer), 3);
+    EXPECT_EQ(std::vector(buffer.begin(), buffer.end()), Assembler::assemble(source));
+
+    auto small = std::array<ProcessorSpec::insr_t, 2> {};
+    EXPECT_EQ(Assembler::assemble(source, small), std::nullopt);
+}
+
+TEST(Assembler, ImmediateNotANumber) {
+    EXPECT_TRUE(Assembler::assemble("ldi r0, #zz").empty());
+    EXPECT_TRUE(Assembler::assemble("ldi r0, #0x").empty());
+    EXPECT_TRUE(Assembler::assemble("ldi r0, #12ab").empty());
+}
+
+static const auto stream_source = std::string_view { "ldi r0, #1\nldi r1, #0x20\n\nst r1, r0, r0\npush r0\nhlt" };
+
+TEST(Assembler, StreamInTinyChunks) {
+    for (usize chunk_size = 1; chunk_size <= 7; chunk_size++) {
+        auto sink = VectorInstructionSink {};
+        auto stream = AssemblerStream { sink };
+        for (usize i = 0; i < stream_source.size(); i += chunk_size)
+            EXPECT_TRUE(stream.feed(stream_source.substr(i, chunk_size)));
+        EXPECT_TRUE(stream.finish());
+
+        EXPECT_EQ(stream.instructions(), 5);
+        EXPECT_EQ(sink.instructions(), Assembler::assemble(stream_source));
+    }
+}
+
+TEST(Assembler, StreamFromIstreamAndFd) {
+    auto input = std::istringstream { std::string { stream_source } };
+    auto from_istream = VectorInstructionSink {};
+    EXPECT_EQ(Assembler::assemble(input, from_istream), 5);
+    EXPECT_EQ(from_istream.instructions(), Assembler::assemble(stream_source));
+
+    auto* file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    std::fwrite(stream_source.data(), 1, stream_source.size(), file);
+    std::fflush(file);
+    std::rewind(file);
+    auto from_fd = VectorInstructionSink {};
+    EXPECT_EQ(Assembler::assemble_fd(fileno(file), from_fd), 5);
+    EXPECT_EQ(from_fd.instructions(), Assembler::assemble(stream_source));
+    std::fclose(file);
+}
+
+TEST(Assembler, StreamStopsAtFirstError) {
+    auto sink = VectorInstructionSink {};
+    auto stream = AssemblerStream { sink };
+    EXPECT_FALSE(stream.feed("ldi r0, #1\nmov r0, r1\nhlt\n"));
+    EXPECT_TRUE(stream.failed());
+    EXPECT_FALSE(stream.finish());
+    EXPECT_EQ(sink.instructions().size(), 1);
+}
+
+TEST(Assembler, StreamIntoProcessor) {
+    auto processor = Processor {};
+    auto sink = LoadingInstructionSink { processor };
+    auto stream = AssemblerStream { sink };
+    EXPECT_TRUE(stream.feed(stream_source));
+    EXPECT_TRUE(stream.finish());
+    EXPECT_EQ(sink.address(), ProcessorSpec::reset_pc + 5 * sizeof(insr_t));
+
+    processor.execute();
+    EXPECT_EQ(processor.read_memory(0x2001), 1);
+    EXPECT_EQ(processor.registers()[0], 1);
+}
+
+TEST(Assembler, ImageSections) {
+    const auto image = Assembler::assemble_image(R"(
+        ldi r0, #1
+        hlt
+    .org 0x1000
+        push r0
+    .org 0x0FFE
+        pop r1
+    )");
+    ASSERT_TRUE(image);
+    ASSERT_EQ(image->sections.size(), 3);
+    EXPECT_EQ(image->sections[0].origin, ProcessorSpec::reset_pc);
+    EXPECT_EQ(image->sections[0].size, 4);
+    EXPECT_EQ(image->sections[1].origin, 0x1000);
+    EXPECT_EQ(image->sections[2].origin, 0x0FFE);
+
+    auto processor = Processor {};
+    image->load_into(processor);
+    EXPECT_EQ(processor.read_memory(0xFF01), 1);
+    EXPECT_EQ(processor.read_memory(0x1000), std::to_underlying(InstructionType::Push) << 4);
+    EXPECT_EQ(processor.read_memory(0x0FFE), (std::to_underlying(InstructionType::Pop) << 4) | 1);
+}
+
+TEST(Assembler, ImageRejectsBadLayouts) {
+    EXPECT_FALSE(Assembler::assemble_image(".org 0x1000\nhlt\nhlt\n.org 0x1002\nhlt"));
+    EXPECT_FALSE(Assembler::assemble_image(".org 0xFFFE\nhlt\nhlt"));
+    EXPECT_FALSE(Assembler::assemble_image(".org 0x10000\nhlt"));
+    EXPECT_FALSE(Assembler::assemble_image(".org\nhlt"));
+    // Flat programs have no place to put sections
+    EXPECT_TRUE(Assembler::assemble(".org 0x1000\nhlt").empty());
+}
+
+TEST(Assembler, ParallelImageMatchesSerial) {
+    auto source = std::string {};
+    for (auto section = 0; section < 16; section++) {
+        source += fmt::format(".org 0x{:X}\n", section * 0x0C00);
+        for (auto i = 0; i < 300; i++)
+            source += fmt::format("    ldi r{}, #{}\n    add r1, r2, r3\n\n", i % 8, (section + i) % 256);
+    }
+    source += "hlt";
+
+    const auto serial = Assembler::assemble_image(source);
+    ASSERT_TRUE(serial);
+    EXPECT_EQ(serial->sections.size(), 16);
+    for (const auto threads : { 2, 3, 8 }) {
+        for (const auto chunk_size : { 1, 100, 4096 }) {
+            const auto parallel = Assembler::assemble_image(source, threads, chunk_size);
+            ASSERT_TRUE(parallel);
+            EXPECT_EQ(parallel->memory, serial->memory);
+            ASSERT_EQ(parallel->sections.size(), serial->sections.size());
+            for (usize i = 0; i < serial->sections.size(); i++) {
+                EXPECT_EQ(parallel->sections[i].origin, serial->sections[i].origin);
+                EXPECT_EQ(parallel->sections[i].size, serial->sections[i].size);
+            }
+        }
+    }
+}
+
+TEST(Assembler, LabelsAndExpressions) {
+    const auto code = Assembler::assemble(R"(
+        ldi r6, $(done >> 8)     ; forward reference, patched at the end
+        ldi r7, $(done & 0xFF)
+        ldi r0, $((1 << 4) | 0b11 * 2 - -1)
+        ldi r1, $(~start & 0xFF)
+start:  jp r6, r7
+        ldi r2, #1
+done:
+        hlt
+    )");
+    ASSERT_EQ(code.size(), 7);
+    EXPECT_EQ(code[0], encode_instruction(InstructionType::LoadFromImm, Register { 6 }, Immediate { 0xFF }));
+    EXPECT_EQ(code[1], encode_instruction(InstructionType::LoadFromImm, Register { 7 }, Immediate { 0x0C }));
+    EXPECT_EQ(code[2], encode_instruction(InstructionType::LoadFromImm, Register { 0 }, Immediate { 23 }));
+    EXPECT_EQ(code[3], encode_instruction(InstructionType::LoadFromImm, Register { 1 }, Immediate { 0xF7 }));
+
+    auto processor = Processor {};
+    for (usize i = 0; i < code.size(); i++)
+        processor.write_instruction(static_cast<addr_t>(ProcessorSpec::reset_pc + i * sizeof(insr_t)), code[i]);
+    processor.execute();
+    EXPECT_EQ(processor.registers()[2], 0);
+    EXPECT_EQ(processor.program_counter(), ProcessorSpec::reset_pc + 7 * sizeof(insr_t));
+}
+
+TEST(Assembler, LabelErrors) {
+    EXPECT_TRUE(Assembler::assemble("a: hlt\na: hlt").empty());
+    EXPECT_TRUE(Assembler::assemble("ldi r0, $(nowhere)").empty());
+    EXPECT_TRUE(Assembler::assemble("1a: hlt").empty());
+    EXPECT_TRUE(Assembler::assemble("ldi r0, $(0x100)").empty());
+    EXPECT_TRUE(Assembler::assemble("ldi r0, $(1 / 0)").empty());
+    EXPECT_TRUE(Assembler::assemble("ldi r0, $((1 + 2)").empty());
+    EXPECT_TRUE(Assembler::assemble("ldi r0, $(1 +)").empty());
+    // The range is only checked once the label is known
+    EXPECT_TRUE(Assembler::assemble("ldi r0, $(end)\nend: hlt").empty());
+}
+
+TEST(Assembler, ExpressionOverflow) {
+    EXPECT_TRUE(Assembler::assemble("ldi r0, $(9223372036854775807 + 1)").empty());
+    EXPECT_TRUE(Assembler::assemble("ldi r0, $(-9223372036854775807 - 2)").empty());
+    EXPECT_TRUE(Assembler::assemble("ldi r0, $(4294967296 * 4294967296)").empty());
+    EXPECT_TRUE(Assembler::assemble("ldi r0, $(-(-9223372036854775807 - 1))").empty());
+    EXPECT_TRUE(Assembler::assemble("ldi r0, $((-9223372036854775807 - 1) / -1)").empty());
+    EXPECT_TRUE(Assembler::assemble("ldi r0, $((-9223372036854775807 - 1) % -1)").empty());
+    // Right at the edges still works
+    EXPECT_EQ(Assembler::assemble("ldi r0, $((-9223372036854775807 - 1 + 9223372036854775807) & 0xFF)").size(), 1);
+    EXPECT_EQ(Assembler::assemble("ldi r0, $(-(-9223372036854775807) >> 56)").size(), 1);
+
+    // Nesting is capped instead of running out of stack
+    const auto nested = [](usize depth) {
+        return "ldi r0, $(" + std::string(depth, '(') + "1" + std::string(depth, ')') + ")";
+    };
+    EXPECT_EQ(Assembler::assemble(nested(200)).size(), 1);
+    EXPECT_TRUE(Assembler::assemble(nested(100000)).empty());
+    EXPECT_EQ(Assembler::assemble("ldi r0, $(" + std::string(200, '-') + "1 & 0xFF)").size(), 1);
+    EXPECT_TRUE(Assembler::assemble("ldi r0, $(" + std::string(100000, '-') + "1)").empty());
+}
+
+TEST(Assembler, Macros) {
+    const auto code = Assembler::assemble(R"(
+@macro load_address $addr, $hi, $lo
+        ldi $hi, $(addr >> 8)
+        ldi $lo, $(addr & 0xFF)
+@end
+@macro jump_to_address $addr
+        push r6
+        push r7
+        load_address $addr, r6, r7
+        jp r6, r7
+@end
+
+        jump_to_address after
+        hlt
+after:  hlt
+    )");
+    ASSERT_EQ(code.size(), 7);
+    EXPECT_EQ(code[2], encode_instruction(InstructionType::LoadFromImm, Register { 6 }, Immediate { 0xFF }));
+    EXPECT_EQ(code[3], encode_instruction(InstructionType::LoadFromImm, Register { 7 }, Immediate { 0x0C }));
+    EXPECT_EQ(code[4], encode_instruction(InstructionType::Jump, Register { 6 }, Register { 7 }));
+}
+
+TEST(Assembler, MacroErrors) {
+    // Wrong number of arguments, used before its definition, undefined, nested definitions, labels
+    EXPECT_TRUE(Assembler::assemble("@macro m $a\npush $a\n@end\nm r0, r1").empty());
+    EXPECT_TRUE(Assembler::assemble("m r0\n@macro m $a\npush $a\n@end").empty());
+    EXPECT_TRUE(Assembler::assemble("@macro m\nhlt").empty());
+    EXPECT_TRUE(Assembler::assemble("@end").empty());
+    EXPECT_TRUE(Assembler::assemble("@macro m\n@macro n\n@end\n@end").empty());
+    EXPECT_TRUE(Assembler::assemble("@macro m\nl: hlt\n@end\nm").empty());
+    EXPECT_TRUE(Assembler::assemble("@macro push $a\n@end").empty());
+    // Recursion runs into the depth limit
+    EXPECT_TRUE(Assembler::assemble("@macro m\nm\n@end\nm").empty());
+}
+
+TEST(Assembler, StreamLabelsBothWays) {
+    const auto backward = std::string_view { "top: hlt\nldi r0, $(top & 0xFF)\n" };
+    auto sink = VectorInstructionSink {};
+    auto stream = AssemblerStream { sink };
+    EXPECT_TRUE(stream.feed(backward));
+    EXPECT_TRUE(stream.finish());
+    EXPECT_EQ(sink.instructions(), Assembler::assemble(backward));
+
+    // Forward references go out with a zero immediate until finish() patches them
+    const auto forward = std::string_view { "ldi r6, $(end >> 8)\nldi r7, $(end & 0xFF)\njp r6, r7\nldi r0, #1\nend: hlt\n" };
+    auto forward_sink = VectorInstructionSink {};
+    auto forward_stream = AssemblerStream { forward_sink };
+    EXPECT_TRUE(forward_stream.feed(forward));
+    EXPECT_EQ(forward_sink.instructions()[1], encode_instruction(InstructionType::LoadFromImm, Register { 7 }, Immediate { 0 }));
+    EXPECT_TRUE(forward_stream.finish());
+    EXPECT_EQ(forward_sink.instructions(), Assembler::assemble(forward));
+
+    auto processor = Processor {};
+    auto loading_sink = LoadingInstructionSink { processor };
+    auto input = std::istringstream { std::string { forward } };
+    EXPECT_EQ(Assembler::assemble(input, loading_sink), 5);
+    processor.execute();
+    EXPECT_EQ(processor.registers()[0], 0);
+    EXPECT_EQ(processor.program_counter(), ProcessorSpec::reset_pc + 5 * sizeof(insr_t));
+
+    auto unknown_sink = VectorInstructionSink {};
+    auto unknown = AssemblerStream { unknown_sink };
+    EXPECT_TRUE(unknown.feed("ldi r0, $(nowhere & 0xFF)\nhlt\n"));
+    EXPECT_FALSE(unknown.finish());
+}
+
+TEST(Assembler, StreamLabelsAtSinkStart) {
+    // Labels point to where the sink puts the code, not the reset PC
+    constexpr auto start = addr_t { 0x1000 };
+    auto processor = Processor {};
+    auto sink = LoadingInstructionSink { processor, start };
+    auto stream = AssemblerStream { sink };
+    EXPECT_TRUE(stream.feed(R"(
+        ldi r0, #10
+        ldi r1, #1
+        ldi r2, #0
+        ldi r6, $(loop >> 8)
+        ldi r7, $(loop & 0xFF)
+        ldi r5, $(done & 0xFF)
+loop:   add r2, r2, r1
+        sub r0, r0, r1
+        jz r6, r5
+        jp r6, r7
+done:   hlt
+)"));
+    EXPECT_TRUE(stream.finish());
+
+    processor.set_program_counter(start);
+    processor.execute();
+    EXPECT_EQ(processor.registers()[2], 10);
+    EXPECT_EQ(processor.program_counter(), start + 11 * sizeof(insr_t));
+}
+
+TEST(Assembler, ImageLabelsAcrossSections) {
+    auto source = std::string { "@macro far_jump $to\n    ldi r6, $(to >> 8)\n    ldi r7, $(to & 0xFF)\n    jp r6, r7\n@end\n" };
+    source += "    far_jump second\n";
+    for (auto section = 1; section < 8; section++) {
+        source += fmt::format(".org 0x{:X}\n", section * 0x1000);
+        for (auto i = 0; i < 200; i++)
+            source += fmt::format("    ldi r{}, #{}\n", i % 6, i);
+        source += section == 3 ? "second:\n    far_jump last\n" : "";
+        source += section == 7 ? "last: hlt\n" : "";
+    }
+
+    const auto serial = Assembler::assemble_image(source);
+    ASSERT_TRUE(serial);
+    for (const auto chunk_size : { 1, 300, 2048 }) {
+        const auto parallel = Assembler::assemble_image(source, 4, chunk_size);
+        ASSERT_TRUE(parallel);
+        EXPECT_EQ(parallel->memory, serial->memory);
+    }
+
+    auto processor = Processor {};
+    serial->load_into(processor);
+    processor.execute();
+    EXPECT_EQ(processor.program_counter(), 0x7000 + 201 * sizeof(insr_t));
+
+    EXPECT_FALSE(Assembler::assemble_image("a: hlt\n.org 0x1000\na: hlt"));
+    EXPECT_FALSE(Assembler::assemble_image("ldi r0, $(missing)\n"));
+}
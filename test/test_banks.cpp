@@ -0,0 +1,167 @@
+#include "helpers.hpp"
+#include <assembler.hpp>
+#include <banks.hpp>
+#include <gtest/gtest.h>
+
+TEST(Banks, WindowsShowBanks) {
+    auto store = ExtendedMemory::create(256 << 20);
+    ASSERT_TRUE(store);
+    EXPECT_EQ(store->size(), 256 << 20);
+
+    auto processor = Processor {};
+    processor.write_memory(0x4000, 0x55);
+    auto switcher = BankSwitcher { processor, *store, 16 };
+    EXPECT_EQ(switcher.bank_size(), 4096);
+    EXPECT_EQ(switcher.bank_count(), 65536);
+    ASSERT_EQ(switcher.add_window(0x40), 0);
+    EXPECT_FALSE(switcher.add_window(0x4F));
+    EXPECT_FALSE(switcher.add_window(0xF8));
+
+    // What was there before is gone
+    EXPECT_EQ(processor.read_memory(0x4000), 0x00);
+    processor.write_memory(0x4000, 0x11);
+    processor.write_memory(0x4FFF, 0x22);
+    EXPECT_EQ(store->data()[0], 0x11);
+    EXPECT_EQ(store->data()[4095], 0x22);
+
+    // The far end of 256 MiB
+    ASSERT_TRUE(switcher.select(0, 65535));
+    EXPECT_EQ(processor.read_memory(0x4000), 0x00);
+    processor.write_memory(0x4000, 0x33);
+    EXPECT_EQ(store->data()[65535u * 4096], 0x33);
+
+    ASSERT_TRUE(switcher.select(0, 0));
+    EXPECT_EQ(processor.read_memory(0x4000), 0x11);
+    EXPECT_EQ(processor.read_memory(0x4FFF), 0x22);
+    EXPECT_FALSE(switcher.select(0, 65536));
+    EXPECT_FALSE(switcher.select(1, 0));
+}
+
+TEST(Banks, ResetAndForksKeepWindows) {
+    auto store = ExtendedMemory::create(1 << 16);
+    ASSERT_TRUE(store);
+    auto processor = Processor {};
+    auto switcher = BankSwitcher { processor, *store, 1 };
+    ASSERT_TRUE(switcher.add_window(0x40));
+    ASSERT_TRUE(switcher.select(0, 3));
+    processor.write_memory(0x4010, 0x77);
+    processor.write_memory(0x5000, 0x01);
+    EXPECT_EQ(processor.dirty_pages().size(), 2);
+
+    auto fork = processor.fork();
+    fork.write_memory(0x4011, 0x78);
+    EXPECT_EQ(processor.read_memory(0x4011), 0x78);
+
+    processor.reset();
+    EXPECT_EQ(processor.read_memory(0x5000), 0x00);
+    EXPECT_EQ(processor.read_memory(0x4010), 0x77);
+    EXPECT_EQ(processor.dirty_pages().size(), 1);
+
+    processor.map_memory_window(0x40, nullptr);
+    EXPECT_EQ(processor.read_memory(0x4010), 0x00);
+    EXPECT_TRUE(processor.dirty_pages().empty());
+}
+
+// Adds up banks 1 to 200, switching them itself through the switcher attached at 0xF000. The first page of
+// every bank is filled with its number, r4 doubles as the offset into the window.
+TEST(Banks, ProgramsSwitchBanks) {
+    auto store = ExtendedMemory::create(1 << 20);
+    ASSERT_TRUE(store);
+    for (usize bank = 0; bank < 256; bank++)
+        std::fill_n(store->data() + bank * 4096, 256, static_cast<u8>(bank));
+
+    auto processor = Processor {};
+    auto switcher = BankSwitcher { processor, *store, 16 };
+    ASSERT_TRUE(switcher.add_window(0x40));
+    ASSERT_TRUE(processor.attach_device(0xF0, 1, switcher));
+    load(processor, R"(
+        ldi r0, #200
+        ldi r1, #1
+        ldi r2, #0xF0
+        ldi r3, #0x40
+        ldi r6, $(loop >> 8)
+        ldi r7, $(loop & 0xFF)
+loop:   st r2, r1, r0
+        ldm r5, r3, r4
+        add r4, r4, r5
+        ldi r5, $(done & 0xFF)
+        sub r0, r0, r1
+        jz r6, r5
+        jp r6, r7
+done:   hlt
+    )");
+    processor.execute();
+    EXPECT_TRUE(processor.is_flag_set(Processor::Flag::Halt));
+    EXPECT_EQ(switcher.bank(0), 1);
+    EXPECT_EQ(processor.registers()[4], static_cast<u8>(200 * 201 / 2));
+}
+
+// Code running out of a window is thrown away when the window switches
+TEST(Banks, SwitchingDropsCachedCode) {
+    auto store = ExtendedMemory::create(2 * 256);
+    ASSERT_TRUE(store);
+    const auto first = Assembler::assemble("ldi r0, #1\nhlt");
+    const auto second = Assembler::assemble("ldi r0, #2\nhlt");
+    for (usize i = 0; i < 2; i++) {
+        store->data()[i * 2] = static_cast<u8>(first[i] >> 8);
+        store->data()[i * 2 + 1] = static_cast<u8>(first[i]);
+        store->data()[256 + i * 2] = static_cast<u8>(second[i] >> 8);
+        store->data()[256 + i * 2 + 1] = static_cast<u8>(second[i]);
+    }
+
+    auto processor = Processor {};
+    auto switcher = BankSwitcher { processor, *store, 1 };
+    ASSERT_TRUE(switcher.add_window(0x40));
+    for (auto i = 0; i < 20; i++) {
+        const auto bank = static_cast<usize>(i % 2);
+        ASSERT_TRUE(switcher.select(0, bank));
+        processor.unset_flag(Processor::Flag::Halt);
+        processor.set_program_counter(0x4000);
+        processor.execute();
+        ASSERT_EQ(processor.registers()[0], bank + 1) << i;
+    }
+}
+
+// Two windows never show the same bytes, so a store through one can't leave stale code cached for the other
+TEST(Banks, WindowsShowDistinctBanks) {
+    auto store = ExtendedMemory::create(3 * 256);
+    ASSERT_TRUE(store);
+    const auto code = Assembler::assemble("ldi r0, #1\nhlt");
+    for (usize i = 0; i < code.size(); i++) {
+        store->data()[i * 2] = static_cast<u8>(code[i] >> 8);
+        store->data()[i * 2 + 1] = static_cast<u8>(code[i]);
+    }
+
+    auto processor = Processor {};
+    auto switcher = BankSwitcher { processor, *store, 1 };
+    ASSERT_EQ(switcher.add_window(0x40), 0);
+    ASSERT_EQ(switcher.add_window(0x50), 1);
+    EXPECT_EQ(switcher.bank(0), 0);
+    EXPECT_EQ(switcher.bank(1), 1);
+
+    processor.set_program_counter(0x4000);
+    processor.execute();
+    ASSERT_EQ(processor.registers()[0], 1);
+
+    EXPECT_FALSE(switcher.select(1, 0));
+    EXPECT_EQ(switcher.bank(1), 1);
+    EXPECT_TRUE(switcher.select(1, 1));
+    ASSERT_TRUE(processor.attach_device(0xF0, 1, switcher));
+    processor.write_memory(0xF002, 0);
+    processor.write_memory(0xF003, 0);
+    EXPECT_EQ(switcher.bank(1), 1);
+
+    // Lands in bank 1, the code in bank 0 is untouched
+    processor.write_instruction(0x5000, Assembler::assemble("ldi r0, #2")[0]);
+    processor.unset_flag(Processor::Flag::Halt);
+    processor.set_program_counter(0x4000);
+    processor.execute();
+    EXPECT_EQ(processor.registers()[0], 1);
+
+    // A bank frees up once its window moves on
+    EXPECT_TRUE(switcher.select(0, 2));
+    EXPECT_TRUE(switcher.select(1, 0));
+    ASSERT_EQ(switcher.add_window(0x60), 2);
+    EXPECT_EQ(switcher.bank(2), 1);
+    EXPECT_FALSE(switcher.add_window(0x70));
+}
@@ -0,0 +1,185 @@
+#include <assembler.hpp>
+#include <batch.hpp>
+#include <gtest/gtest.h>
+#include <random>
+
+static auto kernels() {
+    auto result = std::vector { ProcessorBatch::Kernel::Scalar };
+    if (ProcessorBatch::best_kernel() != ProcessorBatch::Kernel::Scalar)
+        result.push_back(ProcessorBatch::Kernel::Sse);
+    if (ProcessorBatch::best_kernel() == ProcessorBatch::Kernel::Avx2)
+        result.push_back(ProcessorBatch::Kernel::Avx2);
+    return result;
+}
+
+// Runs every lane through a scalar Processor as well and compares the results
+static auto expect_same_as_scalar(
+    const std::vector<insr_t>& code,
+    const std::vector<std::array<data_t, ProcessorSpec::register_count>>& registers,
+    usize instruction_count = std::numeric_limits<usize>::max()
+) {
+    for (const auto kernel : kernels()) {
+        SCOPED_TRACE(static_cast<int>(kernel));
+        auto batch = ProcessorBatch { registers.size(), kernel };
+        for (usize i = 0; i < code.size(); i++)
+            batch.write_instruction(static_cast<addr_t>(ProcessorSpec::reset_pc + i * 2), code[i]);
+        for (usize lane = 0; lane < registers.size(); lane++) {
+            for (u8 reg = 0; reg < ProcessorSpec::register_count; reg++)
+                batch.write_register(lane, reg, registers[lane][reg]);
+        }
+        batch.execute(instruction_count);
+
+        for (usize lane = 0; lane < registers.size(); lane++) {
+            SCOPED_TRACE(lane);
+            auto processor = Processor {};
+            for (usize i = 0; i < code.size(); i++)
+                processor.write_instruction(static_cast<addr_t>(ProcessorSpec::reset_pc + i * 2), code[i]);
+            for (u8 reg = 0; reg < ProcessorSpec::register_count; reg++)
+                processor.write_register(reg, registers[lane][reg]);
+            const auto finished = processor.execute_switch(instruction_count);
+
+            const auto state = batch.lane(lane);
+            EXPECT_EQ(finished, state.status == ProcessorBatch::LaneStatus::OutOfBudget);
+            EXPECT_TRUE(std::ranges::equal(processor.registers(), state.registers));
+            EXPECT_EQ(processor.program_counter(), state.program_counter);
+            EXPECT_EQ(processor.stack_pointer(), state.stack_pointer);
+            EXPECT_EQ(processor.flags(), state.flags);
+            EXPECT_EQ(processor.retired_instructions(), state.retired_instructions);
+        }
+    }
+}
+
+TEST(Batch, ParameterSweep) {
+    // r2 = r0 * r1 + r0 * (r1 - 1) + ..., lanes with different r1 loop a different number of times
+    const auto code = Assembler::assemble(R"(
+        ldi r3, #1
+        ldi r6, #0xFF
+        ldi r7, #0x08
+        ldi r5, #0x16
+        mul r4, r0, r1
+        add r2, r2, r4
+        sub r1, r1, r3
+        jz r6, r5
+        jp r6, r7
+        xor r4, r2, r0
+        hlt
+    )");
+
+    auto registers = std::vector<std::array<data_t, ProcessorSpec::register_count>>(100);
+    for (usize lane = 0; lane < registers.size(); lane++) {
+        registers[lane][0] = static_cast<data_t>(lane * 7);
+        registers[lane][1] = static_cast<data_t>(1 + lane % 13);
+    }
+    expect_same_as_scalar(code, registers);
+
+    auto batch = ProcessorBatch { 64 };
+    EXPECT_EQ(batch.size(), 64);
+}
+
+TEST(Batch, StackAndEscapes) {
+    // Lanes with r0 = 0 fail on the division, lanes with r1 != 0 store outside the stack page
+    const auto code = Assembler::assemble(R"(
+        push r0
+        push r1
+        ldi r2, #0x00
+        ldi r3, #0x40
+        st r2, r3, r0
+        ldm r4, r2, r3
+        st r1, r3, r0
+        pop r5
+        pop r6
+        div r7, r5, r6
+        hlt
+    )");
+
+    auto registers = std::vector<std::array<data_t, ProcessorSpec::register_count>>(40);
+    for (usize lane = 0; lane < registers.size(); lane++) {
+        registers[lane][0] = static_cast<data_t>(lane % 5);
+        registers[lane][1] = static_cast<data_t>(lane * 9);
+    }
+    expect_same_as_scalar(code, registers);
+}
+
+TEST(Batch, EscapedLanesSeeAllOfMemory) {
+    // Lane 1 stores outside the stack page and escapes, then both read the very last byte
+    const auto code = Assembler::assemble(R"(
+        ldi r3, #0x40
+        ldi r6, #0xFF
+        st r0, r3, r1
+        ldm r4, r6, r6
+        hlt
+    )");
+
+    for (const auto kernel : kernels()) {
+        SCOPED_TRACE(static_cast<int>(kernel));
+        auto batch = ProcessorBatch { 2, kernel };
+        for (usize i = 0; i < code.size(); i++)
+            batch.write_instruction(static_cast<addr_t>(ProcessorSpec::reset_pc + i * 2), code[i]);
+        batch.write_memory(ProcessorSpec::highest_addr, 0x5A);
+        batch.write_register(1, 0, 0x40);
+        batch.execute();
+
+        EXPECT_EQ(batch.stats().escaped, 1);
+        for (usize lane = 0; lane < batch.size(); lane++) {
+            EXPECT_EQ(batch.lane(lane).status, ProcessorBatch::LaneStatus::Halted) << lane;
+            EXPECT_EQ(batch.lane(lane).registers[4], 0x5A) << lane;
+        }
+    }
+}
+
+TEST(Batch, Budget) {
+    const auto code = Assembler::assemble(R"(
+        ldi r1, #1
+        ldi r6, #0xFF
+        ldi r7, #0x04
+        sub r0, r0, r1
+        jp r6, r7
+    )");
+
+    auto registers = std::vector<std::array<data_t, ProcessorSpec::register_count>>(3);
+    expect_same_as_scalar(code, registers, 50);
+
+    // Resuming picks up where the last call stopped
+    auto batch = ProcessorBatch { 1 };
+    for (usize i = 0; i < code.size(); i++)
+        batch.write_instruction(static_cast<addr_t>(ProcessorSpec::reset_pc + i * 2), code[i]);
+    batch.execute(20);
+    batch.execute(30);
+    auto processor = Processor {};
+    for (usize i = 0; i < code.size(); i++)
+        processor.write_instruction(static_cast<addr_t>(ProcessorSpec::reset_pc + i * 2), code[i]);
+    processor.execute_switch(50);
+    EXPECT_EQ(batch.lane(0).retired_instructions, 50);
+    EXPECT_EQ(batch.lane(0).program_counter, processor.program_counter());
+    EXPECT_EQ(batch.lane(0).registers[0], processor.registers()[0]);
+}
+
+TEST(Batch, RandomPrograms) {
+    auto rng = std::mt19937 { 0xBA7C4 };
+    auto byte = std::uniform_int_distribution<u16> { 0, 255 };
+    auto type = std::uniform_int_distribution<u16> { 0, 15 };
+    auto reg = std::uniform_int_distribution<u16> { 0, 5 };
+
+    for (auto round = 0; round < 40; round++) {
+        SCOPED_TRACE(round);
+        auto code = std::vector<insr_t> {};
+        for (auto i = 0; i < 24; i++) {
+            const auto instruction_type = static_cast<InstructionType>(type(rng));
+            if (instruction_type == InstructionType::Jump || instruction_type == InstructionType::JumpIfZero)
+                code.push_back(encode_instruction(instruction_type, Register { 6 }, Register { 7 }));
+            else if (instruction_type == InstructionType::LoadFromImm)
+                code.push_back(encode_instruction(instruction_type, Register { 7 }, Immediate { static_cast<u8>(byte(rng) % 24 * 2) }));
+            else
+                code.push_back(encode_instruction(instruction_type, Register { static_cast<u8>(reg(rng)) }, Register { static_cast<u8>(reg(rng)) }, Register { static_cast<u8>(reg(rng)) }));
+        }
+
+        auto registers = std::vector<std::array<data_t, ProcessorSpec::register_count>>(37);
+        for (auto& lane : registers) {
+            for (auto& value : lane)
+                value = static_cast<data_t>(byte(rng));
+            lane[6] = 0xFF;
+            lane[7] = 0x00;
+        }
+        expect_same_as_scalar(code, registers, 500);
+    }
+}
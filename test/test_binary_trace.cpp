@@ -0,0 +1,131 @@
+#include "helpers.hpp"
+#include <assembler.hpp>
+#include <binary_trace.hpp>
+#include <gtest/gtest.h>
+#include <processor.hpp>
+
+// Counts down from 20, pushing every value and popping it right back, so registers, flags, the stack pointer
+// and the program counter all change
+static const auto countdown = std::string { R"(
+        ldi r0, #20
+        ldi r1, #1
+        ldi r6, $(loop >> 8)
+        ldi r7, $(loop & 0xFF)
+        ldi r5, $(done & 0xFF)
+loop:   push r0
+        pop r2
+        add r3, r3, r2
+        sub r0, r0, r1
+        jz r6, r5
+        jp r6, r7
+done:   hlt
+)" };
+
+TEST(BinaryTrace, RingKeepsOrderAcrossThreads) {
+    static constexpr u16 count = 50'000;
+    auto ring = TraceRing { 60 };
+    EXPECT_EQ(ring.capacity(), 64);
+
+    auto consumer = std::jthread { [&ring] {
+        auto batch = std::array<TraceEntry, 16> {};
+        u16 expected = 0;
+        while (expected != count) {
+            const auto popped = ring.pop(batch);
+            for (usize i = 0; i < popped; i++)
+                EXPECT_EQ(batch[i].pc, expected++);
+            if (popped == 0)
+                std::this_thread::yield();
+        }
+    } };
+
+    for (u16 pc = 0; pc < count; pc++) {
+        while (!ring.try_push(TraceEntry { .pc = pc, .instruction = 0, .registers = {}, .stack_pointer = 0, .flags = 0 }))
+            std::this_thread::yield();
+    }
+}
+
+TEST(BinaryTrace, DecodesWhatWasRecorded) {
+    if (!Processor::tracing_enabled)
+        GTEST_SKIP();
+
+    auto expected = RingTraceSink { 1024 };
+    auto reference = Processor { expected };
+    load(reference, countdown);
+    reference.execute();
+
+    auto* file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    {
+        // Small enough to fill up
+        auto sink = BinaryTraceSink { file, 16 };
+        auto processor = Processor { sink };
+        load(processor, countdown);
+        processor.execute();
+        EXPECT_EQ(sink.recorded(), expected.recorded());
+    }
+    const auto bytes = read_all(file);
+    std::fclose(file);
+
+    const auto entries = expected.entries();
+    ASSERT_EQ(entries.size(), expected.recorded());
+    // At most 5 bytes per instruction here, against 16 for an entry
+    EXPECT_LE(bytes.size(), sizeof(BinaryTraceFormat::Header) + entries.size() * 5);
+
+    auto reader = BinaryTraceReader::from_bytes(bytes);
+    ASSERT_TRUE(reader);
+    for (usize i = 0; i < entries.size(); i++) {
+        const auto entry = reader->next();
+        ASSERT_TRUE(entry) << i;
+        EXPECT_EQ(entry->pc, entries[i].pc) << i;
+        EXPECT_EQ(entry->instruction, entries[i].instruction) << i;
+        EXPECT_EQ(entry->registers, entries[i].registers) << i;
+        EXPECT_EQ(entry->stack_pointer, entries[i].stack_pointer) << i;
+        EXPECT_EQ(entry->flags, entries[i].flags) << i;
+    }
+    EXPECT_FALSE(reader->next());
+    EXPECT_FALSE(reader->truncated());
+}
+
+TEST(BinaryTrace, PrintsChanges) {
+    if (!Processor::tracing_enabled)
+        GTEST_SKIP();
+
+    auto* file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    {
+        auto sink = BinaryTraceSink { file };
+        auto processor = Processor { sink };
+        load(processor, "ldi r0, #5\npush r0\nhlt");
+        processor.execute();
+    }
+    auto reader = BinaryTraceReader::from_bytes(read_all(file));
+    std::fclose(file);
+    ASSERT_TRUE(reader);
+
+    auto* text_file = std::tmpfile();
+    ASSERT_NE(text_file, nullptr);
+    EXPECT_EQ(reader->print(text_file), 3);
+    const auto text = read_all(text_file);
+    std::fclose(text_file);
+
+    // Nothing runs after hlt, so what it changed isn't known
+    EXPECT_EQ(std::string(text.begin(), text.end()),
+        "0xFF00 ldi r0, #5           r0=0x05\n"
+        "0xFF02 push r0              sp=0x00FE\n"
+        "0xFF04 hlt\n");
+}
+
+TEST(BinaryTrace, RejectsBrokenFiles) {
+    EXPECT_FALSE(BinaryTraceReader::from_bytes({ 'P', 'T', 'R' }));
+    EXPECT_FALSE(BinaryTraceReader::from_bytes({ 'P', 'I', 'M', 'G', 1, 0, 0, 0 }));
+    EXPECT_FALSE(BinaryTraceReader::from_bytes({ 'P', 'T', 'R', 'C', 2, 0, 0, 0 }));
+
+    // One complete record, then one that's missing its pc and the value of r0
+    auto reader = BinaryTraceReader::from_bytes({ 'P', 'T', 'R', 'C', 1, 0, 0, 0, 0, 0, BinaryTraceFormat::Jumped, 1, 0x00 });
+    ASSERT_TRUE(reader);
+    const auto entry = reader->next();
+    ASSERT_TRUE(entry);
+    EXPECT_EQ(entry->pc, ProcessorSpec::reset_pc);
+    EXPECT_FALSE(reader->next());
+    EXPECT_TRUE(reader->truncated());
+}
@@ -0,0 +1,133 @@
+#include "helpers.hpp"
+#include <assembler.hpp>
+#include <gtest/gtest.h>
+#include <processor.hpp>
+
+// Runs the same program through blocks and the plain interpreter, which have to end up in the same state
+static auto expect_same_as_interpreter(const std::string& source, usize instruction_count = std::numeric_limits<usize>::max()) {
+    auto blocks = Processor {};
+    auto interpreter = Processor {};
+    load(blocks, source);
+    load(interpreter, source);
+
+    EXPECT_EQ(blocks.execute_blocks(instruction_count), interpreter.execute_switch(instruction_count));
+    EXPECT_TRUE(std::ranges::equal(blocks.registers(), interpreter.registers()));
+    EXPECT_EQ(blocks.program_counter(), interpreter.program_counter());
+    EXPECT_EQ(blocks.stack_pointer(), interpreter.stack_pointer());
+    EXPECT_EQ(blocks.flags(), interpreter.flags());
+    EXPECT_EQ(blocks.retired_instructions(), interpreter.retired_instructions());
+    return blocks.block_stats();
+}
+
+TEST(Blocks, CountdownLoop) {
+    const auto stats = expect_same_as_interpreter(R"(
+        ldi r0, #10
+        ldi r1, #1
+        ldi r6, #0xFF
+        ldi r7, #0x0A
+        ldi r5, #0x10
+        sub r0, r0, r1
+        jz r6, r5
+        jp r6, r7
+        hlt
+    )");
+
+    // Entry, loop body, back edge and the final hlt
+    EXPECT_EQ(stats.compiled, 4);
+    EXPECT_GT(stats.dispatches, 10);
+}
+
+TEST(Blocks, DeferredFlags) {
+    // Carry from sub and overflow from add must both survive, even though neither is the last flag writer
+    expect_same_as_interpreter(R"(
+        ldi r0, #1
+        ldi r1, #2
+        ldi r2, #200
+        sub r3, r0, r1
+        add r4, r2, r2
+        and r5, r0, r0
+        hlt
+    )");
+}
+
+TEST(Blocks, FailureInsideBlock) {
+    // The division fails halfway through the block, flags written before it have to be exact
+    expect_same_as_interpreter(R"(
+        ldi r0, #0
+        ldi r1, #5
+        sub r2, r0, r1
+        div r3, r1, r0
+        ldi r4, #1
+        hlt
+    )");
+}
+
+// Blocks keep running while a sink is attached, with every flag as exact as the interpreter has it
+TEST(Blocks, TracedLikeInterpreter) {
+    if (!Processor::tracing_enabled)
+        GTEST_SKIP();
+
+    const auto source = std::string { R"(
+        ldi r0, #10
+        ldi r1, #1
+        ldi r2, #200
+        ldi r6, #0xFF
+        ldi r7, #0x0C
+        ldi r5, #0x16
+        add r4, r2, r2
+        push r4
+        sub r0, r0, r1
+        jz r6, r5
+        jp r6, r7
+        hlt
+    )" };
+    auto blocks_sink = RingTraceSink { 256 };
+    auto interpreter_sink = RingTraceSink { 256 };
+    auto blocks = Processor { blocks_sink };
+    auto interpreter = Processor { interpreter_sink };
+    load(blocks, source);
+    load(interpreter, source);
+
+    EXPECT_EQ(blocks.execute_blocks(), interpreter.execute_switch());
+    EXPECT_GT(blocks.block_stats().dispatches, 10);
+    EXPECT_EQ(blocks.retired_instructions(), interpreter.retired_instructions());
+
+    const auto traced = blocks_sink.entries();
+    const auto expected = interpreter_sink.entries();
+    ASSERT_EQ(traced.size(), expected.size());
+    for (usize i = 0; i < traced.size(); i++) {
+        EXPECT_EQ(traced[i].pc, expected[i].pc) << i;
+        EXPECT_EQ(traced[i].instruction, expected[i].instruction) << i;
+        EXPECT_EQ(traced[i].registers, expected[i].registers) << i;
+        EXPECT_EQ(traced[i].stack_pointer, expected[i].stack_pointer) << i;
+        EXPECT_EQ(traced[i].flags, expected[i].flags) << i;
+    }
+}
+
+TEST(Blocks, BudgetSmallerThanBlock) {
+    expect_same_as_interpreter(R"(
+        ldi r0, #1
+        ldi r1, #2
+        add r2, r0, r1
+        hlt
+    )", 2);
+}
+
+TEST(Blocks, StoreInvalidatesBlock) {
+    auto processor = Processor {};
+    // Patch 'ldi r3, #7' at $FF08 into 'ldi r4, #7' after it ran once, then jump back to it
+    load(processor, R"(
+        ldi r0, #0xFF
+        ldi r1, #0x08
+        ldi r2, #0xD4
+        jp r0, r1
+        ldi r3, #7
+        st r0, r1, r2
+        jp r0, r1
+    )");
+
+    EXPECT_TRUE(processor.execute_blocks(8));
+    EXPECT_EQ(processor.registers()[3], 7);
+    EXPECT_EQ(processor.registers()[4], 7);
+    EXPECT_EQ(processor.block_stats().invalidated, 1);
+}
@@ -0,0 +1,155 @@
+#include "helpers.hpp"
+#include <assembler.hpp>
+#include <bus.hpp>
+#include <gtest/gtest.h>
+#include <processor.hpp>
+
+// Remembers the last access
+class RecordingDevice final : public MemoryDevice {
+public:
+    auto read(u16 offset) -> data_t override {
+        last_read = offset;
+        return static_cast<data_t>(offset + 1);
+    }
+
+    auto write(u16 offset, data_t data) -> void override {
+        last_write = offset;
+        last_data = data;
+    }
+
+    u16 last_read { 0xFFFF };
+    u16 last_write { 0xFFFF };
+    data_t last_data { 0 };
+};
+
+TEST(Bus, DevicesReplaceRam) {
+    auto processor = Processor {};
+    processor.write_memory(0x8005, 0x42);
+
+    auto device = RecordingDevice {};
+    ASSERT_TRUE(processor.attach_device(0x80, 2, device));
+    EXPECT_EQ(processor.read_memory(0x8005), 0x06);
+    EXPECT_EQ(device.last_read, 0x0005);
+    EXPECT_EQ(processor.read_memory(0x81FF), 0x00);
+    EXPECT_EQ(device.last_read, 0x01FF);
+
+    processor.write_memory(0x8105, 0x99);
+    EXPECT_EQ(device.last_write, 0x0105);
+    EXPECT_EQ(device.last_data, 0x99);
+    EXPECT_EQ(processor.peek_memory(0x8105), 0x00);
+    EXPECT_EQ(processor.peek_memory(0x8005), 0x42);
+
+    // Neighbouring pages stay RAM
+    processor.write_memory(0x8200, 0x11);
+    EXPECT_EQ(processor.read_memory(0x8200), 0x11);
+    EXPECT_EQ(device.last_write, 0x0105);
+
+    processor.detach_device(device);
+    EXPECT_EQ(processor.read_memory(0x8005), 0x42);
+}
+
+TEST(Bus, AttachRejectsOverlaps) {
+    auto processor = Processor {};
+    auto first = RecordingDevice {};
+    auto second = RecordingDevice {};
+    EXPECT_TRUE(processor.attach_device(0x10, 4, first));
+    EXPECT_FALSE(processor.attach_device(0x13, 1, second));
+    EXPECT_FALSE(processor.attach_device(0xFF, 2, second));
+    EXPECT_FALSE(processor.attach_device(0x20, 0, second));
+
+    // Nothing of the failed attempt stuck
+    processor.write_memory(0xFF00, 0x01);
+    EXPECT_EQ(processor.peek_memory(0xFF00), 0x01);
+    EXPECT_EQ(second.last_write, 0xFFFF);
+
+    EXPECT_TRUE(processor.attach_device(0x14, 1, second));
+}
+
+TEST(Bus, ProgramsStoreToConsole) {
+    auto* file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    auto console = ConsoleDevice { file };
+
+    auto processor = Processor {};
+    ASSERT_TRUE(processor.attach_device(0xF0, 1, console));
+    load(processor, R"(
+        ldi r0, #0xF0
+        ldi r1, #0
+        ldi r2, #72
+        st r0, r1, r2
+        ldi r2, #105
+        st r0, r1, r2
+        ldi r2, #10
+        st r0, r1, r2
+        hlt
+    )");
+    processor.execute();
+    EXPECT_EQ(console.written(), 3);
+
+    console.flush();
+    std::rewind(file);
+    auto text = std::array<char, 8> {};
+    const auto length = std::fread(text.data(), 1, text.size(), file);
+    EXPECT_EQ(std::string_view(text.data(), length), "Hi\n");
+    std::fclose(file);
+}
+
+TEST(Bus, TimerCountsClockTicks) {
+    u64 now = 1000;
+    auto timer = TimerDevice { [&now] { return now; } };
+
+    now += 0x01020304;
+    EXPECT_EQ(timer.read(0), 0x01);
+    // Latched, the clock moving on doesn't tear the value
+    now += 0xFF;
+    EXPECT_EQ(timer.read(1), 0x02);
+    EXPECT_EQ(timer.read(2), 0x03);
+    EXPECT_EQ(timer.read(3), 0x04);
+    EXPECT_EQ(timer.read(0), 0x01);
+    EXPECT_EQ(timer.read(3), 0x03);
+
+    timer.write(0, 0);
+    now += 5;
+    EXPECT_EQ(timer.read(4), 0x00);
+    EXPECT_EQ(timer.read(7), 0x05);
+}
+
+// The loop gets hot enough for every backend to have compiled it, loads still have to reach the device
+TEST(Bus, HotLoopsReadDevices) {
+    auto device = RecordingDevice {};
+    auto processor = Processor {};
+    ASSERT_TRUE(processor.attach_device(0x40, 1, device));
+    load(processor, R"(
+        ldi r0, #200
+        ldi r1, #1
+        ldi r2, #0x40
+        ldi r3, #0x07
+        ldi r6, $(loop >> 8)
+        ldi r7, $(loop & 0xFF)
+        ldi r5, $(done & 0xFF)
+loop:   ldm r4, r2, r3
+        sub r0, r0, r1
+        jz r6, r5
+        jp r6, r7
+done:   hlt
+    )");
+    processor.execute();
+    EXPECT_TRUE(processor.is_flag_set(Processor::Flag::Halt));
+    EXPECT_EQ(processor.registers()[4], 0x08);
+    EXPECT_EQ(device.last_read, 0x0007);
+}
+
+TEST(Bus, ForksShareDevices) {
+    auto device = RecordingDevice {};
+    auto processor = Processor {};
+    ASSERT_TRUE(processor.attach_device(0x40, 1, device));
+
+    auto fork = processor.fork();
+    fork.write_memory(0x4001, 0x77);
+    EXPECT_EQ(device.last_write, 0x0001);
+    EXPECT_EQ(device.last_data, 0x77);
+
+    // Survives reset like a trace sink does
+    fork.reset();
+    EXPECT_EQ(fork.read_memory(0x4002), 0x03);
+}
@@ -0,0 +1,59 @@
+#include "helpers.hpp"
+#include <assembler.hpp>
+#include <gtest/gtest.h>
+#include <processor.hpp>
+
+TEST(DecodeCache, LoopHitsAfterFirstPass) {
+    auto processor = Processor {};
+    // Count r0 down from 10, the loop body starts at $FF08
+    load(processor, Assembler::assemble(R"(
+        ldi r0, #10
+        ldi r1, #1
+        ldi r6, #0xFF
+        ldi r7, #0x08
+        sub r0, r0, r1
+        jz r6, r5
+        jp r6, r7
+    )"));
+    processor.write_register(5, 0x0E);
+    processor.write_instruction(0xFF0E, encode_instruction(InstructionType::Halt));
+
+    EXPECT_FALSE(processor.execute());
+    EXPECT_EQ(processor.registers()[0], 0);
+
+    // 8 distinct instructions are decoded once each, the remaining 9 loop passes hit the cache
+    const auto stats = processor.decode_cache_stats();
+    EXPECT_EQ(stats.misses, 8);
+    EXPECT_EQ(stats.hits, processor.retired_instructions() - 8);
+    EXPECT_GT(stats.hit_rate(), 0.75);
+}
+
+TEST(DecodeCache, SelfModifyingCode) {
+    auto processor = Processor {};
+    load(processor, Assembler::assemble(R"(
+        ldi r0, #0xFF
+        ldi r1, #0x06
+        ldi r2, #0xD4
+        ldi r3, #7
+        st r0, r1, r2
+        jp r0, r1
+    )"));
+
+    // The store turns 'ldi r3, #7' at $FF06 into 'ldi r4, #7' before jumping back to it
+    EXPECT_TRUE(processor.execute(7));
+    EXPECT_EQ(processor.registers()[3], 7);
+    EXPECT_EQ(processor.registers()[4], 7);
+    EXPECT_EQ(processor.decode_cache_stats().misses, 7);
+}
+
+TEST(DecodeCache, ResetInvalidates) {
+    auto processor = Processor {};
+    processor.write_instruction(ProcessorSpec::reset_pc, encode_instruction(InstructionType::LoadFromImm, Register { 0 }, Immediate { 1 }));
+    EXPECT_TRUE(processor.execute(1));
+
+    processor.reset();
+    processor.write_instruction(ProcessorSpec::reset_pc, encode_instruction(InstructionType::LoadFromImm, Register { 0 }, Immediate { 2 }));
+    EXPECT_TRUE(processor.execute(1));
+    EXPECT_EQ(processor.registers()[0], 2);
+    EXPECT_EQ(processor.decode_cache_stats().hits, 0);
+}
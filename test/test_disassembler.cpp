@@ -1,5 +1,7 @@
+#include <assembler.hpp>
 #include <disassembler.hpp>
 #include <gtest/gtest.h>
+#include <random>
 
 TEST(Disassembler, DiassembleValidProgram) {
     const auto code = std::vector<ProcessorSpec::insr_t> {
@@ -82,4 +84,136 @@ TEST(Disassembler, IllegalInstruction) {
     const auto result = Disassembler::disassemble(std::span { code });
 
     EXPECT_TRUE(result.empty());
-}
\ No newline at end of file
+}
+
+TEST(Disassembler, RoundTripsEveryMnemonic) {
+    for (u8 type = 0; type < instruction_info.size(); type++) {
+        const auto& [mnemonic, operands] = instruction_info[type];
+        EXPECT_EQ(find_mnemonic(mnemonic), static_cast<InstructionType>(type));
+
+        auto source = std::string { mnemonic };
+        switch (operands) {
+        case OperandKind::None:
+            break;
+        case OperandKind::SingleReg:
+            source += " r1";
+            break;
+        case OperandKind::DoubleReg:
+            source += " r1, r2";
+            break;
+        case OperandKind::TripleReg:
+            source += " r1, r2, r3";
+            break;
+        case OperandKind::RegImm:
+            source += " r1, #42";
+            break;
+        }
+
+        const auto code = Assembler::assemble(source);
+        ASSERT_EQ(code.size(), 1);
+        EXPECT_EQ(Disassembler::disassemble(code), std::vector { source });
+    }
+}
+
+TEST(Disassembler, BatchIntoArena) {
+    const auto code = std::vector<ProcessorSpec::insr_t> {
+        encode_instruction(InstructionType::LoadFromImm, Register { 3 }, Immediate { 7 }),
+        encode_instruction(InstructionType::Add, Register { 3 }, Register { 9 }, Register { 1 }),
+        encode_instruction(InstructionType::Push, Register { 2 }),
+        encode_instruction(InstructionType::Halt) | 0x10,
+        encode_instruction(InstructionType::LoadFromMem, Register { 0 }, Register { 6 }, Register { 7 }),
+    };
+
+    auto batch = Disassembly {};
+    Disassembler::disassemble(code, batch);
+    ASSERT_EQ(batch.size(), code.size());
+    EXPECT_EQ(batch.line(0), "ldi r3, #7");
+    EXPECT_EQ(batch.line(1), "");
+    EXPECT_EQ(batch.line(2), "push r2");
+    EXPECT_EQ(batch.line(3), "");
+    EXPECT_EQ(batch.line(4), "ldm r0, r6, r7");
+    EXPECT_EQ(batch.text(), "ldi r3, #7\n\npush r2\n\nldm r0, r6, r7\n");
+
+    ASSERT_EQ(batch.diagnostics().size(), 2);
+    EXPECT_EQ(batch.diagnostics()[0].index, 1);
+    EXPECT_EQ(batch.diagnostics()[0].kind, DisassemblyDiagnostic::InvalidRegister);
+    EXPECT_EQ(batch.diagnostics()[1].index, 3);
+    EXPECT_EQ(batch.diagnostics()[1].instruction, code[3]);
+    EXPECT_EQ(batch.diagnostics()[1].kind, DisassemblyDiagnostic::UnusedFieldSet);
+    EXPECT_EQ(Disassembler::describe(batch.diagnostics()[1]), "Instruction 'hlt' expected no registers, potentially corrupt!");
+
+    // Reusing it replaces everything
+    Disassembler::disassemble(std::span { code }.first(1), batch);
+    EXPECT_EQ(batch.size(), 1);
+    EXPECT_EQ(batch.text(), "ldi r3, #7\n");
+    EXPECT_TRUE(batch.diagnostics().empty());
+}
+
+TEST(Disassembler, BatchMatchesStringsForEveryInstruction) {
+    auto code = std::vector<ProcessorSpec::insr_t>(1 << 16);
+    for (usize i = 0; i < code.size(); i++)
+        code[i] = static_cast<ProcessorSpec::insr_t>(i);
+
+    auto batch = Disassembly {};
+    Disassembler::disassemble(code, batch);
+    auto buffer = fmt::memory_buffer {};
+    auto diagnostics = std::vector<DisassemblyDiagnostic> {};
+    buffer.append(std::string_view { "header\n" });
+    Disassembler::disassemble(code, buffer, diagnostics);
+    EXPECT_EQ(fmt::to_string(buffer), fmt::format("header\n{}", batch.text()));
+    ASSERT_EQ(diagnostics.size(), batch.diagnostics().size());
+
+    testing::internal::CaptureStderr();
+    const auto strings = Disassembler::disassemble(code);
+    testing::internal::GetCapturedStderr();
+    ASSERT_EQ(strings.size() + diagnostics.size(), code.size());
+
+    usize string = 0;
+    auto diagnostic = diagnostics.begin();
+    for (usize i = 0; i < code.size(); i++) {
+        auto line = std::array<char, Disassembler::max_line_length> {};
+        const auto length = Disassembler::disassemble_line(code[i], line);
+        if (diagnostic != diagnostics.end() && diagnostic->index == i) {
+            EXPECT_FALSE(length);
+            EXPECT_EQ(batch.line(i), "");
+            diagnostic++;
+            continue;
+        }
+        ASSERT_TRUE(length);
+        EXPECT_EQ(std::string_view(line.data(), *length), strings[string]);
+        EXPECT_EQ(batch.line(i), strings[string]);
+        string++;
+    }
+}
+
+TEST(Disassembler, ClassifyKernelsAgreeWithScalar) {
+    auto random = std::mt19937 { 1234 };
+    auto code = std::vector<ProcessorSpec::insr_t>((1 << 16) + 77);
+    for (usize i = 0; i < code.size(); i++)
+        code[i] = static_cast<ProcessorSpec::insr_t>(i < (1 << 16) ? i : random());
+    std::ranges::shuffle(code, random);
+
+    const auto classify = [](std::span<const ProcessorSpec::insr_t> instructions, Disassembler::Kernel kernel) {
+        auto groups = std::vector<OperandKind>(instructions.size());
+        // Garbage past the end has to be cleared too
+        auto valid = std::vector<u64>((instructions.size() + 63) / 64, ~u64 { 0 });
+        Disassembler::classify(instructions, groups, valid, kernel);
+        return std::pair { groups, valid };
+    };
+
+    for (auto kernel = Disassembler::Kernel::Scalar; kernel <= Disassembler::best_kernel(); kernel = static_cast<Disassembler::Kernel>(std::to_underlying(kernel) + 1)) {
+        // Odd offsets and lengths run into every kernel's scalar tail
+        for (const auto& [offset, length] : { std::pair<usize, usize> { 0, code.size() }, { 1, 1000 }, { 3, 31 }, { 5, 15 }, { 0, 0 } }) {
+            const auto instructions = std::span { code }.subspan(offset, length);
+            EXPECT_EQ(classify(instructions, kernel), classify(instructions, Disassembler::Kernel::Scalar));
+        }
+    }
+
+    const auto [groups, valid] = classify(code, Disassembler::best_kernel());
+    testing::internal::CaptureStderr();
+    for (usize i = 0; i < code.size(); i++) {
+        EXPECT_EQ(groups[i], info(static_cast<InstructionType>(code[i] >> 12)).operands);
+        EXPECT_EQ(static_cast<bool>(valid[i / 64] >> (i % 64) & 1), Disassembler::disassemble(std::span { &code[i], 1 }).size() == 1);
+    }
+    testing::internal::GetCapturedStderr();
+}
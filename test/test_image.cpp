@@ -0,0 +1,196 @@
+#include <assembler.hpp>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <image.hpp>
+#include <processor.hpp>
+#include <runner.hpp>
+#include <unistd.h>
+
+// A short counting loop at the reset PC and a table of 600 bytes (two whole pages and two partial ones) at 0x40F0
+static const auto program = std::string { R"(
+        ldi r0, #3
+        ldi r1, #1
+        ldi r7, $(loop >> 8)
+        ldi r3, $(loop & 0xFF)
+        ldi r5, $(done & 0xFF)
+loop:   sub r0, r0, r1
+        jz r7, r5
+        jp r7, r3
+done:   hlt
+.org 0x40F0
+table:
+)" };
+
+static auto assemble() {
+    auto source = program;
+    for (usize i = 0; i < 300; i++)
+        source += fmt::format("ldi r{}, #{}\n", i % 8, i % 256);
+    auto image = Assembler::assemble_image(source);
+    EXPECT_TRUE(image);
+    return *image;
+}
+
+static auto temporary_path(std::string_view name) {
+    return (std::filesystem::temp_directory_path() / fmt::format("{}-{}.pimg", name, ::getpid())).string();
+}
+
+TEST(Image, SaveAndOpen) {
+    auto image = assemble();
+    image.entry = 0x0002;
+    const auto path = temporary_path("save");
+    ASSERT_TRUE(image.save(path));
+
+    const auto mapped = MappedImage::open(path);
+    std::filesystem::remove(path);
+    ASSERT_TRUE(mapped);
+    EXPECT_EQ(mapped->entry(), 0x0002);
+    ASSERT_EQ(mapped->segments().size(), 2);
+    EXPECT_EQ(mapped->segments()[0].origin, ProcessorSpec::reset_pc);
+    EXPECT_EQ(mapped->segments()[1].origin, 0x40F0);
+    EXPECT_EQ(mapped->segments()[1].data.size(), 600);
+
+    ASSERT_EQ(mapped->symbols().size(), 3);
+    EXPECT_EQ(mapped->symbols()[0].name, "loop");
+    EXPECT_EQ(mapped->symbols()[0].address, ProcessorSpec::reset_pc + 10);
+    EXPECT_EQ(mapped->symbols()[2].name, "table");
+    EXPECT_EQ(mapped->symbols()[2].address, 0x40F0);
+
+    const auto loaded = mapped->to_program_image();
+    EXPECT_EQ(loaded.memory, image.memory);
+    EXPECT_EQ(loaded.entry, image.entry);
+}
+
+TEST(Image, LoadAndMapMatchProgramImage) {
+    const auto image = assemble();
+    const auto path = temporary_path("load");
+    ASSERT_TRUE(image.save(path));
+    const auto mapped = MappedImage::open(path);
+    std::filesystem::remove(path);
+    ASSERT_TRUE(mapped);
+
+    auto expected = Processor {};
+    image.load_into(expected);
+    auto loaded = Processor {};
+    mapped->load_into(loaded);
+    auto mapped_processor = Processor {};
+    mapped->map_into(mapped_processor);
+
+    for (usize address = 0; address <= ProcessorSpec::highest_addr; address++) {
+        ASSERT_EQ(loaded.read_memory(static_cast<addr_t>(address)), expected.read_memory(static_cast<addr_t>(address))) << address;
+        ASSERT_EQ(mapped_processor.read_memory(static_cast<addr_t>(address)), expected.read_memory(static_cast<addr_t>(address))) << address;
+    }
+
+    EXPECT_FALSE(mapped_processor.execute());
+    EXPECT_TRUE(mapped_processor.is_flag_set(Processor::Flag::Halt));
+    EXPECT_EQ(mapped_processor.registers()[0], 0);
+}
+
+TEST(Image, WritesCopyMappedPages) {
+    const auto image = assemble();
+    const auto path = temporary_path("write");
+    ASSERT_TRUE(image.save(path));
+    const auto mapped = MappedImage::open(path);
+    ASSERT_TRUE(mapped);
+
+    // The mapping is read-only, writing to it in place would crash
+    auto first = Processor {};
+    mapped->map_into(first);
+    auto second = Processor {};
+    mapped->map_into(second);
+    first.write_memory(0x4100, 0xAB);
+    const auto bytes = std::array<data_t, 3> { 1, 2, 3 };
+    first.write_memory(0x41FE, bytes);
+
+    EXPECT_EQ(first.read_memory(0x4100), 0xAB);
+    EXPECT_EQ(first.read_memory(0x41FE), 1);
+    EXPECT_EQ(first.read_memory(0x4200), 3);
+    EXPECT_EQ(second.read_memory(0x4100), image.memory[0x4100]);
+    EXPECT_EQ(second.read_memory(0x4200), image.memory[0x4200]);
+
+    const auto reopened = MappedImage::open(path);
+    std::filesystem::remove(path);
+    ASSERT_TRUE(reopened);
+    EXPECT_EQ(reopened->to_program_image().memory, image.memory);
+}
+
+TEST(Image, RejectsCorruptImages) {
+    const auto image = assemble();
+    const auto path = temporary_path("corrupt");
+    ASSERT_TRUE(image.save(path));
+    auto bytes = std::vector<u8>(std::filesystem::file_size(path));
+    std::ifstream { path, std::ios::binary }.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    std::filesystem::remove(path);
+    ASSERT_TRUE(MappedImage::from_bytes(bytes));
+
+    EXPECT_FALSE(MappedImage::from_bytes(std::span { bytes }.first(8)));
+    EXPECT_FALSE(MappedImage::from_bytes(std::span { bytes }.first(bytes.size() - 1)));
+
+    auto bad_magic = bytes;
+    bad_magic[0] = 'X';
+    EXPECT_FALSE(MappedImage::from_bytes(bad_magic));
+
+    auto bad_version = bytes;
+    bad_version[4] = 2;
+    EXPECT_FALSE(MappedImage::from_bytes(bad_version));
+
+    // Offset of the first segment, one byte off its page alignment
+    auto misaligned = bytes;
+    misaligned[sizeof(ImageFormat::Header) + 8]++;
+    EXPECT_FALSE(MappedImage::from_bytes(misaligned));
+
+    EXPECT_FALSE(MappedImage::open(temporary_path("missing")));
+}
+
+// Mapped pages keep the owner of the bytes alive after the image and everyone else let go of it
+TEST(Image, MappedPagesKeepBytesAlive) {
+    const auto image = assemble();
+    const auto path = temporary_path("owned");
+    ASSERT_TRUE(image.save(path));
+    auto bytes = std::make_shared<std::vector<u8>>(std::filesystem::file_size(path));
+    std::ifstream { path, std::ios::binary }.read(reinterpret_cast<char*>(bytes->data()), static_cast<std::streamsize>(bytes->size()));
+    std::filesystem::remove(path);
+
+    auto processor = Processor {};
+    {
+        const auto mapped = MappedImage::from_bytes(*bytes, bytes);
+        ASSERT_TRUE(mapped);
+        mapped->map_into(processor);
+    }
+    const auto weak = std::weak_ptr { bytes };
+    bytes.reset();
+    EXPECT_FALSE(weak.expired());
+    EXPECT_EQ(processor.read_memory(0x4100), image.memory[0x4100]);
+    EXPECT_EQ(processor.read_memory(0x4200), image.memory[0x4200]);
+}
+
+TEST(Image, RejectsLongSymbolNames) {
+    auto image = assemble();
+    image.symbols.push_back({ .name = std::string(65536, 'x'), .address = 0x4000 });
+    const auto path = temporary_path("long-name");
+    EXPECT_FALSE(image.save(path));
+    EXPECT_FALSE(std::filesystem::exists(path));
+
+    image.symbols.back().name.pop_back();
+    ASSERT_TRUE(image.save(path));
+    const auto mapped = MappedImage::open(path);
+    std::filesystem::remove(path);
+    ASSERT_TRUE(mapped);
+    EXPECT_EQ(mapped->symbols().back().name.size(), 65535);
+}
+
+TEST(Image, RunnerJobs) {
+    const auto image = assemble();
+    const auto path = temporary_path("runner");
+    ASSERT_TRUE(image.save(path));
+    const auto mapped = MappedImage::open(path);
+    std::filesystem::remove(path);
+    ASSERT_TRUE(mapped);
+
+    auto jobs = std::vector<Job>(64, Job { .program = {}, .image = &*mapped });
+    auto runner = JobRunner { 4, 4 };
+    for (const auto& result : runner.run(jobs)) {
+        EXPECT_EQ(result.status, JobStatus::Halted);
+        EXPECT_EQ(result.registers[0], 0);
+    }
+}
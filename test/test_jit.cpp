@@ -0,0 +1,128 @@
+#include "helpers.hpp"
+#include <assembler.hpp>
+#include <gtest/gtest.h>
+#include <processor.hpp>
+#include <random>
+
+#if defined(PROCESSOR_JIT)
+
+TEST(Jit, HotLoop) {
+    const auto code = Assembler::assemble(R"(
+        ldi r0, #200
+        ldi r1, #1
+        ldi r6, #0xFF
+        ldi r7, #0x0A
+        ldi r5, #0x12
+        add r2, r2, r0
+        sub r0, r0, r1
+        jz r6, r5
+        jp r6, r7
+        hlt
+    )");
+
+    auto jit = Processor {};
+    auto interpreter = Processor {};
+    load(jit, code);
+    load(interpreter, code);
+
+    EXPECT_EQ(jit.execute_blocks(), interpreter.execute_switch());
+    expect_same_state(jit, interpreter);
+    EXPECT_GT(jit.jit_stats().compiled, 0);
+}
+
+TEST(Jit, SelfModifyingCode) {
+    // Once hot, the loop keeps patching the immediate of its own "ldi r3" with the running sum
+    const auto code = Assembler::assemble(R"(
+        ldi r0, #40
+        ldi r1, #1
+        ldi r6, #0xFF
+        ldi r7, #0x0A
+        ldi r5, #0x18
+        ldi r3, #1
+        add r2, r2, r3
+        sub r0, r0, r1
+        ldi r4, #0x0B
+        st r6, r4, r2
+        jz r6, r5
+        jp r6, r7
+        hlt
+    )");
+
+    auto jit = Processor {};
+    auto interpreter = Processor {};
+    jit.enable_jit(1);
+    load(jit, code);
+    load(interpreter, code);
+
+    EXPECT_EQ(jit.execute_blocks(), interpreter.execute_switch());
+    expect_same_state(jit, interpreter);
+}
+
+// Random instructions with valid registers, jumps going to random places inside the program through r6:r7
+static auto random_program(std::mt19937& rng) -> std::vector<insr_t> {
+    auto length = std::uniform_int_distribution<usize> { 4, 48 }(rng);
+    auto type = std::uniform_int_distribution<u16> { 0, 15 };
+    auto dst = std::uniform_int_distribution<u16> { 0, 5 };
+    auto src = std::uniform_int_distribution<u16> { 0, 7 };
+    auto byte = std::uniform_int_distribution<u16> { 0, 255 };
+    auto offset = std::uniform_int_distribution<usize> { 0, length - 1 };
+    auto one_in = [&rng](u32 n) { return std::uniform_int_distribution<u32> { 0, n - 1 }(rng) == 0; };
+
+    auto code = std::vector<insr_t> {};
+    for (usize i = 0; i < length; i++) {
+        const auto instruction_type = static_cast<InstructionType>(type(rng));
+        switch (instruction_type) {
+        case InstructionType::Jump:
+        case InstructionType::JumpIfZero:
+            code.push_back(encode_instruction(instruction_type, Register { 6 }, Register { 7 }));
+            break;
+        case InstructionType::LoadFromImm:
+            if (one_in(2))
+                code.push_back(encode_instruction(instruction_type, Register { 7 }, Immediate { static_cast<u8>(offset(rng) * 2) }));
+            else
+                code.push_back(encode_instruction(instruction_type, Register { static_cast<u8>(dst(rng)) }, Immediate { static_cast<u8>(byte(rng)) }));
+            break;
+        case InstructionType::Halt:
+            code.push_back(one_in(4) ? encode_instruction(instruction_type) : encode_instruction(InstructionType::Add, Register { 0 }, Register { 0 }, Register { 1 }));
+            break;
+        default:
+            // Every so often, something that doesn't even pass verification
+            if (one_in(32))
+                code.push_back(static_cast<insr_t>(std::to_underlying(instruction_type) << 12 | byte(rng) << 4 | 0xF));
+            else
+                code.push_back(encode_instruction(instruction_type, Register { static_cast<u8>(dst(rng)) }, Register { static_cast<u8>(src(rng)) }, Register { static_cast<u8>(src(rng)) }));
+            break;
+        }
+    }
+    return code;
+}
+
+TEST(Jit, DifferentialFuzz) {
+    auto rng = std::mt19937 { 0x5EED };
+    auto byte = std::uniform_int_distribution<u16> { 0, 255 };
+
+    for (auto round = 0; round < 300; round++) {
+        SCOPED_TRACE(round);
+        const auto code = random_program(rng);
+
+        auto jit = Processor {};
+        auto interpreter = Processor {};
+        jit.enable_jit(1);
+        load(jit, code);
+        load(interpreter, code);
+        for (u8 reg = 0; reg < 6; reg++) {
+            const auto value = static_cast<data_t>(byte(rng));
+            jit.write_register(reg, value);
+            interpreter.write_register(reg, value);
+        }
+        for (auto* processor : { &jit, &interpreter }) {
+            processor->write_register(6, 0xFF);
+            processor->write_register(7, 0x00);
+        }
+
+        EXPECT_EQ(jit.execute_blocks(2000), interpreter.execute_switch(2000));
+        expect_same_state(jit, interpreter);
+    }
+}
+
+#endif
@@ -0,0 +1,67 @@
+#include <assembler.hpp>
+#include <gtest/gtest.h>
+#include <pool.hpp>
+
+TEST(Pool, ResetOnlyClearsDirtyPages) {
+    auto processor = Processor {};
+    EXPECT_TRUE(processor.dirty_pages().empty());
+
+    processor.write_memory(0x1234, 0xAB);
+    processor.write_memory(0x12FF, 0xCD);
+    processor.write_memory(0x8000, 0xEF);
+    EXPECT_EQ(processor.dirty_pages().size(), 2);
+
+    processor.reset();
+    EXPECT_TRUE(processor.dirty_pages().empty());
+    EXPECT_EQ(processor.read_memory(0x1234), 0);
+    EXPECT_EQ(processor.read_memory(0x12FF), 0);
+    EXPECT_EQ(processor.read_memory(0x8000), 0);
+
+    // Both pages were zeroed and kept, writing again doesn't allocate
+    processor.write_memory(0x4000, 1);
+    processor.write_memory(0x5000, 1);
+    EXPECT_EQ(processor.memory_stats().pages_reused, 2);
+    EXPECT_EQ(processor.read_memory(0x4001), 0);
+}
+
+TEST(Pool, ResetLeavesForksAlone) {
+    auto processor = Processor {};
+    processor.write_memory(0x2000, 42);
+    const auto fork = processor.fork();
+
+    processor.reset();
+    EXPECT_EQ(processor.read_memory(0x2000), 0);
+    EXPECT_EQ(fork.read_memory(0x2000), 42);
+
+    processor.write_memory(0x3000, 1);
+    EXPECT_EQ(processor.memory_stats().pages_reused, 0);
+}
+
+TEST(Pool, ReusedProcessorsStartFresh) {
+    const auto program = Assembler::assemble(R"(
+        ldi r0, #7
+        ldi r1, #0x20
+        st r1, r0, r0
+        push r0
+        hlt
+    )");
+
+    auto pool = ProcessorPool {};
+    for (auto round = 0; round < 3; round++) {
+        auto processor = pool.acquire();
+        EXPECT_EQ(processor->read_memory(0x2007), 0);
+        EXPECT_EQ(processor->stack_pointer(), ProcessorSpec::stack_top_addr);
+        EXPECT_EQ(processor->retired_instructions(), 0);
+        EXPECT_FALSE(processor->is_flag_set(Processor::Flag::Halt));
+
+        for (usize i = 0; i < program.size(); i++)
+            processor->write_instruction(static_cast<addr_t>(ProcessorSpec::reset_pc + i * 2), program[i]);
+        processor->execute();
+        EXPECT_EQ(processor->read_memory(0x2007), 7);
+        pool.release(std::move(processor));
+    }
+
+    EXPECT_EQ(pool.stats().created, 1);
+    EXPECT_EQ(pool.stats().reused, 2);
+    EXPECT_EQ(pool.idle(), 1);
+}
@@ -0,0 +1,127 @@
+#include "helpers.hpp"
+#include <assembler.hpp>
+#include <gtest/gtest.h>
+#include <processor.hpp>
+#include <profiler.hpp>
+
+// Two nested countdown loops, 5 outer and 10 inner iterations each. Jump targets are loaded before the
+// sub, ldi sets the zero flag too.
+static const auto nested = std::string { R"(
+        ldi r0, #5
+        ldi r2, #1
+        ldi r6, $(outer >> 8)
+outer:  ldi r1, #10
+        ldi r7, $(inner & 0xFF)
+        ldi r5, $(next & 0xFF)
+inner:  add r3, r3, r2
+        sub r1, r1, r2
+        jz r6, r5
+        jp r6, r7
+next:   ldi r7, $(outer & 0xFF)
+        ldi r5, $(done & 0xFF)
+        sub r0, r0, r2
+        jz r6, r5
+        jp r6, r7
+done:   hlt
+)" };
+
+TEST(Profiler, CountsPerAddressAndOpcode) {
+    if (!Processor::tracing_enabled)
+        GTEST_SKIP();
+
+    auto profiler = Profiler {};
+    auto processor = Processor { profiler };
+    load(processor, nested);
+    processor.execute();
+
+    EXPECT_EQ(profiler.total(), processor.retired_instructions());
+    EXPECT_EQ(profiler.count(ProcessorSpec::reset_pc), 1);
+    // add r3, r3, r2
+    EXPECT_EQ(profiler.count(ProcessorSpec::reset_pc + 12), 50);
+    EXPECT_EQ(processor.registers()[3], 50);
+    EXPECT_EQ(profiler.count(InstructionType::Add), 50);
+    EXPECT_EQ(profiler.count(InstructionType::Halt), 1);
+
+    // Inner jz, taken when the inner loop is done
+    EXPECT_EQ(profiler.taken(ProcessorSpec::reset_pc + 16), 5);
+    EXPECT_EQ(profiler.not_taken(ProcessorSpec::reset_pc + 16), 45);
+    // Inner jp, always taken
+    EXPECT_EQ(profiler.taken(ProcessorSpec::reset_pc + 18), 45);
+    EXPECT_EQ(profiler.not_taken(ProcessorSpec::reset_pc + 18), 0);
+}
+
+TEST(Profiler, BlocksAndLoops) {
+    if (!Processor::tracing_enabled)
+        GTEST_SKIP();
+
+    auto profiler = Profiler {};
+    auto processor = Processor { profiler };
+    load(processor, nested);
+    processor.execute();
+
+    const auto blocks = profiler.blocks();
+    ASSERT_FALSE(blocks.empty());
+    // add, sub, jz
+    EXPECT_EQ(blocks[0].start, ProcessorSpec::reset_pc + 12);
+    EXPECT_EQ(blocks[0].end, ProcessorSpec::reset_pc + 16);
+    EXPECT_EQ(blocks[0].runs, 50);
+    EXPECT_EQ(blocks[0].instructions, 150);
+    u64 covered = 0;
+    for (const auto& block : blocks)
+        covered += block.instructions;
+    EXPECT_EQ(covered, profiler.total());
+
+    const auto loops = profiler.loops();
+    ASSERT_EQ(loops.size(), 2);
+    // The outer loop contains the inner one
+    EXPECT_EQ(loops[0].start, ProcessorSpec::reset_pc + 6);
+    EXPECT_EQ(loops[0].end, ProcessorSpec::reset_pc + 28);
+    EXPECT_EQ(loops[0].iterations, 4);
+    EXPECT_EQ(loops[0].instructions, 234);
+    EXPECT_EQ(loops[1].start, ProcessorSpec::reset_pc + 12);
+    EXPECT_EQ(loops[1].end, ProcessorSpec::reset_pc + 18);
+    EXPECT_EQ(loops[1].iterations, 45);
+    EXPECT_EQ(loops[1].instructions, 195);
+}
+
+TEST(Profiler, SwitchesOnAndOff) {
+    if (!Processor::tracing_enabled)
+        GTEST_SKIP();
+
+    auto profiler = Profiler {};
+    auto processor = Processor {};
+    load(processor, nested);
+    processor.execute(10);
+    processor.set_trace_sink(&profiler);
+    processor.execute(10);
+    processor.set_trace_sink(nullptr);
+    processor.execute();
+    EXPECT_EQ(profiler.total(), 10);
+
+    profiler.clear();
+    EXPECT_EQ(profiler.total(), 0);
+    EXPECT_TRUE(profiler.blocks().empty());
+}
+
+TEST(Profiler, Report) {
+    if (!Processor::tracing_enabled)
+        GTEST_SKIP();
+
+    auto profiler = Profiler {};
+    auto processor = Processor { profiler };
+    load(processor, nested);
+    processor.execute();
+
+    auto* file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    profiler.report(file, 3);
+    std::rewind(file);
+    auto text = std::string(1 << 16, '\0');
+    text.resize(std::fread(text.data(), 1, text.size(), file));
+    std::fclose(file);
+
+    EXPECT_NE(text.find("Hottest blocks:\n  0xFF0C-0xFF10: 50 runs, 150 instructions"), std::string::npos) << text;
+    EXPECT_NE(text.find("add r3, r3, r2"), std::string::npos) << text;
+    EXPECT_NE(text.find("taken 45, not taken 0"), std::string::npos) << text;
+    EXPECT_NE(text.find("Hottest loops:\n  0xFF06-0xFF1C: 4 iterations"), std::string::npos) << text;
+}
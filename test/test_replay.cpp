@@ -0,0 +1,119 @@
+#include "helpers.hpp"
+#include <assembler.hpp>
+#include <gtest/gtest.h>
+#include <processor.hpp>
+#include <replay.hpp>
+
+// Adds 1 to every byte of pages 0x40 to 0x43, 3 passes over them, pushing and popping the running count
+// along the way. Retires about 27.7k instructions.
+static const auto scribble = std::string { R"(
+        ldi r4, #3
+        ldi r3, #1
+        ldi r1, #0x40
+        ldi r6, $(inner >> 8)
+        ldi r7, $(inner & 0xFF)
+inner:  ldm r5, r1, r0
+        add r5, r5, r3
+        st r1, r0, r5
+        push r5
+        pop r2
+        ldi r5, $(page & 0xFF)
+        add r0, r0, r3
+        jz r6, r5
+        jp r6, r7
+page:   ldi r5, $(pass & 0xFF)
+        add r1, r1, r3
+        ldi r2, #0x44
+        sub r2, r2, r1
+        jz r6, r5
+        jp r6, r7
+pass:   ldi r1, #0x40
+        ldi r5, $(done & 0xFF)
+        sub r4, r4, r3
+        jz r6, r5
+        jp r6, r7
+done:   hlt
+)" };
+
+TEST(Replay, SeeksAnywhere) {
+    auto* file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    auto recorded = Processor {};
+    load(recorded, scribble);
+    {
+        auto recorder = ReplayRecorder { recorded, file, 1000 };
+        EXPECT_FALSE(recorder.execute());
+        EXPECT_EQ(recorder.checkpoints(), recorded.retired_instructions() / 1000 + 1);
+    }
+    EXPECT_TRUE(recorded.is_flag_set(Processor::Flag::Halt));
+    EXPECT_EQ(recorded.read_memory(0x43FF), 3);
+
+    const auto replay = Replay::from_bytes(read_all(file));
+    std::fclose(file);
+    ASSERT_TRUE(replay);
+    EXPECT_EQ(replay->interval(), 1000);
+    ASSERT_EQ(replay->checkpoints().size(), recorded.retired_instructions() / 1000 + 1);
+
+    // Forwards and backwards, on and between checkpoints, up to the very end
+    for (const u64 target : { u64 { 12'345 }, u64 { 0 }, u64 { 5000 }, u64 { 4999 }, u64 { 20'001 }, recorded.retired_instructions() }) {
+        auto expected = Processor {};
+        load(expected, scribble);
+        expected.execute(target);
+
+        auto processor = Processor {};
+        ASSERT_TRUE(replay->seek(processor, target)) << target;
+        expect_same_state(processor, expected);
+    }
+
+    auto processor = Processor {};
+    EXPECT_FALSE(replay->seek(processor, recorded.retired_instructions() + 1));
+}
+
+// Only the pages written between two checkpoints are stored, and a seek never runs more than one interval
+TEST(Replay, CheckpointsOnlyHoldChanges) {
+    if (!Processor::tracing_enabled)
+        GTEST_SKIP();
+
+    auto* file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    auto recorded = Processor {};
+    load(recorded, scribble);
+    {
+        auto recorder = ReplayRecorder { recorded, file, 500 };
+        recorder.execute();
+    }
+    const auto bytes = read_all(file);
+    std::fclose(file);
+
+    // The code, the stack, and at most the two pages being scribbled on per checkpoint
+    const auto checkpoints = recorded.retired_instructions() / 500 + 1;
+    EXPECT_LE(bytes.size(), sizeof(ReplayFormat::Header) + checkpoints * (sizeof(ReplayFormat::Checkpoint) + 3 * sizeof(ReplayFormat::Page)) + sizeof(ReplayFormat::Page));
+
+    const auto replay = Replay::from_bytes(bytes);
+    ASSERT_TRUE(replay);
+    auto sink = RingTraceSink { 1 };
+    auto processor = Processor { sink };
+    ASSERT_TRUE(replay->seek(processor, 10'499));
+    EXPECT_EQ(sink.recorded(), 499);
+}
+
+TEST(Replay, RejectsBrokenFiles) {
+    EXPECT_FALSE(Replay::from_bytes(std::vector<u8> { 'P', 'R', 'P', 'L' }));
+
+    auto* file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    auto processor = Processor {};
+    load(processor, scribble);
+    {
+        auto recorder = ReplayRecorder { processor, file, 100 };
+        recorder.execute(1000);
+    }
+    auto bytes = read_all(file);
+    std::fclose(file);
+    ASSERT_TRUE(Replay::from_bytes(bytes));
+
+    bytes.pop_back();
+    EXPECT_FALSE(Replay::from_bytes(bytes));
+    bytes[0] = 'X';
+    EXPECT_FALSE(Replay::from_bytes(bytes));
+}
@@ -0,0 +1,91 @@
+#include <assembler.hpp>
+#include <gtest/gtest.h>
+#include <runner.hpp>
+
+static auto run_alone(const Job& job, Processor& processor) {
+    for (usize i = 0; i < job.program.size(); i++)
+        processor.write_instruction(static_cast<addr_t>(ProcessorSpec::reset_pc + i * 2), job.program[i]);
+    for (u8 reg = 0; reg < ProcessorSpec::register_count; reg++)
+        processor.write_register(reg, job.registers[reg]);
+    if (processor.execute(job.instruction_budget))
+        return JobStatus::OutOfBudget;
+    return processor.is_flag_set(Processor::Flag::Halt) ? JobStatus::Halted : JobStatus::Failed;
+}
+
+TEST(Runner, MatchesSequentialRuns) {
+    // Loops r1 times, so jobs take very different amounts of time
+    const auto loop = Assembler::assemble(R"(
+        ldi r3, #1
+        ldi r6, #0xFF
+        ldi r7, #0x08
+        ldi r5, #0x14
+        mul r2, r2, r0
+        add r2, r2, r3
+        sub r1, r1, r3
+        jz r6, r5
+        jp r6, r7
+        hlt
+    )");
+    const auto failing = Assembler::assemble(R"(
+        ldi r1, #0
+        div r0, r0, r1
+    )");
+
+    auto jobs = std::vector<Job> {};
+    for (usize i = 0; i < 500; i++) {
+        auto job = Job { .program = i % 50 == 7 ? failing : loop };
+        job.registers[0] = static_cast<data_t>(i);
+        job.registers[1] = static_cast<data_t>(i * 31);
+        if (i % 9 == 0)
+            job.instruction_budget = i;
+        jobs.push_back(job);
+    }
+
+    // Slices far shorter than most jobs, with more threads than jobs per thread
+    auto runner = JobRunner { 8, 37 };
+    const auto results = runner.run(jobs);
+    ASSERT_EQ(results.size(), jobs.size());
+
+    for (usize i = 0; i < jobs.size(); i++) {
+        SCOPED_TRACE(i);
+        auto processor = Processor {};
+        EXPECT_EQ(run_alone(jobs[i], processor), results[i].status);
+        EXPECT_TRUE(std::ranges::equal(processor.registers(), results[i].registers));
+        EXPECT_EQ(processor.program_counter(), results[i].program_counter);
+        EXPECT_EQ(processor.flags(), results[i].flags);
+        EXPECT_EQ(processor.retired_instructions(), results[i].retired_instructions);
+    }
+    EXPECT_EQ(results[7].status, JobStatus::Failed);
+    EXPECT_EQ(results[9].status, JobStatus::OutOfBudget);
+    EXPECT_EQ(results[10].status, JobStatus::Halted);
+
+    u64 retired = 0;
+    for (const auto& result : results)
+        retired += result.retired_instructions;
+    EXPECT_GT(runner.stats().slices, jobs.size());
+    EXPECT_EQ(runner.stats().retired_instructions, retired);
+}
+
+TEST(Runner, Cancel) {
+    const auto forever = Assembler::assemble(R"(
+        ldi r6, #0xFF
+        ldi r7, #0x04
+        add r0, r0, r1
+        jp r6, r7
+    )");
+
+    auto jobs = std::vector<Job>(20, Job { .program = forever });
+    auto stop_source = std::stop_source {};
+    stop_source.request_stop();
+    const auto results = JobRunner { 4, 100 }.run(jobs, stop_source.get_token());
+    for (const auto& result : results) {
+        EXPECT_EQ(result.status, JobStatus::Cancelled);
+        EXPECT_EQ(result.retired_instructions, 0);
+    }
+}
+
+TEST(Runner, ProgramTooBig) {
+    const auto program = std::vector<insr_t>(200, 0);
+    const auto results = JobRunner { 1 }.run(std::vector { Job { .program = program } });
+    EXPECT_EQ(results[0].status, JobStatus::Failed);
+}
@@ -0,0 +1,85 @@
+#include "helpers.hpp"
+#include <assembler.hpp>
+#include <gtest/gtest.h>
+#include <processor.hpp>
+
+// Counts r0 down from 50, storing every value at 0x4000 + r0 and pushing it
+static const auto countdown = std::string { R"(
+    ldi r0, #50
+    ldi r1, #1
+    ldi r2, #0x40
+    ldi r6, #0xFF
+    ldi r7, #0x0C
+    ldi r5, #0x16
+    st r2, r0, r0
+    push r0
+    sub r0, r0, r1
+    jz r6, r5
+    jp r6, r7
+    pop r3
+    hlt
+)" };
+
+TEST(Snapshot, RestoreReplaysTheSameWay) {
+    auto processor = Processor {};
+    load(processor, countdown);
+    EXPECT_TRUE(processor.execute(40));
+
+    const auto snapshot = processor.snapshot();
+    processor.execute();
+    const auto registers = std::vector(processor.registers().begin(), processor.registers().end());
+    const auto retired = processor.retired_instructions();
+
+    processor.restore(snapshot);
+    EXPECT_EQ(processor.retired_instructions(), 40);
+    EXPECT_EQ(processor.read_memory(0x4000 + 40), 0);
+    processor.execute();
+    EXPECT_TRUE(std::ranges::equal(processor.registers(), registers));
+    EXPECT_EQ(processor.retired_instructions(), retired);
+    EXPECT_EQ(processor.read_memory(0x4000 + 40), 40);
+}
+
+TEST(Snapshot, ForkCopiesOnWrite) {
+    auto processor = Processor {};
+    load(processor, countdown);
+    processor.execute(30);
+    const auto copied = processor.memory_stats().pages_copied;
+
+    auto fork = processor.fork();
+    EXPECT_EQ(fork.memory_stats().pages_copied, 0);
+    fork.write_memory(0x4001, 0xAA);
+    EXPECT_EQ(fork.memory_stats().pages_copied, 1);
+    EXPECT_EQ(processor.read_memory(0x4001), 0);
+
+    // The fork let go of its reference to the data page when copying it, only the stack page is still shared
+    processor.execute();
+    EXPECT_EQ(processor.memory_stats().pages_copied, copied + 1);
+    EXPECT_EQ(processor.read_memory(0x4001), 1);
+    EXPECT_EQ(fork.read_memory(0x4001), 0xAA);
+
+    fork.execute();
+    EXPECT_TRUE(std::ranges::equal(processor.registers(), fork.registers()));
+    EXPECT_EQ(processor.retired_instructions(), fork.retired_instructions());
+}
+
+TEST(Snapshot, RestoreDropsChangedCode) {
+    auto processor = Processor {};
+    load(processor, R"(
+        ldi r0, #1
+        hlt
+    )");
+    const auto snapshot = processor.snapshot();
+
+    processor.execute();
+    EXPECT_EQ(processor.registers()[0], 1);
+
+    processor.restore(snapshot);
+    processor.write_instruction(ProcessorSpec::reset_pc, Assembler::assemble("ldi r0, #2")[0]);
+    processor.execute();
+    EXPECT_EQ(processor.registers()[0], 2);
+
+    // Back to the first version of the code, which was cached before
+    processor.restore(snapshot);
+    processor.execute();
+    EXPECT_EQ(processor.registers()[0], 1);
+}
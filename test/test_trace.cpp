@@ -0,0 +1,58 @@
+#include <gtest/gtest.h>
+#include <processor.hpp>
+
+TEST(Trace, QuietByDefault) {
+    auto processor = Processor {};
+    processor.write_instruction(ProcessorSpec::reset_pc, encode_instruction(InstructionType::LoadFromImm, Register { 0 }, Immediate { 5 }));
+    processor.write_instruction(ProcessorSpec::reset_pc + 2, encode_instruction(InstructionType::Add, Register { 1 }, Register { 0 }, Register { 0 }));
+
+    testing::internal::CaptureStdout();
+    EXPECT_TRUE(processor.execute(2));
+    const auto output = testing::internal::GetCapturedStdout();
+
+    EXPECT_TRUE(output.empty());
+    EXPECT_EQ(processor.registers()[1], 10);
+    EXPECT_EQ(processor.retired_instructions(), 2);
+}
+
+TEST(Trace, RingSink) {
+    if (!Processor::tracing_enabled)
+        GTEST_SKIP();
+
+    auto sink = RingTraceSink { 2 };
+    auto processor = Processor { sink };
+    for (auto i = 0; i < 3; i++)
+        processor.write_instruction(static_cast<addr_t>(ProcessorSpec::reset_pc + i * 2), encode_instruction(InstructionType::LoadFromImm, Register { 0 }, Immediate { static_cast<u8>(i + 1) }));
+
+    EXPECT_TRUE(processor.execute(3));
+    EXPECT_EQ(sink.recorded(), 3);
+
+    // Only the last two entries fit
+    const auto entries = sink.entries();
+    ASSERT_EQ(entries.size(), 2);
+    EXPECT_EQ(entries[0].pc, ProcessorSpec::reset_pc + 2);
+    EXPECT_EQ(entries[1].pc, ProcessorSpec::reset_pc + 4);
+    EXPECT_EQ(entries[1].instruction, encode_instruction(InstructionType::LoadFromImm, Register { 0 }, Immediate { 3 }));
+}
+
+TEST(Trace, FileSink) {
+    if (!Processor::tracing_enabled)
+        GTEST_SKIP();
+
+    auto* file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    {
+        auto sink = FileTraceSink { file };
+        auto processor = Processor { sink };
+        processor.write_instruction(ProcessorSpec::reset_pc, encode_instruction(InstructionType::LoadFromImm, Register { 0 }, Immediate { 5 }));
+        processor.write_instruction(ProcessorSpec::reset_pc + 2, encode_instruction(InstructionType::Push, Register { 0 }));
+        EXPECT_TRUE(processor.execute(2));
+    }
+
+    std::rewind(file);
+    auto contents = std::string(128, '\0');
+    contents.resize(std::fread(contents.data(), 1, contents.size(), file));
+    std::fclose(file);
+
+    EXPECT_EQ(contents, "0xFF00 ldi r0, #5\n0xFF02 push r0\n");
+}
@@ -0,0 +1,111 @@
+#include "helpers.hpp"
+#include <assembler.hpp>
+#include <gtest/gtest.h>
+#include <processor.hpp>
+#include <undo.hpp>
+
+// Stores, pushes, pops and arithmetic on every iteration of a loop counting r4 down from 20, 225 instructions
+static const auto shuffle = std::string { R"(
+        ldi r4, #20
+        ldi r3, #1
+        ldi r1, #0x40
+        ldi r6, $(loop >> 8)
+        ldi r7, $(loop & 0xFF)
+loop:   add r0, r0, r4
+        st r1, r4, r0
+        push r0
+        push r4
+        pop r2
+        pop r5
+        mul r2, r2, r5
+        ldi r5, $(done & 0xFF)
+        sub r4, r4, r3
+        jz r6, r5
+        jp r6, r7
+done:   hlt
+)" };
+
+TEST(UndoLog, StepsBackOneInstructionAtATime) {
+    if (!Processor::tracing_enabled)
+        GTEST_SKIP();
+
+    auto processor = Processor {};
+    auto log = UndoLog { processor };
+    processor.set_trace_sink(&log);
+    load(processor, shuffle);
+    EXPECT_FALSE(processor.execute());
+    const auto total = processor.retired_instructions();
+    ASSERT_EQ(total, 225);
+    EXPECT_EQ(log.size(), total);
+    const auto finished = processor.fork();
+
+    for (auto count = total; count > 0; count--) {
+        ASSERT_EQ(log.step_back(1), 1);
+        auto expected = Processor {};
+        load(expected, shuffle);
+        expected.execute(count - 1);
+        expect_same_state(processor, expected);
+    }
+    EXPECT_EQ(log.step_back(1), 0);
+
+    // Running forward again records everything over
+    EXPECT_FALSE(processor.execute());
+    expect_same_state(processor, finished);
+    EXPECT_EQ(log.size(), total);
+}
+
+TEST(UndoLog, StepsBackFromAFailure) {
+    if (!Processor::tracing_enabled)
+        GTEST_SKIP();
+
+    auto processor = Processor {};
+    auto log = UndoLog { processor };
+    processor.set_trace_sink(&log);
+    load(processor, R"(
+        ldi r0, #5
+        ldi r1, #0
+        push r0
+        div r2, r0, r1
+    )");
+    EXPECT_FALSE(processor.execute());
+    EXPECT_EQ(processor.program_counter(), ProcessorSpec::reset_pc + 6);
+
+    // The division never retired, so the push is the first thing to undo
+    EXPECT_EQ(log.step_back(1), 1);
+    EXPECT_EQ(processor.program_counter(), ProcessorSpec::reset_pc + 4);
+    EXPECT_EQ(processor.stack_pointer(), ProcessorSpec::stack_top_addr);
+    EXPECT_EQ(processor.read_memory(ProcessorSpec::stack_top_addr - 1), 0);
+
+    EXPECT_EQ(log.step_back(10), 2);
+    EXPECT_EQ(processor.program_counter(), ProcessorSpec::reset_pc);
+    EXPECT_EQ(processor.registers()[0], 0);
+    EXPECT_EQ(processor.flags(), 0);
+    EXPECT_EQ(processor.retired_instructions(), 0);
+}
+
+TEST(UndoLog, KeepsTheNewestEntries) {
+    if (!Processor::tracing_enabled)
+        GTEST_SKIP();
+
+    auto processor = Processor {};
+    auto log = UndoLog { processor, 3 };
+    EXPECT_EQ(log.capacity(), 4);
+    processor.set_trace_sink(&log);
+    load(processor, shuffle);
+    processor.execute(100);
+    EXPECT_EQ(log.size(), 4);
+
+    EXPECT_EQ(log.step_back(10), 4);
+    auto expected = Processor {};
+    load(expected, shuffle);
+    expected.execute(96);
+    expect_same_state(processor, expected);
+
+    // Going anywhere the log didn't see drops everything in it
+    processor.execute(10);
+    const auto snapshot = processor.snapshot();
+    processor.execute(10);
+    processor.restore(snapshot);
+    EXPECT_EQ(log.step_back(1), 0);
+    EXPECT_EQ(log.size(), 0);
+}
@@ -0,0 +1,62 @@
+#include "helpers.hpp"
+#include <assembler.hpp>
+#include <gtest/gtest.h>
+#include <processor.hpp>
+
+TEST(Verify, ValidProgram) {
+    auto processor = Processor {};
+    const auto code = Assembler::assemble(R"(
+        ldi r0, #3
+        ldi r1, #4
+        add r2, r0, r1
+        push r2
+        hlt
+    )");
+    load(processor, code);
+
+    EXPECT_TRUE(processor.verify(ProcessorSpec::reset_pc, code.size()).empty());
+    for (usize i = 0; i < code.size(); i++)
+        EXPECT_TRUE(processor.is_verified(static_cast<addr_t>(ProcessorSpec::reset_pc + i * 2)));
+
+    EXPECT_FALSE(processor.execute());
+    EXPECT_EQ(processor.registers()[2], 7);
+    // Everything was decoded by verify() already
+    EXPECT_EQ(processor.decode_cache_stats().misses, code.size());
+}
+
+TEST(Verify, InvalidRegister) {
+    auto processor = Processor {};
+    processor.write_instruction(ProcessorSpec::reset_pc, encode_instruction(InstructionType::LoadFromImm, Register { 0 }, Immediate { 1 }));
+    processor.write_instruction(ProcessorSpec::reset_pc + 2, encode_instruction(InstructionType::Add, Register { 1 }, Register { 9 }, Register { 0 }));
+    // Unused fields may hold anything, ldi only reads r1
+    processor.write_instruction(ProcessorSpec::reset_pc + 4, encode_instruction(InstructionType::LoadFromImm, Register { 2 }, Immediate { 0xFF }));
+
+    const auto issues = processor.verify(ProcessorSpec::reset_pc, 3);
+    ASSERT_EQ(issues.size(), 1);
+    EXPECT_EQ(issues[0].address, ProcessorSpec::reset_pc + 2);
+    EXPECT_FALSE(processor.is_verified(ProcessorSpec::reset_pc + 2));
+
+    // The unverified instruction still goes through the checked handler and fails
+    EXPECT_TRUE(processor.execute(1));
+    EXPECT_FALSE(processor.execute(1));
+    EXPECT_EQ(processor.program_counter(), ProcessorSpec::reset_pc + 2);
+}
+
+TEST(Verify, WriteDropsVerification) {
+    auto processor = Processor {};
+    processor.write_instruction(ProcessorSpec::reset_pc, encode_instruction(InstructionType::Push, Register { 0 }));
+    processor.write_instruction(ProcessorSpec::reset_pc + 2, encode_instruction(InstructionType::Push, Register { 1 }));
+
+    EXPECT_TRUE(processor.verify(ProcessorSpec::reset_pc, 2).empty());
+
+    // Touching the low byte of the first instruction only affects the instructions overlapping it
+    processor.write_memory(ProcessorSpec::reset_pc + 1, 0x00);
+    EXPECT_FALSE(processor.is_verified(ProcessorSpec::reset_pc));
+    EXPECT_TRUE(processor.is_verified(ProcessorSpec::reset_pc + 2));
+
+    // Replace 'push r1' with one addressing r15, which must not slip through the fast path
+    processor.write_instruction(ProcessorSpec::reset_pc + 2, encode_instruction(InstructionType::Push, Register { 15 }));
+    EXPECT_FALSE(processor.is_verified(ProcessorSpec::reset_pc + 2));
+    EXPECT_TRUE(processor.execute(1));
+    EXPECT_FALSE(processor.execute(1));
+}